@@ -0,0 +1,335 @@
+#include "webserve/tcp_server.h"
+#include "webserve/iomanager.h"
+#include "webserve/hook.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+// 建连风暴基准：逐个 accept(每个连接再 fstat/fcntl/setsockopt/getsockname/getpeername)
+// 对比 acceptBatch 批量接收；以及句柄耗尽时积压连接是否被及时拒绝、恢复后能否继续接收
+// 用法: test_accept_storm [客户端线程数] [每轮秒数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 统计连接数；hold 为 true 时把连接留着不关
+class StormServer : public sylar::TcpServer {
+public:
+    typedef std::shared_ptr<StormServer> ptr;
+
+    StormServer(sylar::IOManager* worker, bool legacy)
+        :sylar::TcpServer(worker, worker, worker)
+        ,m_legacy(legacy) {
+    }
+
+    uint64_t getCount() const { return m_count;}
+    uint64_t getErrors() const { return m_errors;}
+    void setHold(bool v) { m_hold = v;}
+
+    // 在服务端线程里关闭留着的连接，非 hook 线程里 close 不会注销 FdCtx
+    void release() {
+        sylar::Semaphore sem;
+        m_ioWorker->schedule([this, &sem](){
+            sylar::Mutex::Lock lock(m_mutex);
+            m_held.clear();
+            sem.notify();
+        });
+        sem.wait();
+    }
+
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        ++m_count;
+        if(m_hold) {
+            sylar::Mutex::Lock lock(m_mutex);
+            m_held.push_back(client);
+        } else {
+            client->close();
+        }
+    }
+
+    // 改造前的 accept 循环
+    void startAccept(sylar::Socket::ptr sock) override {
+        if(!m_legacy) {
+            sylar::TcpServer::startAccept(sock);
+            return;
+        }
+        while(!m_isStop) {
+            sylar::Socket::ptr client = sock->accept();
+            if(client) {
+                client->setRecvTimeout(m_recvTimeout);
+                m_ioWorker->schedule(std::bind(&StormServer::handleClient,
+                            std::static_pointer_cast<StormServer>(shared_from_this()), client));
+            } else if(errno != ECANCELED) {
+                ++m_errors;
+            }
+        }
+        // stop 只取消等待(accept 返回 ECANCELED)，监听 socket 和 TcpServer::startAccept 一样由这里关闭
+        sylar::Mutex::Lock lock(m_sockMutex);
+        sock->close();
+    }
+
+private:
+    bool m_legacy;
+    bool m_hold = false;
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_errors = {0};
+    sylar::Mutex m_mutex;
+    std::vector<sylar::Socket::ptr> m_held;
+};
+
+static sylar::Address::ptr start_server(sylar::IOManager& iom, StormServer::ptr server) {
+    // 监听 socket 要在开启了 hook 的线程里创建，才会被设置成非阻塞
+    sylar::Address::ptr addr;
+    sylar::Semaphore sem;
+    iom.schedule([server, &addr, &sem](){
+        if(server->bind(sylar::Address::LookupAny("127.0.0.1:0"))) {
+            addr = server->getSocks()[0]->getLocalAddress();
+            server->start();
+        }
+        sem.notify();
+    });
+    sem.wait();
+    return addr;
+}
+
+// 服务端线程(只有一个)已经消耗的 CPU 时间(微秒)
+static uint64_t server_cpu_us(sylar::IOManager& iom) {
+    uint64_t us = 0;
+    sylar::Semaphore sem;
+    iom.schedule([&us, &sem](){
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        us = ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+        sem.notify();
+    });
+    sem.wait();
+    return us;
+}
+
+static void bench(bool legacy, int client_threads, int seconds) {
+    sylar::IOManager server(1, false, "server");
+    StormServer::ptr tcp(new StormServer(&server, legacy));
+    sylar::Address::ptr addr = start_server(server, tcp);
+    if(!addr) {
+        SYLAR_LOG_ERROR(g_logger) << "bind fail";
+        return;
+    }
+
+    uint64_t end = sylar::GetMonotonicMS() + seconds * 1000;
+    uint64_t conns = 0;
+    uint64_t cpu = 0;
+    {
+        sylar::IOManager client(client_threads, false, "client");
+        uint64_t cpu0 = server_cpu_us(server);
+        uint64_t count0 = tcp->getCount();
+        // 每个客户端线程跑很多协程同时建连，让积压队列里总有多个连接
+        for(int i = 0; i < client_threads * 32; ++i) {
+            client.schedule([addr, end](){
+                while(sylar::GetMonotonicMS() < end) {
+                    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+                    if(!sock->connect(addr)) {
+                        continue;
+                    }
+                    // RST 关闭，避免客户端端口被 TIME_WAIT 占满
+                    struct linger lg = {1, 0};
+                    sock->setOption(SOL_SOCKET, SO_LINGER, lg);
+                    sock->close();
+                }
+            });
+        }
+        // 只统计窗口内的数据，不算客户端退出时的收尾
+        usleep(seconds * 1000 * 1000);
+        conns = tcp->getCount() - count0;
+        cpu = server_cpu_us(server) - cpu0;
+    }
+    tcp->stop();
+    SYLAR_LOG_INFO(g_logger) << (legacy ? "legacy accept" : "batch accept")
+        << " client_threads=" << client_threads
+        << " conns=" << conns
+        << " conn/s=" << conns / seconds
+        << " server_cpu_us/conn=" << (conns ? (double)cpu / conns : 0);
+}
+
+/**
+ * @brief 句柄耗尽
+ * @details 客户端 socket 先全部创建好，再把 RLIMIT_NOFILE 压到只剩几个空位，
+ *          服务端收下几个连接后就 EMFILE，其余的客户端应该很快读到 EOF/RST 而不是一直挂着
+ */
+static void test_emfile(bool legacy) {
+    static const int s_clients = 64;
+    static const int s_spare = 8;
+
+    sylar::IOManager server(1, false, "server");
+    StormServer::ptr tcp(new StormServer(&server, legacy));
+    tcp->setHold(true);
+    sylar::Address::ptr addr = start_server(server, tcp);
+
+    struct rlimit old_limit;
+    getrlimit(RLIMIT_NOFILE, &old_limit);
+    int refused = 0;
+    int connected = 0;
+    {
+        sylar::IOManager client(1, false, "client");
+        sylar::Semaphore sem;
+        std::vector<int> fds;
+        client.schedule([&fds, &sem](){
+            for(int i = 0; i < s_clients; ++i) {
+                fds.push_back(socket(AF_INET, SOCK_STREAM, 0));
+            }
+            sem.notify();
+        });
+        sem.wait();
+
+        // 在客户端最大的句柄号之上只留 s_spare 个空位(加上更小的空洞)
+        struct rlimit limit = old_limit;
+        limit.rlim_cur = *std::max_element(fds.begin(), fds.end()) + 1 + s_spare;
+        setrlimit(RLIMIT_NOFILE, &limit);
+
+        for(int fd : fds) {
+            client.schedule([fd, addr, &refused, &connected](){
+                if(connect(fd, addr->getAddr(), addr->getAddrLen()) != 0) {
+                    ++refused;
+                    close(fd);
+                    return;
+                }
+                ++connected;
+                // 被丢弃的连接会很快读到 0 或 ECONNRESET，被收下的连接 500ms 后超时
+                struct timeval tv = {0, 500 * 1000};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                char c;
+                if(read(fd, &c, 1) == 0 || errno != ETIMEDOUT) {
+                    ++refused;
+                }
+                close(fd);
+            });
+        }
+    }
+    uint64_t held = tcp->getCount();
+
+    // 放开限制、释放连接，退避结束后应该能继续接收
+    tcp->release();
+    setrlimit(RLIMIT_NOFILE, &old_limit);
+    bool recovered = false;
+    {
+        sylar::IOManager client(1, false, "client");
+        client.schedule([addr, tcp, held, &recovered](){
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            if(sock->connect(addr)) {
+                for(int i = 0; i < 200 && tcp->getCount() == held; ++i) {
+                    usleep(10 * 1000);
+                }
+                recovered = tcp->getCount() > held;
+            }
+        });
+    }
+    tcp->release();
+    tcp->stop();
+
+    SYLAR_LOG_INFO(g_logger) << (legacy ? "legacy" : "batch")
+        << " emfile clients=" << s_clients
+        << " connected=" << connected
+        << " held=" << held
+        << " refused_or_dropped=" << refused
+        << " accept_errors=" << tcp->getErrors()
+        << " recovered=" << recovered;
+    if(!legacy) {
+        SYLAR_ASSERT2(held < (uint64_t)s_clients && held + refused >= (uint64_t)s_clients, "emfile shed");
+        SYLAR_ASSERT2(recovered, "emfile recover");
+    }
+}
+
+// acceptBatch 一次取完积压的连接，新连接非阻塞、带读超时、对端地址正确、继承 TCP_NODELAY；
+// 等待可以被取消
+static void test_batch() {
+    sylar::IOManager iom(1, false);
+    iom.schedule([](){
+        sylar::Socket::ptr server = sylar::Socket::CreateTCP(sylar::Address::LookupAny("127.0.0.1:0"));
+        server->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+        server->listen();
+        sylar::Address::ptr addr = server->getLocalAddress();
+
+        std::vector<sylar::Socket::ptr> clients;
+        for(int i = 0; i < 10; ++i) {
+            sylar::Socket::ptr c = sylar::Socket::CreateTCP(addr);
+            c->connect(addr);
+            clients.push_back(c);
+        }
+        std::vector<sylar::Socket::ptr> socks;
+        int rt = server->acceptBatch(socks, 4, 1234);
+        int rt2 = server->acceptBatch(socks, 64, 1234);
+        SYLAR_ASSERT2(rt == 4 && rt2 == 6 && socks.size() == 10, "accept budget");
+
+        bool ok = true;
+        for(size_t i = 0; i < socks.size(); ++i) {
+            auto& s = socks[i];
+            int nodelay = 0;
+            s->getOption(IPPROTO_TCP, TCP_NODELAY, nodelay);
+            ok = ok && (fcntl_f(s->getSocket(), F_GETFL, 0) & O_NONBLOCK)
+                && (fcntl_f(s->getSocket(), F_GETFD, 0) & FD_CLOEXEC)
+                && s->getRecvTimeout() == 1234
+                && nodelay
+                && s->getRemoteAddress()->toString() == clients[i]->getLocalAddress()->toString()
+                && s->getLocalAddress()->toString() == addr->toString();
+        }
+        SYLAR_ASSERT2(ok, "accepted socket state");
+
+        // 积压队列空了会挂起等待；新连接建立后发一条数据，读写走 hook，和普通 accept 出来的连接一样
+        sylar::Socket::ptr late = sylar::Socket::CreateTCP(addr);
+        sylar::IOManager::GetThis()->addTimer(50, [addr, late](){
+            late->connect(addr);
+            late->send("ping", 4);
+        });
+        uint64_t start = sylar::GetMonotonicMS();
+        socks.clear();
+        rt = server->acceptBatch(socks, 64);
+        uint64_t used = sylar::GetMonotonicMS() - start;
+        SYLAR_ASSERT2(rt == 1 && used >= 40, "accept wait");
+
+        char buf[4];
+        rt = socks[0]->recv(buf, 4);
+        SYLAR_ASSERT2(rt == 4 && memcmp(buf, "ping", 4) == 0, "accepted socket io");
+
+        // 等待中被取消时返回 ECANCELED，不再重试；没在等待时取消，下一次等待直接返回
+        sylar::IOManager::GetThis()->addTimer(50, [server](){
+            server->cancelAccept();
+        });
+        socks.clear();
+        rt = server->acceptBatch(socks, 64);
+        int err = errno;
+        SYLAR_ASSERT2(rt == -1 && err == ECANCELED && socks.empty(), "accept cancelled");
+        server->cancelAll();
+        rt = server->acceptBatch(socks, 64);
+        err = errno;
+        SYLAR_ASSERT2(rt == -1 && err == ECANCELED, "accept cancelled before wait");
+
+        // hook 的 accept 同样能被取消，不会在 do_io 里重新等待
+        sylar::IOManager::GetThis()->addTimer(50, [server](){
+            server->cancelAccept();
+        });
+        start = sylar::GetMonotonicMS();
+        sylar::Socket::ptr client = server->accept();
+        used = sylar::GetMonotonicMS() - start;
+        SYLAR_ASSERT2(!client && used >= 40, "hooked accept cancelled");
+    });
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    int client_threads = argc > 1 ? atoi(argv[1]) : 2;
+    int seconds = argc > 2 ? atoi(argv[2]) : 1;
+    test_batch();
+    bench(true, client_threads, seconds);
+    bench(false, client_threads, seconds);
+    // 改造前的循环在 EMFILE 时每次都打错误日志
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::FATAL);
+    test_emfile(true);
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    test_emfile(false);
+    return 0;
+}
@@ -0,0 +1,276 @@
+#include "webserve/streams/buffered_stream.h"
+#include "webserve/streams/socket_stream.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <string.h>
+
+// 测试 BufferedStream：跨多次底层读取的行和分隔符、超长行、大块读写绕过缓冲、
+// 写入合并和顺序，以及在 Unix socketpair 上和直接用 SocketStream 的系统调用次数对比
+// 用法: test_buffered_stream [响应/记录条数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 内存里的流：每次读最多返回 chunk 字节，写入追加到 out，统计调用次数
+class MemStream : public sylar::Stream {
+public:
+    typedef std::shared_ptr<MemStream> ptr;
+    MemStream(const std::string& in = "", size_t chunk = 1 << 20)
+        :m_in(in)
+        ,m_chunk(chunk) {
+    }
+
+    int read(void* buffer, size_t length) override {
+        ++reads;
+        size_t n = std::min(std::min(length, m_chunk), m_in.size() - m_pos);
+        memcpy(buffer, m_in.c_str() + m_pos, n);
+        m_pos += n;
+        return n;
+    }
+    int read(sylar::ByteArray::ptr ba, size_t length) override {
+        ++reads;
+        size_t n = std::min(std::min(length, m_chunk), m_in.size() - m_pos);
+        ba->write(m_in.c_str() + m_pos, n);
+        m_pos += n;
+        return n;
+    }
+    int write(const void* buffer, size_t length) override {
+        ++writes;
+        out.append((const char*)buffer, length);
+        return length;
+    }
+    int write(sylar::ByteArray::ptr ba, size_t length) override {
+        ++writes;
+        std::string tmp(length, 0);
+        ba->read(&tmp[0], length);
+        out += tmp;
+        return length;
+    }
+    void close() override {}
+
+    int reads = 0;
+    int writes = 0;
+    std::string out;
+private:
+    std::string m_in;
+    size_t m_chunk;
+    size_t m_pos = 0;
+};
+
+// 统计底层流的调用次数，每次调用对应一次 recv/send 系统调用
+class CountingStream : public sylar::Stream {
+public:
+    typedef std::shared_ptr<CountingStream> ptr;
+    CountingStream(sylar::Stream::ptr s)
+        :m_stream(s) {
+    }
+    int read(void* buffer, size_t length) override {
+        ++reads;
+        return m_stream->read(buffer, length);
+    }
+    int read(sylar::ByteArray::ptr ba, size_t length) override {
+        ++reads;
+        return m_stream->read(ba, length);
+    }
+    int write(const void* buffer, size_t length) override {
+        ++writes;
+        return m_stream->write(buffer, length);
+    }
+    int write(sylar::ByteArray::ptr ba, size_t length) override {
+        ++writes;
+        return m_stream->write(ba, length);
+    }
+    void close() override { m_stream->close();}
+
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+private:
+    sylar::Stream::ptr m_stream;
+};
+
+void test_lines() {
+    std::vector<std::string> lines;
+    std::string data;
+    for(int i = 0; i < 500; ++i) {
+        std::string line = std::string(i * 37 % 300, 'a' + i % 26) + std::to_string(i);
+        if(i == 100) {
+            // 比读缓冲大很多的行
+            line = std::string(5000, 'L');
+        }
+        lines.push_back(line);
+        data += line + (i % 2 ? "\r\n" : "\n");
+    }
+    data += "tail";
+    bool ok = true;
+    for(size_t chunk : {1, 3, 7, 100, 4096}) {
+        MemStream::ptr ms(new MemStream(data, chunk));
+        sylar::BufferedStream bs(ms, 64);
+        std::string line;
+        for(size_t i = 0; i < lines.size() && ok; ++i) {
+            ok = bs.readLine(line) > 0 && line == lines[i];
+        }
+        // 最后一行没有换行，流关闭时留在缓冲里，还能用 read 读出来
+        char buf[16];
+        ok = ok && bs.readLine(line) == 0 && bs.getReadBuffered() == 4
+            && bs.read(buf, sizeof(buf)) == 4 && memcmp(buf, "tail", 4) == 0
+            && bs.read(buf, sizeof(buf)) == 0;
+    }
+    SYLAR_ASSERT2(ok, "read lines");
+
+    MemStream::ptr ms(new MemStream("GET / HTTP/1.1\r\nHost: a\r\n\r\nbody1234\r\n\r", 5));
+    sylar::BufferedStream bs(ms, 8);
+    std::string head;
+    int rt = bs.readUntil(head, "\r\n\r\n");
+    std::string first = head;
+    char body[8];
+    int n = bs.readFixSize(body, 8);
+    int rt2 = bs.readUntil(head, "\r\n\r\n");
+    SYLAR_ASSERT2(rt == 27 && first == "GET / HTTP/1.1\r\nHost: a"
+            && n == 8 && memcmp(body, "body1234", 8) == 0 && rt2 == 0, "read until");
+
+    MemStream::ptr longms(new MemStream(std::string(1000, 'x') + "\n", 10));
+    sylar::BufferedStream lbs(longms, 16);
+    std::string line;
+    rt = lbs.readLine(line, 100);
+    SYLAR_ASSERT2(rt == -2, "line too long");
+}
+
+void test_read() {
+    std::string data;
+    for(int i = 0; i < 10000; ++i) {
+        data += (char)(i * 7);
+    }
+    // 小读取合并成一次底层读取
+    MemStream::ptr ms(new MemStream(data));
+    sylar::BufferedStream bs(ms, 4096);
+    std::string got(data.size(), 0);
+    for(size_t i = 0; i < got.size(); i += 10) {
+        bs.readFixSize(&got[i], 10);
+    }
+    SYLAR_ASSERT2(got == data && ms->reads == 3, "small reads");
+
+    // 读缓冲为空并且要读的不小于缓冲区时直接读
+    MemStream::ptr ms2(new MemStream(data));
+    sylar::BufferedStream bs2(ms2, 4096);
+    char hdr[4];
+    bs2.readFixSize(hdr, 4);
+    sylar::ByteArray::ptr ba(new sylar::ByteArray);
+    int a = bs2.read(ba, 8192);
+    int b = bs2.read(ba, 8192);
+    ba->setPosition(0);
+    SYLAR_ASSERT2(a == 4092 && b == 5904 && ms2->reads == 2
+            && ba->toString() == data.substr(4), "large reads");
+}
+
+void test_write() {
+    MemStream::ptr ms(new MemStream);
+    sylar::BufferedStream bs(ms, 4096, 1000);
+    std::string expect;
+    for(int i = 0; i < 300; ++i) {
+        std::string s = std::to_string(i) + ",";
+        bs.write(s.c_str(), s.size());
+        expect += s;
+    }
+    SYLAR_ASSERT2(ms->writes == 1 && bs.getWriteBuffered() == expect.size() - ms->out.size(), "write gather");
+    bs.flush();
+    SYLAR_ASSERT2(ms->out == expect && bs.getWriteBuffered() == 0 && bs.flush() == 0, "write flush");
+
+    // 大块写入先 flush 前面攒的，保持顺序
+    bs.write("head", 4);
+    std::string big(5000, 'B');
+    bs.write(big.c_str(), big.size());
+    SYLAR_ASSERT2(ms->out == expect + "head" + big && ms->writes == 4, "write large");
+
+    // write(ByteArray) 只引用数据，之后改 ba 不影响已经写入的
+    sylar::ByteArray::ptr ba(new sylar::ByteArray);
+    ba->write("abcdef", 6);
+    ba->setPosition(0);
+    bs.write(ba, 3);
+    ba->setPosition(0);
+    ba->write("XYZ", 3);
+    bs.write(ba, 3);
+    bs.close();
+    SYLAR_ASSERT2(ms->out == expect + "head" + big + "abcdef", "write bytearray");
+}
+
+#define XX(name, count, code) { \
+    uint64_t t0 = sylar::GetCurrentUS(); \
+    code; \
+    SYLAR_LOG_INFO(g_logger) << name << ": syscalls=" << count \
+        << " ms=" << (sylar::GetCurrentUS() - t0) / 1000; \
+}
+
+// 每条响应分 16 次写(状态行、头部、正文片段)，另一端一直读到关闭
+static void bench_write(int responses, bool buffered) {
+    sylar::Socket::ptr a, b;
+    sylar::Socket::CreateUnixPair(a, b);
+    sylar::IOManager::GetThis()->schedule([b](){
+        char buf[64 * 1024];
+        while(b->recv(buf, sizeof(buf)) > 0) {
+        }
+        b->close();
+    });
+    CountingStream::ptr cs(new CountingStream(sylar::Stream::ptr(new sylar::SocketStream(a))));
+    sylar::BufferedStream::ptr bs(new sylar::BufferedStream(cs));
+    sylar::Stream::ptr s = buffered ? (sylar::Stream::ptr)bs : (sylar::Stream::ptr)cs;
+    std::string piece = "X-Header-Name: some header value\r\n";
+    XX(std::string("write ") + (buffered ? "buffered" : "direct"), cs->writes, {
+        for(int i = 0; i < responses; ++i) {
+            s->writeFixSize("HTTP/1.1 200 OK\r\n", 17);
+            for(int j = 0; j < 14; ++j) {
+                s->writeFixSize(piece.c_str(), piece.size());
+            }
+            s->writeFixSize("\r\n", 2);
+            if(buffered) {
+                bs->flush();
+            }
+        }
+    });
+    s->close();
+}
+
+// 另一端发过来的是 4 字节长度 + 正文的记录
+static void bench_read(int records, bool buffered) {
+    sylar::Socket::ptr a, b;
+    sylar::Socket::CreateUnixPair(a, b);
+    sylar::IOManager::GetThis()->schedule([b, records](){
+        std::string data;
+        for(int i = 0; i < records; ++i) {
+            uint32_t len = 20 + i % 100;
+            data.append((const char*)&len, 4);
+            data.append(len, 'r');
+        }
+        sylar::SocketStream(b).writeFixSize(data.c_str(), data.size());
+    });
+    CountingStream::ptr cs(new CountingStream(sylar::Stream::ptr(new sylar::SocketStream(a))));
+    sylar::Stream::ptr s = buffered ? (sylar::Stream::ptr)sylar::BufferedStream::ptr(
+            new sylar::BufferedStream(cs)) : (sylar::Stream::ptr)cs;
+    int got = 0;
+    XX(std::string("read ") + (buffered ? "buffered" : "direct"), cs->reads, {
+        char body[256];
+        uint32_t len;
+        while(s->readFixSize(&len, 4) > 0 && s->readFixSize(body, len) > 0) {
+            ++got;
+        }
+    });
+    SYLAR_ASSERT2(got == records, "read records");
+    s->close();
+}
+#undef XX
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    test_lines();
+    test_read();
+    test_write();
+    sylar::IOManager iom(1, true, "bench");
+    iom.schedule([count](){
+        bench_write(count, false);
+        bench_write(count, true);
+        bench_read(count, false);
+        bench_read(count, true);
+    });
+    return 0;
+}
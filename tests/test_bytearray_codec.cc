@@ -0,0 +1,307 @@
+#include "webserve/bytearray.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <string.h>
+
+// 测试 ByteArray 的 peek/span/skip、reserve/commit、批量数组编解码，
+// 以及定长、变长整数和字符串逐个编解码和批量编解码的吞吐
+// 用法: test_bytearray_codec [轮数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_peek() {
+    sylar::ByteArray ba(8);
+    ba.write("abcdefghijkl", 12);
+    ba.setPosition(2);
+    const char* p = ba.peek(6);
+    SYLAR_ASSERT2(p && memcmp(p, "cdefgh", 6) == 0 && ba.getPosition() == 2, "peek");
+    // 跨节点、超过数据长度时返回 nullptr
+    SYLAR_ASSERT2(ba.peek(7) == nullptr, "peek cross node");
+    ba.setPosition(10);
+    SYLAR_ASSERT2(ba.peek(3) == nullptr, "peek past end");
+
+    ba.setPosition(3);
+    const char* q = nullptr;
+    size_t n = ba.span(q);
+    SYLAR_ASSERT2(n == 5 && memcmp(q, "defgh", 5) == 0, "span");
+    ba.skip(n);
+    n = ba.span(q);
+    SYLAR_ASSERT2(n == 4 && memcmp(q, "ijkl", 4) == 0, "span next node");
+    ba.skip(4);
+    SYLAR_ASSERT2(ba.span(q) == 0 && q == nullptr, "span end");
+
+    bool thrown = false;
+    try {
+        ba.skip(1);
+    } catch(std::out_of_range&) {
+        thrown = true;
+    }
+    SYLAR_ASSERT2(thrown, "skip out of range");
+}
+
+void test_reserve() {
+    sylar::ByteArray ba(8);
+    ba.write("xyz", 3);
+    // 当前节点放得下
+    char* p = ba.reserve(4);
+    memcpy(p, "1234", 4);
+    ba.commit(2);
+    SYLAR_ASSERT2(ba.getSize() == 5 && ba.getPosition() == 5, "reserve in node");
+
+    // 放不下时截断当前节点，接一个新节点
+    p = ba.reserve(20);
+    SYLAR_ASSERT2(p != nullptr, "reserve new node");
+    for(int i = 0; i < 20; ++i) {
+        p[i] = 'a' + i;
+    }
+    ba.commit(20);
+    ba.write("!", 1);
+    ba.setPosition(0);
+    SYLAR_ASSERT2(ba.toString() == "xyz12abcdefghijklmnopqrst!", "reserve data");
+
+    // 在已有数据中间放不下时返回 nullptr
+    ba.setPosition(1);
+    SYLAR_ASSERT2(ba.reserve(100) == nullptr, "reserve middle");
+
+    // 被 Slice 引用的位置先复制
+    sylar::Slice s = ba.slice(5, 0);
+    ba.setPosition(0);
+    p = ba.reserve(2);
+    memcpy(p, "XY", 2);
+    ba.commit(2);
+    ba.setPosition(0);
+    SYLAR_ASSERT2(s.toString() == "xyz12" && ba.toString().substr(0, 5) == "XYz12", "reserve cow");
+}
+
+// 各种编码跨节点和不跨节点的结果要一致
+void test_codec() {
+    bool same = true;
+    for(size_t base : {1, 3, 7, 4096}) {
+        sylar::ByteArray ba(base);
+        srand(1);
+        for(int i = 0; i < 200; ++i) {
+            int64_t v = ((int64_t)rand() << (i % 32)) * (i % 2 ? -1 : 1);
+            ba.writeFuint16(v);
+            ba.writeFint32(v);
+            ba.writeFuint64(v);
+            ba.writeInt32(v);
+            ba.writeUint32(v);
+            ba.writeInt64(v);
+            ba.writeUint64(v);
+            ba.writeDouble(v * 0.5);
+            ba.writeStringF16(std::to_string(v));
+            ba.writeStringVint(std::string(i, 'v'));
+        }
+        ba.setPosition(0);
+        srand(1);
+        for(int i = 0; same && i < 200; ++i) {
+            int64_t v = ((int64_t)rand() << (i % 32)) * (i % 2 ? -1 : 1);
+            same = ba.readFuint16() == (uint16_t)v
+                && ba.readFint32() == (int32_t)v
+                && ba.readFuint64() == (uint64_t)v
+                && ba.readInt32() == (int32_t)v
+                && ba.readUint32() == (uint32_t)v
+                && ba.readInt64() == v
+                && ba.readUint64() == (uint64_t)v
+                && ba.readDouble() == v * 0.5
+                && ba.readStringF16() == std::to_string(v)
+                && ba.readStringVint() == std::string(i, 'v');
+        }
+        same = same && ba.getReadSize() == 0;
+    }
+    SYLAR_ASSERT2(same, "codec");
+}
+
+// 批量编码和逐个编码的结果一样，可以交叉读
+void test_array() {
+    std::vector<uint32_t> u32;
+    std::vector<uint64_t> u64;
+    std::vector<int32_t> i32;
+    std::vector<int64_t> i64;
+    for(int i = 0; i < 1000; ++i) {
+        // 前面一段全是单字节的值，走 SIMD 路径
+        uint64_t v = i < 300 ? rand() % 128 : ((uint64_t)rand() << 32 | rand()) >> (i % 64);
+        u32.push_back(v);
+        u64.push_back(v);
+        i32.push_back((int32_t)v * (i % 2 ? -1 : 1));
+        i64.push_back((int64_t)v * (i % 2 ? -1 : 1));
+    }
+    bool same = true;
+    for(size_t base : {1, 7, 100, 4096}) {
+        sylar::ByteArray a(base);
+        sylar::ByteArray b(base);
+        a.writeUint32Array(&u32[0], u32.size());
+        a.writeUint64Array(&u64[0], u64.size());
+        a.writeInt32Array(&i32[0], i32.size());
+        a.writeInt64Array(&i64[0], i64.size());
+        a.writeFuint16Array((const uint16_t*)&u32[0], u32.size() * 2);
+        a.writeFuint32Array(&u32[0], u32.size());
+        a.writeFuint64Array(&u64[0], u64.size());
+        for(auto v : u32) b.writeUint32(v);
+        for(auto v : u64) b.writeUint64(v);
+        for(auto v : i32) b.writeInt32(v);
+        for(auto v : i64) b.writeInt64(v);
+        for(size_t i = 0; i < u32.size() * 2; ++i) b.writeFuint16(((const uint16_t*)&u32[0])[i]);
+        for(auto v : u32) b.writeFuint32(v);
+        for(auto v : u64) b.writeFuint64(v);
+        a.setPosition(0);
+        b.setPosition(0);
+        same = same && a.toString() == b.toString();
+
+        std::vector<uint32_t> r32(u32.size());
+        std::vector<uint64_t> r64(u64.size());
+        std::vector<int32_t> s32(i32.size());
+        std::vector<int64_t> s64(i64.size());
+        std::vector<uint16_t> r16(u32.size() * 2);
+        std::vector<uint32_t> f32(u32.size());
+        std::vector<uint64_t> f64(u64.size());
+        // 先逐个读几个，让批量读从奇数位置开始
+        r32[0] = a.readUint32();
+        a.readUint32Array(&r32[1], r32.size() - 1);
+        a.readUint64Array(&r64[0], r64.size());
+        a.readInt32Array(&s32[0], s32.size());
+        a.readInt64Array(&s64[0], s64.size());
+        a.readFuint16Array(&r16[0], r16.size());
+        a.readFuint32Array(&f32[0], f32.size());
+        a.readFuint64Array(&f64[0], f64.size());
+        same = same && r32 == u32 && r64 == u64 && s32 == i32 && s64 == i64
+            && memcmp(&r16[0], &u32[0], u32.size() * 4) == 0
+            && f32 == u32 && f64 == u64 && a.getReadSize() == 0;
+    }
+    SYLAR_ASSERT2(same, "array");
+
+    sylar::ByteArray ba;
+    ba.writeUint32Array(&u32[0], 10);
+    ba.setPosition(0);
+    bool thrown = false;
+    try {
+        ba.readUint32Array(&u32[0], 11);
+    } catch(std::out_of_range&) {
+        thrown = true;
+    }
+    SYLAR_ASSERT2(thrown, "array out of range");
+}
+
+void bench(int rounds) {
+    static const size_t s_count = 4096;
+    sylar::ByteArray ba(4096);
+    std::vector<uint64_t> vals;
+    for(size_t i = 0; i < s_count; ++i) {
+        vals.push_back((uint64_t)rand() >> (i % 24));
+    }
+    std::string str(24, 's');
+
+    uint64_t sum = 0;
+#define XX(name, write_fun, read_fun) { \
+    uint64_t t0 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        ba.clear(); \
+        for(auto v : vals) { \
+            ba.write_fun(v); \
+        } \
+    } \
+    uint64_t t1 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        ba.setPosition(0); \
+        for(size_t i = 0; i < s_count; ++i) { \
+            sum += ba.read_fun(); \
+        } \
+    } \
+    uint64_t t2 = sylar::GetCurrentUS(); \
+    uint64_t n = rounds * s_count; \
+    SYLAR_LOG_INFO(g_logger) << name << ": encode ns/op=" << (t1 - t0) * 1000.0 / n \
+        << " decode ns/op=" << (t2 - t1) * 1000.0 / n \
+        << " bytes=" << ba.getSize(); \
+}
+    XX("fuint32", writeFuint32, readFuint32);
+    XX("fuint64", writeFuint64, readFuint64);
+    XX("uint32 varint", writeUint32, readUint32);
+    XX("uint64 varint", writeUint64, readUint64);
+    XX("int64 zigzag", writeInt64, readInt64);
+#undef XX
+
+    uint64_t t0 = sylar::GetCurrentUS();
+    for(int r = 0; r < rounds; ++r) {
+        ba.clear();
+        for(size_t i = 0; i < s_count; ++i) {
+            ba.writeStringF16(str);
+        }
+    }
+    uint64_t t1 = sylar::GetCurrentUS();
+    for(int r = 0; r < rounds; ++r) {
+        ba.setPosition(0);
+        for(size_t i = 0; i < s_count; ++i) {
+            sum += ba.readStringF16().size();
+        }
+    }
+    uint64_t t2 = sylar::GetCurrentUS();
+    uint64_t n = rounds * s_count;
+    SYLAR_LOG_INFO(g_logger) << "string f16: encode ns/op=" << (t1 - t0) * 1000.0 / n
+        << " decode ns/op=" << (t2 - t1) * 1000.0 / n
+        << " sum=" << sum;
+}
+
+// 10 万个整数逐个编解码和批量编解码的对比
+void bench_array(int rounds, const char* name, uint64_t limit) {
+    static const size_t s_count = 100000;
+    std::vector<uint32_t> u32(s_count);
+    std::vector<uint64_t> u64(s_count);
+    for(size_t i = 0; i < s_count; ++i) {
+        u64[i] = ((uint64_t)rand() << 32 | rand()) % limit;
+        u32[i] = u64[i];
+    }
+    sylar::ByteArray ba(64 * 1024);
+    uint64_t sum = 0;
+    rounds = std::max(rounds / 20, 1);
+#define XX(what, type, vec, one_write, one_read, bulk_write, bulk_read) { \
+    std::vector<type> out(s_count); \
+    uint64_t t0 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        ba.clear(); \
+        for(auto v : vec) ba.one_write(v); \
+    } \
+    uint64_t t1 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        ba.setPosition(0); \
+        for(size_t i = 0; i < s_count; ++i) out[i] = ba.one_read(); \
+    } \
+    uint64_t t2 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        ba.clear(); \
+        ba.bulk_write(&vec[0], s_count); \
+    } \
+    uint64_t t3 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        ba.setPosition(0); \
+        ba.bulk_read(&out[0], s_count); \
+    } \
+    uint64_t t4 = sylar::GetCurrentUS(); \
+    sum += out[s_count - 1]; \
+    double mb = (double)ba.getSize() * rounds / 1024 / 1024; \
+    SYLAR_LOG_INFO(g_logger) << what << " " << name << " bytes/value=" \
+        << (double)ba.getSize() / s_count \
+        << " each encode/decode MB/s=" << (int)(mb * 1e6 / (t1 - t0 + 1)) \
+        << "/" << (int)(mb * 1e6 / (t2 - t1 + 1)) \
+        << " array encode/decode MB/s=" << (int)(mb * 1e6 / (t3 - t2 + 1)) \
+        << "/" << (int)(mb * 1e6 / (t4 - t3 + 1)) \
+        << " ok=" << (out == vec); \
+}
+    XX("uint32", uint32_t, u32, writeUint32, readUint32, writeUint32Array, readUint32Array);
+    XX("uint64", uint64_t, u64, writeUint64, readUint64, writeUint64Array, readUint64Array);
+    XX("fuint32", uint32_t, u32, writeFuint32, readFuint32, writeFuint32Array, readFuint32Array);
+#undef XX
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    test_peek();
+    test_reserve();
+    test_codec();
+    test_array();
+    bench(rounds);
+    bench_array(rounds, "small(<128)", 128);
+    bench_array(rounds, "mixed(<2^20)", 1 << 20);
+    bench_array(rounds, "large(<2^40)", 1ull << 40);
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include "webserve/bytearray.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <malloc.h>
+
+// 测试 ByteArray 的文件映射读写：只读映射不拷贝、在映射范围里写不影响文件、
+// 映射写入按段扩展并在关闭时截断，以及大文件读写和内存占用与 readFromFile/writeToFile 的对比
+// 用法: test_bytearray_mmap [文件MB数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const std::string s_path = "/tmp/sylar_test_bytearray_mmap.dat";
+
+static size_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : (size_t)-1;
+}
+
+// 进程自己的匿名内存 MB，不含映射的文件页(它们在页缓存里，可以随时回收)
+static double anon_mb() {
+    double kb = 0;
+    FILE* f = fopen("/proc/self/status", "r");
+    if(f) {
+        char line[256];
+        while(fgets(line, sizeof(line), f)) {
+            if(strncmp(line, "RssAnon:", 8) == 0) {
+                kb = atof(line + 8);
+                break;
+            }
+        }
+        fclose(f);
+    }
+    return kb / 1024;
+}
+
+void test_map_read() {
+    sylar::ByteArray src(100);
+    for(int i = 0; i < 1000; ++i) {
+        src.writeFuint32(i);
+    }
+    src.setPosition(0);
+    src.writeToFile(s_path);
+
+    sylar::ByteArray ba(100);
+    ba.write("junk", 4);
+    bool ok = ba.mapFromFile(s_path);
+    SYLAR_ASSERT2(ok && ba.getSize() == 4000 && ba.getPosition() == 0, "map read");
+    const char* p = nullptr;
+    SYLAR_ASSERT2(ba.span(p) == 4000, "map single node");
+    bool same = true;
+    for(int i = 0; same && i < 1000; ++i) {
+        same = ba.readFuint32() == (uint32_t)i;
+    }
+    SYLAR_ASSERT2(same, "map content");
+
+    // 追加分配新节点，在映射范围里写先复制，文件不变
+    sylar::Slice s = ba.slice(8, 0);
+    ba.writeFuint32(1000);
+    ba.setPosition(0);
+    ba.writeFuint32(0xffffffff);
+    ba.setPosition(0);
+    sylar::ByteArray again;
+    again.mapFromFile(s_path);
+    uint32_t v1 = ba.readFuint32();
+    uint32_t v2 = again.readFuint32();
+    SYLAR_ASSERT2(v1 == 0xffffffff && v2 == 0
+            && ba.getSize() == 4004 && file_size(s_path) == 4000, "map write copies");
+
+    // 映射在最后一个引用释放时才解除
+    ba.clear();
+    again.clear();
+    sylar::ByteArray tmp;
+    tmp.write(s);
+    tmp.setPosition(0);
+    v1 = tmp.readFuint32();
+    v2 = tmp.readFuint32();
+    SYLAR_ASSERT2(v1 == 0 && v2 == 1, "slice outlives map");
+
+    int fd = open(s_path.c_str(), O_WRONLY | O_TRUNC);
+    close(fd);
+    ok = ba.mapFromFile(s_path);
+    SYLAR_ASSERT2(ok && ba.getSize() == 0, "map empty file");
+    ok = ba.mapFromFile("/tmp/sylar_no_such_file.dat");
+    SYLAR_ASSERT2(!ok, "map missing file");
+}
+
+void test_map_write() {
+    sylar::Slice s;
+    {
+        sylar::ByteArray ba(4096);
+        bool ok = ba.mapToFile(s_path);
+        SYLAR_ASSERT2(ok, "map write open");
+        // 超过一段(1MB)，跨段写
+        std::string chunk(1000, 'x');
+        for(int i = 0; i < 3000; ++i) {
+            chunk[0] = 'a' + i % 26;
+            ba.write(chunk.c_str(), chunk.size());
+        }
+        ba.writeStringF16("tail");
+        // 映射写入时 Slice 拷贝进去，reserve 不截断节点
+        ba.write(sylar::Slice(std::string(300, 's')));
+        // 切出 Slice 之后覆盖写映射的范围：Slice 是拷贝，覆盖的数据仍然写进文件
+        s = ba.slice(1000, 0);
+        ba.setPosition(1);
+        ba.write("yy", 2);
+        const char* p = nullptr;
+        ba.setPosition(0);
+        SYLAR_ASSERT2(ba.span(p) == 1024 * 1024, "map write segments");
+        ba.setPosition(ba.getSize());
+        SYLAR_ASSERT2(ba.reserve(2 * 1024 * 1024) == nullptr, "map write reserve");
+        ok = ba.syncFile();
+        SYLAR_ASSERT2(ok && file_size(s_path) >= ba.getSize(), "map write sync");
+    }
+    SYLAR_ASSERT2(file_size(s_path) == 3000 * 1000 + 6 + 300, "map write truncate");
+
+    sylar::ByteArray rb;
+    rb.readFromFile(s_path);
+    rb.setPosition(0);
+    bool same = true;
+    for(int i = 0; same && i < 3000; ++i) {
+        std::string v(1000, 0);
+        rb.read(&v[0], v.size());
+        char second = i == 0 ? 'y' : 'x';
+        same = v[0] == 'a' + i % 26 && v[1] == second && v[2] == second && v[999] == 'x';
+    }
+    std::string tail = rb.readStringF16();
+    SYLAR_ASSERT2(same && tail == "tail"
+            && rb.toString() == std::string(300, 's') && s.toString()[0] == 'a', "map write content");
+    std::string sliced = s.toString();
+    SYLAR_ASSERT2(sliced[1] == 'x' && sliced[2] == 'x', "map write slice copy");
+}
+
+// 每一项先把空闲的堆内存还给系统，再看这一项新增了多少匿名内存
+#define XX(what, ms, anon, code) { \
+    malloc_trim(0); \
+    double rss0 = anon_mb(); \
+    uint64_t t0 = sylar::GetCurrentUS(); \
+    { \
+        code; \
+        anon = anon_mb() - rss0; \
+    } \
+    ms = (sylar::GetCurrentUS() - t0) / 1000; \
+    SYLAR_LOG_INFO(g_logger) << what << " ms=" << ms << " anon+MB=" << anon; \
+}
+
+void bench(size_t mb) {
+    static const size_t s_chunk = 64 * 1024;
+    std::string chunk(s_chunk, 0);
+    for(size_t i = 0; i < s_chunk; ++i) {
+        chunk[i] = i % 251;
+    }
+    size_t total = mb * 1024 * 1024;
+    uint64_t ms = 0;
+    double anon = 0;
+
+    // 写：直接写进文件映射，和先在内存里拼好再 writeToFile
+    XX("write " << mb << "MB mapToFile", ms, anon, {
+        sylar::ByteArray ba;
+        ba.mapToFile(s_path);
+        for(size_t n = 0; n < total; n += s_chunk) {
+            ba.write(chunk.c_str(), s_chunk);
+        }
+    });
+    XX("write " << mb << "MB build + writeToFile", ms, anon, {
+        sylar::ByteArray ba(s_chunk);
+        for(size_t n = 0; n < total; n += s_chunk) {
+            ba.write(chunk.c_str(), s_chunk);
+        }
+        ba.setPosition(0);
+        ba.writeToFile(s_path);
+    });
+
+    // 读：页缓存是热的，直接映射和拷贝进节点，然后顺序扫一遍
+    uint64_t sum1 = 0, sum2 = 0;
+    XX("read+scan " << mb << "MB mapFromFile", ms, anon, {
+        sylar::ByteArray ba;
+        ba.mapFromFile(s_path);
+        const char* p = nullptr;
+        while(size_t n = ba.span(p)) {
+            for(size_t i = 0; i < n; ++i) {
+                sum1 += (uint8_t)p[i];
+            }
+            ba.skip(n);
+        }
+    });
+    XX("read+scan " << mb << "MB readFromFile", ms, anon, {
+        sylar::ByteArray ba;
+        ba.readFromFile(s_path);
+        ba.setPosition(0);
+        const char* p = nullptr;
+        while(size_t n = ba.span(p)) {
+            for(size_t i = 0; i < n; ++i) {
+                sum2 += (uint8_t)p[i];
+            }
+            ba.skip(n);
+        }
+    });
+    SYLAR_ASSERT2(sum1 == sum2, "bench same");
+}
+#undef XX
+
+int main(int argc, char** argv) {
+    size_t mb = argc > 1 ? atoi(argv[1]) : 256;
+    test_map_read();
+    test_map_write();
+    bench(mb);
+    unlink(s_path.c_str());
+    return 0;
+}
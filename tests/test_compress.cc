@@ -0,0 +1,248 @@
+#include "webserve/compress.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <string.h>
+
+// 测试 LZ4 风格的块压缩和分帧流式压缩：各种长度往返、分多次输入解压、损坏数据不越界，
+// 以及文本、二进制记录、随机数据三种负载的压缩率和 MB/s
+// 用法: test_compress [每种负载的MB数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 类似访问日志的文本
+static std::string make_text(size_t size) {
+    static const char* s_paths[] = {"/index.html", "/api/user", "/static/app.js", "/api/order/list"};
+    static const char* s_agents[] = {"curl/7.68.0", "Mozilla/5.0 (X11; Linux x86_64)", "wrk/4.2"};
+    std::string data;
+    for(int i = 0; data.size() < size; ++i) {
+        data += "{\"time\":" + std::to_string(1700000000 + i * 7)
+            + ",\"ip\":\"10.0." + std::to_string(rand() % 16) + "." + std::to_string(rand() % 256)
+            + "\",\"path\":\"" + s_paths[rand() % 4]
+            + "\",\"status\":" + (rand() % 10 ? "200" : "404")
+            + ",\"bytes\":" + std::to_string(rand() % 100000)
+            + ",\"agent\":\"" + s_agents[rand() % 3] + "\"}\n";
+    }
+    data.resize(size);
+    return data;
+}
+
+// ByteArray 编码的定长记录
+static std::string make_records(size_t size) {
+    sylar::ByteArray ba;
+    for(int i = 0; ba.getSize() < size; ++i) {
+        ba.writeFuint64(1000000 + i);
+        ba.writeFuint32(rand() % 1000);
+        ba.writeFuint16(i % 7);
+        ba.writeDouble((rand() % 10000) / 100.0);
+        ba.writeStringF16("item-" + std::to_string(i % 50));
+    }
+    ba.setPosition(0);
+    std::string data = ba.toString();
+    data.resize(size);
+    return data;
+}
+
+static std::string make_random(size_t size) {
+    std::string data(size, 0);
+    for(size_t i = 0; i < size; ++i) {
+        data[i] = rand();
+    }
+    return data;
+}
+
+static std::string roundtrip_block(const std::string& data, size_t* clen = nullptr) {
+    std::vector<char> comp(sylar::LZ4Codec::CompressBound(data.size()));
+    size_t n = sylar::LZ4Codec::Compress(data.c_str(), data.size(), &comp[0]);
+    if(clen) {
+        *clen = n;
+    }
+    std::string out(data.size(), 0);
+    int64_t rt = sylar::LZ4Codec::Decompress(&comp[0], n, &out[0], out.size());
+    return rt == (int64_t)data.size() ? out : "<fail>";
+}
+
+void test_block() {
+    bool same = true;
+    for(size_t len : {0, 1, 5, 12, 13, 14, 20, 100, 1000, 65535, 65536, 70000, 1 << 20}) {
+        std::string text = make_text(len);
+        std::string rnd = make_random(len);
+        std::string run(len, 'a');
+        same = same && roundtrip_block(text) == text && roundtrip_block(rnd) == rnd
+            && roundtrip_block(run) == run;
+    }
+    SYLAR_ASSERT2(same, "block roundtrip");
+
+    size_t clen = 0;
+    std::string run(100000, 'z');
+    SYLAR_ASSERT2(roundtrip_block(run, &clen) == run && clen < 500, "block ratio");
+
+    // 随机改坏压缩数据，解压只能返回 -1 或者某个长度，不能越界
+    std::string text = make_text(20000);
+    std::vector<char> comp(sylar::LZ4Codec::CompressBound(text.size()));
+    size_t n = sylar::LZ4Codec::Compress(text.c_str(), text.size(), &comp[0]);
+    std::string out(text.size(), 0);
+    int bad = 0;
+    for(int i = 0; i < 2000; ++i) {
+        std::vector<char> broken(comp.begin(), comp.begin() + n);
+        for(int j = 0; j < 1 + i % 4; ++j) {
+            broken[rand() % n] = rand();
+        }
+        size_t len = i % 3 ? n : rand() % n;
+        int64_t rt = sylar::LZ4Codec::Decompress(&broken[0], len, &out[0], out.size());
+        bad += rt < 0;
+    }
+    SYLAR_ASSERT2(bad > 0, "block corrupted");
+    SYLAR_ASSERT2(sylar::LZ4Codec::Decompress(&comp[0], n, &out[0], out.size() - 1) == -1, "block too small");
+}
+
+void test_frame() {
+    std::string data = make_text(300000) + make_random(100000) + make_records(200000);
+    // 输入跨节点，块大小不是节点大小的整数倍
+    sylar::ByteArray::ptr in(new sylar::ByteArray(4096));
+    in->write(data.c_str(), data.size());
+    in->setPosition(0);
+    sylar::ByteArray::ptr comp(new sylar::ByteArray(4096));
+    sylar::LZ4Compressor::Compress(in, comp, 50000);
+    comp->setPosition(0);
+    std::string frame = comp->toString();
+
+    sylar::ByteArray::ptr out(new sylar::ByteArray(4096));
+    bool ok = sylar::LZ4Decompressor::Decompress(comp, out);
+    out->setPosition(0);
+    SYLAR_ASSERT2(ok && in->getReadSize() == 0 && out->toString() == data
+            && frame.size() < data.size(), "frame roundtrip");
+
+    // 输入从一个节点里直接压缩
+    sylar::ByteArray::ptr big(new sylar::ByteArray(1 << 20));
+    big->write(data.c_str(), data.size());
+    big->setPosition(0);
+    sylar::ByteArray::ptr comp2(new sylar::ByteArray);
+    sylar::LZ4Compressor::Compress(big, comp2);
+    comp2->setPosition(0);
+    sylar::ByteArray::ptr out2(new sylar::ByteArray);
+    ok = sylar::LZ4Decompressor::Decompress(comp2, out2);
+    out2->setPosition(0);
+    SYLAR_ASSERT2(ok && out2->toString() == data, "frame from node");
+
+    // 压缩数据分成随机大小的片段陆续到达
+    sylar::ByteArray::ptr out3(new sylar::ByteArray);
+    sylar::LZ4Decompressor d(out3);
+    int rt = 0;
+    for(size_t pos = 0; pos < frame.size() && rt == 0; ) {
+        size_t n = std::min(frame.size() - pos, (size_t)(1 + rand() % 3000));
+        sylar::ByteArray::ptr piece(new sylar::ByteArray(1024));
+        piece->write(frame.c_str() + pos, n);
+        piece->setPosition(0);
+        rt = d.write(piece);
+        pos += n;
+    }
+    out3->setPosition(0);
+    SYLAR_ASSERT2(rt == 1 && d.isFinished() && out3->toString() == data, "frame streaming");
+
+    // 按 1000 字节分段送入默认 64KB 块的数据，缓存的输入不超过一个块加块头
+    std::string large = make_random(2 << 20) + make_text(2 << 20);
+    sylar::ByteArray::ptr lin(new sylar::ByteArray);
+    lin->write(large.c_str(), large.size());
+    lin->setPosition(0);
+    sylar::ByteArray::ptr lcomp(new sylar::ByteArray);
+    sylar::LZ4Compressor::Compress(lin, lcomp);
+    lcomp->setPosition(0);
+    std::string lframe = lcomp->toString();
+    sylar::ByteArray::ptr lout(new sylar::ByteArray);
+    sylar::LZ4Decompressor ld(lout);
+    size_t max_pending = 0;
+    rt = 0;
+    for(size_t pos = 0; pos < lframe.size() && rt == 0; pos += 1000) {
+        sylar::ByteArray::ptr piece(new sylar::ByteArray);
+        piece->write(lframe.c_str() + pos, std::min(lframe.size() - pos, (size_t)1000));
+        piece->setPosition(0);
+        rt = ld.write(piece);
+        max_pending = std::max(max_pending, ld.getPendingSize());
+    }
+    lout->setPosition(0);
+    SYLAR_LOG_INFO(g_logger) << "frame chunked max_pending=" << max_pending;
+    SYLAR_ASSERT2(rt == 1 && lout->toString() == large
+            && max_pending <= 64 * 1024 + 8, "frame chunked pending");
+
+    // 流式压缩，小块多次写入
+    sylar::ByteArray::ptr comp4(new sylar::ByteArray);
+    sylar::LZ4Compressor c(comp4, 8192);
+    for(size_t pos = 0; pos < data.size(); ) {
+        size_t n = std::min(data.size() - pos, (size_t)(1 + rand() % 5000));
+        c.write(data.c_str() + pos, n);
+        pos += n;
+    }
+    c.finish();
+    comp4->setPosition(0);
+    sylar::ByteArray::ptr out4(new sylar::ByteArray);
+    ok = sylar::LZ4Decompressor::Decompress(comp4, out4);
+    out4->setPosition(0);
+    SYLAR_ASSERT2(ok && c.getRawBytes() == data.size() && out4->toString() == data, "frame write pieces");
+
+    // 空输入
+    sylar::ByteArray::ptr empty(new sylar::ByteArray);
+    sylar::ByteArray::ptr comp5(new sylar::ByteArray);
+    sylar::LZ4Compressor::Compress(empty, comp5);
+    comp5->setPosition(0);
+    sylar::ByteArray::ptr out5(new sylar::ByteArray);
+    ok = sylar::LZ4Decompressor::Decompress(comp5, out5);
+    SYLAR_ASSERT2(ok && out5->getSize() == 0, "frame empty");
+
+    // 坏的魔数和块头
+    sylar::ByteArray::ptr bad(new sylar::ByteArray);
+    bad->write("XLZ1\0\0\0\0\0\0\0\0", 12);
+    bad->setPosition(0);
+    ok = sylar::LZ4Decompressor::Decompress(bad, out5);
+    SYLAR_ASSERT2(!ok, "frame bad magic");
+    std::string broken = frame;
+    broken[8] ^= 0x7f;
+    sylar::ByteArray::ptr bad2(new sylar::ByteArray);
+    bad2->write(broken.c_str(), broken.size());
+    bad2->setPosition(0);
+    sylar::ByteArray::ptr out6(new sylar::ByteArray);
+    ok = sylar::LZ4Decompressor::Decompress(bad2, out6);
+    SYLAR_ASSERT2(!ok, "frame bad header");
+}
+
+void bench(const char* name, const std::string& data, int rounds) {
+    sylar::ByteArray::ptr in(new sylar::ByteArray);
+    in->write(data.c_str(), data.size());
+    sylar::ByteArray::ptr comp(new sylar::ByteArray);
+    sylar::ByteArray::ptr out(new sylar::ByteArray);
+
+    uint64_t t0 = sylar::GetCurrentUS();
+    for(int i = 0; i < rounds; ++i) {
+        in->setPosition(0);
+        comp->clear();
+        sylar::LZ4Compressor::Compress(in, comp);
+    }
+    uint64_t t1 = sylar::GetCurrentUS();
+    bool ok = true;
+    for(int i = 0; i < rounds; ++i) {
+        comp->setPosition(0);
+        out->clear();
+        ok = sylar::LZ4Decompressor::Decompress(comp, out) && ok;
+    }
+    uint64_t t2 = sylar::GetCurrentUS();
+    out->setPosition(0);
+    ok = ok && out->toString() == data;
+
+    double mb = (double)data.size() * rounds / 1024 / 1024;
+    SYLAR_LOG_INFO(g_logger) << name << ": size=" << data.size()
+        << " ratio=" << (double)data.size() / comp->getSize()
+        << " compress MB/s=" << (int)(mb * 1e6 / (t1 - t0 + 1))
+        << " decompress MB/s=" << (int)(mb * 1e6 / (t2 - t1 + 1))
+        << " ok=" << ok;
+}
+
+int main(int argc, char** argv) {
+    size_t mb = argc > 1 ? atoi(argv[1]) : 16;
+    test_block();
+    test_frame();
+    size_t size = mb * 1024 * 1024;
+    bench("text", make_text(size), 5);
+    bench("records", make_records(size), 5);
+    bench("random", make_random(size), 5);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include "webserve/dns.h"
+#include "webserve/address.h"
+#include "webserve/socket.h"
+#include "webserve/config.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/macro.h"
+#include <unistd.h>
+
+// 用本地的 DNS 桩服务器测试异步解析器：A/AAAA 应答、TTL 缓存、否定缓存、hosts 文件
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::Socket::ptr s_stub;
+static bool s_stop = false;
+
+static void put16(std::string& buf, uint16_t v) {
+    buf.push_back((char)(v >> 8));
+    buf.push_back((char)(v & 0xff));
+}
+
+// 取出请求里的域名和查询类型
+static std::string parse_question(const std::string& req, uint16_t& qtype) {
+    std::string name;
+    size_t pos = 12;
+    while(pos < req.size() && req[pos]) {
+        uint8_t len = req[pos];
+        if(!name.empty()) {
+            name += ".";
+        }
+        name.append(req, pos + 1, len);
+        pos += len + 1;
+    }
+    qtype = ((uint8_t)req[pos + 1] << 8) | (uint8_t)req[pos + 2];
+    return name;
+}
+
+// www.example.test 有 A 记录(TTL 1秒)，v6.example.test 有 AAAA 记录，其它名字不存在
+static void stub_server() {
+    char buf[512];
+    while(!s_stop) {
+        sylar::Address::ptr from(new sylar::IPv4Address);
+        int n = s_stub->recvFrom(buf, sizeof(buf), from);
+        if(n <= 12) {
+            continue;
+        }
+        std::string req(buf, n);
+        uint16_t qtype = 0;
+        std::string name = parse_question(req, qtype);
+        SYLAR_LOG_INFO(g_logger) << "stub query name=" << name << " qtype=" << qtype;
+
+        std::string rdata;
+        if(name == "www.example.test" && qtype == 1) {
+            rdata = std::string("\x0a\x00\x00\x01", 4);
+        } else if(name == "v6.example.test" && qtype == 28) {
+            rdata = std::string(15, '\0') + "\x01";
+        }
+        bool nx = name != "www.example.test" && name != "v6.example.test";
+
+        std::string rsp = req.substr(0, 2);
+        put16(rsp, nx ? 0x8183 : 0x8180);
+        put16(rsp, 1);
+        put16(rsp, rdata.empty() ? 0 : 1);
+        put16(rsp, 0);
+        put16(rsp, 0);
+        rsp += req.substr(12);
+        if(!rdata.empty()) {
+            put16(rsp, 0xc00c);     // 指向问题区的名字
+            put16(rsp, qtype);
+            put16(rsp, 1);
+            put16(rsp, 0);
+            put16(rsp, 1);          // TTL 1 秒
+            put16(rsp, rdata.size());
+            rsp += rdata;
+        }
+        s_stub->sendTo(rsp.c_str(), rsp.size(), from);
+    }
+}
+
+void test_resolver() {
+    sylar::DnsResolver* dns = sylar::DnsMgr::GetInstance();
+    sylar::IPAddress::ptr server = sylar::IPv4Address::Create("127.0.0.1", 0);
+    s_stub = sylar::Socket::CreateUDP(server);
+    s_stub->bind(server);
+    server = std::dynamic_pointer_cast<sylar::IPAddress>(s_stub->getLocalAddress());
+    sylar::IOManager::GetThis()->schedule(stub_server);
+    SYLAR_LOG_INFO(g_logger) << "stub server " << *server;
+
+    // 不受本机 resolv.conf 的 search 域影响
+    sylar::Config::Lookup<std::string>("dns.resolv_conf")->setValue("/dev/null");
+    dns->setServers({server});
+
+    auto addr = dns->resolveAny("www.example.test");
+    SYLAR_ASSERT2(addr && addr->toString() == "10.0.0.1:0"
+            && dns->getQueryCount() == 1, "resolve A");
+
+    addr = dns->resolveAny("WWW.Example.Test");
+    SYLAR_ASSERT2(addr && dns->getQueryCount() == 1 && dns->getCacheHitCount() == 1, "cache hit");
+
+    usleep(1100 * 1000);
+    addr = dns->resolveAny("www.example.test");
+    SYLAR_ASSERT2(addr && dns->getQueryCount() == 2, "ttl expired");
+
+    addr = dns->resolveAny("v6.example.test", AF_INET6);
+    SYLAR_ASSERT2(addr && addr->toString() == "[::1]:0", "resolve AAAA");
+
+    uint64_t queries = dns->getQueryCount();
+    addr = dns->resolveAny("nosuch.example.test");
+    SYLAR_ASSERT2(!addr && dns->getQueryCount() == queries + 1, "nxdomain");
+    addr = dns->resolveAny("nosuch.example.test");
+    SYLAR_ASSERT2(!addr && dns->getQueryCount() == queries + 1, "negative cache");
+
+    queries = dns->getQueryCount();
+    addr = dns->resolveAny("localhost");
+    SYLAR_ASSERT2(addr && addr->toString() == "127.0.0.1:0"
+            && dns->getQueryCount() == queries, "hosts file");
+
+    // Address::Lookup 在协程里走异步解析器，端口由调用方设置，不影响缓存里的地址
+    addr = sylar::Address::LookupAnyIPAddress("www.example.test:8080");
+    SYLAR_ASSERT2(addr && addr->toString() == "10.0.0.1:8080", "Address::LookupAnyIPAddress");
+    addr = dns->resolveAny("www.example.test");
+    SYLAR_ASSERT2(addr && addr->toString() == "10.0.0.1:0", "cached address untouched");
+
+    s_stop = true;
+    s_stub->close();
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::IOManager iom(1, false);
+    iom.schedule(test_resolver);
+    return 0;
+}
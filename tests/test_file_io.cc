@@ -0,0 +1,170 @@
+#include "webserve/file_io.h"
+#include "webserve/bytearray.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// 冷页缓存下的并发文件读基准：同步 pread、卸载线程池、io_uring 三种方式，
+// 比较总耗时和 IO 线程上 1ms 定时器的最大间隔(间隔越大说明事件循环被磁盘卡得越久)
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_files = 16;
+static const size_t s_file_size = 4 << 20;
+static const size_t s_chunk = 64 << 10;
+
+static std::string s_dir;
+static std::vector<std::string> s_paths;
+
+// 第 i 个文件的内容全是字节 'a' + i
+static void create_files() {
+    char tmpl[] = "/tmp/test_file_io_XXXXXX";
+    s_dir = mkdtemp(tmpl);
+    std::string data(s_file_size, 0);
+    for(int i = 0; i < s_files; ++i) {
+        std::string path = s_dir + "/f" + std::to_string(i);
+        memset(&data[0], 'a' + i, data.size());
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        write(fd, data.c_str(), data.size());
+        fsync(fd);
+        close(fd);
+        s_paths.push_back(path);
+    }
+}
+
+static void remove_files() {
+    for(auto& i : s_paths) {
+        unlink(i.c_str());
+    }
+    rmdir(s_dir.c_str());
+}
+
+// 把文件踢出页缓存，数据已经 fsync 过，干净页可以直接丢弃
+static void drop_cache() {
+    for(auto& i : s_paths) {
+        int fd = open(i.c_str(), O_RDONLY);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/**
+ * @brief 每个文件一个协程并发读完
+ * @param[in] fio 为空时在协程里直接调用 pread
+ */
+static void bench(const char* name, sylar::FileIOManager* fio) {
+    drop_cache();
+    uint64_t start = sylar::GetMonotonicUS();
+    uint64_t max_gap = 0;
+    int remain = s_files;
+    bool ok = true;
+    {
+        sylar::IOManager iom(1, false);
+        uint64_t last = sylar::GetMonotonicUS();
+        std::function<void()> tick = [&last, &max_gap](){
+            uint64_t now = sylar::GetMonotonicUS();
+            max_gap = std::max(max_gap, now - last);
+            last = now;
+        };
+        sylar::Timer::ptr ticker = iom.addTimer(1, tick, true);
+        for(int i = 0; i < s_files; ++i) {
+            iom.schedule([i, fio, ticker, tick, &remain, &ok](){
+                const std::string& path = s_paths[i];
+                int fd = fio ? fio->open(path, O_RDONLY) : open(path.c_str(), O_RDONLY);
+                std::vector<char> buf(s_chunk);
+                off_t offset = 0;
+                while(true) {
+                    ssize_t n = fio ? fio->pread(fd, &buf[0], buf.size(), offset)
+                                    : pread(fd, &buf[0], buf.size(), offset);
+                    if(n <= 0) {
+                        break;
+                    }
+                    if(buf[0] != 'a' + i || buf[n - 1] != 'a' + i) {
+                        ok = false;
+                    }
+                    offset += n;
+                }
+                if(offset != (off_t)s_file_size) {
+                    ok = false;
+                }
+                close(fd);
+                if(--remain == 0) {
+                    // 同步读时定时器可能一次都没机会执行，结束时再量一次
+                    tick();
+                    ticker->cancel();
+                }
+            });
+        }
+    }
+    uint64_t used = sylar::GetMonotonicUS() - start;
+    SYLAR_LOG_INFO(g_logger) << name << " files=" << s_files
+        << " total_mb=" << (s_files * s_file_size >> 20)
+        << " used_ms=" << used / 1000
+        << " mb/s=" << (s_files * s_file_size >> 20) * 1000000.0 / used
+        << " max_loop_gap_us=" << max_gap;
+    SYLAR_ASSERT2(ok && remain == 0, name);
+}
+
+// open/pwrite/fsync/pread 以及 ByteArray 的文件读写
+static void test_api(sylar::FileIOManager* fio) {
+    sylar::IOManager iom(1, false);
+    iom.schedule([fio](){
+        std::string path = s_dir + "/api";
+        int fd = fio->open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        ssize_t w = fio->pwrite(fd, "hello world", 11, 0);
+        int s = fio->fsync(fd);
+        char buf[16] = {0};
+        ssize_t r = fio->pread(fd, buf, sizeof(buf), 6);
+        close(fd);
+        SYLAR_ASSERT2(fd >= 0 && w == 11 && s == 0
+                && r == 5 && memcmp(buf, "world", 5) == 0, "open/pwrite/fsync/pread");
+
+        fd = fio->open(s_dir + "/nosuch", O_RDONLY);
+        int err = errno;
+        SYLAR_ASSERT2(fd == -1 && err == ENOENT, "open error");
+
+        // 跨多个节点
+        sylar::ByteArray ba(1024);
+        for(int i = 0; i < 2000; ++i) {
+            ba.writeFint32(i);
+        }
+        ba.setPosition(0);
+        ba.writeToFile(path);
+        sylar::ByteArray rb(1024);
+        rb.readFromFile(path);
+        rb.setPosition(0);
+        bool same = rb.getReadSize() == 8000;
+        for(int i = 0; same && i < 2000; ++i) {
+            same = rb.readFint32() == i;
+        }
+        SYLAR_ASSERT2(same, "ByteArray file");
+        unlink(path.c_str());
+    });
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    create_files();
+
+    sylar::FileIOManager offload(false, 0);
+    sylar::FileIOManager uring(true, 256);
+    SYLAR_LOG_INFO(g_logger) << "io_uring available=" << uring.isUring();
+
+    test_api(&uring);
+    test_api(&offload);
+
+    bench("sync pread", nullptr);
+    bench("offload pool", &offload);
+    bench("io_uring", &uring);
+    SYLAR_LOG_INFO(g_logger) << "offload ops=" << offload.getOffloadCount()
+        << " uring ops=" << uring.getUringCount();
+
+    remove_files();
+    return 0;
+}
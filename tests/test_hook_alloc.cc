@@ -0,0 +1,166 @@
+#include "webserve/hook.h"
+#include "webserve/log.h"
+#include "webserve/iomanager.h"
+#include "webserve/fd_manager.h"
+#include "webserve/macro.h"
+#include "webserve/util.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <new>
+
+// 统计阻塞 recv 的内存分配次数：两个协程通过 socketpair 乒乓，每一轮两次阻塞 recv；
+// 再由调度器外的线程唤醒唯一一个等待的协程；
+// 最后检查协程长时间占用 CPU 之后，recv 的超时仍然从调用时开始计算
+
+static std::atomic<uint64_t> s_alloc_count {0};
+
+void* operator new(size_t size) {
+    ++s_alloc_count;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_rounds = 10000;
+static int s_fds[2];
+
+void pong() {
+    char c;
+    for(int i = 0; i < s_rounds; ++i) {
+        if(recv(s_fds[1], &c, 1, 0) != 1) {
+            SYLAR_LOG_ERROR(g_logger) << "pong recv errno=" << errno;
+            return;
+        }
+        send(s_fds[1], &c, 1, 0);
+    }
+}
+
+void ping() {
+    char c = 'x';
+    // 预热一轮，让调度队列和超时堆的容量稳定下来
+    send(s_fds[0], &c, 1, 0);
+    recv(s_fds[0], &c, 1, 0);
+
+    uint64_t begin = s_alloc_count;
+    uint64_t start_us = sylar::GetCurrentUS();
+    for(int i = 1; i < s_rounds; ++i) {
+        send(s_fds[0], &c, 1, 0);
+        if(recv(s_fds[0], &c, 1, 0) != 1) {
+            SYLAR_LOG_ERROR(g_logger) << "ping recv errno=" << errno;
+            return;
+        }
+    }
+    uint64_t used_us = sylar::GetCurrentUS() - start_us;
+    uint64_t allocs = s_alloc_count - begin;
+    uint64_t recvs = (s_rounds - 1) * 2;
+    SYLAR_LOG_INFO(g_logger) << "blocking recv=" << recvs
+        << " allocs=" << allocs
+        << " allocs/recv=" << (double)allocs / recvs
+        << " us/recv=" << (double)used_us / recvs;
+    // 每次唤醒只有调度队列的一个节点
+    SYLAR_ASSERT2(allocs <= recvs, "ping allocs/recv=" << (double)allocs / recvs);
+}
+
+// 只有一个协程在等待，由不在调度器里的线程唤醒：每次挂载超时时桶都是空的，
+// 这时挂载超时也不能分配内存
+void single_waiter() {
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    struct timeval tv{5, 0};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    // 对端是阻塞的，收到一个字节就回一个字节，循环里不分配内存
+    std::thread writer([&fds](){
+        char c;
+        while(read(fds[1], &c, 1) == 1) {
+            write(fds[1], &c, 1);
+        }
+    });
+
+    char c = 'x';
+    send(fds[0], &c, 1, 0);
+    recv(fds[0], &c, 1, 0);
+    uint64_t begin = s_alloc_count;
+    int recvs = 0;
+    for(int i = 1; i < s_rounds; ++i) {
+        send(fds[0], &c, 1, 0);
+        if(recv(fds[0], &c, 1, 0) != 1) {
+            break;
+        }
+        ++recvs;
+    }
+    uint64_t allocs = s_alloc_count - begin;
+    shutdown(fds[0], SHUT_RDWR);
+    writer.join();
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "single waiter recv=" << recvs
+        << " allocs=" << allocs
+        << " allocs/recv=" << (double)allocs / std::max(recvs, 1);
+    SYLAR_ASSERT2(recvs == s_rounds - 1 && allocs <= (uint64_t)recvs
+            ,"single waiter allocs/recv=" << (double)allocs / std::max(recvs, 1));
+}
+
+// 协程运行期间事件循环缓存的时钟不会刷新，超时必须从 recv 调用的时刻算起
+void stale_clock() {
+    int fds[2];
+    SYLAR_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    struct timeval tv{0, 100 * 1000};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint64_t busy_until = sylar::GetMonotonicUS() + 200 * 1000;
+    while(sylar::GetMonotonicUS() < busy_until);
+
+    char c;
+    uint64_t start_us = sylar::GetMonotonicUS();
+    int rt = recv(fds[0], &c, 1, 0);
+    uint64_t used_us = sylar::GetMonotonicUS() - start_us;
+    SYLAR_LOG_INFO(g_logger) << "recv after busy loop rt=" << rt
+        << " errno=" << errno << " waited_us=" << used_us;
+    SYLAR_ASSERT(rt == -1 && used_us >= 90 * 1000);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, s_fds)) {
+        SYLAR_LOG_ERROR(g_logger) << "socketpair errno=" << errno;
+        return 1;
+    }
+
+    sylar::IOManager iom(1, false);
+    iom.schedule([](){
+        // socketpair 没有被 hook，这里手动登记，并设置读超时让每次等待都挂上超时
+        for(int fd : s_fds) {
+            sylar::FdMgr::GetInstance()->get(fd, true);
+            struct timeval tv{5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+        sylar::IOManager::GetThis()->schedule(pong);
+        sylar::IOManager::GetThis()->schedule([](){
+            ping();
+            single_waiter();
+            stale_clock();
+        });
+    });
+    return 0;
+}
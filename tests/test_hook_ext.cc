@@ -0,0 +1,199 @@
+#include "webserve/hook.h"
+#include "webserve/log.h"
+#include "webserve/iomanager.h"
+#include "webserve/fd_manager.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+// 测试新增 hook 的函数：poll/select/epoll_wait 等待期间不阻塞线程，splice/sendfile/dup2
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 100ms 之后往 fd 写一个字节，等待方如果阻塞了线程，这个协程就跑不起来
+static void write_later(int fd) {
+    sylar::IOManager::GetThis()->schedule([fd](){
+        usleep(100 * 1000);
+        write(fd, "x", 1);
+    });
+}
+
+static void make_pair(int fds[2]) {
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    sylar::FdMgr::GetInstance()->get(fds[0], true);
+    sylar::FdMgr::GetInstance()->get(fds[1], true);
+}
+
+void test_poll() {
+    int fds[2];
+    make_pair(fds);
+    write_later(fds[1]);
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = poll(&pfd, 1, 1000);
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "poll rt=" << rt << " revents=" << pfd.revents
+        << " used_ms=" << used;
+    // 阻塞了线程的话写数据的协程跑不起来，只能等到超时
+    SYLAR_ASSERT2(rt == 1 && (pfd.revents & POLLIN) && used >= 80 && used < 1000, "poll");
+
+    // 数据读走之后再 poll 应该超时
+    char c;
+    read(fds[0], &c, 1);
+    start = sylar::GetMonotonicMS();
+    rt = poll(&pfd, 1, 50);
+    used = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "poll again rt=" << rt << " used_ms=" << used;
+    SYLAR_ASSERT2(rt == 0 && pfd.revents == 0 && used >= 40, "poll timeout");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_select() {
+    int fds[2];
+    make_pair(fds);
+    write_later(fds[1]);
+    fd_set rset;
+    FD_ZERO(&rset);
+    FD_SET(fds[0], &rset);
+    struct timeval tv{1, 0};
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = select(fds[0] + 1, &rset, nullptr, nullptr, &tv);
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    bool isset = FD_ISSET(fds[0], &rset);
+    SYLAR_LOG_INFO(g_logger) << "select rt=" << rt << " isset=" << isset
+        << " used_ms=" << used;
+    SYLAR_ASSERT2(rt == 1 && isset && used >= 80 && used < 1000, "select");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void test_epoll_wait() {
+    int fds[2];
+    make_pair(fds);
+    int epfd = epoll_create1(0);
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fds[0];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &ev);
+    write_later(fds[1]);
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = epoll_wait(epfd, &ev, 1, 1000);
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "epoll_wait rt=" << rt << " fd=" << ev.data.fd
+        << " used_ms=" << used;
+    SYLAR_ASSERT2(rt == 1 && ev.data.fd == fds[0] && (ev.events & EPOLLIN)
+            && used >= 80 && used < 1000, "epoll_wait");
+    close(epfd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// socket -> pipe -> socket，读端的数据 100ms 之后才到；中间用 tee 复制一份
+void test_splice() {
+    int fds[2], out[2], pipefd[2];
+    make_pair(fds);
+    make_pair(out);
+    pipe(pipefd);
+    write_later(fds[1]);
+    ssize_t n = splice(fds[0], nullptr, pipefd[1], nullptr, 4096, SPLICE_F_MOVE);
+    // tee 复制一份到另一个管道，不消耗原管道里的数据
+    int copy[2];
+    pipe(copy);
+    ssize_t t = tee(pipefd[0], copy[1], 4096, 0);
+    ssize_t m = splice(pipefd[0], nullptr, out[0], nullptr, n, SPLICE_F_MOVE);
+    char c = 0;
+    char c2 = 0;
+    read(out[1], &c, 1);
+    read(copy[0], &c2, 1);
+    SYLAR_LOG_INFO(g_logger) << "splice in=" << n << " tee=" << t << " out=" << m
+        << " c=" << c << " c2=" << c2;
+    SYLAR_ASSERT2(n == 1 && t == 1 && m == 1 && c == 'x' && c2 == 'x', "splice/tee");
+    close(copy[0]);
+    close(copy[1]);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    close(fds[0]);
+    close(fds[1]);
+    close(out[0]);
+    close(out[1]);
+}
+
+void test_sendfile() {
+    char path[] = "/tmp/test_hook_ext_XXXXXX";
+    int file = mkstemp(path);
+    std::string data(1 << 20, 'a');
+    write(file, data.c_str(), data.size());
+    unlink(path);
+
+    int fds[2];
+    make_pair(fds);
+    sylar::IOManager::GetThis()->schedule([fds](){
+        char buf[4096];
+        size_t total = 0;
+        ssize_t n;
+        while((n = read(fds[1], buf, sizeof(buf))) > 0) {
+            total += n;
+        }
+        SYLAR_LOG_INFO(g_logger) << "sendfile reader total=" << total;
+        SYLAR_ASSERT2(total == 1 << 20, "sendfile received");
+        close(fds[1]);
+    });
+    off_t offset = 0;
+    size_t sent = 0;
+    while(sent < data.size()) {
+        ssize_t n = sendfile(fds[0], file, &offset, data.size() - sent);
+        if(n <= 0) {
+            SYLAR_LOG_ERROR(g_logger) << "sendfile n=" << n << " errno=" << errno;
+            break;
+        }
+        sent += n;
+    }
+    SYLAR_LOG_INFO(g_logger) << "sendfile sent=" << sent;
+    SYLAR_ASSERT2(sent == data.size() && offset == (off_t)data.size(), "sendfile");
+    close(fds[0]);
+    close(file);
+}
+
+// dup2 之后新句柄继承读超时
+void test_dup2() {
+    int fds[2];
+    make_pair(fds);
+    struct timeval tv{0, 100 * 1000};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int fd = dup(fds[1]);
+    dup2(fds[0], fd);
+    char c;
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = recv(fd, &c, 1, 0);
+    int err = errno;
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "dup2 recv rt=" << rt << " errno=" << err
+        << " used_ms=" << used;
+    SYLAR_ASSERT2(rt == -1 && err == ETIMEDOUT && used >= 90, "dup2 timeout");
+    close(fd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::IOManager iom(1, false);
+    iom.schedule([](){
+        test_poll();
+        test_select();
+        test_epoll_wait();
+        test_splice();
+        test_sendfile();
+        test_dup2();
+    });
+    return 0;
+}
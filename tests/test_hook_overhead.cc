@@ -0,0 +1,95 @@
+#include "webserve/hook.h"
+#include "webserve/log.h"
+#include "webserve/iomanager.h"
+#include "webserve/fd_manager.h"
+#include "webserve/thread.h"
+#include "webserve/util.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// hook 快路径开销的微基准：数据总是就绪的 send/recv，以及多线程下 FdManager 查找
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const int s_rounds = 1000000;
+static int s_fds[2];
+
+// 一次 send + 一次 recv，数据总是就绪，不会进入等待
+static double bench_io(bool hook) {
+    sylar::set_hook_enable(hook);
+    char c = 'x';
+    uint64_t start = sylar::GetMonotonicUS();
+    for(int i = 0; i < s_rounds; ++i) {
+        send(s_fds[0], &c, 1, 0);
+        recv(s_fds[1], &c, 1, 0);
+    }
+    uint64_t used = sylar::GetMonotonicUS() - start;
+    sylar::set_hook_enable(true);
+    return used * 1000.0 / s_rounds / 2;
+}
+
+void test_io() {
+    for(int fd : s_fds) {
+        sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    bench_io(true);
+    double raw = bench_io(false);
+    double hooked = bench_io(true);
+    SYLAR_LOG_INFO(g_logger) << "raw ns/call=" << raw
+        << " hooked ns/call=" << hooked
+        << " overhead ns/call=" << hooked - raw;
+}
+
+// 多个线程同时查找同一个 fd，对比加锁的 get 和无锁的 lookup
+static void bench_lookup(const char* name, int threads, std::function<void()> op) {
+    std::vector<sylar::Thread::ptr> thrs;
+    uint64_t start = sylar::GetMonotonicUS();
+    for(int i = 0; i < threads; ++i) {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([op](){
+            for(int j = 0; j < s_rounds; ++j) {
+                op();
+            }
+        }, "lookup_" + std::to_string(i))));
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+    uint64_t used = sylar::GetMonotonicUS() - start;
+    SYLAR_LOG_INFO(g_logger) << name << " threads=" << threads
+        << " ns/op=" << used * 1000.0 / s_rounds;
+}
+
+void test_lookup() {
+    int fd = s_fds[0];
+    static std::atomic<uint64_t> s_sink = {0};
+    for(int threads : {1, 4}) {
+        bench_lookup("get", threads, [fd](){
+            sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+            if(ctx->isClose()) {
+                ++s_sink;
+            }
+        });
+        bench_lookup("lookup", threads, [fd](){
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
+            if(ctx->isClose()) {
+                ++s_sink;
+            }
+        });
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, s_fds)) {
+        SYLAR_LOG_ERROR(g_logger) << "socketpair errno=" << errno;
+        return 1;
+    }
+    {
+        sylar::IOManager iom(1, false);
+        iom.schedule(test_io);
+    }
+    test_lookup();
+    return 0;
+}
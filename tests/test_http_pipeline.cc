@@ -0,0 +1,152 @@
+#include "webserve/http/http_server.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+
+// 测试 HttpSession 的读缓冲和流水线：一次发来的多个请求(带消息体)依次解析、不多读 socket，
+// 跨多次读取的请求，攒着的响应按顺序发出；再对 HttpServer 用不同的流水线深度发请求，
+// 类似 wrk --pipeline，对比每秒请求数
+// 用法: test_http_pipeline [请求数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static std::string make_get(const std::string& path) {
+    return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+}
+
+static std::string make_post(const std::string& path, const std::string& body) {
+    return "POST " + path + " HTTP/1.1\r\nHost: localhost\r\ncontent-length: "
+        + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+// 收到的数据里出现 marker 为止
+static std::string recv_until(sylar::Socket::ptr sock, const std::string& marker) {
+    std::string out;
+    std::vector<char> buf(64 * 1024);
+    while(out.find(marker) == std::string::npos) {
+        int rt = sock->recv(&buf[0], buf.size());
+        if(rt <= 0) {
+            break;
+        }
+        out.append(&buf[0], rt);
+    }
+    return out;
+}
+
+void test_session() {
+    sylar::Socket::ptr a, b;
+    sylar::Socket::CreateUnixPair(a, b);
+    sylar::http::HttpSession::ptr session(new sylar::http::HttpSession(a));
+
+    // 一次发过去三个请求，中间的带消息体
+    std::string data = make_get("/a") + make_post("/b", "hello body") + make_get("/c?x=1");
+    b->send(data.c_str(), data.size());
+    auto r1 = session->recvRequest();
+    size_t left1 = session->getReadBuffered();
+    auto r2 = session->recvRequest();
+    auto r3 = session->recvRequest();
+    SYLAR_ASSERT2(r1 && r2 && r3 && r1->getPath() == "/a" && left1 > 0
+            && r2->getPath() == "/b" && r2->getBody() == "hello body"
+            && r3->getPath() == "/c" && r3->getQuery() == "x=1"
+            && session->getReadBuffered() == 0, "pipelined requests");
+
+    // 请求在 socket 上分成几段：头部一半、头部剩下的和一部分消息体、剩下的消息体加下一个请求的开头
+    std::string body(10000, 'x');
+    std::string req = make_post("/long", body) + make_get("/next");
+    size_t cuts[] = {10, 60, 5000, req.size() - 8, req.size()};
+    sylar::IOManager::GetThis()->schedule([b, req, cuts](){
+        size_t off = 0;
+        for(size_t cut : cuts) {
+            b->send(req.c_str() + off, cut - off);
+            off = cut;
+            usleep(2000);
+        }
+    });
+    auto r4 = session->recvRequest();
+    auto r5 = session->recvRequest();
+    SYLAR_ASSERT2(r4 && r5 && r4->getPath() == "/long" && r4->getBody() == body
+            && r5->getPath() == "/next", "split requests");
+
+    // 攒着的响应在下一次读 socket 之前按顺序发出
+    for(int i = 0; i < 3; ++i) {
+        sylar::http::HttpResponse::ptr rsp(new sylar::http::HttpResponse(0x11, false));
+        rsp->setBody("#" + std::to_string(i) + ";");
+        session->sendResponse(rsp, true);
+    }
+    size_t pending = session->getWriteBuffered();
+    sylar::IOManager::GetThis()->schedule([b](){
+        std::string got = recv_until(b, "#2;");
+        std::string more = make_get("/after");
+        b->send(more.c_str(), more.size());
+        // 对端收完所有响应才发下一个请求，响应没发出去的话这里会一直等
+        SYLAR_ASSERT2(got.find("#0;") < got.find("#1;")
+                && got.find("#1;") < got.find("#2;"), "delayed responses");
+    });
+    auto r6 = session->recvRequest();
+    SYLAR_ASSERT2(pending > 0 && r6 && r6->getPath() == "/after"
+            && session->getWriteBuffered() == 0, "flush before read");
+
+    // 头部超过缓冲区大小
+    std::string huge = "GET / HTTP/1.1\r\nX-Big: " + std::string(100 * 1024, 'h') + "\r\n\r\n";
+    sylar::IOManager::GetThis()->schedule([b, huge](){
+        // 对端读了一个缓冲区就关闭，不要 SIGPIPE
+        b->send(huge.c_str(), huge.size(), MSG_NOSIGNAL);
+    });
+    auto r7 = session->recvRequest();
+    SYLAR_ASSERT2(!r7, "header too large");
+    b->close();
+}
+
+// 在 HttpServer 上按 depth 个一批发送 total 个请求，每批收完响应再发下一批
+static void bench(int total, int depth) {
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(true));
+    server->getServletDispatch()->addGlobServlet("/*", [](sylar::http::HttpRequest::ptr req
+                ,sylar::http::HttpResponse::ptr rsp
+                ,sylar::http::HttpSession::ptr session) {
+            rsp->setBody("#" + req->getQuery() + ";");
+            return 0;
+    });
+    server->bind(sylar::Address::LookupAnyIPAddress("127.0.0.1:0"));
+    server->start();
+    sylar::Address::ptr addr = server->getSocks()[0]->getLocalAddress();
+
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    sock->connect(addr);
+    uint64_t t0 = sylar::GetCurrentUS();
+    bool ok = true;
+    for(int i = 0; i < total && ok; i += depth) {
+        std::string batch;
+        int n = std::min(depth, total - i);
+        for(int j = 0; j < n; ++j) {
+            batch += make_get("/p?" + std::to_string(i + j));
+        }
+        sock->send(batch.c_str(), batch.size());
+        std::string got = recv_until(sock, "#" + std::to_string(i + n - 1) + ";");
+        // 响应的顺序和请求一致
+        size_t pos = 0;
+        for(int j = 0; j < n && ok; ++j) {
+            size_t p = got.find("#" + std::to_string(i + j) + ";", pos);
+            ok = p != std::string::npos;
+            pos = p;
+        }
+    }
+    uint64_t us = sylar::GetCurrentUS() - t0;
+    sock->close();
+    server->stop();
+    SYLAR_LOG_INFO(g_logger) << "pipeline depth=" << depth << " requests=" << total
+        << " req/s=" << (uint64_t)(total * 1e6 / (us + 1)) << " in_order=" << ok;
+}
+
+int main(int argc, char** argv) {
+    int total = argc > 1 ? atoi(argv[1]) : 20000;
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::IOManager iom(1, true, "pipeline");
+    iom.schedule([total](){
+        test_session();
+        for(int depth : {1, 4, 16, 64}) {
+            bench(total, depth);
+        }
+    });
+    return 0;
+}
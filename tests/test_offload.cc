@@ -0,0 +1,134 @@
+#include "webserve/offload.h"
+#include "webserve/address.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sstream>
+
+// 测试卸载线程池：阻塞调用期间 IO 线程照常运行，返回值、超时、取消、队列满和运行指标
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 一个工作线程，最多排队两个任务，方便构造排队和拒绝的场景
+static sylar::OffloadPool s_pool(1, 2, "test_offload");
+
+// 工作线程里阻塞 200ms，同一个 IO 线程上的定时器应该照常触发
+void test_blocking() {
+    int ticks = 0;
+    sylar::Timer::ptr timer = sylar::IOManager::GetThis()->addTimer(20, [&ticks](){
+        ++ticks;
+    }, true);
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = s_pool.run([](){
+        usleep(200 * 1000);
+    });
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    timer->cancel();
+    SYLAR_LOG_INFO(g_logger) << "blocking rt=" << rt << " used_ms=" << used << " ticks=" << ticks;
+    SYLAR_ASSERT2(rt == 0 && used >= 200 && ticks >= 5, "io thread not blocked");
+}
+
+void test_call() {
+    struct stat st;
+    int rt = 0;
+    int err = s_pool.call<int>(rt, [&st](){
+        return stat("/", &st);
+    });
+    SYLAR_ASSERT2(err == 0 && rt == 0 && S_ISDIR(st.st_mode), "call stat");
+
+    std::string value;
+    err = s_pool.call<std::string>(value, [](){
+        return std::string("hello");
+    });
+    SYLAR_ASSERT2(err == 0 && value == "hello", "call string");
+}
+
+void test_timeout() {
+    uint64_t start = sylar::GetMonotonicMS();
+    int rt = s_pool.run([](){
+        usleep(300 * 1000);
+    }, 100);
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "timeout rt=" << rt << " used_ms=" << used;
+    SYLAR_ASSERT2(rt == ETIMEDOUT && used >= 90 && used < 250, "timeout");
+
+    // 等前一个任务跑完，不影响后面的测试
+    s_pool.run([](){});
+}
+
+void test_cancel() {
+    // 第一个任务占住唯一的工作线程，第二个任务在排队时被取消
+    auto busy = s_pool.submit([](){
+        usleep(100 * 1000);
+    });
+    bool ran = false;
+    auto task = s_pool.submit([&ran](){
+        ran = true;
+    });
+    sylar::IOManager::GetThis()->addTimer(20, [task](){
+        task->cancel();
+    });
+    int rt = s_pool.wait(task);
+    SYLAR_ASSERT2(rt == ECANCELED, "cancel");
+    rt = s_pool.wait(busy);
+    SYLAR_ASSERT2(rt == 0 && !ran
+            && task->getState() == sylar::OffloadPool::Task::CANCELLED, "cancelled task skipped");
+}
+
+void test_reject() {
+    auto busy = s_pool.submit([](){
+        usleep(50 * 1000);
+    });
+    // 等工作线程把 busy 取走，再把队列排满
+    usleep(10 * 1000);
+    auto t1 = s_pool.submit([](){});
+    auto t2 = s_pool.submit([](){});
+    int rt = s_pool.run([](){});
+    SYLAR_ASSERT2(busy && t1 && t2 && rt == EAGAIN, "queue full");
+    s_pool.wait(busy);
+    s_pool.wait(t1);
+    s_pool.wait(t2);
+}
+
+// Address::Lookup 的 getaddrinfo 回退走全局线程池
+void test_lookup() {
+    auto addr = sylar::Address::LookupAny("localhost:http");
+    SYLAR_ASSERT2(addr && sylar::OffloadMgr::GetInstance()->getStats().completed == 1, "Address::Lookup offload");
+}
+
+void test_stats() {
+    sylar::OffloadPool::Stats s = s_pool.getStats();
+    std::stringstream ss;
+    s_pool.dump(ss);
+    SYLAR_LOG_INFO(g_logger) << ss.str();
+    SYLAR_ASSERT2(s.queued == 0 && s.running == 0 && s.timeouts == 1
+            && s.cancelled == 1 && s.rejected == 1 && s.completed == s.submitted - 1, "stats");
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    {
+        sylar::IOManager iom(1, false);
+        iom.schedule([](){
+            test_blocking();
+            test_call();
+            test_timeout();
+            test_cancel();
+            test_reject();
+            test_lookup();
+            test_stats();
+        });
+    }
+
+    // 不在协程里时阻塞等待
+    int value = 0;
+    int err = s_pool.call<int>(value, [](){
+        return 42;
+    });
+    SYLAR_ASSERT2(err == 0 && value == 42, "call outside fiber");
+    return 0;
+}
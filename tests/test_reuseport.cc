@@ -0,0 +1,115 @@
+#include "webserve/tcp_server.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include <map>
+
+// 建连速率基准：单个监听 socket + 单个 accept 协程，对比每个线程一个 SO_REUSEPORT 监听 socket
+// 用法: test_reuseport [服务端线程数] [客户端线程数] [每轮秒数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 只统计连接数和处理连接的线程，收到就关
+class CountServer : public sylar::TcpServer {
+public:
+    typedef std::shared_ptr<CountServer> ptr;
+
+    CountServer(sylar::IOManager* worker)
+        :sylar::TcpServer(worker, worker, worker) {
+    }
+
+    uint64_t getCount() const { return m_count;}
+
+    std::map<int, uint64_t> getThreads() {
+        sylar::Mutex::Lock lock(m_mutex);
+        return m_threads;
+    }
+
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        ++m_count;
+        {
+            sylar::Mutex::Lock lock(m_mutex);
+            ++m_threads[sylar::GetThreadId()];
+        }
+        client->close();
+    }
+
+private:
+    std::atomic<uint64_t> m_count = {0};
+    sylar::Mutex m_mutex;
+    std::map<int, uint64_t> m_threads;
+};
+
+static void bench(int reuseport, int server_threads, int client_threads, int seconds) {
+    sylar::IOManager server(server_threads, false, "server");
+    CountServer::ptr tcp(new CountServer(&server));
+    tcp->setReusePort(reuseport);
+    // 监听 socket 要在开启了 hook 的线程里创建，才会被设置成非阻塞
+    sylar::Address::ptr addr;
+    size_t listeners = 0;
+    sylar::Semaphore sem;
+    server.schedule([tcp, &addr, &listeners, &sem](){
+        if(tcp->bind(sylar::Address::LookupAny("127.0.0.1:0"))) {
+            addr = tcp->getSocks()[0]->getLocalAddress();
+            listeners = tcp->getSocks().size();
+            tcp->start();
+        }
+        sem.notify();
+    });
+    sem.wait();
+    if(!addr) {
+        SYLAR_LOG_ERROR(g_logger) << "bind fail";
+        return;
+    }
+
+    uint64_t start = sylar::GetMonotonicMS();
+    uint64_t end = start + seconds * 1000;
+    std::atomic<uint64_t> fails = {0};
+    {
+        sylar::IOManager client(client_threads, false, "client");
+        // 每个客户端线程跑几个协程不停地建连、立即关闭
+        for(int i = 0; i < client_threads * 8; ++i) {
+            client.schedule([addr, end, &fails](){
+                while(sylar::GetMonotonicMS() < end) {
+                    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+                    if(!sock->connect(addr)) {
+                        ++fails;
+                        continue;
+                    }
+                    // RST 关闭，避免客户端端口被 TIME_WAIT 占满
+                    struct linger lg = {1, 0};
+                    sock->setOption(SOL_SOCKET, SO_LINGER, lg);
+                    sock->close();
+                }
+            });
+        }
+    }
+    uint64_t used = sylar::GetMonotonicMS() - start;
+    // 等服务端把已经 accept 的连接处理完
+    usleep(100 * 1000);
+    tcp->stop();
+
+    std::stringstream ss;
+    for(auto& i : tcp->getThreads()) {
+        ss << " " << i.first << ":" << i.second;
+    }
+    SYLAR_LOG_INFO(g_logger) << "reuseport=" << reuseport
+        << " listeners=" << listeners
+        << " server_threads=" << server_threads
+        << " client_threads=" << client_threads
+        << " conns=" << tcp->getCount()
+        << " conn/s=" << tcp->getCount() * 1000 / (used ? used : 1)
+        << " connect_fails=" << fails
+        << " per_thread=[" << ss.str() << " ]";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    int server_threads = argc > 1 ? atoi(argv[1]) : 4;
+    int client_threads = argc > 2 ? atoi(argv[2]) : 2;
+    int seconds = argc > 3 ? atoi(argv[3]) : 1;
+    bench(0, server_threads, client_threads, seconds);
+    bench(-1, server_threads, client_threads, seconds);
+    return 0;
+}
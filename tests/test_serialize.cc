@@ -0,0 +1,344 @@
+#include "webserve/serialize.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+
+// 测试 SYLAR_SCHEMA 生成的编解码：和手写 ByteArray 代码的格式一致、两种字节序、跨节点、
+// 可选字段和新旧版本互相解码、截断和损坏的数据，以及和手写代码的性能对比
+// 用法: test_serialize [条数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+struct Order {
+    uint64_t id = 0;
+    int32_t qty = 0;
+    double price = 0;
+    bool paid = false;
+    uint32_t user = 0;
+    int64_t delta = 0;
+    std::string symbol;
+    std::string note;
+    sylar::Optional<std::string> coupon;
+    sylar::Optional<int32_t> discount;
+    sylar::Optional<double> rate;
+};
+
+// 声明顺序和数据顺序无关，定长字段总是在前面
+SYLAR_SCHEMA(Order,
+    SYLAR_FIELD(1, id),
+    SYLAR_FIELD(2, qty),
+    SYLAR_FIELD(3, symbol),
+    SYLAR_FIELD(4, price),
+    SYLAR_FIELD(5, paid),
+    SYLAR_FIELD_VARINT(6, user),
+    SYLAR_FIELD_VARINT(7, delta),
+    SYLAR_FIELD(8, note),
+    SYLAR_FIELD(9, coupon),
+    SYLAR_FIELD_VARINT(10, discount),
+    SYLAR_FIELD(11, rate));
+
+// 旧版本：没有 rate，多一个新版本不认识的 flags
+struct OrderV1 {
+    uint64_t id = 0;
+    int32_t qty = 0;
+    double price = 0;
+    bool paid = false;
+    uint32_t user = 0;
+    int64_t delta = 0;
+    std::string symbol;
+    std::string note;
+    sylar::Optional<std::string> coupon;
+    sylar::Optional<int32_t> discount;
+    sylar::Optional<uint16_t> flags;
+};
+
+SYLAR_SCHEMA(OrderV1,
+    SYLAR_FIELD(1, id),
+    SYLAR_FIELD(2, qty),
+    SYLAR_FIELD(3, symbol),
+    SYLAR_FIELD(4, price),
+    SYLAR_FIELD(5, paid),
+    SYLAR_FIELD_VARINT(6, user),
+    SYLAR_FIELD_VARINT(7, delta),
+    SYLAR_FIELD(8, note),
+    SYLAR_FIELD(9, coupon),
+    SYLAR_FIELD_VARINT(10, discount),
+    SYLAR_FIELD(12, flags));
+
+typedef sylar::Serializer<Order> OrderSerializer;
+static_assert(OrderSerializer::kFixedSize == 8 + 4 + 8 + 1, "fixed prefix");
+
+static Order make_order(int i) {
+    Order o;
+    o.id = 1000000 + i;
+    o.qty = i % 100 - 50;
+    o.price = (i % 10000) / 100.0;
+    o.paid = i % 3 == 0;
+    o.user = i * 37 % 100000;
+    o.delta = -(int64_t)i * 1000;
+    o.symbol = "SYM" + std::to_string(i % 500);
+    o.note = i % 5 ? "" : "note-" + std::to_string(i);
+    if(i % 2) {
+        o.coupon = "C" + std::to_string(i);
+    }
+    if(i % 4 == 1) {
+        o.discount = -(i % 30);
+    }
+    if(i % 7 == 0) {
+        o.rate = 0.5;
+    }
+    return o;
+}
+
+static bool same(const Order& a, const Order& b) {
+    return a.id == b.id && a.qty == b.qty && a.price == b.price && a.paid == b.paid
+        && a.user == b.user && a.delta == b.delta && a.symbol == b.symbol && a.note == b.note
+        && a.coupon.has() == b.coupon.has() && *a.coupon == *b.coupon
+        && a.discount.has() == b.discount.has() && *a.discount == *b.discount
+        && a.rate.has() == b.rate.has() && *a.rate == *b.rate;
+}
+
+// 手写的同样格式
+static void write_hand(const Order& o, sylar::ByteArray& ba) {
+    ba.writeFuint64(o.id);
+    ba.writeFint32(o.qty);
+    ba.writeDouble(o.price);
+    ba.writeFuint8(o.paid);
+    ba.writeStringVint(o.symbol);
+    ba.writeUint32(o.user);
+    ba.writeInt64(o.delta);
+    ba.writeStringVint(o.note);
+    if(o.coupon) {
+        ba.writeUint32(9 << 3 | sylar::schema::WIRE_BYTES);
+        ba.writeStringVint(*o.coupon);
+    }
+    if(o.discount) {
+        ba.writeUint32(10 << 3 | sylar::schema::WIRE_VARINT);
+        ba.writeInt32(*o.discount);
+    }
+    if(o.rate) {
+        ba.writeUint32(11 << 3 | sylar::schema::WIRE_FIXED64);
+        ba.writeDouble(*o.rate);
+    }
+    ba.writeUint32(0);
+}
+
+static bool read_hand(Order& o, sylar::ByteArray& ba) {
+    o.id = ba.readFuint64();
+    o.qty = ba.readFint32();
+    o.price = ba.readDouble();
+    o.paid = ba.readFuint8();
+    o.symbol = ba.readStringVint();
+    o.user = ba.readUint32();
+    o.delta = ba.readInt64();
+    o.note = ba.readStringVint();
+    o.coupon.reset();
+    o.discount.reset();
+    o.rate.reset();
+    while(uint32_t key = ba.readUint32()) {
+        switch(key >> 3) {
+            case 9:
+                o.coupon = ba.readStringVint();
+                break;
+            case 10:
+                o.discount = ba.readInt32();
+                break;
+            case 11:
+                o.rate = ba.readDouble();
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+void test_format() {
+    bool ok = true;
+    for(int i = 0; i < 100 && ok; ++i) {
+        Order o = make_order(i);
+        for(int le = 0; le < 2; ++le) {
+            sylar::ByteArray a, b;
+            a.setIsLittleEndian(le);
+            b.setIsLittleEndian(le);
+            write_hand(o, a);
+            OrderSerializer::Encode(o, b);
+            a.setPosition(0);
+            b.setPosition(0);
+            ok = ok && a.toString() == b.toString();
+        }
+    }
+    SYLAR_ASSERT2(ok, "same as hand written");
+
+    Order o = make_order(7);
+    std::vector<char> buf(OrderSerializer::MaxSize(o));
+    size_t n = OrderSerializer::Encode(o, &buf[0], buf.size());
+    Order d;
+    SYLAR_ASSERT2(n > 0 && OrderSerializer::Decode(d, &buf[0], n) == (int64_t)n && same(o, d), "span roundtrip");
+    SYLAR_ASSERT2(OrderSerializer::Encode(o, &buf[0], buf.size() - 1) == 0, "span too small");
+    n = OrderSerializer::Encode(o, &buf[0], buf.size(), true);
+    SYLAR_ASSERT2(OrderSerializer::Decode(d, &buf[0], n, true) == (int64_t)n && same(o, d), "span little endian");
+}
+
+void test_bytearray() {
+    // 小节点，大部分消息跨节点
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(64));
+    ba->setIsLittleEndian(true);
+    for(int i = 0; i < 1000; ++i) {
+        OrderSerializer::Encode(make_order(i), *ba);
+    }
+    ba->setPosition(0);
+    bool ok = true;
+    for(int i = 0; i < 1000 && ok; ++i) {
+        Order d;
+        ok = OrderSerializer::Decode(d, *ba) && same(d, make_order(i));
+    }
+    SYLAR_ASSERT2(ok && ba->getReadSize() == 0, "bytearray roundtrip");
+
+    // 在已有数据中间覆盖写
+    size_t size = ba->getSize();
+    ba->setPosition(0);
+    Order o = make_order(0);
+    OrderSerializer::Encode(o, *ba);
+    ba->setPosition(0);
+    Order d;
+    ok = OrderSerializer::Decode(d, *ba);
+    SYLAR_ASSERT2(ok && same(o, d) && ba->getSize() == size, "bytearray overwrite");
+
+    // 截断的数据解码失败，position 不变
+    sylar::ByteArray::ptr part(new sylar::ByteArray(16));
+    o = make_order(1);
+    OrderSerializer::Encode(o, *part);
+    size = part->getSize();
+    ok = true;
+    for(size_t len = 0; len < size && ok; ++len) {
+        sylar::ByteArray::ptr t(new sylar::ByteArray(16));
+        part->setPosition(0);
+        std::vector<char> tmp(size);
+        part->read(&tmp[0], size);
+        t->write(&tmp[0], len);
+        t->setPosition(0);
+        ok = !OrderSerializer::Decode(d, *t) && t->getPosition() == 0
+            && OrderSerializer::Decode(d, &tmp[0], len) == -1;
+    }
+    SYLAR_ASSERT2(ok, "truncated");
+}
+
+void test_optional() {
+    Order o = make_order(7);
+    o.coupon = "new";
+    o.discount = -3;
+    o.rate = 0.25;
+    std::vector<char> buf(OrderSerializer::MaxSize(o));
+    size_t n = OrderSerializer::Encode(o, &buf[0], buf.size());
+
+    // 旧版本跳过不认识的 rate
+    OrderV1 v1;
+    v1.flags = 9;
+    int64_t rt = sylar::Serializer<OrderV1>::Decode(v1, &buf[0], n);
+    SYLAR_ASSERT2(rt == (int64_t)n && v1.id == o.id && v1.symbol == o.symbol
+            && *v1.coupon == "new" && *v1.discount == -3 && !v1.flags, "old reads new");
+
+    // 新版本跳过不认识的 flags，没有的可选字段是空的
+    v1.flags = 0xbeef;
+    v1.coupon.reset();
+    std::vector<char> buf1(sylar::Serializer<OrderV1>::MaxSize(v1));
+    n = sylar::Serializer<OrderV1>::Encode(v1, &buf1[0], buf1.size());
+    Order d = o;
+    rt = OrderSerializer::Decode(d, &buf1[0], n);
+    SYLAR_ASSERT2(rt == (int64_t)n && d.id == o.id && !d.coupon && !d.rate
+            && *d.discount == -3, "new reads old");
+
+    // 可选字段的类型不对
+    std::string bad(&buf1[0], n);
+    bad[n - 4] = 10 << 3 | sylar::schema::WIRE_FIXED16;
+    Order e;
+    SYLAR_ASSERT2(OrderSerializer::Decode(e, bad.c_str(), bad.size()) == -1, "wrong wire type");
+}
+
+void test_fuzz() {
+    Order o = make_order(21);
+    std::vector<char> buf(OrderSerializer::MaxSize(o));
+    size_t n = OrderSerializer::Encode(o, &buf[0], buf.size());
+    int bad = 0;
+    for(int i = 0; i < 20000; ++i) {
+        std::vector<char> b(buf.begin(), buf.begin() + n);
+        for(int j = 0; j < 1 + i % 3; ++j) {
+            b[rand() % n] = rand();
+        }
+        Order d;
+        int64_t rt = OrderSerializer::Decode(d, &b[0], n);
+        bad += rt < 0;
+        sylar::ByteArray ba(8);
+        ba.write(&b[0], n);
+        ba.setPosition(0);
+        bool ok = OrderSerializer::Decode(d, ba);
+        if(ok != (rt >= 0) || (ok && ba.getPosition() != (size_t)rt)) {
+            bad = -1000000;
+        }
+    }
+    SYLAR_ASSERT2(bad > 0, "fuzz");
+}
+
+#define XX(name, code) { \
+    uint64_t t0 = sylar::GetCurrentUS(); \
+    for(int r = 0; r < rounds; ++r) { \
+        code; \
+    } \
+    uint64_t us = sylar::GetCurrentUS() - t0; \
+    SYLAR_LOG_INFO(g_logger) << name << ": " << us * 1000 / rounds / count << " ns/msg"; \
+}
+
+void bench(int count) {
+    const int rounds = 10;
+    std::vector<Order> orders;
+    for(int i = 0; i < count; ++i) {
+        orders.push_back(make_order(i));
+    }
+    sylar::ByteArray::ptr hand(new sylar::ByteArray);
+    sylar::ByteArray::ptr gen(new sylar::ByteArray);
+    std::vector<Order> out(count);
+    bool ok = true;
+
+    XX("encode hand written", {
+        hand->clear();
+        for(auto& o : orders) {
+            write_hand(o, *hand);
+        }
+    });
+    XX("encode schema", {
+        gen->clear();
+        for(auto& o : orders) {
+            OrderSerializer::Encode(o, *gen);
+        }
+    });
+    XX("decode hand written", {
+        hand->setPosition(0);
+        for(auto& o : out) {
+            ok = read_hand(o, *hand) && ok;
+        }
+    });
+    XX("decode schema", {
+        gen->setPosition(0);
+        for(auto& o : out) {
+            ok = OrderSerializer::Decode(o, *gen) && ok;
+        }
+    });
+    for(int i = 0; i < count; ++i) {
+        ok = ok && same(out[i], orders[i]);
+    }
+    hand->setPosition(0);
+    gen->setPosition(0);
+    SYLAR_ASSERT2(ok && hand->toString() == gen->toString(), "bench same");
+}
+#undef XX
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    test_format();
+    test_bytearray();
+    test_optional();
+    test_fuzz();
+    bench(count);
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "webserve/bytearray.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+
+// 测试 ByteArray 内存块池和 Slice：切分消息不拷贝、原数组被改写后 Slice 内容不变、
+// Slice 接到另一个 ByteArray 上不拷贝，以及切分消息时 read 拷贝和 readSlice 的耗时对比
+// 用法: test_slice [轮数]，分别测 1KB 和 16KB 的消息
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 释放的节点回到线程的池里，再分配时复用
+void test_pool() {
+    size_t free0 = sylar::BufferBlock::GetPoolFreeBytes();
+    {
+        sylar::ByteArray ba(4096);
+        std::string data(4096 * 8, 'p');
+        ba.write(data.c_str(), data.size());
+    }
+    size_t free1 = sylar::BufferBlock::GetPoolFreeBytes();
+    {
+        sylar::ByteArray ba(4096);
+        std::string data(4096 * 8, 'q');
+        ba.write(data.c_str(), data.size());
+        SYLAR_ASSERT2(free1 >= free0 + 4096 * 8
+                && sylar::BufferBlock::GetPoolFreeBytes() + 4096 * 8 <= free1, "pool reuse");
+    }
+}
+
+// 一块接收缓冲区里有多条长度前缀的消息，切成 Slice 后原缓冲区清空重用
+void test_split() {
+    sylar::ByteArray ba(64);
+    std::vector<std::string> msgs;
+    for(int i = 0; i < 5; ++i) {
+        msgs.push_back(std::string(30 + i * 40, 'a' + i));
+        ba.writeFuint32(msgs.back().size());
+        ba.write(msgs.back().c_str(), msgs.back().size());
+    }
+    ba.setPosition(0);
+    std::vector<sylar::Slice> slices;
+    while(ba.getReadSize() > 0) {
+        uint32_t len = ba.readFuint32();
+        slices.push_back(ba.readSlice(len));
+    }
+    bool same = slices.size() == msgs.size();
+    for(size_t i = 0; same && i < msgs.size(); ++i) {
+        same = slices[i].toString() == msgs[i];
+    }
+    SYLAR_ASSERT2(same, "split");
+
+    // 切出去的数据被冻结，清空后原地重写时先复制节点
+    ba.clear();
+    std::string junk(ba.getBaseSize() * 8, 'z');
+    ba.write(junk.c_str(), junk.size());
+    for(size_t i = 0; same && i < msgs.size(); ++i) {
+        same = slices[i].toString() == msgs[i];
+    }
+    ba.setPosition(0);
+    SYLAR_ASSERT2(same && ba.toString() == junk, "copy on write");
+
+    SYLAR_ASSERT2(slices[4].sub(10, 20).toString() == msgs[4].substr(10, 20)
+            && slices[4].sub(0, slices[4].size()).getPieces().size() == slices[4].getPieces().size(), "sub");
+}
+
+// 在切出去的数据后面继续追加不会触发复制
+void test_append_after_slice() {
+    sylar::ByteArray ba(4096);
+    ba.write("hello", 5);
+    sylar::Slice s = ba.slice(5, 0);
+    ba.write(" world", 6);
+    std::vector<iovec> iovs;
+    ba.getReadBuffers(iovs, ~0ull, 0);
+    SYLAR_ASSERT2(iovs.size() == 1
+            && iovs[0].iov_base == s.getPieces()[0].ptr
+            && ba.slice(11, 0).toString() == "hello world" && s.toString() == "hello", "append after slice");
+}
+
+// 缓存的响应体接到响应头后面，不拷贝
+void test_write_slice() {
+    std::string body_data(10000, 'b');
+    for(size_t i = 0; i < body_data.size(); ++i) {
+        body_data[i] = 'a' + i % 26;
+    }
+    sylar::ByteArray cache(4096);
+    cache.write(body_data.c_str(), body_data.size());
+    sylar::Slice body = cache.slice(body_data.size(), 0);
+
+    sylar::ByteArray rsp(4096);
+    std::string head = "HTTP/1.1 200 OK\r\ncontent-length: 10000\r\n\r\n";
+    rsp.write(head.c_str(), head.size());
+    rsp.write(body);
+    rsp.write("\r\n", 2);
+    rsp.setPosition(0);
+    SYLAR_ASSERT2(rsp.toString() == head + body_data + "\r\n", "write slice");
+
+    // 响应头之后的内存就是缓存里的内存
+    std::vector<iovec> iovs;
+    rsp.getReadBuffers(iovs, ~0ull, 0);
+    SYLAR_ASSERT2(iovs.size() >= 2
+            && iovs[1].iov_base == body.getPieces()[0].ptr, "write slice zero copy");
+
+    // 响应在中间被改写时复制，不影响缓存
+    rsp.setPosition(head.size());
+    rsp.write("XXXX", 4);
+    rsp.setPosition(0);
+    cache.setPosition(0);
+    SYLAR_ASSERT2(cache.toString() == body_data
+            && rsp.toString().substr(head.size(), 4) == "XXXX", "write slice cow");
+
+    // 清空后重新写入
+    rsp.clear();
+    rsp.write(body);
+    rsp.clear();
+    rsp.write(head.c_str(), head.size());
+    rsp.setPosition(0);
+    SYLAR_ASSERT2(rsp.toString() == head && cache.toString() == body_data, "clear after slice");
+
+    // 小的 Slice 直接拷贝
+    sylar::ByteArray small(4096);
+    small.write("abc", 3);
+    small.write(sylar::Slice("defg", 4));
+    small.setPosition(0);
+    SYLAR_ASSERT2(small.toString() == "abcdefg", "small slice");
+}
+
+void bench(int rounds, size_t s_msg) {
+    static const size_t s_count = 256;
+    sylar::ByteArray ba(64 * 1024);
+    std::string msg(s_msg, 'm');
+    for(size_t i = 0; i < s_count; ++i) {
+        ba.write(msg.c_str(), msg.size());
+    }
+
+    uint64_t t0 = sylar::GetCurrentUS();
+    size_t total = 0;
+    for(int r = 0; r < rounds; ++r) {
+        ba.setPosition(0);
+        for(size_t i = 0; i < s_count; ++i) {
+            std::string out(s_msg, '\0');
+            ba.read(&out[0], s_msg);
+            total += out.size();
+        }
+    }
+    uint64_t t1 = sylar::GetCurrentUS();
+    for(int r = 0; r < rounds; ++r) {
+        ba.setPosition(0);
+        for(size_t i = 0; i < s_count; ++i) {
+            sylar::Slice out = ba.readSlice(s_msg);
+            total += out.size();
+        }
+    }
+    uint64_t t2 = sylar::GetCurrentUS();
+    uint64_t msgs = rounds * s_count;
+    SYLAR_LOG_INFO(g_logger) << "split " << msgs << " msgs of " << s_msg << "B:"
+        << " read copy ns/msg=" << (t1 - t0) * 1000.0 / msgs
+        << " readSlice ns/msg=" << (t2 - t1) * 1000.0 / msgs
+        << " total=" << total;
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    test_pool();
+    test_split();
+    test_append_after_slice();
+    test_write_slice();
+    bench(rounds, 1024);
+    bench(rounds, 16 * 1024);
+    return 0;
+}
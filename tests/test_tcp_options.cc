@@ -0,0 +1,111 @@
+#include "webserve/tcp_server.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+
+// 测试 TcpServerConf 里的 TCP 参数：YAML 解析、监听 socket 上的设置、
+// accept 出来的连接继承这些设置，以及 TCP_DEFER_ACCEPT 在有数据之前不唤醒 accept
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int get_int(sylar::Socket::ptr sock, int level, int option) {
+    int value = -1;
+    sock->getOption(level, option, value);
+    return value;
+}
+
+// 把收到的连接留着，方便检查
+class HoldServer : public sylar::TcpServer {
+public:
+    typedef std::shared_ptr<HoldServer> ptr;
+
+    std::vector<sylar::Socket::ptr> getClients() {
+        sylar::Mutex::Lock lock(m_mutex);
+        return m_clients;
+    }
+
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        sylar::Mutex::Lock lock(m_mutex);
+        m_clients.push_back(client);
+    }
+
+private:
+    sylar::Mutex m_mutex;
+    std::vector<sylar::Socket::ptr> m_clients;
+};
+
+static const char* s_yaml =
+    "address: [\"127.0.0.1:0\"]\n"
+    "backlog: 128\n"
+    "nodelay: 0\n"
+    "defer_accept: 5\n"
+    "fastopen: 16\n"
+    "rcvbuf: 65536\n"
+    "sndbuf: 131072\n"
+    "user_timeout: 3000\n";
+
+void test_conf() {
+    sylar::TcpServerConf conf = sylar::LexicalCast<std::string, sylar::TcpServerConf>()(s_yaml);
+    SYLAR_ASSERT2(conf.backlog == 128 && conf.nodelay == 0 && conf.defer_accept == 5
+            && conf.fastopen == 16 && conf.rcvbuf == 65536 && conf.sndbuf == 131072
+            && conf.user_timeout == 3000 && conf.busy_poll == 0, "parse");
+    std::string str = sylar::LexicalCast<sylar::TcpServerConf, std::string>()(conf);
+    sylar::TcpServerConf back = sylar::LexicalCast<std::string, sylar::TcpServerConf>()(str);
+    SYLAR_ASSERT2(back == conf, "round trip");
+}
+
+void test_server() {
+    HoldServer::ptr server(new HoldServer);
+    server->setConf(sylar::LexicalCast<std::string, sylar::TcpServerConf>()(s_yaml));
+    bool ok = server->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+    SYLAR_ASSERT2(ok, "bind");
+    server->start();
+    SYLAR_LOG_INFO(g_logger) << server->toString();
+
+    // 内核把 SO_RCVBUF/SO_SNDBUF 翻倍保存，TCP_DEFER_ACCEPT 换算成重传次数后再取回会向上取整
+    sylar::Socket::ptr sock = server->getSocks()[0];
+    SYLAR_ASSERT2(get_int(sock, IPPROTO_TCP, TCP_NODELAY) == 0
+            && get_int(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT) >= 5
+            && get_int(sock, IPPROTO_TCP, TCP_FASTOPEN) == 16
+            && get_int(sock, SOL_SOCKET, SO_RCVBUF) == 65536 * 2
+            && get_int(sock, SOL_SOCKET, SO_SNDBUF) == 131072 * 2
+            && get_int(sock, IPPROTO_TCP, TCP_USER_TIMEOUT) == 3000, "listen options");
+
+    // 只建连不发数据，TCP_DEFER_ACCEPT 下连接不会被 accept
+    sylar::Address::ptr addr = sock->getLocalAddress();
+    sylar::Socket::ptr client = sylar::Socket::CreateTCP(addr);
+    client->connect(addr);
+    usleep(200 * 1000);
+    SYLAR_ASSERT2(server->getClients().empty(), "defer accept idle");
+
+    // 数据到达后马上完成 accept
+    client->send("hello", 5);
+    for(int i = 0; i < 100 && server->getClients().empty(); ++i) {
+        usleep(10 * 1000);
+    }
+    auto clients = server->getClients();
+    SYLAR_ASSERT2(clients.size() == 1, "defer accept data");
+    if(clients.empty()) {
+        return;
+    }
+
+    // accept 出来的连接继承监听 socket 的设置
+    sylar::Socket::ptr conn = clients[0];
+    SYLAR_ASSERT2(get_int(conn, IPPROTO_TCP, TCP_NODELAY) == 0
+            && get_int(conn, SOL_SOCKET, SO_RCVBUF) == 65536 * 2
+            && get_int(conn, SOL_SOCKET, SO_SNDBUF) == 131072 * 2
+            && get_int(conn, IPPROTO_TCP, TCP_USER_TIMEOUT) == 3000, "accepted options");
+    char buf[5];
+    int rt = conn->recv(buf, 5);
+    SYLAR_ASSERT2(rt == 5 && memcmp(buf, "hello", 5) == 0, "accepted data");
+    server->stop();
+}
+
+int main(int argc, char** argv) {
+    test_conf();
+    sylar::IOManager iom(1, false);
+    iom.schedule(test_server);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "webserve/hook.h"
+#include "webserve/log.h"
+#include "webserve/iomanager.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <unistd.h>
+#include <time.h>
+
+// 测试微秒精度定时器：hook 之后的 usleep/nanosleep 不再截断到毫秒
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 连续 usleep(500)，统计平均每次实际睡了多久
+void test_usleep() {
+    static const int s_loops = 1000;
+    uint64_t start = sylar::GetMonotonicUS();
+    for(int i = 0; i < s_loops; ++i) {
+        usleep(500);
+    }
+    uint64_t used = sylar::GetMonotonicUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "usleep(500) x " << s_loops
+        << " avg_us=" << (double)used / s_loops;
+    // 截断到毫秒的话要么不睡，要么至少睡 1ms
+    SYLAR_ASSERT2(used >= 500 * s_loops && used < 1000 * s_loops
+            ,"usleep(500) avg_us=" << (double)used / s_loops);
+}
+
+void test_nanosleep() {
+    struct timespec req{0, 200 * 1000};
+    uint64_t start = sylar::GetMonotonicUS();
+    int rt = nanosleep(&req, nullptr);
+    uint64_t used = sylar::GetMonotonicUS() - start;
+    SYLAR_LOG_INFO(g_logger) << "nanosleep(200us) used_us=" << used;
+    SYLAR_ASSERT2(rt == 0 && used >= 200 && used < 1000, "nanosleep(200us) used_us=" << used);
+}
+
+// 250us 的循环定时器跑 100ms，理想情况下触发 400 次
+void test_recurring() {
+    static int s_count = 0;
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    sylar::Timer::ptr timer = iom->addTimerUS(250, [](){
+        ++s_count;
+    }, true);
+    usleep(100 * 1000);
+    timer->cancel();
+    SYLAR_LOG_INFO(g_logger) << "recurring 250us timer fired " << s_count
+        << " times in 100ms";
+    // 按毫秒触发的话最多 100 次；按固定节奏推进，不会超过 400 次太多
+    SYLAR_ASSERT2(s_count > 150 && s_count <= 410, "recurring 250us count=" << s_count);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::IOManager iom(1, false);
+    iom.schedule([](){
+        test_usleep();
+        test_nanosleep();
+        test_recurring();
+    });
+    return 0;
+}
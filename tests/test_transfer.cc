@@ -0,0 +1,239 @@
+#include "webserve/streams/socket_stream.h"
+#include "webserve/streams/buffered_stream.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// 测试 Stream::transferFrom：普通文件(sendfile)、管道和 socket(splice)、偏移和文件位置、
+// 发送超时、退回拷贝的默认实现，以及和 pread + write 的吞吐、CPU 时间对比
+// 用法: test_transfer [文件MB数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char* s_path = "/tmp/sylar_test_transfer.dat";
+
+static std::string make_data(size_t size) {
+    std::string data(size, 0);
+    for(size_t i = 0; i < size; ++i) {
+        data[i] = i * 31 + i / 4099;
+    }
+    return data;
+}
+
+static void write_file(const std::string& data) {
+    int fd = open(s_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    write(fd, data.c_str(), data.size());
+    close(fd);
+}
+
+// 一对连接：a 端包成 SocketStream 发送，b 端在另一个协程里收到关闭为止
+struct Pair {
+    sylar::SocketStream::ptr stream;
+    std::shared_ptr<std::string> received;
+    std::shared_ptr<bool> done;
+};
+
+static Pair make_pair() {
+    sylar::Socket::ptr a, b;
+    sylar::Socket::CreateUnixPair(a, b);
+    Pair p;
+    p.stream.reset(new sylar::SocketStream(a));
+    p.received.reset(new std::string);
+    p.done.reset(new bool(false));
+    auto received = p.received;
+    auto done = p.done;
+    sylar::IOManager::GetThis()->schedule([b, received, done](){
+        // 协程栈不大，缓冲区放在堆上
+        std::vector<char> buf(64 * 1024);
+        int rt;
+        while((rt = b->recv(&buf[0], buf.size())) > 0) {
+            received->append(&buf[0], rt);
+        }
+        b->close();
+        *done = true;
+    });
+    return p;
+}
+
+// 关闭发送端，等对端收完
+static std::string finish(Pair& p) {
+    p.stream->close();
+    while(!*p.done) {
+        usleep(1000);
+    }
+    return *p.received;
+}
+
+// 只收集数据的流，用来测试默认实现
+class StringStream : public sylar::Stream {
+public:
+    int read(void*, size_t) override { return 0;}
+    int read(sylar::ByteArray::ptr, size_t) override { return 0;}
+    int write(const void* buffer, size_t length) override {
+        data.append((const char*)buffer, std::min(length, (size_t)1000));
+        return std::min(length, (size_t)1000);
+    }
+    int write(sylar::ByteArray::ptr ba, size_t length) override {
+        std::string tmp(length, 0);
+        ba->read(&tmp[0], length);
+        data += tmp;
+        return length;
+    }
+    void close() override {}
+    std::string data;
+};
+
+void test_file() {
+    std::string data = make_data(3 * 1024 * 1024 + 123);
+    write_file(data);
+    int fd = open(s_path, O_RDONLY);
+
+    Pair p = make_pair();
+    int64_t a = p.stream->transferFrom(fd, 0, data.size());
+    int64_t b = p.stream->transferFrom(fd, 1000, 5000);
+    // 超过文件末尾时只传到末尾
+    int64_t c = p.stream->transferFrom(fd, data.size() - 10, 100);
+    int64_t d = p.stream->transferFrom(fd, data.size(), 100);
+    // 从当前位置读，推进文件位置
+    lseek(fd, 100, SEEK_SET);
+    int64_t e = p.stream->transferFrom(fd, -1, 50);
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    std::string got = finish(p);
+    SYLAR_ASSERT2(a == (int64_t)data.size() && b == 5000 && c == 10 && d == 0
+            && e == 50 && pos == 150
+            && got == data + data.substr(1000, 5000) + data.substr(data.size() - 10)
+                + data.substr(100, 50), "file transfer");
+
+    // BufferedStream 先 flush 再直接传输
+    Pair p2 = make_pair();
+    sylar::BufferedStream::ptr bs(new sylar::BufferedStream(p2.stream));
+    bs->write("head:", 5);
+    int64_t f = bs->transferFrom(fd, 0, 1000);
+    bs->write(":tail", 5);
+    bs->flush();
+    got = finish(p2);
+    SYLAR_ASSERT2(f == 1000 && got == "head:" + data.substr(0, 1000) + ":tail", "buffered transfer");
+
+    // 默认实现读到缓冲区再 writeFixSize
+    StringStream ss;
+    int64_t g = ss.transferFrom(fd, 7, 200000);
+    SYLAR_ASSERT2(g == 200000 && ss.data == data.substr(7, 200000), "default transfer");
+    close(fd);
+}
+
+void test_pipe() {
+    std::string data = make_data(1024 * 1024 + 7);
+    int pfd[2];
+    pipe(pfd);
+    // 管道不是 socket，hook 不接管，写满时阻塞这个线程，另一个线程在取数据
+    sylar::IOManager::GetThis()->schedule([pfd, data](){
+        size_t off = 0;
+        while(off < data.size()) {
+            ssize_t rt = write(pfd[1], data.c_str() + off, std::min((size_t)10000, data.size() - off));
+            if(rt <= 0) {
+                break;
+            }
+            off += rt;
+        }
+        close(pfd[1]);
+    });
+    Pair p = make_pair();
+    int64_t rt = p.stream->transferFrom(pfd[0], -1, 100 * 1024 * 1024);
+    close(pfd[0]);
+    std::string got = finish(p);
+    SYLAR_ASSERT2(rt == (int64_t)data.size() && got == data, "pipe transfer");
+
+    // socket 里的数据经过临时管道
+    std::string sdata = make_data(500000);
+    sylar::Socket::ptr a, b;
+    sylar::Socket::CreateUnixPair(a, b);
+    sylar::IOManager::GetThis()->schedule([a, sdata](){
+        sylar::SocketStream(a).writeFixSize(sdata.c_str(), sdata.size());
+    });
+    Pair p2 = make_pair();
+    rt = p2.stream->transferFrom(b->getSocket(), -1, sdata.size());
+    got = finish(p2);
+    SYLAR_ASSERT2(rt == (int64_t)sdata.size() && got == sdata, "socket transfer");
+}
+
+void test_timeout() {
+    write_file(make_data(16 * 1024 * 1024));
+    int fd = open(s_path, O_RDONLY);
+    sylar::Socket::ptr a, b;
+    sylar::Socket::CreateUnixPair(a, b);
+    a->setSendTimeout(200);
+    sylar::SocketStream ss(a);
+    // 定时器以调度循环的时间为起点，先让出一次，不把上面写文件的时间算进去
+    sylar::IOManager::GetThis()->schedule(sylar::Fiber::GetThis());
+    sylar::Fiber::YieldToHold();
+    uint64_t t0 = sylar::GetCurrentMS();
+    // 对端不读，socket 缓冲写满之后等到超时。协程可能换了线程恢复，errno 不可靠，只看返回值和耗时
+    int64_t rt = ss.transferFrom(fd, 0, 16 * 1024 * 1024);
+    uint64_t ms = sylar::GetCurrentMS() - t0;
+    SYLAR_ASSERT2(rt == -1 && ms >= 100 && ms < 2000, "send timeout");
+    close(fd);
+    b->close();
+}
+
+static double cpu_ms() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+void bench(size_t mb) {
+    size_t size = mb * 1024 * 1024;
+    write_file(make_data(size));
+    int fd = open(s_path, O_RDONLY);
+    // 页缓存预热
+    std::vector<char> buf(64 * 1024);
+    for(size_t off = 0; off < size; off += buf.size()) {
+        pread(fd, &buf[0], buf.size(), off);
+    }
+    for(int zero = 1; zero >= 0; --zero) {
+        sylar::Socket::ptr a, b;
+        sylar::Socket::CreateUnixPair(a, b);
+        auto done = std::make_shared<bool>(false);
+        sylar::IOManager::GetThis()->schedule([b, done](){
+            std::vector<char> buf(256 * 1024);
+            while(b->recv(&buf[0], buf.size()) > 0) {
+            }
+            b->close();
+            *done = true;
+        });
+        sylar::SocketStream ss(a);
+        uint64_t t0 = sylar::GetCurrentUS();
+        double c0 = cpu_ms();
+        int64_t rt = zero ? ss.transferFrom(fd, 0, size) : ss.Stream::transferFrom(fd, 0, size);
+        uint64_t us = sylar::GetCurrentUS() - t0;
+        double cpu = cpu_ms() - c0;
+        ss.close();
+        while(!*done) {
+            usleep(1000);
+        }
+        SYLAR_LOG_INFO(g_logger) << (zero ? "sendfile" : "pread+write") << " " << mb << "MB: "
+            << "MB/s=" << (int)(mb * 1e6 / (us + 1)) << " cpu_ms=" << (int)cpu
+            << " ok=" << (rt == (int64_t)size);
+    }
+    close(fd);
+}
+
+int main(int argc, char** argv) {
+    size_t mb = argc > 1 ? atoi(argv[1]) : 256;
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::IOManager iom(2, false, "transfer");
+    iom.schedule([mb](){
+        test_file();
+        test_pipe();
+        test_timeout();
+        bench(mb);
+        unlink(s_path);
+    });
+    return 0;
+}
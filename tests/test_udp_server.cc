@@ -0,0 +1,204 @@
+#include "webserve/udp_server.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <string.h>
+#include <fstream>
+
+// 测试 DatagramBatch 的批量收发、UdpServer 回显，
+// 以及逐条 recvfrom 和 recvmmsg 批量接收的吞吐对比
+// 用法: test_udp_server [服务端线程数] [客户端线程数] [每轮秒数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 两个 socket 之间用 DatagramBatch 收发
+void test_batch() {
+    sylar::IOManager iom(1, false);
+    iom.schedule([](){
+        sylar::Address::ptr any = sylar::Address::LookupAny("127.0.0.1:0");
+        sylar::Socket::ptr a = sylar::Socket::CreateUDP(any);
+        sylar::Socket::ptr b = sylar::Socket::CreateUDP(any);
+        a->bind(any);
+        b->bind(any);
+
+        sylar::DatagramBatch out(8, 16);
+        for(int i = 0; i < 8; ++i) {
+            std::string msg = "msg" + std::to_string(i);
+            out.append(msg.c_str(), msg.size(), b->getLocalAddress());
+        }
+        bool full = !out.append("x", 1, b->getLocalAddress())
+            && !sylar::DatagramBatch(1, 4).append("toolong", 7, b->getLocalAddress());
+        SYLAR_ASSERT2(full, "append full");
+        int sent = out.sendTo(a);
+
+        sylar::DatagramBatch in(16, 16);
+        int rt = in.recvFrom(b);
+        bool same = sent == 8 && rt == 8;
+        for(int i = 0; same && i < 8; ++i) {
+            std::string msg = "msg" + std::to_string(i);
+            same = std::string(in.data(i), in.length(i)) == msg
+                && in.getAddress(i)->toString() == a->getLocalAddress()->toString();
+        }
+        SYLAR_ASSERT2(same, "batch send/recv");
+
+        // 超过缓冲区的数据报被截断
+        std::string big(64, 'x');
+        a->sendTo(big.c_str(), big.size(), b->getLocalAddress());
+        rt = in.recvFrom(b);
+        SYLAR_ASSERT2(rt == 1 && in.length(0) == 16 && in.isTruncated(0), "truncate");
+    });
+}
+
+// 把每批数据报原样发回去
+class EchoServer : public sylar::UdpServer {
+public:
+    EchoServer(sylar::IOManager* worker)
+        :sylar::UdpServer(worker) {
+    }
+
+protected:
+    void handleBatch(sylar::Socket::ptr sock, sylar::DatagramBatch::ptr batch) override {
+        sylar::DatagramBatch::ptr reply = m_pool->acquire();
+        for(size_t i = 0; i < batch->size(); ++i) {
+            reply->append(batch->data(i), batch->length(i), batch->addr(i), batch->addrLen(i));
+        }
+        reply->sendTo(sock);
+    }
+};
+
+void test_echo() {
+    sylar::IOManager server(2, false, "server");
+    std::shared_ptr<EchoServer> echo(new EchoServer(&server));
+    echo->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+    echo->start();
+    sylar::Address::ptr addr = echo->getSocks()[0]->getLocalAddress();
+    SYLAR_LOG_INFO(g_logger) << echo->toString();
+
+    int got = 0;
+    {
+        sylar::IOManager client(1, false, "client");
+        client.schedule([addr, &got](){
+            sylar::Socket::ptr sock = sylar::Socket::CreateUDP(addr);
+            sock->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+            struct timeval tv = {1, 0};
+            sock->setOption(SOL_SOCKET, SO_RCVTIMEO, tv);
+            sylar::DatagramBatch out(100, 32);
+            for(int i = 0; i < 100; ++i) {
+                std::string msg = "echo" + std::to_string(i);
+                out.append(msg.c_str(), msg.size(), addr);
+            }
+            out.sendTo(sock);
+            sylar::DatagramBatch in(64, 32);
+            while(got < 100 && in.recvFrom(sock) > 0) {
+                got += in.size();
+            }
+        });
+    }
+    SYLAR_ASSERT2(got == 100 && echo->getRecvCount() == 100
+            && echo->getSocks().size() == 2, "echo");
+    echo->stop();
+}
+
+// 改造前的写法：每个 socket 一个协程，逐条 recvfrom
+class CountServer : public sylar::UdpServer {
+public:
+    CountServer(sylar::IOManager* worker, bool legacy)
+        :sylar::UdpServer(worker)
+        ,m_legacy(legacy) {
+    }
+
+protected:
+    void handleBatch(sylar::Socket::ptr sock, sylar::DatagramBatch::ptr batch) override {
+    }
+
+    void startRecv(sylar::Socket::ptr sock) override {
+        if(!m_legacy) {
+            sylar::UdpServer::startRecv(sock);
+            return;
+        }
+        char buf[2048];
+        sylar::Address::ptr from(new sylar::IPv4Address);
+        while(!m_isStop) {
+            if(sock->recvFrom(buf, sizeof(buf), from) >= 0) {
+                ++m_recvCount;
+                ++m_recvCalls;
+            }
+        }
+    }
+
+private:
+    bool m_legacy;
+};
+
+// 调度器所有线程在 CPU 上运行的总时间(微秒)
+static uint64_t cpu_us(sylar::IOManager& iom) {
+    uint64_t ns = 0;
+    for(int tid : iom.getThreadIds()) {
+        std::ifstream ifs("/proc/self/task/" + std::to_string(tid) + "/schedstat");
+        uint64_t v = 0;
+        ifs >> v;
+        ns += v;
+    }
+    return ns / 1000;
+}
+
+void bench(bool legacy, int server_threads, int client_threads, int seconds) {
+    sylar::IOManager server(server_threads, false, "server");
+    std::shared_ptr<CountServer> counter(new CountServer(&server, legacy));
+    counter->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+    counter->start();
+    sylar::Address::ptr addr = counter->getSocks()[0]->getLocalAddress();
+    size_t sockets = counter->getSocks().size();
+
+    uint64_t end = sylar::GetMonotonicMS() + seconds * 1000;
+    std::atomic<uint64_t> sent = {0};
+    uint64_t count = 0;
+    uint64_t calls = 0;
+    uint64_t cpu = 0;
+    {
+        sylar::IOManager client(client_threads, false, "client");
+        uint64_t cpu0 = cpu_us(server);
+        for(int i = 0; i < client_threads; ++i) {
+            // 每个客户端 socket 一个源端口，SO_REUSEPORT 按四元组散列到不同的服务端 socket
+            for(int j = 0; j < 4; ++j) {
+                client.schedule([addr, end, &sent](){
+                    sylar::Socket::ptr sock = sylar::Socket::CreateUDP(addr);
+                    sylar::DatagramBatch out(32, 64);
+                    std::string msg(64, 'm');
+                    while(out.append(msg.c_str(), msg.size(), addr));
+                    while(sylar::GetMonotonicMS() < end) {
+                        int rt = out.sendTo(sock);
+                        if(rt > 0) {
+                            sent += rt;
+                        }
+                    }
+                });
+            }
+        }
+        usleep(seconds * 1000 * 1000);
+        count = counter->getRecvCount();
+        calls = counter->getRecvCalls();
+        cpu = cpu_us(server) - cpu0;
+    }
+    counter->stop();
+    SYLAR_LOG_INFO(g_logger) << (legacy ? "recvfrom" : "recvmmsg")
+        << " sockets=" << sockets
+        << " sent=" << sent
+        << " recv=" << count
+        << " recv_pps=" << count / seconds
+        << " datagrams/call=" << (calls ? (double)count / calls : 0)
+        << " server_cpu_ns/datagram=" << (count ? cpu * 1000.0 / count : 0);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    int server_threads = argc > 1 ? atoi(argv[1]) : 2;
+    int client_threads = argc > 2 ? atoi(argv[2]) : 2;
+    int seconds = argc > 3 ? atoi(argv[3]) : 1;
+    test_batch();
+    test_echo();
+    bench(true, server_threads, client_threads, seconds);
+    bench(false, server_threads, client_threads, seconds);
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "webserve/tcp_server.h"
+#include "webserve/iomanager.h"
+#include "webserve/hook.h"
+#include "webserve/log.h"
+#include "webserve/macro.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 测试 TcpServer 监听 Unix Socket、残留的 socket 文件、SCM_RIGHTS 传递句柄，
+// 以及前端进程 accept 之后把连接交给 fork 出来的工作进程处理
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const char* s_path = "/tmp/sylar_test_unix.sock";
+
+// 读一次，原样加上前缀写回去
+static void echo(sylar::Socket::ptr client, const std::string& prefix) {
+    char buf[256];
+    int rt = client->recv(buf, sizeof(buf));
+    if(rt > 0) {
+        std::string reply = prefix + std::string(buf, rt);
+        client->send(reply.c_str(), reply.size());
+    }
+    client->close();
+}
+
+class EchoServer : public sylar::TcpServer {
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        m_peer = client->getRemoteAddress();
+        echo(client, "echo:");
+    }
+public:
+    sylar::Address::ptr m_peer;
+};
+
+static std::string request(sylar::Address::ptr addr, const std::string& data) {
+    sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)) {
+        return "";
+    }
+    sock->send(data.c_str(), data.size());
+    char buf[256];
+    int rt = sock->recv(buf, sizeof(buf));
+    return rt > 0 ? std::string(buf, rt) : "";
+}
+
+void test_unix_server() {
+    sylar::UnixAddress::ptr addr(new sylar::UnixAddress(s_path));
+    for(int round = 0; round < 2; ++round) {
+        std::shared_ptr<EchoServer> server(new EchoServer);
+        // 每个线程一个 SO_REUSEPORT 监听 socket 的设置对 Unix 路径不生效
+        server->setReusePort(-1);
+        // 第二轮时上一轮留下的 socket 文件还在，bind 应该先删掉它
+        bool ok = server->bind(addr);
+        SYLAR_ASSERT2(ok, "unix bind");
+        server->start();
+        SYLAR_ASSERT2(server->getSocks().size() == 1
+                && access(s_path, F_OK) == 0, "unix listener");
+        std::string echo = request(addr, "hello");
+        SYLAR_ASSERT2(echo == "echo:hello", "unix echo");
+        SYLAR_ASSERT2(std::dynamic_pointer_cast<sylar::UnixAddress>(server->m_peer) != nullptr, "unix peer");
+
+        // 路径上有进程在监听时不能再绑定
+        sylar::Socket::ptr other = sylar::Socket::CreateTCP(addr);
+        bool bound = other->bind(addr);
+        int err = errno;
+        SYLAR_ASSERT2(!bound && err == EADDRINUSE, "unix in use");
+        server->stop();
+        // stop 在调度器里异步关闭监听 socket，等它关掉
+        usleep(50 * 1000);
+    }
+    unlink(s_path);
+}
+
+// 两个管道句柄和数据一起发出去，用收到的写端写，原来的读端能读到
+void test_send_fds() {
+    sylar::Socket::ptr a, b;
+    bool ok = sylar::Socket::CreateUnixPair(a, b);
+    SYLAR_ASSERT2(ok, "socketpair");
+    int p1[2], p2[2];
+    pipe(p1);
+    pipe(p2);
+    int fds[2] = {p1[1], p2[1]};
+    int rt = a->sendFds(fds, 2, "xyz", 3);
+    SYLAR_ASSERT2(rt == 3, "send fds");
+
+    std::vector<int> got;
+    char buf[8];
+    rt = b->recvFds(got, 4, buf, sizeof(buf));
+    SYLAR_ASSERT2(rt == 3 && memcmp(buf, "xyz", 3) == 0 && got.size() == 2
+            && got[0] != p1[1] && got[1] != p2[1], "recv fds");
+    if(got.size() == 2) {
+        write(got[0], "1", 1);
+        write(got[1], "2", 1);
+        char c1 = 0, c2 = 0;
+        read(p1[0], &c1, 1);
+        read(p2[0], &c2, 1);
+        SYLAR_ASSERT2(c1 == '1' && c2 == '2'
+                && (fcntl(got[0], F_GETFD) & FD_CLOEXEC), "fds usable");
+    }
+    for(int fd : got) {
+        close(fd);
+    }
+    close(p1[0]); close(p1[1]); close(p2[0]); close(p2[1]);
+}
+
+// 前端进程只 accept，连接交给工作进程
+class FrontServer : public sylar::TcpServer {
+public:
+    FrontServer(sylar::IOManager* worker, sylar::Socket::ptr channel)
+        :sylar::TcpServer(worker, worker, worker)
+        ,m_channel(channel) {
+    }
+protected:
+    void handleClient(sylar::Socket::ptr client) override {
+        if(!m_channel->sendSocket(client)) {
+            SYLAR_LOG_ERROR(g_logger) << "sendSocket fail errno=" << errno;
+        }
+        client->close();
+    }
+private:
+    sylar::Socket::ptr m_channel;
+};
+
+void test_handoff() {
+    static const int s_clients = 5;
+    sylar::Socket::ptr front, worker;
+    bool paired = sylar::Socket::CreateUnixPair(front, worker);
+    SYLAR_ASSERT2(paired, "socketpair");
+    // 通道在 fork 之前创建，父子进程各留一端
+    pid_t pid = fork();
+    if(pid == 0) {
+        {
+            sylar::IOManager iom(1, false, "worker");
+            // 非 hook 线程里 close 不会注销 FdCtx，都放到调度器里关
+            iom.schedule([front](){
+                front->close();
+            });
+            iom.schedule([worker](){
+                std::string prefix = "worker" + std::to_string(getpid()) + ":";
+                while(sylar::Socket::ptr client = worker->recvSocket()) {
+                    sylar::IOManager::GetThis()->schedule(std::bind(echo, client, prefix));
+                }
+                worker->close();
+            });
+        }
+        _exit(0);
+    }
+    int ok = 0;
+    {
+        sylar::IOManager iom(1, false, "front");
+        iom.schedule([worker](){
+            worker->close();
+        });
+        std::shared_ptr<FrontServer> server(new FrontServer(&iom, front));
+        sylar::Address::ptr addr;
+        sylar::Semaphore sem;
+        iom.schedule([server, &addr, &sem](){
+            if(server->bind(sylar::Address::LookupAny("127.0.0.1:0"))) {
+                addr = server->getSocks()[0]->getLocalAddress();
+                server->start();
+            }
+            sem.notify();
+        });
+        sem.wait();
+
+        std::string expect = "worker" + std::to_string(pid) + ":";
+        for(int i = 0; addr && i < s_clients; ++i) {
+            iom.schedule([addr, expect, i, &ok](){
+                std::string data = "req" + std::to_string(i);
+                if(request(addr, data) == expect + data) {
+                    ++ok;
+                }
+            });
+        }
+        iom.schedule([server, front, &ok](){
+            for(int i = 0; i < 200 && ok < s_clients; ++i) {
+                usleep(10 * 1000);
+            }
+            server->stop();
+            // 关掉通道，工作进程读到 EOF 后退出
+            front->close();
+        });
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    SYLAR_ASSERT2(ok == s_clients, "handoff");
+    SYLAR_ASSERT2(WIFEXITED(status) && WEXITSTATUS(status) == 0, "worker exit");
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    // fork 要在还没有其他线程的时候做
+    test_handoff();
+    sylar::IOManager iom(1, false);
+    iom.schedule(test_send_fds);
+    iom.schedule(test_unix_server);
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "webserve/streams/socket_stream.h"
+#include "webserve/iomanager.h"
+#include "webserve/bytearray.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <time.h>
+
+// 测试 MSG_ZEROCOPY 发送：阈值以下不走零拷贝、数据正确、发送中改写 ByteArray 不影响发出的数据、
+// 完成通知到达后释放内存，以及拷贝发送和零拷贝发送每 GB 消耗的发送端 CPU
+// 用法: test_zerocopy [每轮发送的MB数] [每次发送的KB数]
+// 发往本机(loopback)的零拷贝数据在接收端仍然会被内核拷贝一次，并在通知里标记 COPIED，
+// 要看到真实收益需要把接收端放到另一台机器上
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t thread_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+// 在接收端调度器里监听，收满 total 字节后结束；verify 为真时检查数据是 i % 251
+static sylar::Address::ptr start_receiver(sylar::IOManager& iom, size_t total, bool verify, bool* ok) {
+    sylar::Address::ptr addr;
+    sylar::Semaphore sem;
+    iom.schedule([total, verify, ok, &addr, &sem](){
+        sylar::Socket::ptr listener = sylar::Socket::CreateTCP(sylar::Address::LookupAny("127.0.0.1:0"));
+        listener->bind(sylar::Address::LookupAny("127.0.0.1:0"));
+        listener->listen();
+        addr = listener->getLocalAddress();
+        sem.notify();
+
+        sylar::Socket::ptr conn = listener->accept();
+        std::vector<char> buf(256 * 1024);
+        size_t got = 0;
+        bool same = true;
+        while(got < total) {
+            int rt = conn->recv(&buf[0], buf.size());
+            if(rt <= 0) {
+                break;
+            }
+            for(int i = 0; verify && same && i < rt; ++i) {
+                same = (uint8_t)buf[i] == (got + i) % 251;
+            }
+            got += rt;
+        }
+        *ok = same && got == total;
+    });
+    sem.wait();
+    return addr;
+}
+
+static sylar::ByteArray::ptr make_data(size_t size) {
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(64 * 1024));
+    std::vector<char> data(size);
+    for(size_t i = 0; i < size; ++i) {
+        data[i] = i % 251;
+    }
+    ba->write(&data[0], size);
+    ba->setPosition(0);
+    return ba;
+}
+
+void test_zerocopy() {
+    static const size_t s_small = 100;
+    static const size_t s_big = 1024 * 1024;
+    bool recv_ok = false;
+    {
+        sylar::IOManager receiver(1, false, "recv");
+        sylar::Address::ptr addr = start_receiver(receiver, s_small + s_big, true, &recv_ok);
+
+        sylar::IOManager sender(1, false, "send");
+        sender.schedule([addr](){
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            sock->connect(addr);
+            sylar::SocketStream::ptr stream(new sylar::SocketStream(sock));
+            if(!stream->setZeroCopy(true)) {
+                SYLAR_LOG_WARN(g_logger) << "SO_ZEROCOPY not supported, skip";
+                return;
+            }
+
+            // 小于阈值的发送照常拷贝
+            sylar::ByteArray::ptr small = make_data(s_small);
+            stream->writeFixSize(small, s_small);
+            SYLAR_ASSERT2(sock->getZeroCopySends() == 0 && sock->getZeroCopyPending() == 0, "below threshold");
+
+            // 大数据走零拷贝，数据接着小数据的编号继续，接收端按 i % 251 校验
+            sylar::ByteArray::ptr big(new sylar::ByteArray(64 * 1024));
+            std::vector<char> data(s_big);
+            for(size_t i = 0; i < s_big; ++i) {
+                data[i] = (s_small + i) % 251;
+            }
+            big->write(&data[0], s_big);
+            big->setPosition(0);
+            std::weak_ptr<sylar::ByteArray> weak = big;
+            stream->writeFixSize(big, s_big);
+            // 发送完成之前改写 ByteArray：写出的数据已经冻结，改写时复制节点，接收端看到的还是原来的数据
+            std::vector<char> junk(s_big, 0x5a);
+            big->setPosition(0);
+            big->write(&junk[0], junk.size());
+            big.reset();
+            SYLAR_ASSERT2(sock->getZeroCopySends() > 0, "zerocopy sends");
+
+            // 通知到达后 socket 不再持有 ByteArray
+            bool flushed = sock->flushZeroCopy(1000);
+            SYLAR_ASSERT2(flushed && sock->getZeroCopyPending() == 0 && weak.expired(), "completions");
+            SYLAR_LOG_INFO(g_logger) << "sends=" << sock->getZeroCopySends()
+                << " copied=" << sock->getZeroCopyCopied();
+        });
+    }
+    SYLAR_ASSERT2(recv_ok, "data");
+}
+
+void bench(bool zerocopy, size_t total_mb, size_t chunk_kb) {
+    size_t chunk = chunk_kb * 1024;
+    size_t count = total_mb * 1024 * 1024 / chunk;
+    size_t total = count * chunk;
+    bool recv_ok = false;
+    uint64_t cpu = 0;
+    uint64_t used = 0;
+    uint64_t sends = 0;
+    uint64_t copied = 0;
+    {
+        sylar::IOManager receiver(1, false, "recv");
+        sylar::Address::ptr addr = start_receiver(receiver, total, false, &recv_ok);
+
+        sylar::IOManager sender(1, false, "send");
+        sender.schedule([=, &cpu, &used, &sends, &copied](){
+            sylar::Socket::ptr sock = sylar::Socket::CreateTCP(addr);
+            sock->connect(addr);
+            sylar::SocketStream::ptr stream(new sylar::SocketStream(sock));
+            if(zerocopy && !stream->setZeroCopy(true)) {
+                SYLAR_LOG_WARN(g_logger) << "SO_ZEROCOPY not supported, skip";
+                return;
+            }
+            // 同一块数据反复发送，只移动读位置，不修改内容，零拷贝时也是安全的
+            sylar::ByteArray::ptr ba = make_data(chunk);
+            uint64_t start = sylar::GetMonotonicMS();
+            uint64_t cpu0 = thread_cpu_us();
+            for(size_t i = 0; i < count; ++i) {
+                ba->setPosition(0);
+                if(stream->writeFixSize(ba, chunk) <= 0) {
+                    break;
+                }
+            }
+            sock->flushZeroCopy(1000);
+            cpu = thread_cpu_us() - cpu0;
+            used = sylar::GetMonotonicMS() - start;
+            sends = sock->getZeroCopySends();
+            copied = sock->getZeroCopyCopied();
+        });
+    }
+
+    double gb = (double)total / (1024 * 1024 * 1024);
+    SYLAR_LOG_INFO(g_logger) << (zerocopy ? "zerocopy" : "copy")
+        << " chunk=" << chunk_kb << "KB"
+        << " total=" << total / (1024 * 1024) << "MB"
+        << " recv_ok=" << recv_ok
+        << " MB/s=" << (used ? total / 1024 / 1024 * 1000 / used : 0)
+        << " sender_cpu_ms/GB=" << (gb > 0 ? cpu / 1000.0 / gb : 0)
+        << " zc_sends=" << sends
+        << " zc_copied=" << copied;
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    size_t total_mb = argc > 1 ? atoi(argv[1]) : 256;
+    size_t chunk_kb = argc > 2 ? atoi(argv[2]) : 1024;
+    test_zerocopy();
+    bench(false, total_mb, chunk_kb);
+    bench(true, total_mb, chunk_kb);
+    return 0;
+}
@@ -0,0 +1,291 @@
+#include "webserve/streams/zlib_stream.h"
+#include "webserve/http/http_server.h"
+#include "webserve/http/http_connection.h"
+#include "webserve/iomanager.h"
+#include "webserve/log.h"
+#include "webserve/util.h"
+#include "webserve/macro.h"
+#include <sys/resource.h>
+
+// 测试 ZlibStream：三种格式分块写入的往返、和 zlib 自带函数的互通、数据损坏和压缩炸弹、
+// 线程缓存的 z_stream 复用、Accept-Encoding 协商、HttpServer 压缩响应 + HttpConnection 解压，
+// 以及不同压缩级别的 CPU 开销和省下的字节数
+// 用法: test_zlib_stream [压测次数]
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 类似 JSON 接口返回的文本
+static std::string make_text(size_t size) {
+    std::string s;
+    for(int i = 0; s.size() < size; ++i) {
+        s += "{\"id\":" + std::to_string(i * 7919 % 100003) + ",\"name\":\"user_"
+            + std::to_string(i % 997) + "\",\"tags\":[\"a\",\"bb\"],\"score\":"
+            + std::to_string(i * 31 % 1000) + "},\n";
+    }
+    s.resize(size);
+    return s;
+}
+
+static std::string make_random(size_t size) {
+    std::string s(size, 0);
+    uint32_t x = 12345;
+    for(auto& c : s) {
+        x = x * 1103515245 + 12345;
+        c = x >> 24;
+    }
+    return s;
+}
+
+// 按 chunk 分块写入一个流
+static std::string run(sylar::ZlibStream::ptr zs, const std::string& data, size_t chunk, int* rt) {
+    *rt = 0;
+    for(size_t off = 0; off < data.size() && *rt == 0; off += chunk) {
+        size_t n = std::min(chunk, data.size() - off);
+        if(zs->write(data.c_str() + off, n) != (int)n) {
+            *rt = -1;
+        }
+    }
+    if(*rt == 0) {
+        *rt = zs->flush();
+    }
+    return zs->getResult();
+}
+
+void test_roundtrip() {
+    std::vector<std::string> inputs = {"", "a", make_text(1000), make_text(300 * 1024)
+                                       ,make_random(70000)};
+    sylar::ZlibStream::Type types[] = {sylar::ZlibStream::GZIP, sylar::ZlibStream::ZLIB
+                                       ,sylar::ZlibStream::DEFLATE};
+    bool ok = true;
+    for(auto type : types) {
+        for(auto& in : inputs) {
+            for(size_t chunk : {(size_t)1, (size_t)777, in.size() + 1}) {
+                if(chunk == 1 && in.size() > 2000) {
+                    continue;
+                }
+                int rt1, rt2;
+                std::string z = run(sylar::ZlibStream::Create(true, 1024, type), in, chunk, &rt1);
+                std::string back = run(sylar::ZlibStream::Create(false, 1024, type), z, chunk, &rt2);
+                std::string one;
+                ok = ok && rt1 == 0 && rt2 == 0 && back == in
+                    && sylar::ZlibStream::Decompress(z.c_str(), z.size(), one, type) && one == in;
+            }
+        }
+    }
+    SYLAR_ASSERT2(ok, "roundtrip");
+
+    // Compress 一次压缩的结果能被流解压，ZLIB 格式和 zlib 的 uncompress 互通
+    std::string text = make_text(100000);
+    std::string z;
+    sylar::ZlibStream::Compress(text.c_str(), text.size(), z, sylar::ZlibStream::ZLIB, 9);
+    std::string out(text.size(), 0);
+    uLongf out_len = out.size();
+    int zrt = uncompress((Bytef*)&out[0], &out_len, (const Bytef*)z.c_str(), z.size());
+    std::string zc(compressBound(text.size()), 0);
+    uLongf zc_len = zc.size();
+    compress2((Bytef*)&zc[0], &zc_len, (const Bytef*)text.c_str(), text.size(), 6);
+    std::string back;
+    SYLAR_ASSERT2(zrt == Z_OK && out_len == text.size() && out == text
+            && sylar::ZlibStream::Decompress(zc.c_str(), zc_len, back, sylar::ZlibStream::ZLIB)
+            && back == text, "zlib interop");
+
+    // 解压 GZIP 时也认 zlib 头
+    SYLAR_ASSERT2(sylar::ZlibStream::Decompress(z.c_str(), z.size(), back)
+            && back == text, "gzip accepts zlib");
+
+    // write(ByteArray) 从多个节点读，position 前进
+    sylar::ByteArray::ptr ba(new sylar::ByteArray(100));
+    ba->write(text.c_str(), text.size());
+    ba->setPosition(10);
+    auto zs = sylar::ZlibStream::CreateGzip(true);
+    int n = zs->write(ba, 50000);
+    zs->close();
+    std::string gz = zs->getResult();
+    SYLAR_ASSERT2(n == 50000 && ba->getPosition() == 50010
+            && sylar::ZlibStream::Decompress(gz.c_str(), gz.size(), back)
+            && back == text.substr(10, 50000) && zs->getInBytes() == 50000
+            && zs->getOutBytes() == gz.size() && zs->write("x", 1) == -1, "write bytearray");
+}
+
+void test_errors() {
+    std::string text = make_text(50000);
+    std::string z;
+    sylar::ZlibStream::Compress(text.c_str(), text.size(), z);
+    std::string out;
+    // 截断
+    bool truncated = !sylar::ZlibStream::Decompress(z.c_str(), z.size() - 5, out);
+    // 中间改坏
+    std::string bad = z;
+    bad[bad.size() / 2] ^= 0x55;
+    bad[bad.size() / 2 + 1] ^= 0x55;
+    bool corrupt = !sylar::ZlibStream::Decompress(bad.c_str(), bad.size(), out) || out != text;
+    // 格式不对
+    bool wrong = !sylar::ZlibStream::Decompress(z.c_str(), z.size(), out, sylar::ZlibStream::ZLIB);
+    SYLAR_ASSERT2(truncated && corrupt && wrong, "corrupt input");
+
+    // 10MB 的 0 压缩后只有 10KB 左右，限制解压大小
+    std::string zeros(10 * 1024 * 1024, 0);
+    sylar::ZlibStream::Compress(zeros.c_str(), zeros.size(), z);
+    SYLAR_ASSERT2(z.size() < 20000
+            && !sylar::ZlibStream::Decompress(z.c_str(), z.size(), out, sylar::ZlibStream::GZIP, 1024 * 1024)
+            && sylar::ZlibStream::Decompress(z.c_str(), z.size(), out) && out == zeros, "max size");
+
+    SYLAR_ASSERT2(!sylar::ZlibStream::Create(true, 4096, sylar::ZlibStream::GZIP, 10)
+            && !sylar::ZlibStream::Create(true, 4096, sylar::ZlibStream::GZIP, 6, 16), "invalid params");
+}
+
+void test_cache() {
+    std::string text = make_text(4000);
+    std::string z, out;
+    uint64_t c0, c1;
+    sylar::ZlibStream::GetCachedStates(&c0);
+    bool ok = true;
+    for(int i = 0; i < 100; ++i) {
+        ok = ok && sylar::ZlibStream::Compress(text.c_str(), text.size(), z, sylar::ZlibStream::GZIP, 6)
+            && sylar::ZlibStream::Decompress(z.c_str(), z.size(), out) && out == text;
+    }
+    // 压缩和解压各新建一次，之后都复用
+    size_t cached = sylar::ZlibStream::GetCachedStates(&c1);
+    SYLAR_ASSERT2(ok && c1 - c0 <= 2 && cached >= 2, "state reuse");
+
+    // 参数不同的不复用
+    sylar::ZlibStream::Compress(text.c_str(), text.size(), z, sylar::ZlibStream::GZIP, 1);
+    sylar::ZlibStream::GetCachedStates(&c0);
+    SYLAR_ASSERT2(c0 == c1 + 1, "state by params");
+
+    // 流没有 flush 就析构也归还
+    {
+        auto zs = sylar::ZlibStream::CreateGzip(true, 4096, 6);
+        zs->write(text.c_str(), text.size());
+    }
+    sylar::ZlibStream::GetCachedStates(&c1);
+    SYLAR_ASSERT2(c1 == c0, "state released");
+}
+
+void test_negotiate() {
+    using sylar::http::ChooseContentEncoding;
+    auto eq = [](const char* a, const char* b) {
+        return a == b || (a && b && strcmp(a, b) == 0);
+    };
+    SYLAR_ASSERT2(eq(ChooseContentEncoding("gzip, deflate, br"), "gzip")
+            && eq(ChooseContentEncoding("deflate"), "deflate")
+            && eq(ChooseContentEncoding("gzip;q=0.5, deflate"), "deflate")
+            && eq(ChooseContentEncoding("gzip;q=0"), nullptr)
+            && eq(ChooseContentEncoding("br, identity"), nullptr)
+            && eq(ChooseContentEncoding(""), nullptr)
+            && eq(ChooseContentEncoding("*"), "gzip")
+            && eq(ChooseContentEncoding("*;q=0.3, gzip;q=0"), "deflate")
+            && eq(ChooseContentEncoding(" X-GZIP ; q=0.8 "), "gzip"), "accept-encoding");
+}
+
+void test_http() {
+    std::string big = make_text(20000);
+    sylar::http::HttpServer::ptr server(new sylar::http::HttpServer(false));
+    server->setCompressMinSize(1024);
+    auto sd = server->getServletDispatch();
+    sd->addServlet("/big", [big](sylar::http::HttpRequest::ptr req
+                ,sylar::http::HttpResponse::ptr rsp
+                ,sylar::http::HttpSession::ptr session) {
+            rsp->setHeader("Content-Type", "application/json");
+            rsp->setBody(big);
+            return 0;
+    });
+    sd->addServlet("/small", [](sylar::http::HttpRequest::ptr req
+                ,sylar::http::HttpResponse::ptr rsp
+                ,sylar::http::HttpSession::ptr session) {
+            rsp->setBody("small body");
+            return 0;
+    });
+    sd->addServlet("/png", [big](sylar::http::HttpRequest::ptr req
+                ,sylar::http::HttpResponse::ptr rsp
+                ,sylar::http::HttpSession::ptr session) {
+            rsp->setHeader("Content-Type", "image/png");
+            rsp->setBody(big);
+            return 0;
+    });
+    sylar::Address::ptr addr = sylar::Address::LookupAnyIPAddress("127.0.0.1:0");
+    server->bind(addr);
+    server->start();
+    uint32_t port = std::dynamic_pointer_cast<sylar::IPAddress>(
+            server->getSocks()[0]->getLocalAddress())->getPort();
+    std::string base = "http://127.0.0.1:" + std::to_string(port);
+
+    auto get = [&](const std::string& path, const std::string& accept) {
+        std::map<std::string, std::string> headers;
+        if(!accept.empty()) {
+            headers["Accept-Encoding"] = accept;
+        }
+        return sylar::http::HttpConnection::DoGet(base + path, 3000, headers);
+    };
+    auto r1 = get("/big", "gzip, deflate");
+    auto r2 = get("/big", "deflate");
+    auto r3 = get("/big", "");
+    auto r4 = get("/small", "gzip");
+    auto r5 = get("/png", "gzip");
+    auto enc = [](sylar::http::HttpResult::ptr r) {
+        return r->response ? r->response->getHeader("content-encoding") : "<null>";
+    };
+    auto body = [](sylar::http::HttpResult::ptr r) {
+        return r->response ? r->response->getBody() : "";
+    };
+    SYLAR_ASSERT2(enc(r1) == "gzip" && body(r1) == big
+            && r1->response->getHeader("vary") == "Accept-Encoding", "http gzip");
+    SYLAR_ASSERT2(enc(r2) == "deflate" && body(r2) == big, "http deflate");
+    SYLAR_ASSERT2(enc(r3) == "" && body(r3) == big, "http identity");
+    SYLAR_ASSERT2(enc(r4) == "" && body(r4) == "small body" && enc(r5) == "" && body(r5) == big, "http skip");
+    server->stop();
+}
+
+static double cpu_us() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e6
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// 每个级别压缩一批响应(总量相当于 times 个 4KB)，统计每个响应的 CPU 时间和省下的字节
+void bench(int times) {
+    for(size_t size : {(size_t)4096, (size_t)64 * 1024}) {
+        std::string text = make_text(size);
+        std::string z;
+        int n = std::max(times * 4096 / (int)size, 1);
+        for(int level : {1, 6, 9}) {
+            double c0 = cpu_us();
+            for(int i = 0; i < n; ++i) {
+                sylar::ZlibStream::Compress(text.c_str(), text.size(), z, sylar::ZlibStream::GZIP, level);
+            }
+            double us = (cpu_us() - c0) / n;
+            SYLAR_LOG_INFO(g_logger) << "gzip level=" << level << " body=" << size
+                << " out=" << z.size() << " saved=" << (int)(100 - z.size() * 100.0 / size) << "%"
+                << " cpu_us/rsp=" << (int)us
+                << " MB/s=" << (int)(size / (us + 0.001));
+        }
+    }
+
+    // 1KB 响应：复用线程缓存的 z_stream 和每次 deflateInit2 新建对比
+    std::string text = make_text(1024);
+    std::string z;
+    for(size_t max_cached : {(size_t)4, (size_t)0}) {
+        sylar::ZlibStream::SetMaxCachedStates(max_cached);
+        double c0 = cpu_us();
+        for(int i = 0; i < times; ++i) {
+            sylar::ZlibStream::Compress(text.c_str(), text.size(), z, sylar::ZlibStream::GZIP, 1);
+        }
+        SYLAR_LOG_INFO(g_logger) << (max_cached ? "cached state" : "init per response")
+            << ": cpu_us/rsp=" << (cpu_us() - c0) / times;
+    }
+    sylar::ZlibStream::SetMaxCachedStates(4);
+}
+
+int main(int argc, char** argv) {
+    int times = argc > 1 ? atoi(argv[1]) : 2000;
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    test_roundtrip();
+    test_errors();
+    test_cache();
+    test_negotiate();
+    bench(times);
+    sylar::IOManager iom(1, true, "http");
+    iom.schedule(test_http);
+    return 0;
+}
@@ -1,5 +1,10 @@
 #include "address.h"
 #include "log.h"
+#include "config.h"
+#include "hook.h"
+#include "dns.h"
+#include "offload.h"
+#include "iomanager.h"
 #include <sstream>
 #include <netdb.h>
 #include <ifaddrs.h>
@@ -11,6 +16,24 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<bool>::ptr g_dns_async =
+    sylar::Config::Lookup("dns.async", true, "resolve names with async dns resolver in fibers");
+
+static bool s_dns_async = true;
+
+namespace {
+struct _DnsAsyncIniter {
+    _DnsAsyncIniter() {
+        s_dns_async = g_dns_async->getValue();
+        g_dns_async->addListener([](const bool& ov, const bool& nv){
+            s_dns_async = nv;
+        });
+    }
+};
+
+static _DnsAsyncIniter s_dns_async_initer;
+}
+
 template<class T>
 static T CreateMask(uint32_t bits) {
     return (1 << (sizeof(T) * 8 - bits)) - 1;
@@ -95,7 +118,35 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
     if(node.empty()) {
         node = host;
     }
-    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+
+    // 协程里(hook 开启)走异步 DNS 解析器，避免 getaddrinfo 阻塞整个 IO 线程；
+    // 只处理数字端口，服务名和没有配置域名服务器的情况还是交给 getaddrinfo
+    if(is_hook_enable() && s_dns_async
+            && (family == AF_INET || family == AF_INET6 || family == AF_UNSPEC)
+            && (!service || (*service && strspn(service, "0123456789") == strlen(service)))) {
+        std::vector<IPAddress::ptr> addrs;
+        if(DnsMgr::GetInstance()->resolve(addrs, node, family)) {
+            uint16_t port = service ? atoi(service) : 0;
+            for(auto& i : addrs) {
+                i->setPort(port);
+                result.push_back(i);
+            }
+            return true;
+        }
+        if(!DnsMgr::GetInstance()->getServers().empty()) {
+            return false;
+        }
+    }
+
+    int error = 0;
+    // 协程里把 getaddrinfo 放到卸载线程池执行，不设超时，所以可以直接引用栈上变量；
+    // 线程池排满时退回到当前线程直接调用
+    if(!is_hook_enable() || !IOManager::GetThis()
+            || OffloadMgr::GetInstance()->run([&](){
+                    error = getaddrinfo(node.c_str(), service, &hints, &results);
+                })) {
+        error = getaddrinfo(node.c_str(), service, &hints, &results);
+    }
     if(error) {
         SYLAR_LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", "
             << family << ", " << type << ") err=" << error << " errstr="
@@ -218,6 +269,15 @@ Address::ptr Address::Create(const sockaddr* addr, socklen_t addrlen) {
         case AF_INET6:
             result.reset(new IPv6Address(*(const sockaddr_in6*)addr));
             break;
+        case AF_UNIX: {
+                // 未命名的对端(比如 connect 之前没有 bind)只有 sun_family
+                UnixAddress::ptr uaddr(new UnixAddress);
+                socklen_t len = std::min(addrlen, (socklen_t)sizeof(sockaddr_un));
+                memcpy(uaddr->getAddr(), addr, len);
+                uaddr->setAddrLen(len);
+                result = uaddr;
+            }
+            break;
         default:
             result.reset(new UnknownAddress(*addr));
             break;
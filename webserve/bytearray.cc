@@ -1,30 +1,50 @@
 #include "bytearray.h"
 #include "endian.h"
 #include "log.h"
-#include <fstream>
+#include "file_io.h"
 #include <sstream>
 #include <string.h>
 #include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
 ByteArray::Node::Node(size_t s)
-    :ptr(new char[s])
+    :ptr(nullptr)
     ,next(nullptr)
-    ,size(s) {
+    ,size(s)
+    ,block(BufferBlock::Alloc(s)) {
+    ptr = block->data();
+}
+
+ByteArray::Node::Node(BufferBlock* b, char* p, size_t s)
+    :ptr(p)
+    ,next(nullptr)
+    ,size(s)
+    ,block(b) {
+    block->ref();
 }
 
 ByteArray::Node::Node()
     :ptr(nullptr)
     ,next(nullptr)
-    ,size(0) {
+    ,size(0)
+    ,block(nullptr) {
 }
 
 ByteArray::Node::~Node() {
-    if(ptr) {
-        delete[] ptr;
+    if(block) {
+        block->unref();
     }
 }
 
@@ -35,10 +55,14 @@ ByteArray::ByteArray(size_t base_size)
     ,m_size(0)
     ,m_endian(SYLAR_BIG_ENDIAN)
     ,m_root(new Node(base_size))
-    ,m_cur(m_root) {
+    ,m_cur(m_root)
+    ,m_curStart(0)
+    ,m_mapFd(-1)
+    ,m_mapSize(0) {
 }
 
 ByteArray::~ByteArray() {
+    closeMapFile();
     // 将节点全部释放掉
     Node* tmp = m_root;
     while(tmp) {
@@ -60,57 +84,68 @@ void ByteArray::setIsLittleEndian(bool val) {
     }
 }
 
+// 当前节点放得下时直接拷到节点里，省掉 write 的循环
+#define XX(value) \
+    if(char* p = writePtr(sizeof(value))) { \
+        memcpy(p, &value, sizeof(value)); \
+        advance(sizeof(value)); \
+    } else { \
+        write(&value, sizeof(value)); \
+    }
+
 // 一个字节的数据，大端小端都是一样的
 void ByteArray::writeFint8  (int8_t value) {
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFuint8 (uint8_t value) {
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFint16 (int16_t value) {
     if(m_endian != SYLAR_BYTE_ORDER) {
         value = byteswap(value);
     }
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFuint16(uint16_t value) {
     if(m_endian != SYLAR_BYTE_ORDER) {
         value = byteswap(value);
     }
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFint32 (int32_t value) {
     if(m_endian != SYLAR_BYTE_ORDER) {
         value = byteswap(value);
     }
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFuint32(uint32_t value) {
     if(m_endian != SYLAR_BYTE_ORDER) {
         value = byteswap(value);
     }
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFint64 (int64_t value) {
     if(m_endian != SYLAR_BYTE_ORDER) {
         value = byteswap(value);
     }
-    write(&value, sizeof(value));
+    XX(value);
 }
 
 void ByteArray::writeFuint64(uint64_t value) {
     if(m_endian != SYLAR_BYTE_ORDER) {
         value = byteswap(value);
     }
-    write(&value, sizeof(value));
+    XX(value);
 }
 
+#undef XX
+
 // 对有无符号的数进行转换，都转换成连续的正数（-1 = 1, 1 = 2, -2 = 3)
 static uint32_t EncodeZigzag32(const int32_t& v) {
     if(v < 0) {
@@ -141,17 +176,27 @@ void ByteArray::writeInt32  (int32_t value) {
     writeUint32(EncodeZigzag32(value));
 }
 
-void ByteArray::writeUint32 (uint32_t value) {
-    // 这里是可压缩的数据，上限是5个字节
-    uint8_t tmp[5];
-    uint8_t i = 0;
+// 编码到 p，返回占用的字节数
+template<class T>
+static size_t EncodeVarint(uint8_t* p, T value) {
+    size_t i = 0;
     // 这是TLV协议压缩整型
     while(value >= 0x80) {
-        tmp[i++] = (value & 0x7F) | 0x80;
+        p[i++] = (value & 0x7F) | 0x80;
         value >>= 7;
     }
-    tmp[i++] = value;
-    write(tmp, i);
+    p[i++] = value;
+    return i;
+}
+
+void ByteArray::writeUint32 (uint32_t value) {
+    // 这里是可压缩的数据，上限是5个字节
+    if(char* p = writePtr(5)) {
+        advance(EncodeVarint((uint8_t*)p, value));
+        return;
+    }
+    uint8_t tmp[5];
+    write(tmp, EncodeVarint(tmp, value));
 }
 
 void ByteArray::writeInt64  (int64_t value) {
@@ -159,14 +204,12 @@ void ByteArray::writeInt64  (int64_t value) {
 }
 
 void ByteArray::writeUint64 (uint64_t value) {
-    uint8_t tmp[10];
-    uint8_t i = 0;
-    while(value >= 0x80) {
-        tmp[i++] = (value & 0x7F) | 0x80;
-        value >>= 7;
+    if(char* p = writePtr(10)) {
+        advance(EncodeVarint((uint8_t*)p, value));
+        return;
     }
-    tmp[i++] = value;
-    write(tmp, i);
+    uint8_t tmp[10];
+    write(tmp, EncodeVarint(tmp, value));
 }
 
 void ByteArray::writeFloat  (float value) {
@@ -206,21 +249,30 @@ void ByteArray::writeStringWithoutLength(const std::string& value) {
     write(value.c_str(), value.size());
 }
 
+// 数据都在当前节点里时直接从节点拷出来，省掉 read 的循环
+#define YY(v) \
+    if(const char* p = peek(sizeof(v))) { \
+        memcpy(&v, p, sizeof(v)); \
+        advance(sizeof(v)); \
+    } else { \
+        read(&v, sizeof(v)); \
+    }
+
 int8_t   ByteArray::readFint8() {
     int8_t v;
-    read(&v, sizeof(v));
+    YY(v);
     return v;
 }
 
 uint8_t  ByteArray::readFuint8() {
     uint8_t v;
-    read(&v, sizeof(v));
+    YY(v);
     return v;
 }
 
 #define XX(type) \
     type v; \
-    read(&v, sizeof(v)); \
+    YY(v); \
     if(m_endian == SYLAR_BYTE_ORDER) { \
         return v; \
     } else { \
@@ -252,6 +304,25 @@ uint64_t ByteArray::readFuint64() {
 }
 
 #undef XX
+#undef YY
+
+/**
+ * @brief 从 p 开始解码最多 max 个字节的变长整数
+ * @return 占用的字节数，n 个字节里还没结束时返回 0
+ */
+template<class T>
+static size_t DecodeVarint(const uint8_t* p, size_t n, size_t max, T& result) {
+    result = 0;
+    for(size_t i = 0; i < n && i < max; ++i) {
+        uint8_t b = p[i];
+        result |= ((T)(b & 0x7f)) << (i * 7);
+        // 和逐字节读取一样，读满 max 个字节就结束
+        if(b < 0x80 || i + 1 == max) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
 
 int32_t  ByteArray::readInt32() {
     return DecodeZigzag32(readUint32());
@@ -259,6 +330,13 @@ int32_t  ByteArray::readInt32() {
 
 uint32_t ByteArray::readUint32() {
     uint32_t result = 0;
+    const char* p = nullptr;
+    size_t n = span(p);
+    if(size_t used = DecodeVarint((const uint8_t*)p, n, 5, result)) {
+        advance(used);
+        return result;
+    }
+    result = 0;
     // 一个字节一个字节的进行压缩
     for(int i = 0; i < 32; i += 7) {
         uint8_t b = readFuint8();
@@ -278,6 +356,13 @@ int64_t  ByteArray::readInt64() {
 
 uint64_t ByteArray::readUint64() {
     uint64_t result = 0;
+    const char* p = nullptr;
+    size_t n = span(p);
+    if(size_t used = DecodeVarint((const uint8_t*)p, n, 10, result)) {
+        advance(used);
+        return result;
+    }
+    result = 0;
     for(int i = 0; i < 64; i += 7) {
         uint8_t b = readFuint8();
         if(b < 0x80) {
@@ -306,38 +391,326 @@ double   ByteArray::readDouble() {
 
 std::string ByteArray::readStringF16() {
     uint16_t len = readFuint16();
-    std::string buff;
-    buff.resize(len);
-    read(&buff[0], len);
-    return buff;
+    return readString(len);
 }
 
 std::string ByteArray::readStringF32() {
     uint32_t len = readFuint32();
-    std::string buff;
-    buff.resize(len);
-    read(&buff[0], len);
-    return buff;
+    return readString(len);
 }
 
 std::string ByteArray::readStringF64() {
     uint64_t len = readFuint64();
-    std::string buff;
-    buff.resize(len);
-    read(&buff[0], len);
-    return buff;
+    return readString(len);
 }
 
 std::string ByteArray::readStringVint() {
     uint64_t len = readUint64();
+    return readString(len);
+}
+
+std::string ByteArray::readString(size_t len) {
+    if(const char* p = peek(len)) {
+        std::string buff(p, len);
+        advance(len);
+        return buff;
+    }
     std::string buff;
     buff.resize(len);
     read(&buff[0], len);
     return buff;
 }
 
+// 每批编码的个数，编码结果最长 10 * 64 字节，放不进当前节点时先编码到栈上再 write
+static const size_t s_varint_batch = 64;
+
+// Varint 最多占用的字节数
+template<class T>
+struct VarintMax {
+    static const size_t value = (sizeof(T) * 8 + 6) / 7;
+};
+
+#if defined(__SSE2__)
+// 4 个值是否都小于 0x80
+static inline bool AllSmall(const uint32_t* in) {
+    __m128i v = _mm_loadu_si128((const __m128i*)in);
+    v = _mm_and_si128(v, _mm_set1_epi32(~0x7f));
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(v, _mm_setzero_si128())) == 0xffff;
+}
+
+static inline bool AllSmall(const uint64_t* in) {
+    __m128i a = _mm_loadu_si128((const __m128i*)in);
+    __m128i b = _mm_loadu_si128((const __m128i*)(in + 2));
+    __m128i v = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi64x(~0x7fll));
+    return _mm_movemask_epi8(_mm_cmpeq_epi32(v, _mm_setzero_si128())) == 0xffff;
+}
+
+// 取出 4 个值的低 32 位
+static inline __m128i Low32x4(const uint32_t* in) {
+    return _mm_loadu_si128((const __m128i*)in);
+}
+
+static inline __m128i Low32x4(const uint64_t* in) {
+    __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)in), _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(in + 2)), _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_unpacklo_epi64(a, b);
+}
+#endif
+
+/**
+ * @brief 把 n 个值按 Varint 编码到 out
+ * @return 编码后的长度
+ */
+template<class T>
+static size_t EncodeVarints(const T* in, size_t n, uint8_t* out) {
+    size_t k = 0;
+    size_t o = 0;
+#if defined(__SSE2__)
+    // 16 个值都是单字节时直接压成 16 个字节
+    while(n - k >= 16) {
+        if(!(AllSmall(in + k) && AllSmall(in + k + 4)
+                && AllSmall(in + k + 8) && AllSmall(in + k + 12))) {
+            for(size_t end = k + 16; k < end; ++k) {
+                o += EncodeVarint(out + o, in[k]);
+            }
+            continue;
+        }
+        __m128i lo = _mm_packs_epi32(Low32x4(in + k), Low32x4(in + k + 4));
+        __m128i hi = _mm_packs_epi32(Low32x4(in + k + 8), Low32x4(in + k + 12));
+        _mm_storeu_si128((__m128i*)(out + o), _mm_packus_epi16(lo, hi));
+        k += 16;
+        o += 16;
+    }
+#endif
+    for(; k < n; ++k) {
+        o += EncodeVarint(out + o, in[k]);
+    }
+    return o;
+}
+
+/**
+ * @brief 从 [p, p + len) 里解码最多 n 个值，只解完整的值
+ * @param[out] count 解出的个数
+ * @return 消耗的字节数
+ */
+template<class T>
+static size_t DecodeVarints(const uint8_t* p, size_t len, T* out, size_t n, size_t& count) {
+    static const size_t s_max = VarintMax<T>::value;
+    size_t i = 0;
+    size_t k = 0;
+#if defined(__SSE2__)
+    while(len - i >= 16 && k < n) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        uint32_t mask = _mm_movemask_epi8(v);
+        if(mask == 0 && n - k >= 16) {
+            // 16 个单字节的值，零扩展后直接存
+            __m128i zero = _mm_setzero_si128();
+            __m128i lo = _mm_unpacklo_epi8(v, zero);
+            __m128i hi = _mm_unpackhi_epi8(v, zero);
+            if(sizeof(T) == 4) {
+                _mm_storeu_si128((__m128i*)(out + k), _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128((__m128i*)(out + k + 4), _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128((__m128i*)(out + k + 8), _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128((__m128i*)(out + k + 12), _mm_unpackhi_epi16(hi, zero));
+            } else {
+                for(int j = 0; j < 16; ++j) {
+                    out[k + j] = p[i + j];
+                }
+            }
+            i += 16;
+            k += 16;
+            continue;
+        }
+        // 最高位为 0 的字节是一个值的结尾，按结尾位置把每个值拼出来
+        uint32_t ends = ~mask & 0xffff;
+        size_t start = 0;
+        while(ends && k < n) {
+            size_t end = __builtin_ctz(ends);
+            ends &= ends - 1;
+            size_t vlen = end - start + 1;
+            if(vlen > s_max) {
+                break;
+            }
+            T result = 0;
+            for(size_t j = 0; j < vlen; ++j) {
+                result |= ((T)(p[i + start + j] & 0x7f)) << (j * 7);
+            }
+            out[k++] = result;
+            start = end + 1;
+        }
+        i += start;
+        if(k < n && (ends || start == 0)) {
+            // 超长的值(和逐字节读一样读满 s_max 个字节就结束)，或者 16 个字节里没有结尾
+            size_t used = DecodeVarint(p + i, len - i, s_max, out[k]);
+            if(!used) {
+                break;
+            }
+            i += used;
+            ++k;
+        }
+    }
+#endif
+    while(k < n && i < len) {
+        size_t used = DecodeVarint(p + i, len - i, s_max, out[k]);
+        if(!used) {
+            break;
+        }
+        i += used;
+        ++k;
+    }
+    count = k;
+    return i;
+}
+
+template<class T>
+void ByteArray::writeVarints(const T* values, size_t n) {
+    static const size_t s_max = VarintMax<T>::value * s_varint_batch;
+    while(n > 0) {
+        size_t m = std::min(n, s_varint_batch);
+        if(char* p = writePtr(s_max)) {
+            advance(EncodeVarints(values, m, (uint8_t*)p));
+        } else {
+            uint8_t tmp[s_max];
+            write(tmp, EncodeVarints(values, m, tmp));
+        }
+        values += m;
+        n -= m;
+    }
+}
+
+template<class T>
+void ByteArray::readVarints(T* values, size_t n) {
+    size_t k = 0;
+    while(k < n) {
+        const char* p = nullptr;
+        size_t len = span(p);
+        size_t count = 0;
+        size_t used = DecodeVarints((const uint8_t*)p, len, values + k, n - k, count);
+        if(count > 0) {
+            advance(used);
+            k += count;
+        } else if(sizeof(T) == 4) {
+            // 这个值跨了节点
+            values[k++] = readUint32();
+        } else {
+            values[k++] = readUint64();
+        }
+    }
+}
+
+void ByteArray::writeUint32Array(const uint32_t* values, size_t n) {
+    writeVarints(values, n);
+}
+
+void ByteArray::writeUint64Array(const uint64_t* values, size_t n) {
+    writeVarints(values, n);
+}
+
+void ByteArray::writeInt32Array(const int32_t* values, size_t n) {
+    uint32_t tmp[s_varint_batch];
+    while(n > 0) {
+        size_t m = std::min(n, s_varint_batch);
+        for(size_t i = 0; i < m; ++i) {
+            tmp[i] = EncodeZigzag32(values[i]);
+        }
+        writeVarints(tmp, m);
+        values += m;
+        n -= m;
+    }
+}
+
+void ByteArray::writeInt64Array(const int64_t* values, size_t n) {
+    uint64_t tmp[s_varint_batch];
+    while(n > 0) {
+        size_t m = std::min(n, s_varint_batch);
+        for(size_t i = 0; i < m; ++i) {
+            tmp[i] = EncodeZigzag64(values[i]);
+        }
+        writeVarints(tmp, m);
+        values += m;
+        n -= m;
+    }
+}
+
+void ByteArray::readUint32Array(uint32_t* values, size_t n) {
+    readVarints(values, n);
+}
+
+void ByteArray::readUint64Array(uint64_t* values, size_t n) {
+    readVarints(values, n);
+}
+
+void ByteArray::readInt32Array(int32_t* values, size_t n) {
+    readVarints((uint32_t*)values, n);
+    for(size_t i = 0; i < n; ++i) {
+        values[i] = DecodeZigzag32(values[i]);
+    }
+}
+
+void ByteArray::readInt64Array(int64_t* values, size_t n) {
+    readVarints((uint64_t*)values, n);
+    for(size_t i = 0; i < n; ++i) {
+        values[i] = DecodeZigzag64(values[i]);
+    }
+}
+
+template<class T>
+void ByteArray::writeFixedArray(const T* values, size_t n) {
+    if(m_endian == SYLAR_BYTE_ORDER) {
+        write(values, n * sizeof(T));
+        return;
+    }
+    // 分批换字节序，循环简单，-O3 下编译器会向量化
+    static const size_t s_batch = 256;
+    T tmp[s_batch];
+    while(n > 0) {
+        size_t m = std::min(n, s_batch);
+        for(size_t i = 0; i < m; ++i) {
+            tmp[i] = byteswap(values[i]);
+        }
+        write(tmp, m * sizeof(T));
+        values += m;
+        n -= m;
+    }
+}
+
+template<class T>
+void ByteArray::readFixedArray(T* values, size_t n) {
+    read(values, n * sizeof(T));
+    if(m_endian != SYLAR_BYTE_ORDER) {
+        for(size_t i = 0; i < n; ++i) {
+            values[i] = byteswap(values[i]);
+        }
+    }
+}
+
+void ByteArray::writeFuint16Array(const uint16_t* values, size_t n) {
+    writeFixedArray(values, n);
+}
+
+void ByteArray::writeFuint32Array(const uint32_t* values, size_t n) {
+    writeFixedArray(values, n);
+}
+
+void ByteArray::writeFuint64Array(const uint64_t* values, size_t n) {
+    writeFixedArray(values, n);
+}
+
+void ByteArray::readFuint16Array(uint16_t* values, size_t n) {
+    readFixedArray(values, n);
+}
+
+void ByteArray::readFuint32Array(uint32_t* values, size_t n) {
+    readFixedArray(values, n);
+}
+
+void ByteArray::readFuint64Array(uint64_t* values, size_t n) {
+    readFixedArray(values, n);
+}
+
 // 相当于是析构函数，只留一个节点
 void ByteArray::clear() {
+    closeMapFile();
     m_position = m_size = 0;
     m_capacity = m_baseSize;
     Node* tmp = m_root->next;
@@ -346,7 +719,14 @@ void ByteArray::clear() {
         tmp = tmp->next;
         delete m_cur;
     }
+    // 根节点被截断过、是写入 Slice 时接进来的或者是文件映射，换回一个完整的节点
+    if(m_root->size != m_baseSize || m_root->ptr != m_root->block->data()
+            || m_root->block->isMapped()) {
+        delete m_root;
+        m_root = new Node(m_baseSize);
+    }
     m_cur = m_root;
+    m_curStart = 0;
     m_root->next = NULL;
 }
 
@@ -356,27 +736,21 @@ void ByteArray::write(const void* buf, size_t size) {
     }
     addCapacity(size);
 
-    // 当前节点的位置，容量，写入的偏移量
-    size_t npos = m_position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
+    // 当前节点内的偏移量，已经写入的偏移量
+    size_t npos = m_position - m_curStart;
     size_t bpos = 0;
 
     while(size > 0) {
-        if(ncap >= size) {
-            memcpy(m_cur->ptr + npos, (const char*)buf + bpos, size);
-            if(m_cur->size == (npos + size)) {
-                m_cur = m_cur->next;
-            }
-            m_position += size;
-            bpos += size;
-            size = 0;
-        } else {
-            memcpy(m_cur->ptr + npos, (const char*)buf + bpos, ncap);
-            m_position += ncap;
-            bpos += ncap;
-            size -= ncap;
+        makeWritable(m_cur, npos);
+        size_t len = std::min(m_cur->size - npos, size);
+        memcpy(m_cur->ptr + npos, (const char*)buf + bpos, len);
+        m_position += len;
+        bpos += len;
+        size -= len;
+        npos += len;
+        if(npos == m_cur->size) {
+            m_curStart += m_cur->size;
             m_cur = m_cur->next;
-            ncap = m_cur->size;
             npos = 0;
         }
     }
@@ -391,62 +765,169 @@ void ByteArray::read(void* buf, size_t size) {
         throw std::out_of_range("not enough len");
     }
 
-    // 当前节点的位置，容量，写入的偏移量
-    size_t npos = m_position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
+    size_t npos = m_position - m_curStart;
     size_t bpos = 0;
     while(size > 0) {
-        if(ncap >= size) {
-            memcpy((char*)buf + bpos, m_cur->ptr + npos, size);
-            if(m_cur->size == (npos + size)) {
-                m_cur = m_cur->next;
-            }
-            m_position += size;
-            bpos += size;
-            size = 0;
-        } else {
-            memcpy((char*)buf + bpos, m_cur->ptr + npos, ncap);
-            m_position += ncap;
-            bpos += ncap;
-            size -= ncap;
+        size_t len = std::min(m_cur->size - npos, size);
+        memcpy((char*)buf + bpos, m_cur->ptr + npos, len);
+        m_position += len;
+        bpos += len;
+        size -= len;
+        npos += len;
+        if(npos == m_cur->size) {
+            m_curStart += m_cur->size;
             m_cur = m_cur->next;
-            ncap = m_cur->size;
             npos = 0;
         }
     }
 }
 
 void ByteArray::read(void* buf, size_t size, size_t position) const {
-    if(size > (m_size - position)) {
+    if(position > m_size || size > (m_size - position)) {
         throw std::out_of_range("not enough len");
     }
 
-    size_t npos = position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
-    size_t bpos = 0;
+    size_t npos = 0;
     // 多了一个 cur 来存储当前的节点位置
-    Node* cur = m_cur;
+    Node* cur = findNode(position, npos);
+    size_t bpos = 0;
     while(size > 0) {
-        if(ncap >= size) {
-            memcpy((char*)buf + bpos, cur->ptr + npos, size);
-            if(cur->size == (npos + size)) {
-                cur = cur->next;
-            }
-            position += size;
-            bpos += size;
-            size = 0;
+        size_t len = std::min(cur->size - npos, size);
+        memcpy((char*)buf + bpos, cur->ptr + npos, len);
+        bpos += len;
+        size -= len;
+        cur = cur->next;
+        npos = 0;
+    }
+}
+
+Slice ByteArray::slice(size_t len, size_t position) const {
+    if(position > m_size || len > (m_size - position)) {
+        throw std::out_of_range("not enough len");
+    }
+    Slice result;
+    if(m_mapFd >= 0) {
+        // 写文件映射时节点要和文件一一对应：冻结映射的节点之后，再往这里写会把节点复制到匿名内存，
+        // 写入的数据就到不了文件；所以和 write(Slice) 一样改成拷贝
+        if(len > 0) {
+            BufferBlock* block = BufferBlock::Alloc(len);
+            read(block->data(), len, position);
+            result.append(block, block->data(), len);
+            block->unref();
+        }
+        return result;
+    }
+    size_t npos = 0;
+    Node* cur = findNode(position, npos);
+    while(len > 0) {
+        size_t n = std::min(cur->size - npos, len);
+        result.append(cur->block, cur->ptr + npos, n);
+        len -= n;
+        cur = cur->next;
+        npos = 0;
+    }
+    return result;
+}
+
+Slice ByteArray::readSlice(size_t len) {
+    Slice result = slice(len, m_position);
+    setPosition(m_position + len);
+    return result;
+}
+
+void ByteArray::write(const Slice& s) {
+    // 小数据接一个节点不划算，读的时候还要多走节点
+    static const size_t s_min_link = 256;
+    if(m_position != m_size || s.size() < s_min_link || m_mapFd >= 0) {
+        for(auto& i : s.getPieces()) {
+            write(i.ptr, i.len);
+        }
+        return;
+    }
+
+    // 当前节点在 m_position 处截断，接上 Slice 的各段，原来还没用到的节点接在最后
+    Node* prev = cutAtPosition();
+    Node* next = prev ? prev->next : m_root;
+    for(auto& i : s.getPieces()) {
+        Node* node = new Node(i.block, i.ptr, i.len);
+        if(prev) {
+            prev->next = node;
         } else {
-            memcpy((char*)buf + bpos, cur->ptr + npos, ncap);
-            position += ncap;
-            bpos += ncap;
-            size -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
+            m_root = node;
         }
+        prev = node;
+    }
+    prev->next = next;
+    m_capacity += s.size();
+    m_position += s.size();
+    m_size = m_position;
+    m_cur = next;
+    m_curStart = m_position;
+}
+
+ByteArray::Node* ByteArray::cutAtPosition() {
+    size_t npos = m_position - m_curStart;
+    if(m_cur && npos > 0) {
+        m_capacity -= m_cur->size - npos;
+        m_cur->size = npos;
+        return m_cur;
+    }
+    if(m_cur == m_root) {
+        return nullptr;
+    }
+    Node* prev = m_root;
+    while(prev->next != m_cur) {
+        prev = prev->next;
+    }
+    return prev;
+}
+
+void ByteArray::skip(size_t len) {
+    if(len > getReadSize()) {
+        throw std::out_of_range("not enough len");
+    }
+    if(m_cur && m_position - m_curStart + len <= m_cur->size) {
+        advance(len);
+    } else {
+        setPosition(m_position + len);
     }
 }
 
+char* ByteArray::reserve(size_t len) {
+    if(char* p = writePtr(len)) {
+        return p;
+    }
+    if(m_position != m_size || m_mapFd >= 0) {
+        return nullptr;
+    }
+    // 当前节点剩下的放不下，截断后接一个新节点，后面没用到的节点接在新节点后面
+    Node* prev = cutAtPosition();
+    Node* node = new Node(std::max(len, m_baseSize));
+    if(prev) {
+        node->next = prev->next;
+        prev->next = node;
+    } else {
+        node->next = m_root;
+        m_root = node;
+    }
+    m_capacity += node->size;
+    m_cur = node;
+    m_curStart = m_position;
+    return node->ptr;
+}
+
+char* ByteArray::writePtr(size_t len) {
+    if(!m_cur) {
+        return nullptr;
+    }
+    size_t npos = m_position - m_curStart;
+    if(npos + len > m_cur->size) {
+        return nullptr;
+    }
+    makeWritable(m_cur, npos);
+    return m_cur->ptr + npos;
+}
+
 void ByteArray::setPosition(size_t v) {
     if(v > m_capacity) {
         throw std::out_of_range("set_position out of range");
@@ -455,60 +936,234 @@ void ByteArray::setPosition(size_t v) {
     if(m_position > m_size) {
         m_size = m_position;
     }
-    m_cur = m_root;
-    while(v > m_cur->size) {
-        v -= m_cur->size;
-        m_cur = m_cur->next;
+    m_cur = findNode(v, v);
+    m_curStart = m_position - v;
+}
+
+ByteArray::Node* ByteArray::findNode(size_t position, size_t& npos) const {
+    // 往后找可以从当前节点开始
+    Node* cur = m_root;
+    size_t start = 0;
+    if(m_cur && position >= m_curStart) {
+        cur = m_cur;
+        start = m_curStart;
+    }
+    while(cur && position >= start + cur->size) {
+        start += cur->size;
+        cur = cur->next;
     }
-    if(v == m_cur->size) {
-        m_cur = m_cur->next;
+    npos = position - start;
+    return cur;
+}
+
+void ByteArray::makeWritable(Node* node, size_t npos) {
+    BufferBlock* block = node->block;
+    if(!block->isReadOnly() && (!block->isShared()
+            || (size_t)(node->ptr - block->data()) + npos >= block->getFrozen())) {
+        return;
     }
+    BufferBlock* copy = BufferBlock::Alloc(node->size);
+    memcpy(copy->data(), node->ptr, node->size);
+    block->unref();
+    node->block = copy;
+    node->ptr = copy->data();
 }
 
 bool ByteArray::writeToFile(const std::string& name) const {
-    // 首先先打开文件
-    std::ofstream ofs;
-    ofs.open(name, std::ios::trunc | std::ios::binary);
-    if(!ofs) {
+    // 首先先打开文件，在协程里磁盘 IO 只挂起当前协程
+    FileIOManager* fio = FileIOMgr::GetInstance();
+    int fd = fio->open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0) {
         SYLAR_LOG_ERROR(g_logger) << "writeToFile name=" << name
             << " error , errno=" << errno << " errstr=" << strerror(errno);
         return false;
     }
 
-    int64_t read_size = getReadSize();
-    int64_t pos = m_position;
-    Node* cur = m_cur;
-
-    while(read_size > 0) {
-        // 取出偏移量，再获取长度（如果读取的长度 > 链表的长度，那么就取链表的长度）
-        int diff = pos % m_baseSize;
-        int64_t len = (read_size > (int64_t)m_baseSize ? m_baseSize : read_size) - diff;
-        ofs.write(cur->ptr + diff, len);
-        cur = cur->next;
-        pos += len;
-        read_size -= len;
+    std::vector<iovec> iovs;
+    getReadBuffers(iovs);
+    off_t offset = 0;
+    for(auto& iov : iovs) {
+        size_t done = 0;
+        while(done < iov.iov_len) {
+            ssize_t n = fio->pwrite(fd, (const char*)iov.iov_base + done, iov.iov_len - done, offset);
+            if(n < 0) {
+                SYLAR_LOG_ERROR(g_logger) << "writeToFile name=" << name
+                    << " error , errno=" << errno << " errstr=" << strerror(errno);
+                ::close(fd);
+                return false;
+            }
+            done += n;
+            offset += n;
+        }
     }
 
+    ::close(fd);
     return true;
 }
 
 bool ByteArray::readFromFile(const std::string& name) {
-    std::ifstream ifs;
-    ifs.open(name, std::ios::binary);
-    if(!ifs) {
+    FileIOManager* fio = FileIOMgr::GetInstance();
+    int fd = fio->open(name, O_RDONLY);
+    if(fd < 0) {
         SYLAR_LOG_ERROR(g_logger) << "readFromFile name=" << name
             << " error, errno=" << errno << " errstr=" << strerror(errno);
         return false;
     }
 
-    std::shared_ptr<char> buff(new char[m_baseSize], [](char* ptr) { delete[] ptr;});
-    while(!ifs.eof()) {
-        ifs.read(buff.get(), m_baseSize);
-        write(buff.get(), ifs.gcount());
+    // 按文件大小一次扩容，直接读进节点，不经过临时缓冲区
+    struct stat st;
+    size_t want = fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size : m_baseSize;
+    off_t offset = 0;
+    bool eof = false;
+    while(!eof) {
+        std::vector<iovec> iovs;
+        getWriteBuffers(iovs, want);
+        size_t got = 0;
+        for(auto& iov : iovs) {
+            size_t done = 0;
+            while(done < iov.iov_len) {
+                ssize_t n = fio->pread(fd, (char*)iov.iov_base + done, iov.iov_len - done, offset);
+                if(n < 0) {
+                    SYLAR_LOG_ERROR(g_logger) << "readFromFile name=" << name
+                        << " error, errno=" << errno << " errstr=" << strerror(errno);
+                    ::close(fd);
+                    return false;
+                }
+                if(n == 0) {
+                    eof = true;
+                    break;
+                }
+                done += n;
+                offset += n;
+            }
+            got += done;
+            if(eof) {
+                break;
+            }
+        }
+        setPosition(m_position + got);
+        // 读的过程中文件变长了，按节点大小继续读到结尾
+        want = m_baseSize;
     }
+    ::close(fd);
     return true;
 }
 
+bool ByteArray::mapFromFile(const std::string& name, bool sequential) {
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        SYLAR_LOG_ERROR(g_logger) << "mapFromFile name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        if(fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    clear();
+    size_t size = st.st_size;
+    if(size == 0) {
+        ::close(fd);
+        return true;
+    }
+    // 映射建立之后就不需要句柄了
+    BufferBlock* block = BufferBlock::Map(fd, 0, size, false);
+    int err = errno;
+    ::close(fd);
+    if(!block) {
+        SYLAR_LOG_ERROR(g_logger) << "mapFromFile mmap name=" << name
+            << " size=" << size << " error, errno=" << err << " errstr=" << strerror(err);
+        return false;
+    }
+    madvise(block->data(), size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+    Node* node = new Node(block, block->data(), size);
+    block->unref();
+    delete m_root;
+    m_root = m_cur = node;
+    m_curStart = 0;
+    m_capacity = m_size = size;
+    return true;
+}
+
+bool ByteArray::mapToFile(const std::string& name) {
+    clear();
+    int fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "mapToFile name=" << name
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    m_mapFd = fd;
+    m_mapSize = 0;
+    Node* node = nullptr;
+    try {
+        node = newNode();
+    } catch(...) {
+        closeMapFile();
+        return false;
+    }
+    delete m_root;
+    m_root = m_cur = node;
+    m_curStart = 0;
+    m_capacity = node->size;
+    return true;
+}
+
+bool ByteArray::syncFile() {
+    if(m_mapFd < 0) {
+        return false;
+    }
+    size_t left = m_size;
+    for(Node* cur = m_root; cur && left > 0; cur = cur->next) {
+        size_t len = std::min(cur->size, left);
+        if(msync(cur->ptr, len, MS_SYNC) != 0) {
+            SYLAR_LOG_ERROR(g_logger) << "syncFile msync error, errno=" << errno
+                << " errstr=" << strerror(errno);
+            return false;
+        }
+        left -= len;
+    }
+    return true;
+}
+
+ByteArray::Node* ByteArray::newNode() {
+    if(m_mapFd < 0) {
+        return new Node(m_baseSize);
+    }
+    // 每段至少 1MB，按页对齐，避免频繁 ftruncate/mmap
+    static const size_t s_min_chunk = 1024 * 1024;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = (std::max(m_baseSize, s_min_chunk) + page - 1) / page * page;
+    BufferBlock* block = nullptr;
+    if(ftruncate(m_mapFd, m_mapSize + len) == 0) {
+        block = BufferBlock::Map(m_mapFd, m_mapSize, len, true);
+    }
+    if(!block) {
+        SYLAR_LOG_ERROR(g_logger) << "mapToFile extend to " << m_mapSize + len
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+        throw std::runtime_error("map file extend fail");
+    }
+    m_mapSize += len;
+    Node* node = new Node(block, block->data(), len);
+    block->unref();
+    return node;
+}
+
+void ByteArray::closeMapFile() {
+    if(m_mapFd < 0) {
+        return;
+    }
+    // 去掉末尾预分配的空间。已经切出去的 Slice 都在 m_size 以内，不会访问到截掉的页
+    if(ftruncate(m_mapFd, m_size) != 0) {
+        SYLAR_LOG_ERROR(g_logger) << "mapToFile truncate to " << m_size
+            << " error, errno=" << errno << " errstr=" << strerror(errno);
+    }
+    ::close(m_mapFd);
+    m_mapFd = -1;
+    m_mapSize = 0;
+}
+
 void ByteArray::addCapacity(size_t size) {
     if(size == 0) {
         return;
@@ -518,26 +1173,26 @@ void ByteArray::addCapacity(size_t size) {
         return;
     }
 
-    size = size - old_cap;
-    // size_t count = ceil(1.0 * size / m_baseSize);
-    size_t count = (size / m_baseSize) + (((size % m_baseSize) > old_cap) ? 1 : 0);
     Node* tmp = m_root;
     while(tmp->next) {
         tmp = tmp->next;
     }
 
     Node* first = NULL;
-    for(size_t i = 0; i < count; ++i) {
-        tmp->next = new Node(m_baseSize);
+    // mapToFile 之后节点按段映射，不一定是 m_baseSize，按实际大小累加
+    while(getCapacity() < size) {
+        tmp->next = newNode();
         if(first == NULL) {
             first = tmp->next;
         }
         tmp = tmp->next;
-        m_capacity += m_baseSize;
+        m_capacity += tmp->size;
     }
 
+    // 原来正好写满，当前节点是空的
     if(old_cap == 0) {
         m_cur = first;
+        m_curStart = m_position;
     }
 }
 
@@ -567,69 +1222,31 @@ std::string ByteArray::toHexString() const {
 }
 
 uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len) const {
-    len = len > getReadSize() ? getReadSize() : len;
-    if(len == 0) {
-        return 0;
-    }
-
-    uint64_t size = len;
-
-    size_t npos = m_position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
-    struct iovec iov;
-    Node* cur = m_cur;
-
-    while(len > 0) {
-        // 如果当前的容量 > len，那么就可以全部读完
-        if(ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        } else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
-        buffers.push_back(iov);
-    }
-    return size;
+    return getReadBuffers(buffers, len, m_position);
 }
 
 uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers
                                 ,uint64_t len, uint64_t position) const {
-    len = len > getReadSize() ? getReadSize() : len;
+    if(position > m_size) {
+        return 0;
+    }
+    len = len > (m_size - position) ? (m_size - position) : len;
     if(len == 0) {
         return 0;
     }
 
     uint64_t size = len;
-
-    size_t npos = position % m_baseSize;
-    size_t count = position / m_baseSize;
-    Node* cur = m_root;
-    while(count > 0) {
-        cur = cur->next;
-        --count;
-    }
-
-    size_t ncap = cur->size - npos;
+    size_t npos = 0;
+    Node* cur = findNode(position, npos);
     struct iovec iov;
     while(len > 0) {
-        if(ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        } else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
+        // 如果当前的容量 > len，那么就可以全部读完
+        size_t ncap = cur->size - npos;
+        iov.iov_base = cur->ptr + npos;
+        iov.iov_len = ncap >= len ? len : ncap;
+        len -= iov.iov_len;
+        cur = cur->next;
+        npos = 0;
         buffers.push_back(iov);
     }
     return size;
@@ -642,27 +1259,21 @@ uint64_t ByteArray::getWriteBuffers(std::vector<iovec>& buffers, uint64_t len) {
     addCapacity(len);
     uint64_t size = len;
 
-    size_t npos = m_position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
+    size_t npos = m_position - m_curStart;
     struct iovec iov;
     Node* cur = m_cur;
     while(len > 0) {
-        if(ncap >= len) {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = len;
-            len = 0;
-        } else {
-            iov.iov_base = cur->ptr + npos;
-            iov.iov_len = ncap;
-
-            len -= ncap;
-            cur = cur->next;
-            ncap = cur->size;
-            npos = 0;
-        }
+        // 交出去的内存会被直接写入，被 Slice 引用的部分先换成私有拷贝
+        makeWritable(cur, npos);
+        size_t ncap = cur->size - npos;
+        iov.iov_base = cur->ptr + npos;
+        iov.iov_len = ncap >= len ? len : ncap;
+        len -= iov.iov_len;
+        cur = cur->next;
+        npos = 0;
         buffers.push_back(iov);
     }
     return size;
 }
 
-}
\ No newline at end of file
+}
@@ -7,6 +7,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <vector>
+#include <algorithm>
+#include "slice.h"
 
 namespace sylar {
 
@@ -15,16 +17,23 @@ class ByteArray {
 public:
     typedef std::shared_ptr<ByteArray> ptr;
 
-    // ByteArray的存储节点,采用链表的方式
+    /**
+     * @brief ByteArray的存储节点,采用链表的方式
+     * @details 内存来自引用计数的 BufferBlock。自己分配的节点大小是 m_baseSize，
+     *          写入 Slice 时接进来的节点引用别人的内存块，大小不固定
+     */
     struct Node {
-        // 构造指定大小的内存块, s 内存块字节数
+        // 构造指定大小的内存块, s 内存块字节数，从当前线程的 slab 池分配
         Node(size_t s);
+        // 引用 block 里从 p 开始的 s 个字节，不拷贝
+        Node(BufferBlock* b, char* p, size_t s);
         Node();
         ~Node();
-   
-        char* ptr;      // 内存块地址指针
-        Node* next;     // 下一个内存块地址 
-        size_t size;    // 内存块大小
+
+        char* ptr;              // 内存块地址指针
+        Node* next;             // 下一个内存块地址 
+        size_t size;            // 内存块大小
+        BufferBlock* block;     // ptr 所在的内存块
     };
 
     /**
@@ -102,6 +111,26 @@ public:
     void writeStringWithoutLength(const std::string& value);
 
 
+    /**
+     * @brief 批量写入无符号Varint32数组,不写长度
+     * @details 编码结果和逐个调用 writeUint32 完全一样，可以混着读写。
+     *          一次编码一批直接写进节点，全是单字节的值时用 SSE2 一次编码 16 个
+     * @post m_position += 编码后的总长度
+     */
+    void writeUint32Array(const uint32_t* values, size_t n);
+    void writeUint64Array(const uint64_t* values, size_t n);
+    // 有符号数组，先 zigzag 再按 Varint 编码，和逐个调用 writeInt32/writeInt64 一样
+    void writeInt32Array (const int32_t* values, size_t n);
+    void writeInt64Array (const int64_t* values, size_t n);
+
+    /**
+     * @brief 批量写入定长数组,按当前字节序,不写长度
+     * @details 字节序和本机相同时整块写入。有符号数组转成对应的无符号指针传入即可
+     */
+    void writeFuint16Array(const uint16_t* values, size_t n);
+    void writeFuint32Array(const uint32_t* values, size_t n);
+    void writeFuint64Array(const uint64_t* values, size_t n);
+
     /**
      * @brief 读取int8_t类型的数据
      * @pre getReadSize() >= sizeof(int8_t)
@@ -157,6 +186,25 @@ public:
      */
     std::string readStringVint();
 
+    /**
+     * @brief 批量读取 n 个无符号Varint32
+     * @details 在节点里连续的数据一次解码一批，16 个字节都是单字节的值时用 SSE2 一次解出 16 个，
+     *          其余按字节掩码找到每个值的结尾再拼出来；跨节点的值按 readUint32 读
+     * @exception 数据不够 n 个时抛出 std::out_of_range，已经读出的值留在 values 里
+     */
+    void readUint32Array(uint32_t* values, size_t n);
+    void readUint64Array(uint64_t* values, size_t n);
+    void readInt32Array (int32_t* values, size_t n);
+    void readInt64Array (int64_t* values, size_t n);
+
+    /**
+     * @brief 批量读取定长数组
+     * @exception 如果getReadSize() < n * sizeof(值) 抛出 std::out_of_range
+     */
+    void readFuint16Array(uint16_t* values, size_t n);
+    void readFuint32Array(uint32_t* values, size_t n);
+    void readFuint64Array(uint64_t* values, size_t n);
+
     /**
      * @brief 清空ByteArray
      * @post m_position = 0, m_size = 0
@@ -189,6 +237,80 @@ public:
      */
     void read(void* buf, size_t size, size_t position) const;
 
+    /**
+     * @brief 把 [position, position + len) 切成 Slice，不拷贝，不改变 m_position
+     * @details 切出去的数据被冻结，之后 ByteArray 再往这段位置写时会先把节点复制一份，
+     *          Slice 看到的内容不会变；在后面继续追加数据不受影响。
+     *          mapToFile 之后映射的节点不能脱离文件，这时拷贝一份数据
+     * @exception 如果 (m_size - position) < len 则抛出 std::out_of_range
+     */
+    Slice slice(size_t len, size_t position) const;
+
+    /**
+     * @brief 从当前位置切出 len 字节的 Slice，不拷贝
+     * @post m_position += len
+     * @exception 如果getReadSize() < len 则抛出 std::out_of_range
+     */
+    Slice readSlice(size_t len);
+
+    /**
+     * @brief 写入 Slice
+     * @details 在末尾写入(m_position == m_size)并且不小于 256 字节时直接把 Slice 的内存块接到链表里，
+     *          不拷贝；否则按普通 write 拷贝
+     * @post m_position += s.size(), 如果m_position > m_size 则 m_size = m_position
+     */
+    void write(const Slice& s);
+
+    /**
+     * @brief 当前位置起的 len 字节在同一个节点里时返回它们的地址，不改变 m_position
+     * @details 跨节点或者可读数据不足 len 时返回 nullptr，调用方改用 read 拷贝出来。
+     *          返回的地址在下一次修改 ByteArray 之前有效
+     */
+    const char* peek(size_t len) const {
+        size_t npos = m_position - m_curStart;
+        if(len <= m_size - m_position && m_cur && npos + len <= m_cur->size) {
+            return m_cur->ptr + npos;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief 当前位置起在同一个节点里连续可读的数据
+     * @param[out] ptr 数据地址
+     * @return 连续可读的字节数，没有可读数据时返回 0
+     */
+    size_t span(const char*& ptr) const {
+        if(m_position == m_size || !m_cur) {
+            ptr = nullptr;
+            return 0;
+        }
+        size_t npos = m_position - m_curStart;
+        ptr = m_cur->ptr + npos;
+        return std::min(m_cur->size - npos, m_size - m_position);
+    }
+
+    /**
+     * @brief 跳过 len 字节
+     * @post m_position += len
+     * @exception 如果getReadSize() < len 则抛出 std::out_of_range
+     */
+    void skip(size_t len);
+
+    /**
+     * @brief 在当前位置预留 len 字节的连续内存，直接在里面编码，写完后用 commit 提交
+     * @details 当前节点放得下时直接返回节点里的地址；放不下并且在末尾写入(m_position == m_size)时，
+     *          在当前位置截断节点，接一个至少 len 字节的新节点；在已有数据中间放不下时返回 nullptr
+     * @return 可写入的地址，commit 或者下一次修改 ByteArray 之前有效
+     */
+    char* reserve(size_t len);
+
+    /**
+     * @brief 提交 reserve 之后实际写入的 len 字节
+     * @pre len 不超过 reserve 的长度
+     * @post m_position += len, 如果m_position > m_size 则 m_size = m_position
+     */
+    void commit(size_t len) { advance(len);}
+
     // 返回ByteArray当前位置
     size_t getPosition() const { return m_position;}
     /**
@@ -203,6 +325,31 @@ public:
     //从文件中读取数据
     bool readFromFile(const std::string& name);
 
+    /**
+     * @brief 把文件映射成 ByteArray 的数据，不拷贝
+     * @details 原有数据被清空，整个文件成为一个只读节点，m_position = 0, m_size = 文件大小。
+     *          之后在末尾追加照常分配新节点；在映射的范围里写时先把整个节点复制一份，应尽量避免。
+     *          sequential 为 true 时 madvise(MADV_SEQUENTIAL) 加大预读并尽早回收读过的页，
+     *          为 false 时 MADV_RANDOM 关闭预读
+     * @attention 缺页是同步的磁盘读，在协程里会阻塞整个线程；冷数据并且在 IO 线程里读时用 readFromFile
+     */
+    bool mapFromFile(const std::string& name, bool sequential = true);
+
+    /**
+     * @brief 以文件映射的方式写文件
+     * @details 清空数据并截断文件，之后的节点都是文件的 MAP_SHARED 映射，写入直接进页缓存，
+     *          容量不够时 ftruncate 扩展文件再映射一段。为了保证节点和文件一一对应，
+     *          写入 Slice 和切出 Slice 时都拷贝数据，reserve 在当前节点放不下时返回 nullptr。
+     *          clear() 或析构时把文件截断到 getSize() 并关闭
+     */
+    bool mapToFile(const std::string& name);
+
+    /**
+     * @brief 把 mapToFile 之后写入的数据 msync 到磁盘
+     * @details 文件在关闭之前末尾可能还有预分配的空间
+     */
+    bool syncFile();
+
     // 返回内存块的大小
     size_t getBaseSize() const { return m_baseSize;}
     // 返回可读取数据大小
@@ -250,8 +397,43 @@ public:
 private:
     // 扩容ByteArray,使其可以容纳size个数据(如果原本可以可以容纳,则不扩容)
     void addCapacity(size_t size);
+    // 分配一个新节点，mapToFile 之后是文件的下一段映射
+    Node* newNode();
+    // 结束 mapToFile，把文件截断到 m_size 并关闭
+    void closeMapFile();
     // 获取当前的可写入容量
     size_t getCapacity() const { return m_capacity - m_position;}
+    // 找到 position 所在的节点，npos 返回节点内的偏移；position == m_capacity 时返回 nullptr
+    Node* findNode(size_t position, size_t& npos) const;
+    // 要在节点的 npos 处写入：这个位置已经被 Slice 引用时先把节点换成一份私有的拷贝
+    void makeWritable(Node* node, size_t npos);
+    // 当前位置起的 len 字节在 m_cur 里并且可以原地写时返回地址，否则返回 nullptr
+    char* writePtr(size_t len);
+    // 在 m_cur 里前进 len 字节，走到节点末尾时切到下一个节点
+    void advance(size_t len) {
+        m_position += len;
+        if(m_cur && m_position - m_curStart == m_cur->size) {
+            m_curStart += m_cur->size;
+            m_cur = m_cur->next;
+        }
+        if(m_position > m_size) {
+            m_size = m_position;
+        }
+    }
+    // 在 m_position(== m_size) 处截断当前节点，返回新节点要接在哪个节点后面，nullptr 表示接在最前面
+    Node* cutAtPosition();
+    // 读取 len 字节的字符串
+    std::string readString(size_t len);
+    // 批量 Varint 编解码的实现，T 为 uint32_t 或 uint64_t
+    template<class T>
+    void writeVarints(const T* values, size_t n);
+    template<class T>
+    void readVarints(T* values, size_t n);
+    // 定长数组的实现
+    template<class T>
+    void writeFixedArray(const T* values, size_t n);
+    template<class T>
+    void readFixedArray(T* values, size_t n);
 
 private: 
     size_t m_baseSize;      // 内存块的大小
@@ -261,6 +443,9 @@ private:
     int8_t m_endian;        // 字节序,默认大端
     Node* m_root;           // 第一个内存块指针
     Node* m_cur;            // 当前操作的内存块指针
+    size_t m_curStart;      // m_cur 第一个字节的位置
+    int m_mapFd;            // mapToFile 的文件句柄，没有时为 -1
+    size_t m_mapSize;       // mapToFile 的文件已经映射的长度
 };
 
 }
@@ -0,0 +1,460 @@
+#include "compress.h"
+#include "endian.h"
+#include "log.h"
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static const size_t s_min_match = 4;        // 最短匹配
+static const size_t s_last_literals = 5;    // 最后 5 个字节必须是字面量
+static const size_t s_mf_limit = 12;        // 最后 12 个字节里不再开始新的匹配
+static const size_t s_max_distance = 65535; // 偏移用 2 个字节
+static const int s_hash_log = 12;
+
+static const char s_magic[4] = {'S', 'L', 'Z', '1'};
+static const size_t s_header_size = 8;
+static const size_t s_max_block = 16 * 1024 * 1024;
+
+// 哈希表里存的是块内偏移，不同块之间不清空：取出来的位置都会先比较内容，过期的只是命中不了
+static thread_local uint32_t t_hash_table[1 << s_hash_log];
+
+static inline uint32_t Read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t Read64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t Hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - s_hash_log);
+}
+
+// 从 a、b 开始往后比较，a 最多比到 limit，返回相同的字节数
+static inline size_t CountMatch(const char* a, const char* b, const char* limit) {
+    const char* start = a;
+    while(a + 8 <= limit) {
+        uint64_t diff = Read64(a) ^ Read64(b);
+        if(diff) {
+#if SYLAR_BYTE_ORDER == SYLAR_LITTLE_ENDIAN
+            return a - start + (__builtin_ctzll(diff) >> 3);
+#else
+            return a - start + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        a += 8;
+        b += 8;
+    }
+    while(a < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return a - start;
+}
+
+// 长度超过 15 的部分：每个 255 一个字节，最后一个字节小于 255
+static inline char* WriteLength(char* op, size_t len) {
+    while(len >= 255) {
+        *op++ = (char)255;
+        len -= 255;
+    }
+    *op++ = (char)len;
+    return op;
+}
+
+static inline char* WriteLiterals(char* op, char* token, const char* anchor, size_t len) {
+    if(len >= 15) {
+        *token = (char)(15 << 4);
+        op = WriteLength(op, len - 15);
+    } else {
+        *token = (char)(len << 4);
+    }
+    memcpy(op, anchor, len);
+    return op + len;
+}
+
+// 超过 15 的长度后面的扩展字节，数据不够时返回 false
+static inline bool ReadLength(const uint8_t*& ip, const uint8_t* iend, size_t& len) {
+    uint8_t b = 0;
+    do {
+        if(ip >= iend) {
+            return false;
+        }
+        b = *ip++;
+        len += b;
+    } while(b == 255);
+    return true;
+}
+
+static inline void WriteLE32(char* p, uint32_t v) {
+    v = byteswapOnBigEndian(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t ReadLE32(const char* p) {
+    return byteswapOnBigEndian(Read32(p));
+}
+
+size_t LZ4Codec::Compress(const char* src, size_t len, char* dst) {
+    const char* ip = src;
+    const char* anchor = src;
+    const char* iend = src + len;
+    char* op = dst;
+
+    // 太短的数据全部当字面量
+    if(len > s_mf_limit) {
+        const char* mflimit = iend - s_mf_limit;
+        const char* matchlimit = iend - s_last_literals;
+        uint32_t* table = t_hash_table;
+        table[Hash4(Read32(ip))] = 0;
+        ++ip;
+        bool end = false;
+        while(!end) {
+            // 找下一个匹配，连续找不到时步长逐渐变大，跳过不可压缩的数据
+            const char* ref = nullptr;
+            size_t attempts = 1 << 6;
+            while(true) {
+                if(ip > mflimit) {
+                    end = true;
+                    break;
+                }
+                uint32_t seq = Read32(ip);
+                uint32_t h = Hash4(seq);
+                ref = src + table[h];
+                table[h] = ip - src;
+                if(ref < ip && (size_t)(ip - ref) <= s_max_distance && Read32(ref) == seq) {
+                    break;
+                }
+                ip += attempts++ >> 6;
+            }
+            if(end) {
+                break;
+            }
+
+            // 往前扩展
+            while(ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            char* token = op++;
+            op = WriteLiterals(op, token, anchor, ip - anchor);
+
+            uint16_t offset = ip - ref;
+            op[0] = (char)(offset & 0xff);
+            op[1] = (char)(offset >> 8);
+            op += 2;
+
+            size_t mlen = CountMatch(ip + s_min_match, ref + s_min_match, matchlimit);
+            if(mlen >= 15) {
+                *token |= 15;
+                op = WriteLength(op, mlen - 15);
+            } else {
+                *token |= (char)mlen;
+            }
+            ip += mlen + s_min_match;
+            anchor = ip;
+            if(ip > mflimit) {
+                break;
+            }
+            table[Hash4(Read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    // 最后一段字面量
+    char* token = op++;
+    op = WriteLiterals(op, token, anchor, iend - anchor);
+    return op - dst;
+}
+
+int64_t LZ4Codec::Decompress(const char* src, size_t len, char* dst, size_t cap) {
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* iend = ip + len;
+    char* op = dst;
+    char* oend = dst + cap;
+
+    while(true) {
+        if(ip >= iend) {
+            return -1;
+        }
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if(lit == 15 && !ReadLength(ip, iend, lit)) {
+            return -1;
+        }
+        if((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        // 最后一段只有字面量
+        if(ip == iend) {
+            break;
+        }
+
+        if(iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        size_t mlen = token & 15;
+        if(mlen == 15 && !ReadLength(ip, iend, mlen)) {
+            return -1;
+        }
+        mlen += s_min_match;
+        if((size_t)(oend - op) < mlen) {
+            return -1;
+        }
+        const char* m = op - offset;
+        if(offset >= 8 && (size_t)(oend - op) >= mlen + 8) {
+            // 8 字节一组拷贝，最后一组多写的几个字节会被后面的数据覆盖
+            char* end = op + mlen;
+            while(op < end) {
+                memcpy(op, m, 8);
+                op += 8;
+                m += 8;
+            }
+            op = end;
+        } else {
+            // 重叠的匹配(比如连续重复的字节)只能逐字节拷贝
+            for(size_t i = 0; i < mlen; ++i) {
+                op[i] = m[i];
+            }
+            op += mlen;
+        }
+    }
+    return op - dst;
+}
+
+LZ4Compressor::LZ4Compressor(ByteArray::ptr out, size_t block_size)
+    :m_out(out)
+    ,m_blockSize(std::min(std::max(block_size, (size_t)1024), s_max_block)) {
+}
+
+void LZ4Compressor::write(const void* data, size_t len) {
+    const char* p = (const char*)data;
+    m_rawBytes += len;
+    while(len > 0) {
+        // 没有攒着的数据并且够一整块时直接压缩
+        if(m_pendingSize == 0 && len >= m_blockSize) {
+            compressBlock(p, m_blockSize);
+            p += m_blockSize;
+            len -= m_blockSize;
+            continue;
+        }
+        if(m_pending.size() < m_blockSize) {
+            m_pending.resize(m_blockSize);
+        }
+        size_t n = std::min(len, m_blockSize - m_pendingSize);
+        memcpy(&m_pending[m_pendingSize], p, n);
+        m_pendingSize += n;
+        p += n;
+        len -= n;
+        if(m_pendingSize == m_blockSize) {
+            compressBlock(&m_pending[0], m_blockSize);
+            m_pendingSize = 0;
+        }
+    }
+}
+
+void LZ4Compressor::write(ByteArray::ptr in) {
+    while(in->getReadSize() > 0) {
+        if(m_pendingSize == 0 && in->getReadSize() >= m_blockSize) {
+            // 一整块都在一个节点里，直接从节点压缩
+            if(const char* p = in->peek(m_blockSize)) {
+                m_rawBytes += m_blockSize;
+                compressBlock(p, m_blockSize);
+                in->skip(m_blockSize);
+                continue;
+            }
+        }
+        // 跨节点，把能凑进当前块的部分拷过来
+        std::vector<iovec> iovs;
+        size_t n = in->getReadBuffers(iovs, m_blockSize - m_pendingSize);
+        for(auto& iov : iovs) {
+            write(iov.iov_base, iov.iov_len);
+        }
+        in->skip(n);
+    }
+}
+
+void LZ4Compressor::finish() {
+    if(m_finished) {
+        return;
+    }
+    if(m_pendingSize > 0) {
+        compressBlock(&m_pending[0], m_pendingSize);
+        m_pendingSize = 0;
+    }
+    if(!m_started) {
+        m_out->write(s_magic, sizeof(s_magic));
+        m_started = true;
+    }
+    char end[s_header_size] = {0};
+    m_out->write(end, sizeof(end));
+    m_finished = true;
+}
+
+void LZ4Compressor::compressBlock(const char* data, size_t len) {
+    if(m_finished) {
+        throw std::logic_error("LZ4Compressor write after finish");
+    }
+    if(!m_started) {
+        m_out->write(s_magic, sizeof(s_magic));
+        m_started = true;
+    }
+    // 压缩结果的长度事先不知道，先压到临时缓存，再把实际长度写进输出
+    size_t bound = s_header_size + LZ4Codec::CompressBound(len);
+    if(m_scratch.size() < bound) {
+        m_scratch.resize(bound);
+    }
+    char* p = &m_scratch[0];
+    size_t n = LZ4Codec::Compress(data, len, p + s_header_size);
+    bool stored = n >= len;
+    WriteLE32(p, len);
+    if(stored) {
+        WriteLE32(p + 4, len << 1 | 1);
+        m_out->write(p, s_header_size);
+        m_out->write(data, len);
+    } else {
+        WriteLE32(p + 4, n << 1);
+        m_out->write(p, s_header_size + n);
+    }
+}
+
+void LZ4Compressor::Compress(ByteArray::ptr in, ByteArray::ptr out, size_t block_size) {
+    LZ4Compressor c(out, block_size);
+    c.write(in);
+    c.finish();
+}
+
+LZ4Decompressor::LZ4Decompressor(ByteArray::ptr out)
+    :m_out(out)
+    ,m_pending(new ByteArray) {
+}
+
+int LZ4Decompressor::write(ByteArray::ptr in) {
+    if(m_error) {
+        return -1;
+    }
+    if(m_finished) {
+        return 1;
+    }
+    if(m_pending->getReadSize() == 0) {
+        m_pending->clear();
+        int rt = decode(in);
+        // 不完整的块留到下次，in 里的数据全部消耗掉
+        if(rt == 0 && in->getReadSize() > 0) {
+            m_pending->write(in->readSlice(in->getReadSize()));
+            m_pending->setPosition(0);
+        }
+        return rt;
+    }
+    // 接在上次剩下的数据后面
+    size_t pos = m_pending->getPosition();
+    m_pending->setPosition(m_pending->getSize());
+    m_pending->write(in->readSlice(in->getReadSize()));
+    m_pending->setPosition(pos);
+    int rt = decode(m_pending);
+    // 解完的块从缓存里去掉，只留下不完整的块；否则输入分成小段到达时 m_pending 会一直增长
+    if(m_pending->getPosition() > 0) {
+        ByteArray::ptr rest(new ByteArray);
+        if(rt == 0 && m_pending->getReadSize() > 0) {
+            rest->write(m_pending->readSlice(m_pending->getReadSize()));
+            rest->setPosition(0);
+        }
+        m_pending = rest;
+    }
+    return rt;
+}
+
+int LZ4Decompressor::decode(ByteArray::ptr src) {
+    if(!m_started) {
+        if(src->getReadSize() < sizeof(s_magic)) {
+            return 0;
+        }
+        char magic[sizeof(s_magic)];
+        src->read(magic, sizeof(magic));
+        if(memcmp(magic, s_magic, sizeof(s_magic)) != 0) {
+            SYLAR_LOG_ERROR(g_logger) << "LZ4Decompressor bad magic";
+            m_error = true;
+            return -1;
+        }
+        m_started = true;
+    }
+    while(src->getReadSize() >= s_header_size) {
+        size_t start = src->getPosition();
+        char header[s_header_size];
+        src->read(header, sizeof(header));
+        uint32_t raw = ReadLE32(header);
+        uint32_t desc = ReadLE32(header + 4);
+        if(raw == 0) {
+            m_finished = true;
+            return 1;
+        }
+        size_t len = desc >> 1;
+        bool stored = desc & 1;
+        if(raw > s_max_block || len > LZ4Codec::CompressBound(raw) || (stored && len != raw)) {
+            SYLAR_LOG_ERROR(g_logger) << "LZ4Decompressor bad block header raw=" << raw
+                << " len=" << len << " stored=" << stored;
+            m_error = true;
+            return -1;
+        }
+        if(src->getReadSize() < len) {
+            src->setPosition(start);
+            return 0;
+        }
+        if(stored) {
+            m_out->write(src->readSlice(len));
+            continue;
+        }
+
+        const char* data = src->peek(len);
+        if(!data) {
+            if(m_scratch.size() < len) {
+                m_scratch.resize(len);
+            }
+            src->read(&m_scratch[0], len);
+            data = &m_scratch[0];
+        } else {
+            src->skip(len);
+        }
+        // 直接解压进输出的节点，不在末尾写时解到临时缓存再拷贝
+        std::vector<char> tmp;
+        char* dst = m_out->reserve(raw);
+        if(!dst) {
+            tmp.resize(raw);
+            dst = &tmp[0];
+        }
+        if(LZ4Codec::Decompress(data, len, dst, raw) != (int64_t)raw) {
+            SYLAR_LOG_ERROR(g_logger) << "LZ4Decompressor corrupted block raw=" << raw
+                << " len=" << len;
+            m_error = true;
+            return -1;
+        }
+        if(tmp.empty()) {
+            m_out->commit(raw);
+        } else {
+            m_out->write(dst, raw);
+        }
+    }
+    return 0;
+}
+
+bool LZ4Decompressor::Decompress(ByteArray::ptr in, ByteArray::ptr out) {
+    LZ4Decompressor d(out);
+    return d.write(in) == 1;
+}
+
+}
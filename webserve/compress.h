@@ -0,0 +1,130 @@
+#ifndef __SYLAR_COMPRESS_H__
+#define __SYLAR_COMPRESS_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "bytearray.h"
+
+namespace sylar {
+
+/**
+ * @brief LZ4 风格的块压缩，不依赖外部库
+ * @details 块格式和 LZ4 block format 一致(token + 字面量 + 2 字节偏移 + 匹配长度，最短匹配 4 字节)，
+ *          压缩用单个哈希表贪心匹配，解压对输入做完整的边界检查，可以处理不可信的数据
+ */
+class LZ4Codec {
+public:
+    // 长度为 len 的数据压缩后最多占用的字节数
+    static size_t CompressBound(size_t len) { return len + len / 255 + 16;}
+
+    /**
+     * @brief 压缩 [src, src + len)
+     * @param[out] dst 输出缓存，至少 CompressBound(len) 字节
+     * @return 压缩后的长度
+     */
+    static size_t Compress(const char* src, size_t len, char* dst);
+
+    /**
+     * @brief 解压一块
+     * @param[out] dst 输出缓存
+     * @param[in] cap dst 的大小
+     * @return 解压后的长度，数据损坏或者 dst 放不下时返回 -1
+     */
+    static int64_t Decompress(const char* src, size_t len, char* dst, size_t cap);
+};
+
+/**
+ * @brief 分帧的流式压缩，输出追加到 ByteArray
+ * @details 帧格式：4 字节魔数 "SLZ1"，然后是若干块，每块是 8 字节块头(小端的原始长度，
+ *          小端的 数据长度 << 1 | 是否原样存放) + 数据，原始长度为 0 的块头表示结束。
+ *          输入攒满一块(默认 64KB)压缩一次，压缩后没变小的块原样存放。
+ *          输入的一块正好在 ByteArray 的一个节点里时直接从节点压缩，跨节点时用 getReadBuffers 拼成一块
+ */
+class LZ4Compressor {
+public:
+    typedef std::shared_ptr<LZ4Compressor> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] out 压缩结果追加到 out
+     * @param[in] block_size 每块的原始大小，最大 16MB
+     */
+    LZ4Compressor(ByteArray::ptr out, size_t block_size = 64 * 1024);
+
+    // 追加要压缩的数据
+    void write(const void* data, size_t len);
+    /**
+     * @brief 追加 in 里 [position, size) 的数据
+     * @post in 的 position 移到 size
+     */
+    void write(ByteArray::ptr in);
+    // 压缩剩下的数据并写入结束标记，之后不能再写
+    void finish();
+
+    // 已经输入的原始字节数
+    uint64_t getRawBytes() const { return m_rawBytes;}
+
+    // 把 in 里 [position, size) 的数据压缩成一帧追加到 out
+    static void Compress(ByteArray::ptr in, ByteArray::ptr out, size_t block_size = 64 * 1024);
+
+private:
+    // 压缩一块写入 m_out
+    void compressBlock(const char* data, size_t len);
+
+private:
+    ByteArray::ptr m_out;
+    size_t m_blockSize;
+    // 不够一块的输入先攒在这里
+    std::vector<char> m_pending;
+    size_t m_pendingSize = 0;
+    // 输出不能直接写进节点时的临时缓存
+    std::vector<char> m_scratch;
+    uint64_t m_rawBytes = 0;
+    bool m_started = false;
+    bool m_finished = false;
+};
+
+/**
+ * @brief 分帧的流式解压，输入可以分多次到达
+ * @details 原样存放的块用 Slice 接到输出后面，不拷贝；压缩的块在输出末尾 reserve 出连续内存直接解压进节点
+ */
+class LZ4Decompressor {
+public:
+    typedef std::shared_ptr<LZ4Decompressor> ptr;
+
+    // 解压结果追加到 out
+    LZ4Decompressor(ByteArray::ptr out);
+
+    /**
+     * @brief 解出 in 里所有完整的块，消耗 in 的 [position, size)，不完整的块留在 in 里等下次
+     * @return 1 读到结束标记，0 还需要更多数据，-1 数据损坏
+     */
+    int write(ByteArray::ptr in);
+
+    // 是否读到了结束标记
+    bool isFinished() const { return m_finished;}
+    // 缓存的还没解完的输入的字节数，不超过一个块加块头
+    size_t getPendingSize() const { return m_pending->getSize();}
+
+    // 解压 in 里 [position, size) 的一整帧，追加到 out
+    static bool Decompress(ByteArray::ptr in, ByteArray::ptr out);
+
+private:
+    // 解出 src 里所有完整的块
+    int decode(ByteArray::ptr src);
+
+private:
+    ByteArray::ptr m_out;
+    // 上次没有解完的输入
+    ByteArray::ptr m_pending;
+    std::vector<char> m_scratch;
+    bool m_started = false;
+    bool m_finished = false;
+    bool m_error = false;
+};
+
+}
+
+#endif
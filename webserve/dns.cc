@@ -0,0 +1,657 @@
+#include "dns.h"
+#include "socket.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include "endian.h"
+#include <ctype.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<std::vector<std::string> >::ptr g_dns_servers =
+    sylar::Config::Lookup("dns.servers", std::vector<std::string>(), "dns servers, override resolv.conf");
+
+static sylar::ConfigVar<std::string>::ptr g_dns_hosts_file =
+    sylar::Config::Lookup("dns.hosts_file", std::string("/etc/hosts"), "dns hosts file");
+
+static sylar::ConfigVar<std::string>::ptr g_dns_resolv_conf =
+    sylar::Config::Lookup("dns.resolv_conf", std::string("/etc/resolv.conf"), "dns resolv.conf");
+
+static sylar::ConfigVar<uint32_t>::ptr g_dns_max_ttl =
+    sylar::Config::Lookup("dns.max_ttl", (uint32_t)3600, "dns cache max ttl seconds");
+
+static sylar::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+    sylar::Config::Lookup("dns.negative_ttl", (uint32_t)30, "dns negative cache ttl seconds");
+
+static sylar::ConfigVar<uint32_t>::ptr g_dns_cache_size =
+    sylar::Config::Lookup("dns.cache_size", (uint32_t)16384, "dns cache max entries");
+
+namespace {
+struct _DnsIniter {
+    _DnsIniter() {
+        // 服务器和配置文件路径变化后重新加载
+        g_dns_servers->addListener([](const std::vector<std::string>& ov
+                    ,const std::vector<std::string>& nv){
+            DnsMgr::GetInstance()->reload();
+        });
+        g_dns_hosts_file->addListener([](const std::string& ov, const std::string& nv){
+            DnsMgr::GetInstance()->reload();
+        });
+        g_dns_resolv_conf->addListener([](const std::string& ov, const std::string& nv){
+            DnsMgr::GetInstance()->reload();
+        });
+    }
+};
+
+static _DnsIniter s_dns_initer;
+}
+
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_AAAA = 28;
+static const uint16_t DNS_CLASS_IN = 1;
+static const int DNS_RCODE_NXDOMAIN = 3;
+static const size_t DNS_UDP_SIZE = 512;
+
+static std::string ToLower(const std::string& str) {
+    std::string rt = str;
+    std::transform(rt.begin(), rt.end(), rt.begin(), ::tolower);
+    return rt;
+}
+
+static void PutUint16(std::string& buf, uint16_t v) {
+    buf.push_back((char)(v >> 8));
+    buf.push_back((char)(v & 0xff));
+}
+
+static uint16_t GetUint16(const std::string& buf, size_t pos) {
+    return ((uint8_t)buf[pos] << 8) | (uint8_t)buf[pos + 1];
+}
+
+static uint32_t GetUint32(const std::string& buf, size_t pos) {
+    return ((uint32_t)GetUint16(buf, pos) << 16) | GetUint16(buf, pos + 2);
+}
+
+static uint16_t NextQueryId() {
+    static thread_local std::mt19937 s_rng(std::random_device{}());
+    return (uint16_t)s_rng();
+}
+
+/**
+ * @brief 构造查询报文
+ * @return 名字不合法返回 false
+ */
+static bool BuildQuery(std::string& buf, uint16_t id, const std::string& name, uint16_t qtype) {
+    buf.clear();
+    PutUint16(buf, id);
+    PutUint16(buf, 0x0100);     // RD，请求递归
+    PutUint16(buf, 1);          // QDCOUNT
+    PutUint16(buf, 0);
+    PutUint16(buf, 0);
+    PutUint16(buf, 0);
+
+    size_t begin = 0;
+    while(begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos) {
+            end = name.size();
+        }
+        size_t len = end - begin;
+        if(len == 0 || len > 63) {
+            return false;
+        }
+        buf.push_back((char)len);
+        buf.append(name, begin, len);
+        begin = end + 1;
+    }
+    buf.push_back(0);
+    if(buf.size() - 12 > 255) {
+        return false;
+    }
+    PutUint16(buf, qtype);
+    PutUint16(buf, DNS_CLASS_IN);
+    return true;
+}
+
+// 跳过报文中的名字(可能是压缩指针)，越界返回 false
+static bool SkipName(const std::string& buf, size_t& pos) {
+    while(pos < buf.size()) {
+        uint8_t len = buf[pos];
+        if(len == 0) {
+            ++pos;
+            return true;
+        }
+        if((len & 0xc0) == 0xc0) {
+            pos += 2;
+            return pos <= buf.size();
+        }
+        pos += len + 1;
+    }
+    return false;
+}
+
+/**
+ * @brief 解析应答报文，收集 qtype 类型的地址
+ * @param[out] ttl 所有地址记录中最小的 TTL
+ * @param[out] rcode 应答码
+ * @param[out] truncated 是否被截断
+ * @return 报文是否合法
+ */
+static bool ParseResponse(const std::string& buf, uint16_t id, uint16_t qtype,
+                          std::vector<IPAddress::ptr>& result, uint32_t& ttl,
+                          int& rcode, bool& truncated) {
+    if(buf.size() < 12 || GetUint16(buf, 0) != id) {
+        return false;
+    }
+    uint16_t flags = GetUint16(buf, 2);
+    if(!(flags & 0x8000)) {
+        return false;
+    }
+    truncated = flags & 0x0200;
+    rcode = flags & 0x000f;
+    uint16_t qdcount = GetUint16(buf, 4);
+    uint16_t ancount = GetUint16(buf, 6);
+
+    size_t pos = 12;
+    for(uint16_t i = 0; i < qdcount; ++i) {
+        if(!SkipName(buf, pos) || pos + 4 > buf.size()) {
+            return false;
+        }
+        pos += 4;
+    }
+
+    // CNAME 链和最终的地址记录都在应答区，这里只收集地址记录
+    ttl = ~0u;
+    for(uint16_t i = 0; i < ancount; ++i) {
+        if(!SkipName(buf, pos) || pos + 10 > buf.size()) {
+            return false;
+        }
+        uint16_t type = GetUint16(buf, pos);
+        uint16_t klass = GetUint16(buf, pos + 2);
+        uint32_t rttl = GetUint32(buf, pos + 4);
+        uint16_t rdlen = GetUint16(buf, pos + 8);
+        pos += 10;
+        if(pos + rdlen > buf.size()) {
+            return false;
+        }
+        if(klass == DNS_CLASS_IN && type == qtype) {
+            if(type == DNS_TYPE_A && rdlen == 4) {
+                sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                memcpy(&addr.sin_addr, buf.c_str() + pos, 4);
+                result.push_back(std::make_shared<IPv4Address>(addr));
+                ttl = std::min(ttl, rttl);
+            } else if(type == DNS_TYPE_AAAA && rdlen == 16) {
+                sockaddr_in6 addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin6_family = AF_INET6;
+                memcpy(&addr.sin6_addr, buf.c_str() + pos, 16);
+                result.push_back(std::make_shared<IPv6Address>(addr));
+                ttl = std::min(ttl, rttl);
+            }
+        }
+        pos += rdlen;
+    }
+    if(ttl == ~0u) {
+        ttl = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief 解析服务器地址 ip、ip:port 或 [ipv6]:port，没有端口时用53
+ * @details 只接受数字地址，这里不能再走域名解析
+ */
+static IPAddress::ptr ParseServer(const std::string& str) {
+    std::string ip = str;
+    uint16_t port = 53;
+    if(!str.empty() && str[0] == '[') {
+        size_t end = str.find(']');
+        if(end == std::string::npos) {
+            return nullptr;
+        }
+        ip = str.substr(1, end - 1);
+        if(end + 1 < str.size() && str[end + 1] == ':') {
+            port = atoi(str.c_str() + end + 2);
+        }
+    } else if(std::count(str.begin(), str.end(), ':') == 1) {
+        size_t pos = str.find(':');
+        ip = str.substr(0, pos);
+        port = atoi(str.c_str() + pos + 1);
+    }
+    return IPAddress::Create(ip.c_str(), port);
+}
+
+// 数字地址直接转换，不是数字地址返回nullptr
+static IPAddress::ptr ParseNumeric(const std::string& name) {
+    sockaddr_in addr4;
+    memset(&addr4, 0, sizeof(addr4));
+    if(inet_pton(AF_INET, name.c_str(), &addr4.sin_addr) == 1) {
+        addr4.sin_family = AF_INET;
+        return std::make_shared<IPv4Address>(addr4);
+    }
+    sockaddr_in6 addr6;
+    memset(&addr6, 0, sizeof(addr6));
+    if(inet_pton(AF_INET6, name.c_str(), &addr6.sin6_addr) == 1) {
+        addr6.sin6_family = AF_INET6;
+        return std::make_shared<IPv6Address>(addr6);
+    }
+    return nullptr;
+}
+
+// 复制一份地址，缓存里的对象不能交给调用方修改
+static IPAddress::ptr CopyAddress(const IPAddress::ptr& addr) {
+    return std::dynamic_pointer_cast<IPAddress>(
+            Address::Create(addr->getAddr(), addr->getAddrLen()));
+}
+
+DnsResolver::DnsResolver() {
+}
+
+void DnsResolver::reload() {
+    RWMutex::WriteLock lock(m_mutex);
+    loadHosts();
+    loadResolvConf();
+    m_loaded = true;
+}
+
+void DnsResolver::loadHosts() {
+    m_hosts.clear();
+    std::ifstream ifs(g_dns_hosts_file->getValue());
+    std::string line;
+    while(std::getline(ifs, line)) {
+        size_t comment = line.find('#');
+        if(comment != std::string::npos) {
+            line.resize(comment);
+        }
+        std::istringstream iss(line);
+        std::string ip;
+        if(!(iss >> ip)) {
+            continue;
+        }
+        IPAddress::ptr addr = IPAddress::Create(ip.c_str());
+        if(!addr) {
+            continue;
+        }
+        std::string name;
+        while(iss >> name) {
+            m_hosts[ToLower(name)].push_back(addr);
+        }
+    }
+}
+
+void DnsResolver::loadResolvConf() {
+    std::vector<IPAddress::ptr> servers;
+    m_search.clear();
+    m_ndots = 1;
+    m_timeout = 5000;
+    m_attempts = 2;
+
+    std::ifstream ifs(g_dns_resolv_conf->getValue());
+    std::string line;
+    while(std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        std::string key;
+        if(!(iss >> key) || key[0] == '#' || key[0] == ';') {
+            continue;
+        }
+        if(key == "nameserver") {
+            std::string ip;
+            if(iss >> ip) {
+                IPAddress::ptr addr = IPAddress::Create(ip.c_str(), 53);
+                if(addr) {
+                    servers.push_back(addr);
+                }
+            }
+        } else if(key == "search" || key == "domain") {
+            // 后出现的 search/domain 覆盖前面的
+            m_search.clear();
+            std::string domain;
+            while(iss >> domain) {
+                m_search.push_back(domain);
+            }
+        } else if(key == "options") {
+            std::string opt;
+            while(iss >> opt) {
+                if(opt.compare(0, 6, "ndots:") == 0) {
+                    m_ndots = std::min(atoi(opt.c_str() + 6), 15);
+                } else if(opt.compare(0, 8, "timeout:") == 0) {
+                    m_timeout = std::max(atoi(opt.c_str() + 8), 1) * 1000;
+                } else if(opt.compare(0, 9, "attempts:") == 0) {
+                    m_attempts = std::max(std::min(atoi(opt.c_str() + 9), 5), 1);
+                }
+            }
+        }
+    }
+
+    std::vector<std::string> conf_servers = g_dns_servers->getValue();
+    if(!conf_servers.empty()) {
+        servers.clear();
+    }
+    for(auto& i : conf_servers) {
+        IPAddress::ptr addr = ParseServer(i);
+        if(!addr) {
+            SYLAR_LOG_ERROR(g_logger) << "invalid dns server: " << i;
+            continue;
+        }
+        servers.push_back(addr);
+    }
+    if(!m_userServers) {
+        m_servers.swap(servers);
+    }
+}
+
+void DnsResolver::setServers(const std::vector<IPAddress::ptr>& servers) {
+    std::vector<IPAddress::ptr> tmp;
+    for(auto& i : servers) {
+        IPAddress::ptr addr = CopyAddress(i);
+        if(addr->getPort() == 0) {
+            addr->setPort(53);
+        }
+        tmp.push_back(addr);
+    }
+    RWMutex::WriteLock lock(m_mutex);
+    if(!m_loaded) {
+        loadHosts();
+        loadResolvConf();
+        m_loaded = true;
+    }
+    m_servers.swap(tmp);
+    m_userServers = true;
+}
+
+std::vector<IPAddress::ptr> DnsResolver::getServers() {
+    RWMutex::ReadLock lock(m_mutex);
+    return m_servers;
+}
+
+void DnsResolver::clearCache() {
+    for(auto& shard : m_cache) {
+        MutexType::Lock lock(shard.mutex);
+        shard.entries.clear();
+    }
+}
+
+bool DnsResolver::lookupHosts(std::vector<IPAddress::ptr>& result,
+                              const std::string& name, uint16_t qtype) {
+    int family = qtype == DNS_TYPE_A ? AF_INET : AF_INET6;
+    RWMutex::ReadLock lock(m_mutex);
+    auto it = m_hosts.find(name);
+    if(it == m_hosts.end()) {
+        return false;
+    }
+    size_t size = result.size();
+    for(auto& i : it->second) {
+        if(i->getFamily() == family) {
+            result.push_back(CopyAddress(i));
+        }
+    }
+    return result.size() > size;
+}
+
+bool DnsResolver::lookupCache(std::vector<IPAddress::ptr>& result,
+                              const std::string& key, bool& found) {
+    CacheShard& shard = m_cache[std::hash<std::string>()(key) % CACHE_SHARDS];
+    MutexType::Lock lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if(it == shard.entries.end()) {
+        found = false;
+        return false;
+    }
+    if(it->second.expire <= GetMonotonicMS()) {
+        shard.entries.erase(it);
+        found = false;
+        return false;
+    }
+    found = true;
+    for(auto& i : it->second.addrs) {
+        result.push_back(CopyAddress(i));
+    }
+    return !it->second.addrs.empty();
+}
+
+void DnsResolver::storeCache(const std::string& key,
+                             const std::vector<IPAddress::ptr>& addrs, uint32_t ttl) {
+    ttl = std::min(ttl, g_dns_max_ttl->getValue());
+    if(ttl == 0) {
+        return;
+    }
+    size_t max_size = std::max(g_dns_cache_size->getValue() / CACHE_SHARDS, (size_t)1);
+    uint64_t now = GetMonotonicMS();
+
+    CacheShard& shard = m_cache[std::hash<std::string>()(key) % CACHE_SHARDS];
+    MutexType::Lock lock(shard.mutex);
+    if(shard.entries.size() >= max_size) {
+        // 先清理过期的，还是满的话随便淘汰一个
+        for(auto it = shard.entries.begin(); it != shard.entries.end();) {
+            if(it->second.expire <= now) {
+                it = shard.entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if(shard.entries.size() >= max_size) {
+            shard.entries.erase(shard.entries.begin());
+        }
+    }
+    CacheEntry& entry = shard.entries[key];
+    entry.addrs = addrs;
+    entry.expire = now + ttl * 1000ull;
+}
+
+bool DnsResolver::exchange(const IPAddress::ptr& server, const std::string& request,
+                           std::string& response, bool tcp) {
+    uint64_t timeout;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        timeout = m_timeout;
+    }
+    Socket::ptr sock = tcp ? Socket::CreateTCP(server) : Socket::CreateUDP(server);
+    sock->setRecvTimeout(timeout);
+    sock->setSendTimeout(timeout);
+    if(!sock->connect(server, timeout)) {
+        return false;
+    }
+
+    if(!tcp) {
+        if(sock->send(request.c_str(), request.size()) != (int)request.size()) {
+            return false;
+        }
+        response.resize(DNS_UDP_SIZE);
+        int rt = sock->recv(&response[0], response.size());
+        if(rt <= 0) {
+            return false;
+        }
+        response.resize(rt);
+        return true;
+    }
+
+    // TCP 报文前面带两个字节的长度
+    std::string buf;
+    PutUint16(buf, request.size());
+    buf += request;
+    if(sock->send(buf.c_str(), buf.size()) != (int)buf.size()) {
+        return false;
+    }
+    uint8_t len[2];
+    size_t got = 0;
+    while(got < 2) {
+        int rt = sock->recv(len + got, 2 - got);
+        if(rt <= 0) {
+            return false;
+        }
+        got += rt;
+    }
+    response.resize((len[0] << 8) | len[1]);
+    got = 0;
+    while(got < response.size()) {
+        int rt = sock->recv(&response[got], response.size() - got);
+        if(rt <= 0) {
+            return false;
+        }
+        got += rt;
+    }
+    return true;
+}
+
+bool DnsResolver::queryName(std::vector<IPAddress::ptr>& result, const std::string& fqdn,
+                            uint16_t qtype, uint32_t& ttl, int& rcode) {
+    std::vector<IPAddress::ptr> servers;
+    int attempts;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        servers = m_servers;
+        attempts = m_attempts;
+    }
+    rcode = -1;
+    if(servers.empty()) {
+        SYLAR_LOG_ERROR(g_logger) << "DnsResolver no dns server, name=" << fqdn;
+        return false;
+    }
+
+    std::string request;
+    std::string response;
+    for(int attempt = 0; attempt < attempts; ++attempt) {
+        for(auto& server : servers) {
+            uint16_t id = NextQueryId();
+            if(!BuildQuery(request, id, fqdn, qtype)) {
+                return false;
+            }
+            ++m_queries;
+            if(!exchange(server, request, response, false)) {
+                SYLAR_LOG_DEBUG(g_logger) << "DnsResolver query " << fqdn << " server="
+                    << *server << " errno=" << errno << " errstr=" << strerror(errno);
+                continue;
+            }
+            std::vector<IPAddress::ptr> addrs;
+            bool truncated = false;
+            if(!ParseResponse(response, id, qtype, addrs, ttl, rcode, truncated)) {
+                continue;
+            }
+            if(truncated) {
+                addrs.clear();
+                if(!exchange(server, request, response, true)
+                        || !ParseResponse(response, id, qtype, addrs, ttl, rcode, truncated)) {
+                    continue;
+                }
+            }
+            // SERVFAIL/REFUSED 之类换下一个服务器
+            if(rcode != 0 && rcode != DNS_RCODE_NXDOMAIN) {
+                continue;
+            }
+            result.insert(result.end(), addrs.begin(), addrs.end());
+            return !addrs.empty();
+        }
+    }
+    return false;
+}
+
+bool DnsResolver::query(std::vector<IPAddress::ptr>& result,
+                        const std::string& name, uint16_t qtype) {
+    std::vector<std::string> candidates;
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        if(name.back() == '.') {
+            candidates.push_back(name.substr(0, name.size() - 1));
+        } else {
+            // 点数不少于 ndots 的名字先按绝对名字查，否则先拼 search 域
+            bool absolute_first = std::count(name.begin(), name.end(), '.') >= m_ndots;
+            if(absolute_first) {
+                candidates.push_back(name);
+            }
+            for(auto& i : m_search) {
+                candidates.push_back(name + "." + i);
+            }
+            if(!absolute_first) {
+                candidates.push_back(name);
+            }
+        }
+    }
+
+    for(auto& fqdn : candidates) {
+        std::string key = fqdn + (qtype == DNS_TYPE_A ? "/A" : "/AAAA");
+        bool found = false;
+        if(lookupCache(result, key, found)) {
+            ++m_cacheHits;
+            return true;
+        }
+        if(found) {
+            ++m_cacheHits;
+            continue;
+        }
+
+        std::vector<IPAddress::ptr> addrs;
+        uint32_t ttl = 0;
+        int rcode = -1;
+        if(queryName(addrs, fqdn, qtype, ttl, rcode)) {
+            storeCache(key, addrs, ttl);
+            for(auto& i : addrs) {
+                result.push_back(CopyAddress(i));
+            }
+            return true;
+        }
+        // 明确的不存在/没有记录才做否定缓存，超时之类的不缓存
+        if(rcode == 0 || rcode == DNS_RCODE_NXDOMAIN) {
+            storeCache(key, addrs, g_dns_negative_ttl->getValue());
+        }
+    }
+    return false;
+}
+
+bool DnsResolver::resolve(std::vector<IPAddress::ptr>& result, const std::string& name,
+                          int family) {
+    if(name.empty()) {
+        return false;
+    }
+    // 数字地址不需要查询
+    IPAddress::ptr numeric = ParseNumeric(name);
+    if(numeric) {
+        if(family == AF_UNSPEC || numeric->getFamily() == family) {
+            result.push_back(numeric);
+            return true;
+        }
+        return false;
+    }
+
+    {
+        RWMutex::ReadLock lock(m_mutex);
+        if(!m_loaded) {
+            lock.unlock();
+            reload();
+        }
+    }
+
+    std::string lname = ToLower(name);
+    std::vector<uint16_t> qtypes;
+    if(family == AF_INET || family == AF_UNSPEC) {
+        qtypes.push_back(DNS_TYPE_A);
+    }
+    if(family == AF_INET6 || family == AF_UNSPEC) {
+        qtypes.push_back(DNS_TYPE_AAAA);
+    }
+
+    size_t size = result.size();
+    for(auto qtype : qtypes) {
+        if(!lookupHosts(result, lname, qtype)) {
+            query(result, lname, qtype);
+        }
+    }
+    return result.size() > size;
+}
+
+IPAddress::ptr DnsResolver::resolveAny(const std::string& name, int family) {
+    std::vector<IPAddress::ptr> result;
+    if(resolve(result, name, family)) {
+        return result[0];
+    }
+    return nullptr;
+}
+
+}
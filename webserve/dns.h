@@ -0,0 +1,132 @@
+#ifndef __SYLAR_DNS_H__
+#define __SYLAR_DNS_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include "address.h"
+#include "thread.h"
+#include "singleton.h"
+
+namespace sylar {
+
+/**
+ * @brief 协程友好的异步 DNS 解析器
+ * @details 通过 hook 过的 UDP socket 发送查询，等待应答时只挂起当前协程，不阻塞 IO 线程；
+ *          应答被截断(TC)时改用 TCP 重查。解析顺序: 数字地址 -> /etc/hosts -> 缓存 -> 域名服务器。
+ *          域名服务器、search 域、ndots/timeout/attempts 取自 resolv.conf，
+ *          配置项 dns.servers 不为空时覆盖 resolv.conf 里的 nameserver。
+ *          缓存按名字分片加锁，遵守应答里的 TTL，不存在的域名也会缓存一小段时间
+ */
+class DnsResolver {
+public:
+    typedef std::shared_ptr<DnsResolver> ptr;
+    typedef Mutex MutexType;
+
+    DnsResolver();
+
+    /**
+     * @brief 解析域名
+     * @param[out] result 解析得到的地址(端口为0)，每次返回新的对象，调用方可以随意修改
+     * @param[in] name 域名或数字地址
+     * @param[in] family AF_INET 查 A 记录，AF_INET6 查 AAAA 记录，AF_UNSPEC 两种都查
+     * @return 是否解析到地址
+     */
+    bool resolve(std::vector<IPAddress::ptr>& result, const std::string& name,
+                 int family = AF_INET);
+
+    // 解析域名，返回任意一个地址，失败返回nullptr
+    IPAddress::ptr resolveAny(const std::string& name, int family = AF_INET);
+
+    /**
+     * @brief 设置域名服务器，覆盖 resolv.conf 和 dns.servers
+     * @param[in] servers 服务器地址，端口为0时使用53
+     */
+    void setServers(const std::vector<IPAddress::ptr>& servers);
+
+    // 返回当前使用的域名服务器
+    std::vector<IPAddress::ptr> getServers();
+
+    // 重新加载 hosts 文件和 resolv.conf
+    void reload();
+
+    // 清空缓存
+    void clearCache();
+
+    // 返回发往域名服务器的查询次数
+    uint64_t getQueryCount() const { return m_queries;}
+    // 返回命中缓存的次数
+    uint64_t getCacheHitCount() const { return m_cacheHits;}
+
+private:
+    // 缓存项，空地址表示域名不存在(否定缓存)
+    struct CacheEntry {
+        std::vector<IPAddress::ptr> addrs;
+        uint64_t expire = 0;    // 过期时间(单调时钟毫秒)
+    };
+
+    // 缓存分片
+    struct CacheShard {
+        MutexType mutex;
+        std::unordered_map<std::string, CacheEntry> entries;
+    };
+
+    static const size_t CACHE_SHARDS = 16;
+
+private:
+    void loadHosts();
+    void loadResolvConf();
+
+    // 查 hosts 文件
+    bool lookupHosts(std::vector<IPAddress::ptr>& result, const std::string& name, uint16_t qtype);
+
+    /**
+     * @brief 查缓存
+     * @param[out] found 是否命中(包括否定缓存)
+     */
+    bool lookupCache(std::vector<IPAddress::ptr>& result, const std::string& key, bool& found);
+
+    // 写缓存，ttl 为秒
+    void storeCache(const std::string& key, const std::vector<IPAddress::ptr>& addrs, uint32_t ttl);
+
+    // 按 search 域和 ndots 展开候选名字依次查询
+    bool query(std::vector<IPAddress::ptr>& result, const std::string& name, uint16_t qtype);
+
+    /**
+     * @brief 查询一个完整的名字，依次尝试所有服务器
+     * @param[out] rcode 应答码，没有任何应答时为 -1
+     */
+    bool queryName(std::vector<IPAddress::ptr>& result, const std::string& fqdn,
+                   uint16_t qtype, uint32_t& ttl, int& rcode);
+
+    /**
+     * @brief 向一个服务器发送请求并接收应答
+     * @param[in] tcp 是否使用 TCP
+     */
+    bool exchange(const IPAddress::ptr& server, const std::string& request,
+                  std::string& response, bool tcp);
+
+private:
+    RWMutex m_mutex;                                        // 保护下面的配置
+    bool m_loaded = false;                                  // 配置文件是否已经加载
+    bool m_userServers = false;                             // 是否调用过 setServers
+    std::vector<IPAddress::ptr> m_servers;                  // 域名服务器
+    std::vector<std::string> m_search;                      // search 域
+    int m_ndots = 1;                                        // 点数少于 ndots 时先尝试 search 域
+    uint64_t m_timeout = 5000;                              // 单次查询超时时间(毫秒)
+    int m_attempts = 2;                                     // 每个服务器的尝试次数
+    std::map<std::string, std::vector<IPAddress::ptr> > m_hosts;   // hosts 文件，小写域名 -> 地址
+    CacheShard m_cache[CACHE_SHARDS];                       // 分片缓存
+    std::atomic<uint64_t> m_queries = {0};                  // 查询次数
+    std::atomic<uint64_t> m_cacheHits = {0};                // 缓存命中次数
+};
+
+// DNS 解析器单例
+typedef Singleton<DnsResolver> DnsMgr;
+
+}
+
+#endif
@@ -3,56 +3,64 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 
 namespace sylar {
 
 FdCtx::FdCtx(int fd)
-    :m_isInit(false)
-    ,m_isSocket(false)
-    ,m_sysNonblock(false)
-    ,m_userNonblock(false)
-    ,m_isClosed(false)
+    :m_flags(0)
     ,m_fd(fd)
     ,m_recvTimeout(-1)
     ,m_sendTimeout(-1) {
     init();
 }
 
+FdCtx::FdCtx(int fd, bool)
+    :m_flags(0)
+    ,m_fd(fd)
+    ,m_recvTimeout(-1)
+    ,m_sendTimeout(-1) {
+}
+
 FdCtx::~FdCtx() {
 }
 
 bool FdCtx::init() {
-    if(m_isInit) {
+    if(isInit()) {
         return true;
     }
     m_recvTimeout = -1;
     m_sendTimeout = -1;
 
+    uint8_t flags = 0;
     struct stat fd_stat;
     // 判断 fd 是否已经关闭
-    if(-1 == fstat(m_fd, &fd_stat)) {
-        m_isInit = false;
-        m_isSocket = false;
-    } else {
-        m_isInit = true;
-        m_isSocket = S_ISSOCK(fd_stat.st_mode);
+    if(-1 != fstat(m_fd, &fd_stat)) {
+        flags |= INIT;
+        if(S_ISSOCK(fd_stat.st_mode)) {
+            flags |= SOCKET;
+        }
     }
 
     // 判断是不是 socket
-    if(m_isSocket) {
-        int flags = fcntl_f(m_fd, F_GETFL, 0);
+    if(flags & SOCKET) {
+        int fl = fcntl_f(m_fd, F_GETFL, 0);
         // 如果不是非阻塞的，要设置成非阻塞的
-        if(!(flags & O_NONBLOCK)) {
-            fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+        if(!(fl & O_NONBLOCK)) {
+            fcntl_f(m_fd, F_SETFL, fl | O_NONBLOCK);
         }
-        m_sysNonblock = true;
-    } else {
-        m_sysNonblock = false;
+        flags |= SYS_NONBLOCK;
     }
 
-    m_userNonblock = false;
-    m_isClosed = false;
-    return m_isInit;
+    // 用户非阻塞、关闭标志一起清掉
+    m_flags.store(flags, std::memory_order_relaxed);
+    return flags & INIT;
+}
+
+void FdCtx::initSocket() {
+    m_flags.store(INIT | SOCKET | SYS_NONBLOCK, std::memory_order_relaxed);
+    m_recvTimeout = -1;
+    m_sendTimeout = -1;
 }
 
 void FdCtx::setTimeout(int type, uint64_t v) {
@@ -73,10 +81,38 @@ uint64_t FdCtx::getTimeout(int type) {
 
 FdManager::FdManager() {
     m_datas.resize(64);
+    for(auto& i : m_chunks) {
+        i.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FdManager::~FdManager() {
+    for(auto& i : m_chunks) {
+        delete[] i.load(std::memory_order_relaxed);
+    }
+}
+
+void FdManager::publish(int fd, FdCtx* ctx) {
+    if(fd >= MAX_FDS) {
+        return;
+    }
+    std::atomic<Slot*>& chunk_ref = m_chunks[fd >> CHUNK_SHIFT];
+    Slot* chunk = chunk_ref.load(std::memory_order_relaxed);
+    if(!chunk) {
+        if(!ctx) {
+            return;
+        }
+        chunk = new Slot[CHUNK_SIZE];
+        for(int i = 0; i < CHUNK_SIZE; ++i) {
+            chunk[i].store(nullptr, std::memory_order_relaxed);
+        }
+        chunk_ref.store(chunk, std::memory_order_release);
+    }
+    chunk[fd & (CHUNK_SIZE - 1)].store(ctx, std::memory_order_release);
 }
 
 FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
+    if(fd < 0) {
         return nullptr;
     }
     RWMutexType::ReadLock lock(m_mutex);
@@ -86,29 +122,72 @@ FdCtx::ptr FdManager::get(int fd, bool auto_create) {
             return nullptr;
         }
     } else {
-        // 有句柄，不创建
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+        // 有句柄，不创建；已经关闭的句柄对外等同于不存在
+        const FdCtx::ptr& ctx = m_datas[fd];
+        if(ctx && !ctx->isClose()) {
+            return ctx;
+        }
+        if(!auto_create) {
+            return nullptr;
         }
     }
     lock.unlock();
-    
-    // 创建新的句柄
+
     RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
     if(fd >= (int)m_datas.size()) {
         m_datas.resize(fd * 1.5);
     }
-    m_datas[fd] = ctx;
+    FdCtx::ptr& ctx = m_datas[fd];
+    if(ctx && !ctx->isClose()) {
+        return ctx;
+    }
+    if(ctx) {
+        // 同一个 fd 被重新打开，原地复用关闭的对象，借用旧指针的读者不会读到释放的内存；
+        // 还持有旧 FdCtx::ptr 的一方看到的是同一个 fd 号的新状态，和直接用 fd 号操作的效果一样
+        ctx->setFlag(FdCtx::INIT, false);
+        ctx->m_fd = fd;
+        ctx->init();
+    } else {
+        ctx.reset(new FdCtx(fd));
+    }
+    publish(fd, ctx.get());
     return ctx;
 }
 
+void FdManager::addSockets(const int* fds, size_t count, uint64_t recv_timeout) {
+    if(count == 0) {
+        return;
+    }
+    int max_fd = *std::max_element(fds, fds + count);
+    RWMutexType::WriteLock lock(m_mutex);
+    if(max_fd >= (int)m_datas.size()) {
+        m_datas.resize(max_fd * 1.5);
+    }
+    for(size_t i = 0; i < count; ++i) {
+        int fd = fds[i];
+        FdCtx::ptr& ctx = m_datas[fd];
+        if(ctx) {
+            // 和 get 一样原地复用关闭的对象
+            ctx->m_fd = fd;
+        } else {
+            ctx.reset(new FdCtx(fd, true));
+        }
+        ctx->initSocket();
+        ctx->m_recvTimeout = recv_timeout;
+        publish(fd, ctx.get());
+    }
+}
+
 void FdManager::del(int fd) {
     RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
+    if(fd < 0 || (int)m_datas.size() <= fd) {
         return;
     }
-    m_datas[fd].reset();
+    // 先从无锁表摘掉，再标记关闭；对象留在槽位上等待复用
+    publish(fd, nullptr);
+    if(m_datas[fd]) {
+        m_datas[fd]->setFlag(FdCtx::CLOSED, true);
+    }
 }
 
 }
@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <vector>
+#include <atomic>
+#include <sys/socket.h>
 #include "thread.h"
 #include "singleton.h"
 
@@ -14,6 +16,7 @@ namespace sylar {
  *          是否阻塞,是否关闭,读/写超时时间
  */
 class FdCtx : public std::enable_shared_from_this<FdCtx> {
+friend class FdManager;
 public:
     typedef std::shared_ptr<FdCtx> ptr;
 
@@ -22,27 +25,27 @@ public:
     ~FdCtx();
 
     // 是否初始化完成
-    bool isInit() const { return m_isInit;}
+    bool isInit() const { return hasFlag(INIT);}
     // 是否socket
-    bool isSocket() const { return m_isSocket;}
+    bool isSocket() const { return hasFlag(SOCKET);}
     // 是否已关闭
-    bool isClose() const { return m_isClosed;}
+    bool isClose() const { return hasFlag(CLOSED);}
 
     /**
      * @brief 设置用户主动设置非阻塞
      * @param[in] v 是否阻塞
      */
-    void setUserNonblock(bool v) { m_userNonblock = v;}
+    void setUserNonblock(bool v) { setFlag(USER_NONBLOCK, v);}
     // 获取是否用户主动设置的非阻塞
-    bool getUserNonblock() const { return m_userNonblock;}
+    bool getUserNonblock() const { return hasFlag(USER_NONBLOCK);}
 
     /**
      * @brief 设置系统非阻塞
      * @param[in] v 是否阻塞
      */
-    void setSysNonblock(bool v) { m_sysNonblock = v;}
+    void setSysNonblock(bool v) { setFlag(SYS_NONBLOCK, v);}
     // 获取系统非阻塞
-    bool getSysNonblock() const { return m_sysNonblock;}
+    bool getSysNonblock() const { return hasFlag(SYS_NONBLOCK);}
 
     /**
      * @brief 设置超时时间
@@ -57,26 +60,78 @@ public:
      */
     uint64_t getTimeout(int type);
 
+    /**
+     * @brief 标记读/写等待被取消
+     * @details 标记一直保留到等待的一方用 takeCancelled 取走，取消发生在协程登记事件之前也不会丢；
+     *          同一个 fd 重新打开时清除
+     * @param[in] type 类型SO_RCVTIMEO(读), SO_SNDTIMEO(写)
+     */
+    void setCancelled(int type) { setFlag(CancelFlag(type), true);}
+    // 是否有还没取走的取消标记
+    bool isCancelled(int type) const { return hasFlag(CancelFlag(type));}
+    // 取走取消标记，返回之前是否被标记
+    bool takeCancelled(int type) {
+        uint8_t f = CancelFlag(type);
+        return m_flags.fetch_and(~f, std::memory_order_relaxed) & f;
+    }
+
 private:
+    // 给 FdManager::addSockets 用的构造函数，不做任何系统调用，由 initSocket 完成初始化
+    FdCtx(int fd, bool);
     bool init();
+    // 登记一个已经是非阻塞的 socket，不需要 fstat/fcntl
+    void initSocket();
+
+    // 状态标志位
+    enum Flag {
+        INIT            = 0x1,      // 是否初始化
+        SOCKET          = 0x2,      // 是否socket
+        SYS_NONBLOCK    = 0x4,      // 是否hook非阻塞
+        USER_NONBLOCK   = 0x8,      // 是否用户主动设置非阻塞
+        CLOSED          = 0x10,     // 是否关闭
+        READ_CANCELLED  = 0x20,     // 读等待被取消
+        WRITE_CANCELLED = 0x40      // 写等待被取消
+    };
+
+    static uint8_t CancelFlag(int type) {
+        return type == SO_RCVTIMEO ? READ_CANCELLED : WRITE_CANCELLED;
+    }
+
+    bool hasFlag(uint8_t f) const { return m_flags.load(std::memory_order_relaxed) & f;}
+    void setFlag(uint8_t f, bool v) {
+        if(v) {
+            m_flags.fetch_or(f, std::memory_order_relaxed);
+        } else {
+            m_flags.fetch_and(~f, std::memory_order_relaxed);
+        }
+    }
 
 private:
-    bool m_isInit: 1;           // 是否初始化
-    bool m_isSocket: 1;         // 是否socket
-    bool m_sysNonblock: 1;      // 是否hook非阻塞
-    bool m_userNonblock: 1;     // 是否用户主动设置非阻塞
-    bool m_isClosed: 1;         // 是否关闭
-    int m_fd;                   // 文件句柄
-    uint64_t m_recvTimeout;     // 读超时时间毫秒
-    uint64_t m_sendTimeout;     // 写超时时间毫秒
+    /**
+     * 状态和超时会被 hook 的快路径不加锁地读(FdManager::lookup)，
+     * fcntl/setsockopt 也不加锁地改，所以都用原子变量。
+     * 重新初始化发生在 FdManager 的写锁内、发布到无锁表(release)之前，
+     * 读者通过 lookup 的 acquire 看到完整的新状态，单个字段用 relaxed 就够了
+     */
+    std::atomic<uint8_t> m_flags;           // 状态标志位 Flag
+    int m_fd;                               // 文件句柄
+    std::atomic<uint64_t> m_recvTimeout;    // 读超时时间毫秒
+    std::atomic<uint64_t> m_sendTimeout;    // 写超时时间毫秒
 };
 
 
-// 文件句柄管理类
+/**
+ * @brief 文件句柄管理类
+ * @details 除了加锁的 get，还提供无锁的 lookup 给 hook 的快路径使用。
+ *          句柄关闭时 FdCtx 只标记关闭并从无锁表里摘掉，对象本身留在槽位上，
+ *          同一个 fd 再次打开时总是原地重新初始化(不管是否还有别人持有)，
+ *          所以 FdCtx 的内存在 FdManager 生命周期内不会释放
+ */
 class FdManager {
 public:
     typedef RWMutex RWMutexType;
     FdManager();
+    ~FdManager();
 
     /**
      * @brief 获取/创建文件句柄类FdCtx
@@ -86,15 +141,55 @@ public:
      */
     FdCtx::ptr get(int fd, bool auto_create = false);
 
+    /**
+     * @brief 批量登记新接收的 socket
+     * @details 只加一次写锁，调用方保证这些 fd 都是已经设置了 O_NONBLOCK 的 socket
+     *          (例如 accept4(SOCK_NONBLOCK) 的返回值)，所以不再逐个 fstat/fcntl
+     * @param[in] fds 文件句柄数组
+     * @param[in] count 文件句柄个数
+     * @param[in] recv_timeout 读超时时间毫秒，-1 表示不超时
+     */
+    void addSockets(const int* fds, size_t count, uint64_t recv_timeout = -1);
+
+    /**
+     * @brief 无锁查找文件句柄类FdCtx
+     * @details 不加锁，也不增加引用计数，只有一次 acquire 读。
+     *          返回的是借用的指针，内存不会释放，但 fd 随时可能被关闭后重新初始化，
+     *          切换协程之后它描述的可能已经是同一个 fd 号上新打开的文件
+     * @param[in] fd 文件句柄
+     * @return 没有登记或已经关闭返回 nullptr
+     */
+    FdCtx* lookup(int fd) {
+        if(fd < 0 || fd >= MAX_FDS) {
+            return nullptr;
+        }
+        Slot* chunk = m_chunks[fd >> CHUNK_SHIFT].load(std::memory_order_acquire);
+        if(!chunk) {
+            return nullptr;
+        }
+        return chunk[fd & (CHUNK_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
     /**
      * @brief 删除文件句柄类
      * @param[in] fd 文件句柄
      */
     void del(int fd);
 
+private:
+    typedef std::atomic<FdCtx*> Slot;
+    static const int CHUNK_SHIFT = 10;
+    static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static const int MAX_CHUNKS = 4096;
+    static const int MAX_FDS = CHUNK_SIZE * MAX_CHUNKS;
+
+    // 在无锁表中发布 fd 对应的 FdCtx，调用方持有写锁
+    void publish(int fd, FdCtx* ctx);
+
 private:
     RWMutexType m_mutex;                // 读写锁
-    std::vector<FdCtx::ptr> m_datas;    // 文件句柄集合
+    std::vector<FdCtx::ptr> m_datas;    // 文件句柄集合，持有 FdCtx 的所有权
+    std::atomic<Slot*> m_chunks[MAX_CHUNKS];    // 无锁表，按 fd 分块，分块只增不减
 };
 
 // 文件句柄单例
@@ -149,6 +149,9 @@ void Fiber::call() {
     if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
         SYLAR_ASSERT2(false, "swapcontext");
     }
+    if(m_state == EXEC) {
+        m_state = HOLD;
+    }
 }
 
 // 特殊化的swapout
@@ -160,7 +163,7 @@ void Fiber::back() {
 }
 
 // 将目标协程（sub_fiber)切换到当前协程，并执行
-void Fiber::swapIn() {
+Fiber::State Fiber::swapIn() {
     SetThis(this);
     SYLAR_ASSERT(m_state != EXEC);
     m_state = EXEC;
@@ -171,6 +174,13 @@ void Fiber::swapIn() {
     {
         SYLAR_ASSERT2(false, "swapcontext");
     }
+    // 切回来之后上下文才保存完整，这时才能标记为 HOLD 让别的线程恢复它
+    State state = m_state;
+    if(state == EXEC) {
+        state = HOLD;
+        m_state = HOLD;
+    }
+    return state;
 }
 
 // 切换到后台执行
@@ -210,10 +220,11 @@ void Fiber::YieldToReady() {
 }
 
 // 协程切换到后台，并且设置为Hold状态
+// 状态保持 EXEC 直到切换完成(由 swapIn/call 返回后设置 HOLD)，
+// 否则别的线程可能在上下文还没保存完时就把它调度起来
 void Fiber::YieldToHold() {
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur->m_state == EXEC);
-    cur->m_state = HOLD;
     cur->swapOut();
 }
 
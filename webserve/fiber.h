@@ -54,9 +54,11 @@ public:
     /**
      * @brief 将当前协程切换到运行状态
      * @pre getState() != EXEC
-     * @post getState() = EXEC
+     * @return 切回来时协程的状态，让出(YieldToHold)的返回 HOLD
+     * @attention 协程被标记为 HOLD 之后可能马上被别的线程恢复，
+     *            调用方要用返回值判断，不能再读 getState()
      */
-    void swapIn();
+    State swapIn();
 
     // 将当前协程切换到后台执行？
     void swapOut();
@@ -0,0 +1,376 @@
+#include "file_io.h"
+#include "offload.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "config.h"
+#include "log.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<bool>::ptr g_fileio_uring =
+    sylar::Config::Lookup("fileio.io_uring", true, "use io_uring for fiber file io when available");
+
+static sylar::ConfigVar<uint32_t>::ptr g_fileio_entries =
+    sylar::Config::Lookup("fileio.entries", (uint32_t)256, "fiber file io io_uring queue depth");
+
+// 单次读写的最大长度，和内核 read/write 的上限一致
+static const size_t MAX_RW_COUNT = 0x7ffff000;
+
+// 当前是否运行在调度器的任务协程里
+static bool InFiber() {
+    return Scheduler::GetThis() && Fiber::GetFiberId() != 0
+        && Fiber::GetThis().get() != Scheduler::GetMainFiber();
+}
+
+// 一个 io_uring 请求，放在等待协程的栈上
+struct FileRequest {
+    Scheduler* scheduler = nullptr;     // 等待协程所在的调度器
+    Fiber::ptr fiber;                   // 等待的协程
+    int res = 0;                        // 完成结果，负数为 -errno
+};
+
+/**
+ * @brief 直接用系统调用操作的 io_uring
+ * @details 每次提交都立即 io_uring_enter，提交队列的槽位用完即还；
+ *          完成队列由一个收割线程阻塞等待，在飞行中的请求数不超过完成队列长度，不会溢出
+ */
+class IOUring : Noncopyable {
+public:
+    ~IOUring();
+
+    // 创建 io_uring 并启动收割线程，内核不支持需要的操作时返回 false
+    bool init(uint32_t entries);
+
+    // 提交请求，排满或提交失败时返回 false
+    bool submit(uint8_t op, int fd, uint64_t addr, uint32_t len,
+                uint64_t offset, uint32_t op_flags, FileRequest* req);
+
+private:
+    // 收割线程执行函数
+    void reap();
+
+    // 提交一个 NOP，用户数据为空表示让收割线程退出
+    bool submitNop();
+
+    bool push(uint8_t op, int fd, uint64_t addr, uint32_t len,
+              uint64_t offset, uint32_t op_flags, uint64_t user_data);
+
+private:
+    int m_fd = -1;
+    Mutex m_mutex;                          // 保护提交队列
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned* m_sqArray = nullptr;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+    unsigned m_cqEntries = 0;
+
+    std::atomic<unsigned> m_inflight = {0}; // 在飞行中的请求数
+    Thread::ptr m_reaper;                   // 收割线程
+};
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IOUring::~IOUring() {
+    if(m_reaper) {
+        submitNop();
+        m_reaper->join();
+    }
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool IOUring::init(uint32_t entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = sys_io_uring_setup(entries, &params);
+    if(m_fd < 0) {
+        SYLAR_LOG_INFO(g_logger) << "io_uring_setup(" << entries << ") errno=" << errno
+            << " errstr=" << strerror(errno) << ", file io uses offload pool";
+        return false;
+    }
+
+    // 检查需要的操作码
+    size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> probe_buf(new char[probe_size]());
+    io_uring_probe* probe = (io_uring_probe*)probe_buf.get();
+    if(sys_io_uring_register(m_fd, IORING_REGISTER_PROBE, probe, 256)) {
+        SYLAR_LOG_INFO(g_logger) << "io_uring probe errno=" << errno << ", file io uses offload pool";
+        return false;
+    }
+    for(uint8_t op : {IORING_OP_NOP, IORING_OP_OPENAT, IORING_OP_READ,
+                      IORING_OP_WRITE, IORING_OP_FSYNC}) {
+        if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            SYLAR_LOG_INFO(g_logger) << "io_uring op " << (int)op
+                << " not supported, file io uses offload pool";
+            return false;
+        }
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + params.sq_off.head);
+    m_sqTail = (unsigned*)(sq + params.sq_off.tail);
+    m_sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    m_sqArray = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + params.cq_off.head);
+    m_cqTail = (unsigned*)(cq + params.cq_off.tail);
+    m_cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    m_cqEntries = params.cq_entries;
+
+    m_reaper.reset(new Thread(std::bind(&IOUring::reap, this), "io_uring"));
+    SYLAR_LOG_INFO(g_logger) << "file io uses io_uring sq_entries=" << params.sq_entries
+        << " cq_entries=" << params.cq_entries;
+    return true;
+}
+
+bool IOUring::push(uint8_t op, int fd, uint64_t addr, uint32_t len,
+                   uint64_t offset, uint32_t op_flags, uint64_t user_data) {
+    Mutex::Lock lock(m_mutex);
+    unsigned tail = *m_sqTail;
+    unsigned idx = tail & m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->rw_flags = op_flags;       // 和 open_flags/fsync_flags 共用同一个位置
+    sqe->user_data = user_data;
+    m_sqArray[idx] = idx;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    int rt = sys_io_uring_enter(m_fd, 1, 0, 0);
+    while(rt < 0 && errno == EINTR) {
+        rt = sys_io_uring_enter(m_fd, 1, 0, 0);
+    }
+    if(rt == 1) {
+        return true;
+    }
+    // 内核没有取走这个请求，撤回
+    SYLAR_LOG_ERROR(g_logger) << "io_uring_enter rt=" << rt << " errno=" << errno
+        << " errstr=" << strerror(errno);
+    if(__atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) == tail) {
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    }
+    return false;
+}
+
+bool IOUring::submit(uint8_t op, int fd, uint64_t addr, uint32_t len,
+                     uint64_t offset, uint32_t op_flags, FileRequest* req) {
+    // 完成队列留一个位置给退出用的 NOP
+    if(++m_inflight >= m_cqEntries) {
+        --m_inflight;
+        return false;
+    }
+    if(!push(op, fd, addr, len, offset, op_flags, (uint64_t)req)) {
+        --m_inflight;
+        return false;
+    }
+    return true;
+}
+
+bool IOUring::submitNop() {
+    return push(IORING_OP_NOP, -1, 0, 0, 0, 0, 0);
+}
+
+void IOUring::reap() {
+    bool stop = false;
+    while(!stop || m_inflight) {
+        int rt = sys_io_uring_enter(m_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if(rt < 0 && errno != EINTR) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring_enter getevents errno=" << errno
+                << " errstr=" << strerror(errno);
+        }
+
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head) {
+            io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+            FileRequest* req = (FileRequest*)cqe->user_data;
+            if(!req) {
+                stop = true;
+                continue;
+            }
+            // 放回调度器之后请求所在的栈随时可能失效，先把需要的取出来
+            Scheduler* scheduler = req->scheduler;
+            Fiber::ptr fiber;
+            fiber.swap(req->fiber);
+            req->res = cqe->res;
+            --m_inflight;
+            scheduler->schedule(fiber);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+FileIOManager::FileIOManager() {
+    init(g_fileio_uring->getValue(), g_fileio_entries->getValue());
+}
+
+FileIOManager::FileIOManager(bool use_uring, uint32_t entries) {
+    init(use_uring, entries);
+}
+
+FileIOManager::~FileIOManager() {
+}
+
+void FileIOManager::init(bool use_uring, uint32_t entries) {
+    if(!use_uring) {
+        return;
+    }
+    m_uring.reset(new IOUring);
+    if(!m_uring->init(entries)) {
+        m_uring.reset();
+    }
+}
+
+ssize_t FileIOManager::submit(uint8_t op, int fd, const void* addr, uint32_t len,
+                              uint64_t offset, uint32_t op_flags, std::function<ssize_t()> sync) {
+    if(!InFiber()) {
+        ++m_syncCount;
+        return sync();
+    }
+
+    if(m_uring) {
+        FileRequest req;
+        req.scheduler = Scheduler::GetThis();
+        req.fiber = Fiber::GetThis();
+        // 先登记好等待的协程再提交，完成得再快也能找到它
+        if(m_uring->submit(op, fd, (uint64_t)addr, len, offset, op_flags, &req)) {
+            req.scheduler->addExternalWait();
+            Fiber::YieldToHold();
+            req.scheduler->delExternalWait();
+            ++m_uringCount;
+            if(req.res < 0) {
+                errno = -req.res;
+                return -1;
+            }
+            return req.res;
+        }
+    }
+
+    // 不设超时，sync 可以引用调用方栈上的参数
+    ssize_t rt = -1;
+    int err = 0;
+    if(OffloadMgr::GetInstance()->run([&rt, &err, &sync](){
+                rt = sync();
+                err = errno;
+            }) == 0) {
+        ++m_offloadCount;
+        errno = err;
+        return rt;
+    }
+    ++m_syncCount;
+    return sync();
+}
+
+int FileIOManager::open(const std::string& path, int flags, mode_t mode) {
+    const char* p = path.c_str();
+    return submit(IORING_OP_OPENAT, AT_FDCWD, p, mode, 0, flags | O_CLOEXEC
+            , [p, flags, mode](){
+        return (ssize_t)::open(p, flags | O_CLOEXEC, mode);
+    });
+}
+
+ssize_t FileIOManager::pread(int fd, void* buf, size_t count, off_t offset) {
+    count = std::min(count, MAX_RW_COUNT);
+    return submit(IORING_OP_READ, fd, buf, count, offset, 0, [fd, buf, count, offset](){
+        return ::pread(fd, buf, count, offset);
+    });
+}
+
+ssize_t FileIOManager::pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    count = std::min(count, MAX_RW_COUNT);
+    return submit(IORING_OP_WRITE, fd, buf, count, offset, 0, [fd, buf, count, offset](){
+        return ::pwrite(fd, buf, count, offset);
+    });
+}
+
+int FileIOManager::fsync(int fd) {
+    return submit(IORING_OP_FSYNC, fd, nullptr, 0, 0, 0, [fd](){
+        return (ssize_t)::fsync(fd);
+    });
+}
+
+int FileIOManager::fdatasync(int fd) {
+    return submit(IORING_OP_FSYNC, fd, nullptr, 0, 0, IORING_FSYNC_DATASYNC, [fd](){
+        return (ssize_t)::fdatasync(fd);
+    });
+}
+
+}
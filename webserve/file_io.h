@@ -0,0 +1,92 @@
+#ifndef __SYLAR_FILE_IO_H__
+#define __SYLAR_FILE_IO_H__
+
+#include <memory>
+#include <string>
+#include <atomic>
+#include <functional>
+#include <sys/types.h>
+#include "noncopyable.h"
+#include "singleton.h"
+
+namespace sylar {
+
+class IOUring;
+
+/**
+ * @brief 协程友好的普通文件 IO
+ * @details 普通文件在 epoll 里永远是可读可写的，hook 的 do_io 不处理它们，
+ *          页缓存没命中时 read/write 会把整个 IO 线程卡在磁盘上。
+ *          这里的 open/pread/pwrite/fsync 在协程里调用时只挂起当前协程：
+ *          内核支持 io_uring 时直接提交给 io_uring，由收割线程在完成后把协程放回原来的调度器；
+ *          否则(或 io_uring 请求排满时)交给卸载线程池执行。
+ *          不在协程里调用时直接执行系统调用。
+ *          返回值和 errno 与对应的系统调用一致
+ */
+class FileIOManager : Noncopyable {
+public:
+    typedef std::shared_ptr<FileIOManager> ptr;
+
+    /**
+     * @brief 构造函数，是否使用 io_uring 和队列深度取自配置 fileio.io_uring / fileio.entries
+     */
+    FileIOManager();
+
+    /**
+     * @brief 构造函数
+     * @param[in] use_uring 是否尝试使用 io_uring，false 时总是使用卸载线程池
+     * @param[in] entries io_uring 队列深度
+     */
+    FileIOManager(bool use_uring, uint32_t entries);
+
+    ~FileIOManager();
+
+    // 打开文件，返回文件句柄
+    int open(const std::string& path, int flags, mode_t mode = 0);
+
+    // 从 offset 处读取最多 count 字节
+    ssize_t pread(int fd, void* buf, size_t count, off_t offset);
+
+    // 从 offset 处写入 count 字节
+    ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset);
+
+    // 把文件数据和元数据刷到磁盘
+    int fsync(int fd);
+
+    // 只把文件数据刷到磁盘
+    int fdatasync(int fd);
+
+    // 是否在使用 io_uring
+    bool isUring() const { return m_uring != nullptr;}
+
+    // 返回经 io_uring 完成的请求数
+    uint64_t getUringCount() const { return m_uringCount;}
+    // 返回经卸载线程池完成的请求数
+    uint64_t getOffloadCount() const { return m_offloadCount;}
+    // 返回在当前线程直接执行的请求数
+    uint64_t getSyncCount() const { return m_syncCount;}
+
+private:
+    void init(bool use_uring, uint32_t entries);
+
+    /**
+     * @brief 执行一个请求
+     * @param[in] op io_uring 操作码
+     * @param[in] sync 不能走 io_uring 时执行的系统调用，返回值同系统调用
+     */
+    ssize_t submit(uint8_t op, int fd, const void* addr, uint32_t len,
+                   uint64_t offset, uint32_t op_flags, std::function<ssize_t()> sync);
+
+private:
+    std::unique_ptr<IOUring> m_uring;           // io_uring，不可用时为空
+    std::atomic<uint64_t> m_uringCount = {0};
+    std::atomic<uint64_t> m_offloadCount = {0};
+    std::atomic<uint64_t> m_syncCount = {0};
+};
+
+// 全局的文件 IO 管理器
+typedef Singleton<FileIOManager> FileIOMgr;
+
+}
+
+#endif
@@ -5,7 +5,11 @@
 #include "iomanager.h"
 #include "fd_manager.h"
 #include "macro.h"
+#include "util.h"
 #include <dlfcn.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 namespace sylar {
@@ -23,17 +27,28 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
     XX(close) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(tee) \
+    XX(poll) \
+    XX(select) \
+    XX(epoll_wait) \
+    XX(dup) \
+    XX(dup2) \
     XX(fcntl) \
     XX(ioctl) \
     XX(getsockopt) \
@@ -75,7 +90,21 @@ void set_hook_enable(bool flag) {
 
 }
 
-struct timer_info {
+// IO 超时节点，直接放在等待协程的栈上，挂载/摘除超时都不需要分配内存
+struct timer_info : public sylar::TimeoutNode {
+    timer_info(sylar::IOManager* iom, int fd, uint32_t event)
+        :iom(iom), fd(fd), event(event) {
+    }
+
+    // 在 TimerManager 的锁内执行，协程摘除节点后才会离开栈帧
+    void onTimeout() override {
+        cancelled = ETIMEDOUT;
+        iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+    }
+
+    sylar::IOManager* iom;
+    int fd;
+    uint32_t event;
     int cancelled = 0;
 };
 
@@ -90,8 +119,8 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
 
     SYLAR_LOG_DEBUG(g_logger) << "do_io" << hook_fun_name << " >";
 
-    // 判断是不是 文件句柄
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    // 判断是不是 文件句柄；无锁查找，快路径上不加锁也不动引用计数
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     if(!ctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -107,7 +136,8 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
 
     // 设置超时时间和超时条件
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    timer_info tinfo(iom, fd, event);
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -116,39 +146,34 @@ retry:
     }
     // 如果执行一直失败，那么就设置成异步操作
     if(n == -1 && errno == EAGAIN) {
-        sylar::IOManager* iom = sylar::IOManager::GetThis();
-        sylar::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
-
         if(to != (uint64_t)-1) {
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
+            iom->armTimeout(&tinfo, to);
         }
 
         int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
         // 如果添加事件失败，那么也要把定时器取消（因为是先加的定时器）
         /* if(SYLAR_UNLIKELY(rt)) */ 
-        if(rt > 0){
+        if(rt) {
             SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
-            if(timer) {
-                timer->cancel();
-            }
+            iom->disarmTimeout(&tinfo);
             return -1;
         } else {
-            // 添加成功则 yield ，唤醒之后如果还有定时就取消掉，再强制触发
-            sylar::Fiber::YieldToHold();
-            if(timer) {
-                timer->cancel();
+            // 添加成功则 yield ，唤醒之后如果还有定时就取消掉，再强制触发。
+            // 取消的一方(Socket::cancelRead 等)先设置标记再取消事件：取消发生在 addEvent 之前时
+            // 这里能看到标记，自己把事件删掉；删除失败说明事件已经被触发，当前协程已经被调度，要让出一次
+            if(!ctx->isCancelled(timeout_so) || !iom->delEvent(fd, (sylar::IOManager::Event)(event))) {
+                sylar::Fiber::YieldToHold();
             }
-            if(tinfo->cancelled) {
-                errno = tinfo->cancelled;
+            iom->disarmTimeout(&tinfo);
+            // 被取消的等待不再重试，否则 accept 这类调用永远停不下来；
+            // FdCtx 的内存不会释放，等待期间 fd 被关闭重开也只是标记被清掉
+            if(ctx->takeCancelled(timeout_so)) {
+                errno = ECANCELED;
+                return -1;
+            }
+            if(tinfo.cancelled) {
+                errno = tinfo.cancelled;
                 return -1;
             }
             goto retry;
@@ -158,6 +183,165 @@ retry:
 }
 
 
+/**
+ * @brief 以协程方式等待一组 fd 中任意一个就绪
+ * @details IOManager 里同一个 fd 的同一种事件只能有一个等待者，poll/select 关心的 fd
+ *          可能已经有别的协程在等，所以把它们放进一个临时的 epoll，协程只等待这个 epoll 可读
+ * @param[in] timeout_ms 超时时间(毫秒)，-1 表示不超时
+ * @return 0 有 fd 就绪，ETIMEDOUT 超时，-1 无法以协程方式等待(调用方退回阻塞调用)
+ */
+static int wait_pollfds(const struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom) {
+        return -1;
+    }
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd < 0) {
+        return -1;
+    }
+    int added = 0;
+    for(nfds_t i = 0; i < nfds; ++i) {
+        if(fds[i].fd < 0) {
+            continue;
+        }
+        // linux 上 POLLIN/POLLPRI/POLLOUT/POLLRDHUP 和对应的 EPOLL 标志数值相同
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = fds[i].events & (POLLIN | POLLPRI | POLLOUT | POLLRDHUP);
+        ev.data.fd = fds[i].fd;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) == 0) {
+            ++added;
+        }
+    }
+    if(!added && timeout_ms < 0) {
+        close_f(epfd);
+        return -1;
+    }
+
+    timer_info tinfo(iom, epfd, sylar::IOManager::READ);
+    if(timeout_ms >= 0) {
+        iom->armTimeout(&tinfo, timeout_ms);
+    }
+    if(iom->addEvent(epfd, sylar::IOManager::READ)) {
+        iom->disarmTimeout(&tinfo);
+        close_f(epfd);
+        return -1;
+    }
+    sylar::Fiber::YieldToHold();
+    iom->disarmTimeout(&tinfo);
+    close_f(epfd);
+    return tinfo.cancelled;
+}
+
+// 截止时间(单调时钟毫秒)换算成剩余的超时时间，~0ull 表示不超时，返回 -1
+static int remain_ms(uint64_t deadline) {
+    if(deadline == ~0ull) {
+        return -1;
+    }
+    uint64_t now = sylar::GetMonotonicMS();
+    return now >= deadline ? 0 : (int)(deadline - now);
+}
+
+// poll 的协程实现，select/epoll_wait 也转换成 poll 来等待
+static int do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    int n = poll_f(fds, nfds, 0);
+    if(n != 0 || timeout_ms == 0) {
+        return n;
+    }
+    uint64_t deadline = timeout_ms < 0 ? ~0ull : sylar::GetMonotonicMS() + timeout_ms;
+    while(true) {
+        int left = remain_ms(deadline);
+        if(left == 0) {
+            return 0;
+        }
+        int rt = wait_pollfds(fds, nfds, left);
+        if(rt == -1) {
+            return poll_f(fds, nfds, left);
+        }
+        n = poll_f(fds, nfds, 0);
+        if(n != 0 || rt == ETIMEDOUT) {
+            return n;
+        }
+    }
+}
+
+/**
+ * @brief splice/tee 这类两端都可能阻塞的零拷贝调用
+ * @details 管道一端加上 SPLICE_F_NONBLOCK，socket 一端本来就被 hook 设成了非阻塞，
+ *          EAGAIN 时在还没就绪的一端上等待再重试。超时取两端 socket 超时中较小的一个
+ */
+template<typename Fun>
+static ssize_t do_pipe_io(int fd_in, int fd_out, unsigned int flags, Fun fun) {
+    if(!sylar::t_hook_enable || (flags & SPLICE_F_NONBLOCK)) {
+        return fun(flags);
+    }
+    sylar::FdCtx* in_ctx = sylar::FdMgr::GetInstance()->lookup(fd_in);
+    sylar::FdCtx* out_ctx = sylar::FdMgr::GetInstance()->lookup(fd_out);
+    if((in_ctx && in_ctx->getUserNonblock())
+            || (out_ctx && out_ctx->getUserNonblock())) {
+        return fun(flags);
+    }
+    uint64_t to = -1;
+    if(in_ctx && in_ctx->isSocket()) {
+        to = std::min(to, in_ctx->getTimeout(SO_RCVTIMEO));
+    }
+    if(out_ctx && out_ctx->isSocket()) {
+        to = std::min(to, out_ctx->getTimeout(SO_SNDTIMEO));
+    }
+    uint64_t deadline = to == (uint64_t)-1 ? ~0ull : sylar::GetMonotonicMS() + to;
+
+    while(true) {
+        ssize_t n = fun(flags | SPLICE_F_NONBLOCK);
+        if(n == -1 && errno == EINTR) {
+            continue;
+        }
+        if(n != -1 || errno != EAGAIN) {
+            return n;
+        }
+
+        // 只等待还没就绪的一端
+        struct pollfd pfds[2] = {{fd_in, POLLIN, 0}, {fd_out, POLLOUT, 0}};
+        poll_f(pfds, 2, 0);
+        struct pollfd waits[2];
+        nfds_t cnt = 0;
+        for(auto& p : pfds) {
+            if(!(p.revents & (p.events | POLLERR | POLLHUP))) {
+                waits[cnt++] = p;
+            }
+        }
+        if(cnt == 0) {
+            // 两端都显示就绪，只是瞬时状态，让出一次再试
+            sylar::Fiber::YieldToReady();
+            continue;
+        }
+
+        int left = remain_ms(deadline);
+        if(left == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        int rt = wait_pollfds(waits, cnt, left);
+        if(rt == ETIMEDOUT) {
+            errno = ETIMEDOUT;
+            return -1;
+        } else if(rt == -1) {
+            return fun(flags);
+        }
+    }
+}
+
+// 复制句柄时带上 FdCtx 的状态：非阻塞标志和 socket 超时属于打开的文件，新旧句柄共享
+static void dup_fdctx(int oldfd, int newfd) {
+    sylar::FdCtx* old_ctx = sylar::FdMgr::GetInstance()->lookup(oldfd);
+    if(!old_ctx) {
+        return;
+    }
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(newfd, true);
+    ctx->setUserNonblock(old_ctx->getUserNonblock());
+    ctx->setTimeout(SO_RCVTIMEO, old_ctx->getTimeout(SO_RCVTIMEO));
+    ctx->setTimeout(SO_SNDTIMEO, old_ctx->getTimeout(SO_SNDTIMEO));
+}
+
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;
     HOOK_FUN(XX);
@@ -184,7 +368,7 @@ int usleep(useconds_t usec) {
     }
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void(sylar::Scheduler::*)
+    iom->addTimerUS(usec, std::bind((void(sylar::Scheduler::*)
             (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
             ,iom, fiber, -1));
     sylar::Fiber::YieldToHold();
@@ -196,10 +380,11 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
         return nanosleep_f(req, rem);
     }
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
+    // 纳秒向上取整到微秒，保证不会比要求的时间睡得短
+    uint64_t timeout_us = req->tv_sec * 1000 * 1000ul + (req->tv_nsec + 999) / 1000;
     sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    iom->addTimer(timeout_ms, std::bind((void(sylar::Scheduler::*)
+    iom->addTimerUS(timeout_us, std::bind((void(sylar::Scheduler::*)
             (sylar::Fiber::ptr, int thread))&sylar::IOManager::schedule
             ,iom, fiber, -1));
     sylar::Fiber::YieldToHold();
@@ -223,7 +408,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!sylar::t_hook_enable) {
         return connect_f(fd, addr, addrlen);
     }
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     // 如果不是 fd 或者已经关闭了
     if(!ctx || ctx->isClose()) {
         errno = EBADF;
@@ -248,20 +433,11 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     }
 
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    sylar::Timer::ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
+    timer_info tinfo(iom, fd, sylar::IOManager::WRITE);
 
     // 如果没有超时
     if(timeout_ms != (uint64_t)-1) {
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, winfo);
+        iom->armTimeout(&tinfo, timeout_ms);
     }
 
     // 这里进行添加事件
@@ -269,17 +445,13 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(rt == 0) {
         sylar::Fiber::YieldToHold();
         // 定时结束之后，取消定时器
-        if(timer) {
-            timer->cancel();
-        }
-        if(tinfo->cancelled) {
-            errno = tinfo->cancelled;
+        iom->disarmTimeout(&tinfo);
+        if(tinfo.cancelled) {
+            errno = tinfo.cancelled;
             return -1;
         }
     } else {
-        if(timer) {
-            timer->cancel();
-        }
+        iom->disarmTimeout(&tinfo);
         SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
@@ -308,6 +480,18 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     return fd;
 }
 
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    int fd = do_io(s, accept4_f, "accept4", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    if(fd >= 0) {
+        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd, true);
+        // 调用方要求非阻塞时记下来，之后的 IO 不再由 hook 代为等待
+        if(flags & SOCK_NONBLOCK) {
+            ctx->setUserNonblock(true);
+        }
+    }
+    return fd;
+}
+
 
 // read
 ssize_t read(int fd, void *buf, size_t count) {
@@ -330,6 +514,11 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+// 非阻塞的 socket 上 recvmmsg 收完已经到达的数据报就返回，timeout 只对阻塞 socket 有意义
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", sylar::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 
 // write
 ssize_t write(int fd, const void *buf, size_t count) {
@@ -352,12 +541,16 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int sendmmsg(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    return do_io(s, sendmmsg_f, "sendmmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
 int close(int fd) {
     if(!sylar::t_hook_enable) {
         return close_f(fd);
     }
 
-    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
     if(ctx) {
         // 先取消事件，再关闭事件
         auto iom = sylar::IOManager::GetThis();
@@ -370,6 +563,149 @@ int close(int fd) {
 }
 
 
+// sendfile splice tee
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    return do_io(out_fd, sendfile_f, "sendfile", sylar::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags) {
+    return do_pipe_io(fd_in, fd_out, flags, [=](unsigned int f){
+        return splice_f(fd_in, off_in, fd_out, off_out, len, f);
+    });
+}
+
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags) {
+    return do_pipe_io(fd_in, fd_out, flags, [=](unsigned int f){
+        return tee_f(fd_in, fd_out, len, f);
+    });
+}
+
+
+// poll select epoll_wait
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    if(!sylar::t_hook_enable) {
+        return poll_f(fds, nfds, timeout);
+    }
+    return do_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if(!sylar::t_hook_enable) {
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+    int timeout_ms = timeout ? timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000 : -1;
+    std::vector<struct pollfd> pfds;
+    for(int fd = 0; fd < nfds; ++fd) {
+        short events = 0;
+        if(readfds && FD_ISSET(fd, readfds)) {
+            events |= POLLIN;
+        }
+        if(writefds && FD_ISSET(fd, writefds)) {
+            events |= POLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, exceptfds)) {
+            events |= POLLPRI;
+        }
+        if(events) {
+            pfds.push_back({fd, events, 0});
+        }
+    }
+
+    int n = do_poll(pfds.data(), pfds.size(), timeout_ms);
+    if(n < 0) {
+        return n;
+    }
+    for(auto& p : pfds) {
+        if(p.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+    // 按内核 select 的规则把 revents 换算回三个集合
+    int count = 0;
+    if(readfds) {
+        FD_ZERO(readfds);
+    }
+    if(writefds) {
+        FD_ZERO(writefds);
+    }
+    if(exceptfds) {
+        FD_ZERO(exceptfds);
+    }
+    for(auto& p : pfds) {
+        if((p.events & POLLIN) && (p.revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(p.fd, readfds);
+            ++count;
+        }
+        if((p.events & POLLOUT) && (p.revents & (POLLOUT | POLLERR))) {
+            FD_SET(p.fd, writefds);
+            ++count;
+        }
+        if((p.events & POLLPRI) && (p.revents & POLLPRI)) {
+            FD_SET(p.fd, exceptfds);
+            ++count;
+        }
+    }
+    return count;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if(!sylar::t_hook_enable) {
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+    int n = epoll_wait_f(epfd, events, maxevents, 0);
+    if(n != 0 || timeout == 0) {
+        return n;
+    }
+    // epoll 句柄本身有事件时可读，等它可读再取事件；事件被别人取走了就继续等
+    uint64_t deadline = timeout < 0 ? ~0ull : sylar::GetMonotonicMS() + timeout;
+    while(true) {
+        int left = remain_ms(deadline);
+        if(left == 0) {
+            return 0;
+        }
+        struct pollfd pfd = {epfd, POLLIN, 0};
+        n = do_poll(&pfd, 1, left);
+        if(n <= 0) {
+            return n;
+        }
+        n = epoll_wait_f(epfd, events, maxevents, 0);
+        if(n != 0) {
+            return n;
+        }
+    }
+}
+
+
+// dup dup2
+int dup(int oldfd) {
+    int fd = dup_f(oldfd);
+    if(fd >= 0 && sylar::t_hook_enable) {
+        dup_fdctx(oldfd, fd);
+    }
+    return fd;
+}
+
+int dup2(int oldfd, int newfd) {
+    if(!sylar::t_hook_enable || oldfd == newfd || fcntl_f(oldfd, F_GETFD) == -1) {
+        return dup2_f(oldfd, newfd);
+    }
+    // newfd 原来打开着的话会被内核隐式关闭，先按 close 的方式清理它的事件和上下文
+    if(sylar::FdMgr::GetInstance()->lookup(newfd)) {
+        auto iom = sylar::IOManager::GetThis();
+        if(iom) {
+            iom->cancelAll(newfd);
+        }
+        sylar::FdMgr::GetInstance()->del(newfd);
+    }
+    int fd = dup2_f(oldfd, newfd);
+    if(fd >= 0) {
+        dup_fdctx(oldfd, fd);
+    }
+    return fd;
+}
+
+
 int fcntl(int fd, int cmd, ... /* arg */ ) {
     va_list va;
     va_start(va, cmd);
@@ -379,7 +715,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return fcntl_f(fd, cmd, arg);
                 }
@@ -396,7 +732,7 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(fd);
                 if(!ctx || ctx->isClose() || !ctx->isSocket()) {
                     return arg;
                 }
@@ -470,7 +806,7 @@ int ioctl(int d, unsigned long int request, ...) {
 
     if(FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(d);
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(d);
         if(!ctx || ctx->isClose() || !ctx->isSocket()) {
             return ioctl_f(d, request, arg);
         }
@@ -489,7 +825,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     }
     if(level == SOL_SOCKET) {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
-            sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->lookup(sockfd);
             if(ctx) {
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
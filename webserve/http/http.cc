@@ -52,6 +52,50 @@ const char* HttpStatusToString(const HttpStatus& s) {
     }
 }
 
+const char* ChooseContentEncoding(const std::string& accept_encoding) {
+    // -1 表示没有出现
+    double gzip = -1, deflate = -1, star = -1;
+    size_t pos = 0;
+    while(pos < accept_encoding.size()) {
+        size_t end = accept_encoding.find(',', pos);
+        if(end == std::string::npos) {
+            end = accept_encoding.size();
+        }
+        // 每一项是 "coding" 或 "coding;q=0.5"
+        std::string item = accept_encoding.substr(pos, end - pos);
+        pos = end + 1;
+        double q = 1;
+        size_t semi = item.find(';');
+        if(semi != std::string::npos) {
+            size_t qpos = item.find("q=", semi);
+            if(qpos != std::string::npos) {
+                q = atof(item.c_str() + qpos + 2);
+            }
+            item.resize(semi);
+        }
+        size_t b = item.find_first_not_of(" \t");
+        size_t e = item.find_last_not_of(" \t");
+        std::string coding = b == std::string::npos ? "" : item.substr(b, e - b + 1);
+        if(strcasecmp(coding.c_str(), "gzip") == 0 || strcasecmp(coding.c_str(), "x-gzip") == 0) {
+            gzip = q;
+        } else if(strcasecmp(coding.c_str(), "deflate") == 0) {
+            deflate = q;
+        } else if(coding == "*") {
+            star = q;
+        }
+    }
+    if(gzip < 0) {
+        gzip = star;
+    }
+    if(deflate < 0) {
+        deflate = star;
+    }
+    if(gzip <= 0 && deflate <= 0) {
+        return nullptr;
+    }
+    return gzip >= deflate ? "gzip" : "deflate";
+}
+
 bool CaseInsensitiveLess::operator()(const std::string& lhs
                             ,const std::string& rhs) const {
     // 这个方法不区分大小写
@@ -205,6 +249,9 @@ void HttpRequest::init() {
         } else {
             m_close = true;
         }
+    } else {
+        // 没有 Connection 头时 HTTP/1.1 默认是长连接，HTTP/1.0 默认关闭
+        m_close = m_version < 0x11;
     }
 }
 
@@ -145,6 +145,13 @@ const char* HttpMethodToString(const HttpMethod& m);
 // 将HTTP状态枚举转换成字符串
 const char* HttpStatusToString(const HttpStatus& s);
 
+/**
+ * @brief 根据请求的 Accept-Encoding 选择响应的压缩方式
+ * @details 按 q 值选择 gzip 或 deflate，q 值相同时优先 gzip，"*" 匹配没有单独列出的方式，q=0 表示不接受
+ * @return "gzip"、"deflate"，都不接受时返回 nullptr
+ */
+const char* ChooseContentEncoding(const std::string& accept_encoding);
+
 // 忽略大小写比较仿函数
 struct CaseInsensitiveLess {
     // 忽略大小写比较字符串
@@ -1,7 +1,7 @@
 #include "http_connection.h"
 #include "http_parser.h"
 #include "webserve/log.h"
-// #include "webserve/streams/zlib_stream.h"
+#include "webserve/streams/zlib_stream.h"
 
 namespace sylar {
 namespace http {
@@ -131,23 +131,23 @@ HttpResponse::ptr HttpConnection::recvResponse() {
             }
         }
     }
-    // if(!body.empty()) {
-    //     auto content_encoding = parser->getData()->getHeader("content-encoding");
-    //     SYLAR_LOG_DEBUG(g_logger) << "content_encoding: " << content_encoding
-    //         << " size=" << body.size();
-    //     if(strcasecmp(content_encoding.c_str(), "gzip") == 0) {
-    //         auto zs = ZlibStream::CreateGzip(false);
-    //         zs->write(body.c_str(), body.size());
-    //         zs->flush();
-    //         zs->getResult().swap(body);
-    //     } else if(strcasecmp(content_encoding.c_str(), "deflate") == 0) {
-    //         auto zs = ZlibStream::CreateDeflate(false);
-    //         zs->write(body.c_str(), body.size());
-    //         zs->flush();
-    //         zs->getResult().swap(body);
-    //     }
-    //     parser->getData()->setBody(body);
-    // }
+    if(!body.empty()) {
+        auto content_encoding = parser->getData()->getHeader("content-encoding");
+        SYLAR_LOG_DEBUG(g_logger) << "content_encoding: " << content_encoding
+            << " size=" << body.size();
+        // HTTP 的 deflate 是 zlib 格式，解压 GZIP 时两种头都认
+        if(strcasecmp(content_encoding.c_str(), "gzip") == 0
+                || strcasecmp(content_encoding.c_str(), "deflate") == 0) {
+            std::string out;
+            if(!ZlibStream::Decompress(body.c_str(), body.size(), out, ZlibStream::GZIP
+                    ,HttpResponseParser::GetHttpResponseMaxBodySize())) {
+                close();
+                return nullptr;
+            }
+            body.swap(out);
+        }
+        parser->getData()->setBody(body);
+    }
     return parser->getData();
 }
 
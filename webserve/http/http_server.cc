@@ -1,5 +1,7 @@
 #include "http_server.h"
 #include "webserve/log.h"
+#include "webserve/config.h"
+#include "webserve/streams/zlib_stream.h"
 // #include "webserve/http/servlets/config_servlet.h"
 // #include "webserve/http/servlets/status_servlet.h"
 
@@ -8,12 +10,39 @@ namespace http {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+// 响应压缩级别 1~9，级别越高越费 CPU，0 表示不压缩
+static sylar::ConfigVar<int32_t>::ptr g_http_compress_level =
+    sylar::Config::Lookup("http.compress.level", (int32_t)6
+                ,"http response gzip/deflate level, 0 disables");
+
+// 小的消息体压缩省不了多少字节，不压缩
+static sylar::ConfigVar<uint64_t>::ptr g_http_compress_min_size =
+    sylar::Config::Lookup("http.compress.min_size", (uint64_t)1024
+                ,"http response min body size to compress");
+
+// 文本类的内容才值得压缩，图片、视频、压缩包本身已经压缩过
+static bool IsCompressible(const std::string& content_type) {
+    if(content_type.empty() || strncasecmp(content_type.c_str(), "text/", 5) == 0) {
+        return true;
+    }
+    static const char* s_types[] = {"json", "xml", "javascript", "ecmascript"
+                                    ,"x-www-form-urlencoded"};
+    for(auto t : s_types) {
+        if(strcasestr(content_type.c_str(), t)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 HttpServer::HttpServer(bool keepalive
                ,sylar::IOManager* worker
                ,sylar::IOManager* io_worker
                ,sylar::IOManager* accept_worker)
     :TcpServer(worker, io_worker, accept_worker)
-    ,m_isKeepalive(keepalive) {
+    ,m_isKeepalive(keepalive)
+    ,m_compressLevel(g_http_compress_level->getValue())
+    ,m_compressMinSize(g_http_compress_min_size->getValue()) {
     m_dispatch.reset(new ServletDispatch);
 
     // m_type = "http";
@@ -41,7 +70,9 @@ void HttpServer::handleClient(Socket::ptr client) {
                             ,req->isClose() || !m_isKeepalive));
         rsp->setHeader("Server", getName());
         m_dispatch->handle(req, rsp, session);
-        session->sendResponse(rsp);
+        compressResponse(req, rsp);
+        // 流水线上后面的请求已经在读缓冲里了，响应先攒着，和后面的一起发
+        session->sendResponse(rsp, !rsp->isClose() && session->getReadBuffered() > 0);
         if(!m_isKeepalive || req->isClose()) {
             break;
         }
@@ -49,5 +80,30 @@ void HttpServer::handleClient(Socket::ptr client) {
     session->close();
 }
 
+void HttpServer::compressResponse(HttpRequest::ptr req, HttpResponse::ptr rsp) {
+    const std::string& body = rsp->getBody();
+    if(m_compressLevel <= 0 || body.size() < m_compressMinSize
+            || !rsp->getHeader("content-encoding").empty()
+            || !IsCompressible(rsp->getHeader("content-type"))) {
+        return;
+    }
+    // 同一个地址的响应按 Accept-Encoding 不同，告诉缓存要区分
+    rsp->setHeader("Vary", "Accept-Encoding");
+    const char* encoding = ChooseContentEncoding(req->getHeader("accept-encoding"));
+    if(!encoding) {
+        return;
+    }
+    // HTTP 的 deflate 是 zlib 格式
+    std::string out;
+    if(!ZlibStream::Compress(body.c_str(), body.size(), out
+            ,encoding[0] == 'g' ? ZlibStream::GZIP : ZlibStream::ZLIB
+            ,std::min(m_compressLevel, (int)ZlibStream::BEST_COMPRESSION))
+            || out.size() >= body.size()) {
+        return;
+    }
+    rsp->setBody(out);
+    rsp->setHeader("Content-Encoding", encoding);
+}
+
 }
 }
@@ -30,13 +30,28 @@ public:
     void setServletDispatch(ServletDispatch::ptr v) { m_dispatch = v;}
 
     virtual void setName(const std::string& v) override;
+
+    // 响应压缩级别 1~9，0 表示不压缩
+    int getCompressLevel() const { return m_compressLevel;}
+    void setCompressLevel(int v) { m_compressLevel = v;}
+    // 消息体不小于这个大小时才压缩
+    uint64_t getCompressMinSize() const { return m_compressMinSize;}
+    void setCompressMinSize(uint64_t v) { m_compressMinSize = v;}
     
 protected:
     virtual void handleClient(Socket::ptr client) override;
+
+    /**
+     * @brief 按请求的 Accept-Encoding 压缩响应的消息体
+     * @details 只压缩文本类的 Content-Type，已经设置了 Content-Encoding 或者压缩后没有变小时不动
+     */
+    void compressResponse(HttpRequest::ptr req, HttpResponse::ptr rsp);
     
 private:
     bool m_isKeepalive;// 是否支持长连接  
     ServletDispatch::ptr m_dispatch;// Servlet分发器
+    int m_compressLevel;// 响应压缩级别
+    uint64_t m_compressMinSize;// 压缩的最小消息体
 };
 
 }
@@ -1,80 +1,124 @@
 #include "http_session.h"
 #include "http_parser.h"
+#include <string.h>
 
 namespace sylar {
 namespace http {
 
+// 流水线上攒着的响应超过这个大小就先发出去
+static const size_t s_max_delay_bytes = 64 * 1024;
+
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
     :SocketStream(sock, owner) {
 }
 
+HttpSession::~HttpSession() {
+    if(m_rblock) {
+        m_rblock->unref();
+    }
+}
+
 HttpRequest::ptr HttpSession::recvRequest() {
     HttpRequestParser::ptr parser(new HttpRequestParser);
-    uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    //uint64_t buff_size = 100;
-    std::shared_ptr<char> buffer(
-            new char[buff_size], [](char* ptr){
-                delete[] ptr;
-            });
-    char* data = buffer.get();
-    int offset = 0;
-    do {
-        int len = read(data + offset, buff_size - offset);
-        if(len <= 0) {
+    if(!m_rblock) {
+        m_rblock = BufferBlock::Alloc(HttpRequestParser::GetHttpRequestBufferSize());
+    }
+    // 上一个请求之后剩下的数据在缓冲区开头
+    uint64_t buff_size = m_rblock->getCapacity();
+    char* data = m_rblock->data();
+    size_t offset = m_rlen;
+    m_rlen = 0;
+    // 解析器在两次 execute 之间不保留半个字段，等头部完整("\r\n\r\n")了再一次解析；
+    // scanned 是已经找过、不可能是结尾开头的字节数
+    size_t scanned = 0;
+    while(!(offset >= 4 && memmem(data + scanned, offset - scanned, "\r\n\r\n", 4))) {
+        scanned = offset > 3 ? offset - 3 : 0;
+        // 缓冲区满了头部还没有结束
+        if(offset == buff_size) {
+            releaseRead();
+            flush();
             close();
             return nullptr;
         }
-        len += offset;
-        // 实际解析 HTTP 的长度
-        size_t nparse = parser->execute(data, len);
-        if(parser->hasError()) {
+        // 要等客户端的数据了，先把攒着的响应发出去，客户端可能在等它们
+        if(flush() < 0) {
+            releaseRead();
             close();
             return nullptr;
         }
-        // 缓冲区的大小
-        offset = len - nparse;
-        if(offset == (int)buff_size) {
+        int len = read(data + offset, buff_size - offset);
+        if(len <= 0) {
+            releaseRead();
             close();
             return nullptr;
         }
-        if(parser->isFinished()) {
-            break;
-        }
-    } while(true);
-    
+        offset += len;
+    }
+    // 实际解析 HTTP 的长度，解析过的数据被移走
+    size_t nparse = parser->execute(data, offset);
+    if(parser->hasError() || !parser->isFinished()) {
+        releaseRead();
+        flush();
+        close();
+        return nullptr;
+    }
+    offset -= nparse;
+
     int64_t length = parser->getContentLength();
     if(length > 0) {
         std::string body;
         body.resize(length);
 
-        int len = 0;
-        if(length >= offset) {
-            memcpy(&body[0], data, offset);
-            len = offset;
-        } else {
-            memcpy(&body[0], data, length);
-            len = length;
-        }
-        length -= offset;
-        if(length > 0) {
-            if(readFixSize(&body[len], length) <= 0) {
+        size_t len = std::min((size_t)length, offset);
+        memcpy(&body[0], data, len);
+        // 消息体之后的数据是流水线上的下一个请求，留在缓冲区里
+        memmove(data, data + len, offset - len);
+        offset -= len;
+        if((size_t)length > len) {
+            if(flush() < 0 || readFixSize(&body[len], length - len) <= 0) {
+                releaseRead();
                 close();
                 return nullptr;
             }
         }
         parser->getData()->setBody(body);
     }
+    m_rlen = offset;
+    releaseRead();
 
     parser->getData()->init();
     return parser->getData();
 }
 
-int HttpSession::sendResponse(HttpResponse::ptr rsp) {
+int HttpSession::sendResponse(HttpResponse::ptr rsp, bool delay) {
     std::stringstream ss;
     ss << *rsp;
     std::string data = ss.str();
+    if(!delay && m_wbuf.empty()) {
+        return writeFixSize(data.c_str(), data.size());
+    }
+    m_wbuf += data;
+    if(delay && m_wbuf.size() < s_max_delay_bytes) {
+        return data.size();
+    }
+    return flush();
+}
+
+int HttpSession::flush() {
+    if(m_wbuf.empty()) {
+        return 0;
+    }
+    std::string data;
+    data.swap(m_wbuf);
     return writeFixSize(data.c_str(), data.size());
 }
 
+void HttpSession::releaseRead() {
+    if(m_rblock && m_rlen == 0) {
+        m_rblock->unref();
+        m_rblock = nullptr;
+    }
+}
+
 }
 }
@@ -3,11 +3,19 @@
 
 #include "webserve/streams/socket_stream.h"
 #include "http.h"
+#include "webserve/slice.h"
 
 namespace sylar {
 namespace http {
 
-// HTTPSession封装
+/**
+ * @brief HTTPSession封装
+ * @details 读缓冲在请求之间保留：解析完一个请求后多读到的数据(流水线发来的下一个请求)留在缓冲里，
+ *          下一次 recvRequest 先解析它们。缓冲的内存来自 BufferBlock 的 slab 池，读空后立即归还，
+ *          空闲的长连接不占内存。
+ *          流水线上的响应可以先攒在发送缓冲里，recvRequest 要从 socket 读数据之前一起发出去，
+ *          响应的顺序和请求一致
+ */
 class HttpSession : public SocketStream {
 public:
     typedef std::shared_ptr<HttpSession> ptr;
@@ -18,18 +26,47 @@ public:
      * @param[in] owner 是否托管
      */
     HttpSession(Socket::ptr sock, bool owner = true);
+    ~HttpSession();
     
-    // 接收HTTP请求
+    /**
+     * @brief 接收HTTP请求
+     * @details 读缓冲里已经有完整的请求时不读 socket；需要读 socket 时先 flush 发送缓冲
+     * @return 出错或者对方关闭时返回 nullptr，并关闭连接
+     */
     HttpRequest::ptr recvRequest();
 
     /**
      * @brief 发送HTTP响应
      * @param[in] rsp HTTP响应
-     * @return >0 发送成功
+     * @param[in] delay 为 true 时先放进发送缓冲，和后面的响应合并成一次发送；
+     *                  发送缓冲超过 64KB 时立即发送
+     * @return >0 发送成功(delay 时是放进缓冲的长度)
      *         =0 对方关闭
      *         <0 Socket异常
      */
-    int sendResponse(HttpResponse::ptr rsp);
+    int sendResponse(HttpResponse::ptr rsp, bool delay = false);
+
+    /**
+     * @brief 发出发送缓冲里的响应
+     * @return >0 发送的长度，=0 没有数据或者对方关闭，<0 Socket异常
+     */
+    int flush();
+
+    // 读缓冲里还没有解析的字节数，>0 说明客户端在流水线上发了后面的请求
+    size_t getReadBuffered() const { return m_rlen;}
+    // 发送缓冲里还没有发出的字节数
+    size_t getWriteBuffered() const { return m_wbuf.size();}
+
+private:
+    // 读缓冲读空后把内存还给池
+    void releaseRead();
+
+private:
+    // 读缓冲，[0, m_rlen) 是上一个请求之后还没有解析的数据
+    BufferBlock* m_rblock = nullptr;
+    size_t m_rlen = 0;
+    // 发送缓冲
+    std::string m_wbuf;
 };
 
 }
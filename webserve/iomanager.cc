@@ -1,6 +1,7 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "hook.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
@@ -11,6 +12,29 @@ namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+// 内核是否支持 epoll_pwait2(5.11+)，不支持时退回毫秒精度的 epoll_wait
+static std::atomic<bool> s_has_epoll_pwait2 = {true};
+
+/**
+ * @brief 以微秒精度等待事件
+ * @details epoll_wait 的超时只有毫秒精度，usleep(500) 这类亚毫秒定时器会被放大成 1ms 甚至空转，
+ *          优先使用 epoll_pwait2 的 timespec 超时，老内核上向上取整到毫秒
+ */
+static int EpollWaitUS(int epfd, epoll_event* events, int maxevents, uint64_t timeout_us) {
+    if(s_has_epoll_pwait2) {
+        struct timespec ts;
+        ts.tv_sec = timeout_us / 1000000;
+        ts.tv_nsec = timeout_us % 1000000 * 1000;
+        int rt = epoll_pwait2(epfd, events, maxevents, &ts, nullptr);
+        if(rt >= 0 || errno != ENOSYS) {
+            return rt;
+        }
+        s_has_epoll_pwait2 = false;
+    }
+    // 直接调用原始的 epoll_wait，hook 之后的版本会让出协程
+    return epoll_wait_f(epfd, events, maxevents, (int)((timeout_us + 999) / 1000));
+}
+
 enum EpollCtlOp {
 };
 
@@ -216,7 +240,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 bool IOManager::delEvent(int fd, Event event) {
     // 找到fd对应的FdContext
     RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    if(fd < 0 || (int)m_fdContexts.size() <= fd) {
         return false;
     }
     FdContext* fd_ctx = m_fdContexts[fd];
@@ -256,7 +280,7 @@ bool IOManager::delEvent(int fd, Event event) {
 bool IOManager::cancelEvent(int fd, Event event) {
     // 找到fd对应的FdContext
     RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    if(fd < 0 || (int)m_fdContexts.size() <= fd) {
         return false;
     }
     FdContext* fd_ctx = m_fdContexts[fd];
@@ -292,7 +316,7 @@ bool IOManager::cancelEvent(int fd, Event event) {
 bool IOManager::cancelAll(int fd) {
     // 找到fd对应的FdContext
     RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    if(fd < 0 || (int)m_fdContexts.size() <= fd) {
         return false;
     }
     FdContext* fd_ctx = m_fdContexts[fd];
@@ -347,7 +371,7 @@ void IOManager::tickle() {
 }
 
 bool IOManager::stopping(uint64_t& timeout) {
-    timeout = getNextTimer();
+    timeout = getNextTimerUS();
     return timeout == ~0ull
         && m_pendingEventCount == 0
         && Scheduler::stopping();
@@ -369,25 +393,25 @@ void IOManager::idle() {
     });
 
     while(true) {
+        // 每一轮循环刷新一次缓存的单调时钟，本轮的定时器计算都用这个时间
+        UpdateCachedMonotonicUS();
         uint64_t next_timeout = 0;
         // if(SYLAR_UNLIKELY(stopping(next_timeout))) {
         if(stopping(next_timeout)) {
             SYLAR_LOG_INFO(g_logger) << "name=" << getName()
                                      << " idle stopping exit";
+            ClearCachedMonotonic();
             break;
         }
 
         int rt = 0;
         do {
-            // 设置超时时长，epoll_wait并不是完全阻塞的
-            static const int MAX_TIMEOUT = 3000;
-            if(next_timeout != ~0ull) {
-                next_timeout = (int)next_timeout > MAX_TIMEOUT
-                                ? MAX_TIMEOUT : next_timeout;
-            } else {
+            // 设置超时时长(微秒)，epoll_wait并不是完全阻塞的
+            static const uint64_t MAX_TIMEOUT = 3000 * 1000;
+            if(next_timeout > MAX_TIMEOUT) {
                 next_timeout = MAX_TIMEOUT;
             }
-            rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
+            rt = EpollWaitUS(m_epfd, events, MAX_EVNETS, next_timeout);
 
             // 如果epoll_wait发生错误，或者被一个信号强制中断了，那还是继续执行
             if(rt < 0 && errno == EINTR) {
@@ -396,6 +420,8 @@ void IOManager::idle() {
             }
         } while(true);
 
+        // epoll_wait 可能阻塞了很久，唤醒之后再刷新一次
+        UpdateCachedMonotonicUS();
         std::vector<std::function<void()> > cbs;
         listExpiredCb(cbs);
         if(!cbs.empty()) {
@@ -115,7 +115,7 @@ protected:
 
     /**
      * @brief 判断是否可以停止
-     * @param[out] timeout 最近要出发的定时器事件间隔
+     * @param[out] timeout 最近要出发的定时器事件间隔(微秒)
      * @return 返回是否可以停止
      */
     bool stopping(uint64_t& timeout);
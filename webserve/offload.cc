@@ -0,0 +1,288 @@
+#include "offload.h"
+#include "scheduler.h"
+#include "iomanager.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static sylar::ConfigVar<uint32_t>::ptr g_offload_threads =
+    sylar::Config::Lookup("offload.threads", (uint32_t)4, "offload pool thread count");
+
+static sylar::ConfigVar<uint32_t>::ptr g_offload_max_queue =
+    sylar::Config::Lookup("offload.max_queue", (uint32_t)1024, "offload pool max queued tasks");
+
+// 等待超时节点，放在等待协程的栈上
+struct OffloadTimeout : public TimeoutNode {
+    OffloadTimeout(OffloadPool::Task::ptr task)
+        :task(task) {
+    }
+
+    void onTimeout() override {
+        fired = true;
+        task->cancel();
+    }
+
+    OffloadPool::Task::ptr task;
+    bool fired = false;
+};
+
+// 原子地更新最大值
+static void UpdateMax(std::atomic<uint64_t>& max, uint64_t v) {
+    uint64_t old = max.load(std::memory_order_relaxed);
+    while(v > old && !max.compare_exchange_weak(old, v, std::memory_order_relaxed)) {
+    }
+}
+
+OffloadPool::Task::Task(std::function<void()> cb)
+    :m_cb(cb) {
+}
+
+bool OffloadPool::Task::cancel() {
+    int state = m_state.load();
+    while(state == PENDING || state == RUNNING) {
+        // 排队中的直接标记取消，执行中的保持 RUNNING，由工作线程执行完后置为 DONE
+        if(state == RUNNING || m_state.compare_exchange_weak(state, CANCELLED)) {
+            wake(ECANCELED);
+            return true;
+        }
+    }
+    return false;
+}
+
+void OffloadPool::Task::wake(int reason) {
+    Scheduler* scheduler = nullptr;
+    Fiber::ptr fiber;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_woken) {
+            return;
+        }
+        m_woken = true;
+        m_reason = reason;
+        if(m_sem) {
+            m_sem->notify();
+            return;
+        }
+        scheduler = m_scheduler;
+        fiber.swap(m_fiber);
+    }
+    // 回到等待协程原来的调度器上继续执行
+    if(fiber) {
+        scheduler->schedule(fiber);
+    }
+}
+
+OffloadPool::OffloadPool()
+    :m_name("offload")
+    ,m_maxQueue(g_offload_max_queue->getValue()) {
+    start(g_offload_threads->getValue());
+}
+
+OffloadPool::OffloadPool(size_t threads, size_t max_queue, const std::string& name)
+    :m_name(name)
+    ,m_maxQueue(max_queue) {
+    start(threads);
+}
+
+OffloadPool::~OffloadPool() {
+    stop();
+}
+
+void OffloadPool::start(size_t threads) {
+    SYLAR_ASSERT(threads > 0);
+    for(size_t i = 0; i < threads; ++i) {
+        m_threads.push_back(Thread::ptr(new Thread(std::bind(&OffloadPool::work, this)
+                            , m_name + "_" + std::to_string(i))));
+    }
+}
+
+void OffloadPool::stop() {
+    std::vector<Thread::ptr> thrs;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_stopping) {
+            return;
+        }
+        m_stopping = true;
+        thrs.swap(m_threads);
+    }
+    // 每个线程一个空任务，让阻塞在信号量上的线程醒来退出
+    for(size_t i = 0; i < thrs.size(); ++i) {
+        m_sem.notify();
+    }
+    for(auto& i : thrs) {
+        i->join();
+    }
+}
+
+OffloadPool::Task::ptr OffloadPool::submit(std::function<void()> cb) {
+    Task::ptr task(new Task(cb));
+    task->m_submitUS = GetMonotonicUS();
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_stopping || m_tasks.size() >= m_maxQueue) {
+            lock.unlock();
+            ++m_rejected;
+            return nullptr;
+        }
+        m_tasks.push_back(task);
+    }
+    ++m_submitted;
+    m_sem.notify();
+    return task;
+}
+
+int OffloadPool::wait(Task::ptr task, uint64_t timeout_ms) {
+    Scheduler* scheduler = Scheduler::GetThis();
+    bool in_fiber = scheduler && Fiber::GetFiberId() != 0
+                    && Fiber::GetThis().get() != Scheduler::GetMainFiber();
+    if(!in_fiber) {
+        // 不在协程里，只能阻塞当前线程
+        Semaphore sem;
+        {
+            MutexType::Lock lock(task->m_mutex);
+            if(!task->m_woken) {
+                task->m_sem = &sem;
+            }
+        }
+        if(task->m_sem) {
+            sem.wait();
+            // 等 wake 释放锁之后信号量才能析构
+            MutexType::Lock lock(task->m_mutex);
+            task->m_sem = nullptr;
+        }
+        return task->m_reason;
+    }
+
+    {
+        MutexType::Lock lock(task->m_mutex);
+        if(task->m_woken) {
+            return task->m_reason;
+        }
+        task->m_scheduler = scheduler;
+        task->m_fiber = Fiber::GetThis();
+    }
+
+    IOManager* iom = IOManager::GetThis();
+    OffloadTimeout tinfo(task);
+    if(timeout_ms != (uint64_t)-1 && iom) {
+        iom->armTimeout(&tinfo, timeout_ms);
+    }
+    scheduler->addExternalWait();
+    Fiber::YieldToHold();
+    scheduler->delExternalWait();
+    if(iom) {
+        iom->disarmTimeout(&tinfo);
+    }
+
+    // 超时取消时唤醒原因是 ECANCELED，这里区分出来
+    if(tinfo.fired && task->m_reason == ECANCELED) {
+        ++m_timeouts;
+        return ETIMEDOUT;
+    }
+    return task->m_reason;
+}
+
+int OffloadPool::run(std::function<void()> cb, uint64_t timeout_ms) {
+    Task::ptr task = submit(cb);
+    if(!task) {
+        return EAGAIN;
+    }
+    return wait(task, timeout_ms);
+}
+
+void OffloadPool::work() {
+    SYLAR_LOG_DEBUG(g_logger) << m_name << " worker start";
+    while(true) {
+        m_sem.wait();
+        Task::ptr task;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_tasks.empty()) {
+                if(m_stopping) {
+                    break;
+                }
+                continue;
+            }
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+
+        int state = Task::PENDING;
+        if(!task->m_state.compare_exchange_strong(state, Task::RUNNING)) {
+            ++m_cancelled;
+            continue;
+        }
+
+        uint64_t start = GetMonotonicUS();
+        uint64_t wait_us = start - task->m_submitUS;
+        m_waitUSTotal += wait_us;
+        UpdateMax(m_waitUSMax, wait_us);
+
+        ++m_running;
+        try {
+            task->m_cb();
+        } catch (std::exception& ex) {
+            SYLAR_LOG_ERROR(g_logger) << m_name << " task except: " << ex.what();
+        } catch (...) {
+            SYLAR_LOG_ERROR(g_logger) << m_name << " task except";
+        }
+        --m_running;
+
+        uint64_t exec_us = GetMonotonicUS() - start;
+        m_execUSTotal += exec_us;
+        UpdateMax(m_execUSMax, exec_us);
+        ++m_completed;
+
+        // 在工作线程里释放回调捕获的资源
+        task->m_cb = nullptr;
+        task->m_state = Task::DONE;
+        task->wake(0);
+    }
+    SYLAR_LOG_DEBUG(g_logger) << m_name << " worker exit";
+}
+
+OffloadPool::Stats OffloadPool::getStats() {
+    Stats s;
+    {
+        MutexType::Lock lock(m_mutex);
+        s.queued = m_tasks.size();
+    }
+    s.running = m_running;
+    s.submitted = m_submitted;
+    s.completed = m_completed;
+    s.rejected = m_rejected;
+    s.timeouts = m_timeouts;
+    s.cancelled = m_cancelled;
+    s.wait_us_total = m_waitUSTotal;
+    s.wait_us_max = m_waitUSMax;
+    s.exec_us_total = m_execUSTotal;
+    s.exec_us_max = m_execUSMax;
+    return s;
+}
+
+std::ostream& OffloadPool::dump(std::ostream& os) {
+    Stats s = getStats();
+    os << "[OffloadPool name=" << m_name
+       << " threads=" << m_threads.size()
+       << " queued=" << s.queued
+       << " running=" << s.running
+       << " submitted=" << s.submitted
+       << " completed=" << s.completed
+       << " rejected=" << s.rejected
+       << " timeouts=" << s.timeouts
+       << " cancelled=" << s.cancelled
+       << " wait_us_avg=" << (s.completed ? s.wait_us_total / s.completed : 0)
+       << " wait_us_max=" << s.wait_us_max
+       << " exec_us_avg=" << (s.completed ? s.exec_us_total / s.completed : 0)
+       << " exec_us_max=" << s.exec_us_max
+       << "]";
+    return os;
+}
+
+}
@@ -0,0 +1,191 @@
+#ifndef __SYLAR_OFFLOAD_H__
+#define __SYLAR_OFFLOAD_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <list>
+#include <atomic>
+#include <functional>
+#include "thread.h"
+#include "fiber.h"
+#include "singleton.h"
+#include "noncopyable.h"
+
+namespace sylar {
+
+class Scheduler;
+
+/**
+ * @brief 阻塞调用卸载线程池
+ * @details 普通文件的 read/write、fsync、stat、getaddrinfo、第三方同步客户端库这些调用
+ *          没办法变成非阻塞的，直接在协程里调用会卡住整个 IO 线程。
+ *          把它们交给专门的线程池执行，当前协程挂起，执行完成(或超时、取消)后
+ *          回到原来的调度器上继续运行。线程数和排队长度都有上限，排满时直接拒绝
+ */
+class OffloadPool : Noncopyable {
+public:
+    typedef std::shared_ptr<OffloadPool> ptr;
+    typedef Mutex MutexType;
+
+    // 提交到线程池的任务
+    class Task {
+    friend class OffloadPool;
+    public:
+        typedef std::shared_ptr<Task> ptr;
+
+        enum State {
+            PENDING     = 0,    // 排队中
+            RUNNING     = 1,    // 执行中
+            DONE        = 2,    // 执行完成
+            CANCELLED   = 3     // 已取消，不会再执行
+        };
+
+        Task(std::function<void()> cb);
+
+        /**
+         * @brief 取消任务
+         * @details 还在排队的任务不再执行；已经开始执行的没办法打断，
+         *          但等待它的协程会立即以 ECANCELED 返回
+         * @return 任务是否还没有执行完成
+         */
+        bool cancel();
+
+        // 返回任务状态
+        State getState() const { return (State)m_state.load();}
+
+    private:
+        /**
+         * @brief 唤醒等待的协程，只有第一次调用生效
+         * @param[in] reason 0 完成，ETIMEDOUT 超时，ECANCELED 取消
+         */
+        void wake(int reason);
+
+    private:
+        std::function<void()> m_cb;             // 要执行的函数
+        std::atomic<int> m_state = {PENDING};   // 任务状态
+        uint64_t m_submitUS = 0;                // 提交时间(单调时钟微秒)
+        MutexType m_mutex;                      // 保护下面的等待者
+        Scheduler* m_scheduler = nullptr;       // 等待协程所在的调度器
+        Fiber::ptr m_fiber;                     // 等待的协程
+        Semaphore* m_sem = nullptr;             // 不在协程里时等待的信号量
+        bool m_woken = false;                   // 是否已经唤醒过
+        int m_reason = 0;                       // 唤醒原因
+    };
+
+    // 线程池的运行指标
+    struct Stats {
+        uint64_t queued = 0;        // 当前排队的任务数
+        uint64_t running = 0;       // 当前正在执行的任务数
+        uint64_t submitted = 0;     // 累计提交的任务数
+        uint64_t completed = 0;     // 累计执行完成的任务数
+        uint64_t rejected = 0;      // 因为队列满被拒绝的任务数
+        uint64_t timeouts = 0;      // 等待超时的次数
+        uint64_t cancelled = 0;     // 被取消的任务数
+        uint64_t wait_us_total = 0; // 累计排队耗时(微秒)
+        uint64_t wait_us_max = 0;   // 最大排队耗时(微秒)
+        uint64_t exec_us_total = 0; // 累计执行耗时(微秒)
+        uint64_t exec_us_max = 0;   // 最大执行耗时(微秒)
+    };
+
+    /**
+     * @brief 构造函数，线程数和队列长度取自配置 offload.threads / offload.max_queue
+     */
+    OffloadPool();
+
+    /**
+     * @brief 构造函数
+     * @param[in] threads 工作线程数
+     * @param[in] max_queue 最多排队的任务数
+     * @param[in] name 线程池名称，工作线程名为 name_序号
+     */
+    OffloadPool(size_t threads, size_t max_queue, const std::string& name = "offload");
+
+    ~OffloadPool();
+
+    /**
+     * @brief 提交任务，不等待
+     * @return 队列满或线程池已停止时返回 nullptr
+     */
+    Task::ptr submit(std::function<void()> cb);
+
+    /**
+     * @brief 等待任务结束
+     * @details 在协程里挂起当前协程，结束后回到原来的调度器；
+     *          不在协程里时阻塞当前线程，此时不支持超时
+     * @param[in] timeout_ms 超时时间(毫秒)，-1 表示一直等待。超时后还没开始执行的任务会被取消
+     * @return 0 完成，ETIMEDOUT 超时，ECANCELED 被取消
+     */
+    int wait(Task::ptr task, uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 在线程池里执行 cb 并等待结果
+     * @attention 设置了超时时，超时返回后 cb 可能仍在执行，不能捕获调用方栈上变量的引用
+     * @return 0 完成，ETIMEDOUT 超时，ECANCELED 被取消，EAGAIN 队列已满
+     */
+    int run(std::function<void()> cb, uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 在线程池里执行 cb 并取回返回值
+     * @details 返回值先放在堆上，超时之后任务才完成也不会写到调用方的栈上
+     * @param[out] result 成功时为 cb 的返回值
+     * @return 同 run
+     */
+    template<class T>
+    int call(T& result, std::function<T()> cb, uint64_t timeout_ms = -1) {
+        std::shared_ptr<T> rt = std::make_shared<T>();
+        int err = run([rt, cb](){
+            *rt = cb();
+        }, timeout_ms);
+        if(!err) {
+            result = std::move(*rt);
+        }
+        return err;
+    }
+
+    // 停止线程池，已经排队的任务执行完之后线程退出
+    void stop();
+
+    // 返回运行指标
+    Stats getStats();
+
+    // 输出运行指标
+    std::ostream& dump(std::ostream& os);
+
+    const std::string& getName() const { return m_name;}
+    size_t getThreadCount() const { return m_threads.size();}
+    size_t getMaxQueue() const { return m_maxQueue;}
+
+private:
+    void start(size_t threads);
+
+    // 工作线程执行函数
+    void work();
+
+private:
+    std::string m_name;                     // 线程池名称
+    size_t m_maxQueue;                      // 最多排队的任务数
+    MutexType m_mutex;                      // 保护任务队列
+    std::list<Task::ptr> m_tasks;           // 任务队列
+    Semaphore m_sem;                        // 队列中的任务数
+    std::vector<Thread::ptr> m_threads;     // 工作线程
+    bool m_stopping = false;                // 是否正在停止
+
+    std::atomic<uint64_t> m_running = {0};
+    std::atomic<uint64_t> m_submitted = {0};
+    std::atomic<uint64_t> m_completed = {0};
+    std::atomic<uint64_t> m_rejected = {0};
+    std::atomic<uint64_t> m_timeouts = {0};
+    std::atomic<uint64_t> m_cancelled = {0};
+    std::atomic<uint64_t> m_waitUSTotal = {0};
+    std::atomic<uint64_t> m_waitUSMax = {0};
+    std::atomic<uint64_t> m_execUSTotal = {0};
+    std::atomic<uint64_t> m_execUSMax = {0};
+};
+
+// 全局的卸载线程池
+typedef Singleton<OffloadPool> OffloadMgr;
+
+}
+
+#endif
@@ -222,15 +222,14 @@ void Scheduler::run() {
         // 如果该协程不是结束/异常状态（这种状态为什么还放入队列里）就唤醒执行
         if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
                         && ft.fiber->getState() != Fiber::EXCEPT)) {
-            ft.fiber->swapIn();
+            // 让出的协程已经由 swapIn 标记为 HOLD，可能已经被别的线程恢复，
+            // 所以用 swapIn 返回的状态判断，不能再读或者改它的状态
+            Fiber::State state = ft.fiber->swapIn();
             --m_activeThreadCount;
 
             // 执行之后的状态判断，如果是ready就继续执行
-            if(ft.fiber->getState() == Fiber::READY) {
+            if(state == Fiber::READY) {
                 schedule(ft.fiber);
-            } else if(ft.fiber->getState() != Fiber::TERM
-                    && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
             }
             ft.reset();
         } else if(ft.cb) {
@@ -241,17 +240,16 @@ void Scheduler::run() {
                 cb_fiber.reset(new Fiber(ft.cb));
             }
             ft.reset();
-            cb_fiber->swapIn();
+            Fiber::State state = cb_fiber->swapIn();
             --m_activeThreadCount;
 
-            if(cb_fiber->getState() == Fiber::READY) {
+            if(state == Fiber::READY) {
                 schedule(cb_fiber);
                 cb_fiber.reset();
-            } else if(cb_fiber->getState() == Fiber::EXCEPT
-                    || cb_fiber->getState() == Fiber::TERM) {
+            } else if(state == Fiber::EXCEPT
+                    || state == Fiber::TERM) {
                 cb_fiber->reset(nullptr);
             } else {
-                cb_fiber->m_state = Fiber::HOLD;
                 cb_fiber.reset();
             }
         } else {
@@ -285,7 +283,8 @@ void Scheduler::tickle() {
 bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
     return m_autoStop && m_stopping
-        && m_fibers.empty() && m_activeThreadCount == 0;
+        && m_fibers.empty() && m_activeThreadCount == 0
+        && m_externalWaits == 0;
 }
 
 void Scheduler::idle() {
@@ -48,6 +48,13 @@ public:
     // 停止协程调度器
     void stop();
 
+    // 返回调度器的线程id，start 之后有效
+    const std::vector<int>& getThreadIds() const { return m_threadIds;}
+
+    // 协程挂起等待调度器之外的事件(如卸载线程池的任务)时计数，计数不为0时调度器不会停止
+    void addExternalWait() { ++m_externalWaits;}
+    void delExternalWait() { --m_externalWaits;}
+
     // 调度协程 -- （fc 协程或函数，thread 协程执行的线程id,-1标识任意线程)
     template<class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
@@ -180,6 +187,7 @@ protected:
     bool m_stopping = true;                         // 是否正在停止  
     bool m_autoStop = false;                        // 是否自动停止  
     int m_rootThread = 0;                           // 主线程id(use_caller)
+    std::atomic<size_t> m_externalWaits = {0};      // 挂起等待外部事件的协程数
 };
 
 // class SchedulerSwitcher : public Noncopyable {
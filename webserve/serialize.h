@@ -0,0 +1,786 @@
+#ifndef __SYLAR_SERIALIZE_H__
+#define __SYLAR_SERIALIZE_H__
+
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include "bytearray.h"
+#include "endian.h"
+
+namespace sylar {
+
+/**
+ * @brief 可选字段的值，没有设置时不参与序列化
+ */
+template<class T>
+class Optional {
+public:
+    Optional()
+        :m_has(false)
+        ,m_value() {
+    }
+
+    Optional(const T& v)
+        :m_has(true)
+        ,m_value(v) {
+    }
+
+    Optional& operator=(const T& v) {
+        m_has = true;
+        m_value = v;
+        return *this;
+    }
+
+    // 是否设置了值
+    bool has() const { return m_has;}
+    explicit operator bool() const { return m_has;}
+
+    // 返回值，没有设置时是 T 的默认值
+    const T& get() const { return m_value;}
+    const T& operator*() const { return m_value;}
+    const T* operator->() const { return &m_value;}
+
+    // 标记为已设置并返回值的引用
+    T& set() {
+        m_has = true;
+        return m_value;
+    }
+
+    // 清除值
+    void reset() {
+        m_has = false;
+        m_value = T();
+    }
+
+private:
+    bool m_has;
+    T m_value;
+};
+
+/**
+ * @brief 编译期生成的结构体序列化
+ * @details 结构体用 SYLAR_SCHEMA 描述一次，Serializer<T> 生成编码和解码。数据格式：
+ *          1. 固定前缀：必选的定长字段(整数，浮点数，bool)按声明顺序紧挨着存放，长度编译期确定
+ *          2. 必选的变长字段按声明顺序存放：SYLAR_FIELD_VARINT 的整数和 writeInt32/writeUint64 一样，
+ *             字符串和 writeStringVint 一样
+ *          3. 设置了的可选字段，每个是 Varint 的 (tag << 3 | 类型) + 值，最后是一个字节的 0
+ *          定长字段的字节序和 ByteArray 一致，编码到 ByteArray 时跟随它的设置，编码到内存时默认大端。
+ *          解码时不认识的 tag 按类型跳过，所以只增加可选字段时新旧版本可以互相解码
+ */
+namespace schema {
+
+// 整数和浮点数定长编码，字符串是 Varint 长度 + 内容
+struct Default {};
+// 整数按 Varint 编码，有符号数先做 zigzag
+struct Varint {};
+
+// 可选字段的类型，用 key 的低 3 位表示
+enum WireType {
+    WIRE_VARINT  = 0,
+    WIRE_FIXED8  = 1,
+    WIRE_FIXED16 = 2,
+    WIRE_FIXED32 = 3,
+    WIRE_FIXED64 = 4,
+    WIRE_BYTES   = 5
+};
+
+template<size_t N> struct UintOf;
+template<> struct UintOf<1> { typedef uint8_t type;};
+template<> struct UintOf<2> { typedef uint16_t type;};
+template<> struct UintOf<4> { typedef uint32_t type;};
+template<> struct UintOf<8> { typedef uint64_t type;};
+
+inline uint8_t Swap(uint8_t v) { return v;}
+template<class U>
+inline U Swap(U v) { return byteswap(v);}
+
+/**
+ * @brief 写入连续内存，调用者事先保证放得下，写入时不再检查边界
+ */
+class SpanWriter {
+public:
+    SpanWriter(char* p)
+        :m_begin(p)
+        ,m_ptr(p) {
+    }
+
+    // 返回接下来 n 个字节的地址
+    char* take(size_t n) {
+        char* p = m_ptr;
+        m_ptr += n;
+        return p;
+    }
+
+    void varint(uint64_t v) {
+        uint8_t* p = (uint8_t*)m_ptr;
+        while(v >= 0x80) {
+            *p++ = (v & 0x7f) | 0x80;
+            v >>= 7;
+        }
+        *p++ = v;
+        m_ptr = (char*)p;
+    }
+
+    void bytes(const void* data, size_t n) {
+        memcpy(m_ptr, data, n);
+        m_ptr += n;
+    }
+
+    // 已经写入的字节数
+    size_t size() const { return m_ptr - m_begin;}
+
+private:
+    char* m_begin;
+    char* m_ptr;
+};
+
+/**
+ * @brief 从连续内存读取，每次读取都检查边界
+ */
+class SpanReader {
+public:
+    SpanReader(const char* p, size_t len)
+        :m_begin(p)
+        ,m_ptr(p)
+        ,m_end(p + len) {
+    }
+
+    // 返回接下来 n 个字节的地址，不够时返回 nullptr
+    const char* take(size_t n, char* tmp) {
+        if(n == 0) {
+            return tmp;
+        }
+        if((size_t)(m_end - m_ptr) < n) {
+            return nullptr;
+        }
+        const char* p = m_ptr;
+        m_ptr += n;
+        return p;
+    }
+
+    // 最多读 max 个字节，和 ByteArray 一样读满 max 个字节就结束
+    bool varint(uint64_t& v, size_t max) {
+        v = 0;
+        for(size_t i = 0; i < max; ++i) {
+            if(m_ptr == m_end) {
+                return false;
+            }
+            uint8_t b = *m_ptr++;
+            v |= ((uint64_t)(b & 0x7f)) << (i * 7);
+            if(b < 0x80) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool bytes(std::string& v, uint64_t n) {
+        if((uint64_t)(m_end - m_ptr) < n) {
+            return false;
+        }
+        v.assign(m_ptr, n);
+        m_ptr += n;
+        return true;
+    }
+
+    bool skip(uint64_t n) {
+        if((uint64_t)(m_end - m_ptr) < n) {
+            return false;
+        }
+        m_ptr += n;
+        return true;
+    }
+
+    // 已经读取的字节数
+    size_t size() const { return m_ptr - m_begin;}
+
+private:
+    const char* m_begin;
+    const char* m_ptr;
+    const char* m_end;
+};
+
+/**
+ * @brief 从 ByteArray 读取，用于数据跨节点的情况
+ */
+class ByteArrayReader {
+public:
+    ByteArrayReader(ByteArray& ba)
+        :m_ba(ba) {
+    }
+
+    // 接下来 n 个字节在一个节点里时返回节点里的地址，否则拷到 tmp
+    const char* take(size_t n, char* tmp) {
+        if(n == 0) {
+            return tmp;
+        }
+        if(m_ba.getReadSize() < n) {
+            return nullptr;
+        }
+        if(const char* p = m_ba.peek(n)) {
+            m_ba.skip(n);
+            return p;
+        }
+        m_ba.read(tmp, n);
+        return tmp;
+    }
+
+    bool varint(uint64_t& v, size_t max) {
+        v = 0;
+        for(size_t i = 0; i < max; ++i) {
+            if(!m_ba.getReadSize()) {
+                return false;
+            }
+            uint8_t b = m_ba.readFuint8();
+            v |= ((uint64_t)(b & 0x7f)) << (i * 7);
+            if(b < 0x80) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool bytes(std::string& v, uint64_t n) {
+        if(m_ba.getReadSize() < n) {
+            return false;
+        }
+        v.resize(n);
+        m_ba.read(&v[0], n);
+        return true;
+    }
+
+    bool skip(uint64_t n) {
+        if(m_ba.getReadSize() < n) {
+            return false;
+        }
+        m_ba.skip(n);
+        return true;
+    }
+
+private:
+    ByteArray& m_ba;
+};
+
+/**
+ * @brief 单个值的编解码
+ * @details kFixed 非 0 表示定长，必选时放在固定前缀里；S 为 true 时定长字段需要交换字节序
+ */
+template<class V, class Enc, class Enable = void>
+struct ValueCodec;
+
+// 定长的整数，浮点数，bool
+template<class V>
+struct ValueCodec<V, Default, typename std::enable_if<std::is_arithmetic<V>::value>::type> {
+    typedef typename UintOf<sizeof(V)>::type Bits;
+    static const size_t kFixed = sizeof(V);
+    static const int kWireType = sizeof(V) == 1 ? WIRE_FIXED8
+                               : sizeof(V) == 2 ? WIRE_FIXED16
+                               : sizeof(V) == 4 ? WIRE_FIXED32 : WIRE_FIXED64;
+
+    static size_t MaxSize(const V&) { return sizeof(V);}
+
+    template<bool S>
+    static void Put(char* p, const V& v) {
+        Bits u;
+        memcpy(&u, &v, sizeof(u));
+        if(S) {
+            u = Swap(u);
+        }
+        memcpy(p, &u, sizeof(u));
+    }
+
+    template<bool S>
+    static void Get(const char* p, V& v) {
+        Bits u;
+        memcpy(&u, p, sizeof(u));
+        if(S) {
+            u = Swap(u);
+        }
+        FromBits(u, v);
+    }
+
+    template<bool S>
+    static void Write(SpanWriter& w, const V& v) {
+        Put<S>(w.take(sizeof(V)), v);
+    }
+
+    template<bool S, class R>
+    static bool Read(R& r, V& v) {
+        char tmp[sizeof(V)];
+        const char* p = r.take(sizeof(V), tmp);
+        if(!p) {
+            return false;
+        }
+        Get<S>(p, v);
+        return true;
+    }
+
+private:
+    static void FromBits(uint8_t u, bool& v) { v = u != 0;}
+    template<class T>
+    static void FromBits(Bits u, T& v) { memcpy(&v, &u, sizeof(v));}
+};
+
+// Varint 的整数，32 位以内最多 5 个字节，64 位最多 10 个字节
+template<class V>
+struct ValueCodec<V, Varint, typename std::enable_if<std::is_integral<V>::value
+        && !std::is_same<V, bool>::value>::type> {
+    static const size_t kFixed = 0;
+    static const size_t kMax = sizeof(V) <= 4 ? 5 : 10;
+    static const int kWireType = WIRE_VARINT;
+
+    static size_t MaxSize(const V&) { return kMax;}
+
+    template<bool S>
+    static void Write(SpanWriter& w, const V& v) {
+        w.varint(ToWire(v, std::is_signed<V>()));
+    }
+
+    template<bool S, class R>
+    static bool Read(R& r, V& v) {
+        uint64_t u;
+        if(!r.varint(u, kMax)) {
+            return false;
+        }
+        v = FromWire(u, std::is_signed<V>());
+        return true;
+    }
+
+private:
+    static uint64_t ToWire(V v, std::true_type) {
+        int64_t s = v;
+        return ((uint64_t)s << 1) ^ (uint64_t)(s >> 63);
+    }
+    static uint64_t ToWire(V v, std::false_type) { return v;}
+    static V FromWire(uint64_t u, std::true_type) { return (V)((u >> 1) ^ -(u & 1));}
+    static V FromWire(uint64_t u, std::false_type) { return (V)u;}
+};
+
+// 字符串，Varint 长度 + 内容
+template<>
+struct ValueCodec<std::string, Default, void> {
+    static const size_t kFixed = 0;
+    static const int kWireType = WIRE_BYTES;
+
+    static size_t MaxSize(const std::string& v) { return 10 + v.size();}
+
+    template<bool S>
+    static void Write(SpanWriter& w, const std::string& v) {
+        w.varint(v.size());
+        w.bytes(v.c_str(), v.size());
+    }
+
+    template<bool S, class R>
+    static bool Read(R& r, std::string& v) {
+        uint64_t len;
+        return r.varint(len, 10) && r.bytes(v, len);
+    }
+};
+
+template<class T> struct IsOptional : std::false_type {};
+template<class T> struct IsOptional<Optional<T> > : std::true_type {};
+template<class T> struct ValueOf { typedef T type;};
+template<class T> struct ValueOf<Optional<T> > { typedef T type;};
+
+/**
+ * @brief 字段描述，由 SYLAR_FIELD 生成
+ * @param Tag 字段编号，可选字段在数据里用它标识
+ * @param P 成员指针
+ * @param Enc 编码方式 Default 或者 Varint
+ */
+template<uint32_t Tag, class C, class M, M C::*P, class Enc>
+struct Field {
+    static_assert(Tag > 0 && Tag < (1u << 28), "field tag must be in [1, 2^28)");
+    typedef typename ValueOf<M>::type Value;
+    typedef ValueCodec<Value, Enc> Codec;
+    static const uint32_t kTag = Tag;
+    static const bool kOptional = IsOptional<M>::value;
+
+    static const M& Ref(const C& obj) { return obj.*P;}
+    static M& Ref(C& obj) { return obj.*P;}
+};
+
+struct KindFixed {};
+struct KindVar {};
+struct KindOptional {};
+
+template<class F>
+struct KindOf {
+    typedef typename std::conditional<F::kOptional, KindOptional,
+            typename std::conditional<F::Codec::kFixed != 0, KindFixed, KindVar>::type>::type type;
+};
+
+// 字段在三个部分里的编解码
+template<class F, class K = typename KindOf<F>::type>
+struct FieldOps;
+
+template<class F>
+struct FieldOps<F, KindFixed> {
+    typedef typename F::Codec Codec;
+    static const size_t kFixedSize = Codec::kFixed;
+
+    template<class C>
+    static size_t MaxSize(const C&) { return 0;}
+    template<bool S, class C>
+    static void PutFixed(char*& p, const C& obj) {
+        Codec::template Put<S>(p, F::Ref(obj));
+        p += Codec::kFixed;
+    }
+    template<bool S, class C>
+    static void WriteVar(SpanWriter&, const C&) {}
+    template<bool S, class C>
+    static void WriteOptional(SpanWriter&, const C&) {}
+    template<bool S, class C>
+    static void GetFixed(const char*& p, C& obj) {
+        Codec::template Get<S>(p, F::Ref(obj));
+        p += Codec::kFixed;
+    }
+    template<bool S, class R, class C>
+    static bool ReadVar(R&, C&) { return true;}
+    template<bool S, class R, class C>
+    static int ReadOptional(R&, C&, uint32_t, int) { return 0;}
+    template<class C>
+    static void Reset(C&) {}
+};
+
+template<class F>
+struct FieldOps<F, KindVar> {
+    typedef typename F::Codec Codec;
+    static const size_t kFixedSize = 0;
+
+    template<class C>
+    static size_t MaxSize(const C& obj) { return Codec::MaxSize(F::Ref(obj));}
+    template<bool S, class C>
+    static void PutFixed(char*&, const C&) {}
+    template<bool S, class C>
+    static void WriteVar(SpanWriter& w, const C& obj) {
+        Codec::template Write<S>(w, F::Ref(obj));
+    }
+    template<bool S, class C>
+    static void WriteOptional(SpanWriter&, const C&) {}
+    template<bool S, class C>
+    static void GetFixed(const char*&, C&) {}
+    template<bool S, class R, class C>
+    static bool ReadVar(R& r, C& obj) {
+        return Codec::template Read<S>(r, F::Ref(obj));
+    }
+    template<bool S, class R, class C>
+    static int ReadOptional(R&, C&, uint32_t, int) { return 0;}
+    template<class C>
+    static void Reset(C&) {}
+};
+
+template<class F>
+struct FieldOps<F, KindOptional> {
+    typedef typename F::Codec Codec;
+    static const size_t kFixedSize = 0;
+    static const uint32_t kKey = F::kTag << 3 | Codec::kWireType;
+
+    template<class C>
+    static size_t MaxSize(const C& obj) {
+        return F::Ref(obj).has() ? 5 + Codec::MaxSize(F::Ref(obj).get()) : 0;
+    }
+    template<bool S, class C>
+    static void PutFixed(char*&, const C&) {}
+    template<bool S, class C>
+    static void WriteVar(SpanWriter&, const C&) {}
+    template<bool S, class C>
+    static void WriteOptional(SpanWriter& w, const C& obj) {
+        if(F::Ref(obj).has()) {
+            w.varint(kKey);
+            Codec::template Write<S>(w, F::Ref(obj).get());
+        }
+    }
+    template<bool S, class C>
+    static void GetFixed(const char*&, C&) {}
+    template<bool S, class R, class C>
+    static bool ReadVar(R&, C&) { return true;}
+    // 返回 1 解出了这个字段，0 不是这个字段，-1 类型不对或者数据不完整
+    template<bool S, class R, class C>
+    static int ReadOptional(R& r, C& obj, uint32_t tag, int type) {
+        if(tag != F::kTag) {
+            return 0;
+        }
+        if(type != Codec::kWireType) {
+            return -1;
+        }
+        return Codec::template Read<S>(r, F::Ref(obj).set()) ? 1 : -1;
+    }
+    template<class C>
+    static void Reset(C& obj) {
+        F::Ref(obj).reset();
+    }
+};
+
+/**
+ * @brief 字段列表，编解码时在编译期展开成逐个字段的代码
+ */
+template<class... F>
+struct FieldList;
+
+template<>
+struct FieldList<> {
+    static const size_t kFixedSize = 0;
+
+    template<uint32_t Tag>
+    struct HasTag : std::false_type {};
+    struct TagsUnique : std::true_type {};
+
+    template<class C>
+    static size_t MaxSize(const C&) { return 0;}
+    template<bool S, class C>
+    static void PutFixed(char*, const C&) {}
+    template<bool S, class C>
+    static void WriteVar(SpanWriter&, const C&) {}
+    template<bool S, class C>
+    static void WriteOptional(SpanWriter&, const C&) {}
+    template<bool S, class C>
+    static void GetFixed(const char*, C&) {}
+    template<bool S, class R, class C>
+    static bool ReadVar(R&, C&) { return true;}
+    template<bool S, class R, class C>
+    static int ReadOptional(R&, C&, uint32_t, int) { return 0;}
+    template<class C>
+    static void Reset(C&) {}
+};
+
+template<class F, class... Rest>
+struct FieldList<F, Rest...> {
+    typedef FieldOps<F> Ops;
+    typedef FieldList<Rest...> Next;
+    // 固定前缀的长度
+    static const size_t kFixedSize = Ops::kFixedSize + Next::kFixedSize;
+
+    template<uint32_t Tag>
+    struct HasTag : std::integral_constant<bool, Tag == F::kTag
+        || Next::template HasTag<Tag>::value> {};
+    struct TagsUnique : std::integral_constant<bool, !Next::template HasTag<F::kTag>::value
+        && Next::TagsUnique::value> {};
+
+    // 固定前缀以外最多占用的字节数
+    template<class C>
+    static size_t MaxSize(const C& obj) {
+        return Ops::MaxSize(obj) + Next::MaxSize(obj);
+    }
+    template<bool S, class C>
+    static void PutFixed(char* p, const C& obj) {
+        Ops::template PutFixed<S>(p, obj);
+        Next::template PutFixed<S>(p, obj);
+    }
+    template<bool S, class C>
+    static void WriteVar(SpanWriter& w, const C& obj) {
+        Ops::template WriteVar<S>(w, obj);
+        Next::template WriteVar<S>(w, obj);
+    }
+    template<bool S, class C>
+    static void WriteOptional(SpanWriter& w, const C& obj) {
+        Ops::template WriteOptional<S>(w, obj);
+        Next::template WriteOptional<S>(w, obj);
+    }
+    template<bool S, class C>
+    static void GetFixed(const char* p, C& obj) {
+        Ops::template GetFixed<S>(p, obj);
+        Next::template GetFixed<S>(p, obj);
+    }
+    template<bool S, class R, class C>
+    static bool ReadVar(R& r, C& obj) {
+        return Ops::template ReadVar<S>(r, obj) && Next::template ReadVar<S>(r, obj);
+    }
+    template<bool S, class R, class C>
+    static int ReadOptional(R& r, C& obj, uint32_t tag, int type) {
+        if(int rt = Ops::template ReadOptional<S>(r, obj, tag, type)) {
+            return rt;
+        }
+        return Next::template ReadOptional<S>(r, obj, tag, type);
+    }
+    template<class C>
+    static void Reset(C& obj) {
+        Ops::Reset(obj);
+        Next::Reset(obj);
+    }
+};
+
+}
+
+/**
+ * @brief 结构体的编码和解码，T 需要先用 SYLAR_SCHEMA 描述
+ * @details 编码先算出长度上限(固定前缀是编译期常量，只有字符串需要运行时计算)，
+ *          一次检查或者一次 reserve 之后直接写内存，不再逐个字段检查边界
+ */
+template<class T>
+class Serializer {
+public:
+    typedef decltype(SylarSchemaOf((const T*)nullptr)) Schema;
+    typedef typename Schema::Fields Fields;
+    static_assert(Fields::TagsUnique::value, "duplicate field tag in schema");
+
+    // 固定前缀的字节数
+    static const size_t kFixedSize = Fields::kFixedSize;
+
+    // 编码 v 最多需要的字节数
+    static size_t MaxSize(const T& v) {
+        return kFixedSize + Fields::MaxSize(v) + 1;
+    }
+
+    /**
+     * @brief 编码到 buf
+     * @param[in] cap buf 的大小，不小于 MaxSize(v)
+     * @param[in] little_endian 定长字段是否用小端
+     * @return 编码后的长度，cap < MaxSize(v) 时返回 0
+     */
+    static size_t Encode(const T& v, char* buf, size_t cap, bool little_endian = false) {
+        if(cap < MaxSize(v)) {
+            return 0;
+        }
+        return NeedSwap(little_endian) ? EncodeTo<true>(v, buf) : EncodeTo<false>(v, buf);
+    }
+
+    /**
+     * @brief 编码后写入 ba 的当前位置，字节序跟随 ba
+     * @details reserve 出 MaxSize(v) 字节直接编码，reserve 失败时(在已有数据中间或者 mapToFile)先编码到临时缓存
+     */
+    static void Encode(const T& v, ByteArray& ba) {
+        size_t max = MaxSize(v);
+        bool swap = NeedSwap(ba.isLittleEndian());
+        if(char* p = ba.reserve(max)) {
+            ba.commit(swap ? EncodeTo<true>(v, p) : EncodeTo<false>(v, p));
+            return;
+        }
+        std::vector<char> buf(max);
+        ba.write(&buf[0], swap ? EncodeTo<true>(v, &buf[0]) : EncodeTo<false>(v, &buf[0]));
+    }
+
+    /**
+     * @brief 从 buf 解码
+     * @return 消耗的字节数，数据不完整或者损坏时返回 -1，此时 v 的内容不确定
+     */
+    static int64_t Decode(T& v, const char* buf, size_t len, bool little_endian = false) {
+        schema::SpanReader r(buf, len);
+        bool ok = NeedSwap(little_endian) ? DecodeFrom<true>(v, r) : DecodeFrom<false>(v, r);
+        return ok ? (int64_t)r.size() : -1;
+    }
+
+    /**
+     * @brief 从 ba 的当前位置解码，字节序跟随 ba
+     * @details 数据在当前节点里时直接从节点解码，跨节点时逐个字段读取
+     * @return 失败时 position 不变，v 的内容不确定
+     */
+    static bool Decode(T& v, ByteArray& ba) {
+        bool swap = NeedSwap(ba.isLittleEndian());
+        const char* p = nullptr;
+        if(size_t n = ba.span(p)) {
+            schema::SpanReader r(p, n);
+            if(swap ? DecodeFrom<true>(v, r) : DecodeFrom<false>(v, r)) {
+                ba.skip(r.size());
+                return true;
+            }
+            if(n == ba.getReadSize()) {
+                return false;
+            }
+        }
+        size_t pos = ba.getPosition();
+        schema::ByteArrayReader r(ba);
+        if(swap ? DecodeFrom<true>(v, r) : DecodeFrom<false>(v, r)) {
+            return true;
+        }
+        ba.setPosition(pos);
+        return false;
+    }
+
+private:
+    static bool NeedSwap(bool little_endian) {
+        return (little_endian ? SYLAR_LITTLE_ENDIAN : SYLAR_BIG_ENDIAN) != SYLAR_BYTE_ORDER;
+    }
+
+    template<bool S>
+    static size_t EncodeTo(const T& v, char* p) {
+        Fields::template PutFixed<S>(p, v);
+        schema::SpanWriter w(p + kFixedSize);
+        Fields::template WriteVar<S>(w, v);
+        Fields::template WriteOptional<S>(w, v);
+        w.varint(0);
+        return kFixedSize + w.size();
+    }
+
+    template<bool S, class R>
+    static bool DecodeFrom(T& v, R& r) {
+        char tmp[kFixedSize ? kFixedSize : 1];
+        const char* p = r.take(kFixedSize, tmp);
+        if(!p) {
+            return false;
+        }
+        Fields::template GetFixed<S>(p, v);
+        if(!Fields::template ReadVar<S>(r, v)) {
+            return false;
+        }
+        Fields::Reset(v);
+        while(true) {
+            uint64_t key;
+            if(!r.varint(key, 5)) {
+                return false;
+            }
+            if(key == 0) {
+                return true;
+            }
+            int type = key & 7;
+            int rt = Fields::template ReadOptional<S>(r, v, key >> 3, type);
+            if(rt < 0 || (rt == 0 && !Skip(r, type))) {
+                return false;
+            }
+        }
+    }
+
+    // 跳过不认识的可选字段
+    template<class R>
+    static bool Skip(R& r, int type) {
+        uint64_t n;
+        switch(type) {
+            case schema::WIRE_VARINT:
+                return r.varint(n, 10);
+            case schema::WIRE_FIXED8:
+            case schema::WIRE_FIXED16:
+            case schema::WIRE_FIXED32:
+            case schema::WIRE_FIXED64:
+                return r.skip(1 << (type - 1));
+            case schema::WIRE_BYTES:
+                return r.varint(n, 10) && r.skip(n);
+            default:
+                return false;
+        }
+    }
+};
+
+}
+
+/**
+ * @brief 描述结构体的字段，写在结构体所在的命名空间里
+ * @details 例:
+ *     struct Order {
+ *         uint64_t id;
+ *         std::string symbol;
+ *         sylar::Optional<int32_t> discount;
+ *     };
+ *     SYLAR_SCHEMA(Order,
+ *         SYLAR_FIELD(1, id),
+ *         SYLAR_FIELD(2, symbol),
+ *         SYLAR_FIELD_VARINT(3, discount));
+ *     sylar::Serializer<Order>::Encode(order, ba);
+ */
+#define SYLAR_SCHEMA(Type, ...) \
+    struct SylarSchema_##Type { \
+        typedef Type Self; \
+        typedef sylar::schema::FieldList<__VA_ARGS__> Fields; \
+    }; \
+    SylarSchema_##Type SylarSchemaOf(const Type*)
+
+// 整数和浮点数定长，字符串 Varint 长度 + 内容，成员类型是 sylar::Optional 时是可选字段
+#define SYLAR_FIELD(tag, member) \
+    sylar::schema::Field<tag, Self, decltype(Self::member), &Self::member, sylar::schema::Default>
+
+// 整数按 Varint 编码
+#define SYLAR_FIELD_VARINT(tag, member) \
+    sylar::schema::Field<tag, Self, decltype(Self::member), &Self::member, sylar::schema::Varint>
+
+#endif
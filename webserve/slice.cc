@@ -0,0 +1,289 @@
+#include "slice.h"
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <new>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/mman.h>
+
+namespace sylar {
+
+static sylar::ConfigVar<uint64_t>::ptr g_bytearray_pool_max_bytes =
+    sylar::Config::Lookup("bytearray.pool_max_bytes", (uint64_t)(8 * 1024 * 1024),
+            "max free bytes cached by each thread's ByteArray block pool");
+
+// 每次释放内存块都要用，缓存下来避免读配置加锁
+static std::atomic<uint64_t> s_pool_max_bytes = {0};
+
+struct _BlockPoolIniter {
+    _BlockPoolIniter() {
+        s_pool_max_bytes = g_bytearray_pool_max_bytes->getValue();
+        g_bytearray_pool_max_bytes->addListener([](const uint64_t& old_value, const uint64_t& new_value){
+            s_pool_max_bytes = new_value;
+        });
+    }
+};
+
+static _BlockPoolIniter s_block_pool_initer;
+
+static const int s_min_shift = 6;       // 最小档 64B
+static const int s_max_shift = 20;      // 最大档 1MB
+static const int s_classes = s_max_shift - s_min_shift + 1;
+
+static thread_local bool t_pool_dead = false;
+
+// 每个线程一个，只有本线程访问，不需要加锁
+struct BlockPool {
+    std::vector<BufferBlock*> free[s_classes];
+    size_t bytes = 0;
+
+    ~BlockPool() {
+        // 线程退出之后再释放的内存块直接还给系统
+        t_pool_dead = true;
+        for(auto& list : free) {
+            for(auto b : list) {
+                ::free(b);
+            }
+        }
+    }
+};
+
+static BlockPool* GetPool() {
+    if(t_pool_dead) {
+        return nullptr;
+    }
+    static thread_local BlockPool s_pool;
+    return &s_pool;
+}
+
+BufferBlock::BufferBlock(char* data, size_t capacity, int cls)
+    :m_ref(1)
+    ,m_class(cls)
+    ,m_readonly(false)
+    ,m_frozen(0)
+    ,m_capacity(capacity)
+    ,m_data(data) {
+}
+
+BufferBlock* BufferBlock::Alloc(size_t size) {
+    int cls = s_unpooled;
+    size_t capacity = size;
+    if(size <= ((size_t)1 << s_max_shift)) {
+        int shift = size <= ((size_t)1 << s_min_shift) ? s_min_shift : 64 - __builtin_clzll(size - 1);
+        cls = shift - s_min_shift;
+        capacity = (size_t)1 << shift;
+        BlockPool* pool = GetPool();
+        if(pool && !pool->free[cls].empty()) {
+            BufferBlock* block = pool->free[cls].back();
+            pool->free[cls].pop_back();
+            pool->bytes -= capacity;
+            return block;
+        }
+    }
+    void* mem = ::malloc(sizeof(BufferBlock) + capacity);
+    if(!mem) {
+        throw std::bad_alloc();
+    }
+    return new (mem) BufferBlock((char*)mem + sizeof(BufferBlock), capacity, cls);
+}
+
+BufferBlock* BufferBlock::Map(int fd, size_t offset, size_t len, bool writable) {
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    int flags = writable ? MAP_SHARED : MAP_PRIVATE;
+    void* addr = ::mmap(nullptr, len, prot, flags, fd, offset);
+    if(addr == MAP_FAILED) {
+        return nullptr;
+    }
+    BufferBlock* block = new BufferBlock((char*)addr, len, s_mapped);
+    block->m_readonly = !writable;
+    return block;
+}
+
+size_t BufferBlock::GetPoolFreeBytes() {
+    BlockPool* pool = GetPool();
+    return pool ? pool->bytes : 0;
+}
+
+void BufferBlock::unref() {
+    if(m_ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        Release(this);
+    }
+}
+
+void BufferBlock::freeze(size_t end) {
+    size_t old = m_frozen.load(std::memory_order_relaxed);
+    while(old < end && !m_frozen.compare_exchange_weak(old, end, std::memory_order_acq_rel)) {
+    }
+}
+
+void BufferBlock::Release(BufferBlock* block) {
+    if(block->m_class == s_mapped) {
+        ::munmap(block->m_data, block->m_capacity);
+        delete block;
+        return;
+    }
+    // 回到释放线程的池里，不一定是分配它的线程
+    if(block->m_class >= 0) {
+        BlockPool* pool = GetPool();
+        if(pool && pool->bytes + block->m_capacity <= s_pool_max_bytes) {
+            block->m_ref.store(1, std::memory_order_relaxed);
+            block->m_frozen.store(0, std::memory_order_relaxed);
+            pool->free[block->m_class].push_back(block);
+            pool->bytes += block->m_capacity;
+            return;
+        }
+    }
+    block->~BufferBlock();
+    ::free(block);
+}
+
+Slice::Slice(const void* data, size_t len) {
+    if(len == 0) {
+        return;
+    }
+    BufferBlock* block = BufferBlock::Alloc(len);
+    memcpy(block->data(), data, len);
+    append(block, block->data(), len);
+    block->unref();
+}
+
+Slice::Slice(const std::string& data)
+    :Slice(data.c_str(), data.size()) {
+}
+
+Slice::Slice(const Slice& rhs)
+    :m_pieces(rhs.m_pieces)
+    ,m_size(rhs.m_size) {
+    for(auto& i : m_pieces) {
+        i.block->ref();
+    }
+}
+
+Slice::Slice(Slice&& rhs)
+    :m_pieces(std::move(rhs.m_pieces))
+    ,m_size(rhs.m_size) {
+    rhs.m_pieces.clear();
+    rhs.m_size = 0;
+}
+
+Slice& Slice::operator=(const Slice& rhs) {
+    if(this != &rhs) {
+        Slice tmp(rhs);
+        std::swap(m_pieces, tmp.m_pieces);
+        std::swap(m_size, tmp.m_size);
+    }
+    return *this;
+}
+
+Slice& Slice::operator=(Slice&& rhs) {
+    if(this != &rhs) {
+        clear();
+        std::swap(m_pieces, rhs.m_pieces);
+        std::swap(m_size, rhs.m_size);
+    }
+    return *this;
+}
+
+Slice::~Slice() {
+    clear();
+}
+
+void Slice::clear() {
+    for(auto& i : m_pieces) {
+        i.block->unref();
+    }
+    m_pieces.clear();
+    m_size = 0;
+}
+
+void Slice::append(BufferBlock* block, char* ptr, size_t len) {
+    if(len == 0) {
+        return;
+    }
+    block->ref();
+    block->freeze(ptr + len - block->data());
+    // 和上一段在同一个块里首尾相接时合并
+    if(!m_pieces.empty()) {
+        Piece& last = m_pieces.back();
+        if(last.block == block && last.ptr + last.len == ptr) {
+            last.len += len;
+            m_size += len;
+            block->unref();
+            return;
+        }
+    }
+    m_pieces.push_back({block, ptr, len});
+    m_size += len;
+}
+
+void Slice::append(const Slice& rhs) {
+    // rhs 可能就是自己，先拷贝一份段列表
+    std::vector<Piece> pieces = rhs.m_pieces;
+    for(auto& i : pieces) {
+        append(i.block, i.ptr, i.len);
+    }
+}
+
+Slice Slice::sub(size_t offset, size_t len) const {
+    if(offset > m_size || len > m_size - offset) {
+        throw std::out_of_range("slice sub out of range");
+    }
+    Slice result;
+    for(auto& i : m_pieces) {
+        if(len == 0) {
+            break;
+        }
+        if(offset >= i.len) {
+            offset -= i.len;
+            continue;
+        }
+        size_t n = std::min(i.len - offset, len);
+        result.append(i.block, i.ptr + offset, n);
+        len -= n;
+        offset = 0;
+    }
+    return result;
+}
+
+uint64_t Slice::getBuffers(std::vector<iovec>& buffers) const {
+    for(auto& i : m_pieces) {
+        iovec iov;
+        iov.iov_base = i.ptr;
+        iov.iov_len = i.len;
+        buffers.push_back(iov);
+    }
+    return m_size;
+}
+
+void Slice::copyTo(void* buf, size_t len, size_t offset) const {
+    if(offset > m_size || len > m_size - offset) {
+        throw std::out_of_range("slice copy out of range");
+    }
+    char* out = (char*)buf;
+    for(auto& i : m_pieces) {
+        if(len == 0) {
+            break;
+        }
+        if(offset >= i.len) {
+            offset -= i.len;
+            continue;
+        }
+        size_t n = std::min(i.len - offset, len);
+        memcpy(out, i.ptr + offset, n);
+        out += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+std::string Slice::toString() const {
+    std::string str;
+    str.resize(m_size);
+    if(m_size) {
+        copyTo(&str[0], m_size);
+    }
+    return str;
+}
+
+}
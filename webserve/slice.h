@@ -0,0 +1,145 @@
+#ifndef __SYLAR_SLICE_H__
+#define __SYLAR_SLICE_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/uio.h>
+
+namespace sylar {
+
+/**
+ * @brief 引用计数的内存块
+ * @details ByteArray 的节点和 Slice 都引用内存块，最后一个引用释放时回到当前线程的 slab 池。
+ *          块头和数据区一次分配，数据区紧跟在块头后面；也可以是一段文件映射
+ */
+class BufferBlock {
+public:
+    /**
+     * @brief 分配一个至少 size 字节的内存块，引用计数为1
+     * @details 按 2 的幂分档(64B ~ 1MB)，先从当前线程的空闲链表里取，
+     *          超过 1MB 的直接分配，释放时也直接还给系统
+     */
+    static BufferBlock* Alloc(size_t size);
+
+    /**
+     * @brief 把文件 [offset, offset + len) 映射成内存块，最后一个引用释放时 munmap
+     * @param[in] writable true 时 MAP_SHARED 可写，写入直接进文件的页缓存；
+     *            false 时只读，ByteArray 要在里面写时先复制一份
+     * @return 失败返回 nullptr，errno 为 mmap 的错误
+     */
+    static BufferBlock* Map(int fd, size_t offset, size_t len, bool writable);
+
+    // 当前线程的池里缓存的空闲字节数
+    static size_t GetPoolFreeBytes();
+
+    // 数据区
+    char* data() { return m_data;}
+    // 数据区大小
+    size_t getCapacity() const { return m_capacity;}
+    // 是否是文件映射
+    bool isMapped() const { return m_class == s_mapped;}
+    // 是否只读，只读的块不能原地写
+    bool isReadOnly() const { return m_readonly;}
+
+    // 增加引用
+    void ref() { m_ref.fetch_add(1, std::memory_order_relaxed);}
+    // 减少引用，最后一个引用释放时回收
+    void unref();
+    // 是否还有别的引用
+    bool isShared() const { return m_ref.load(std::memory_order_acquire) > 1;}
+
+    /**
+     * @brief 被 Slice 引用的数据末尾(相对 data() 的偏移)
+     * @details 这之前的字节可能被别人看到，引用还在时不能原地修改；之后的字节可以继续写
+     */
+    size_t getFrozen() const { return m_frozen.load(std::memory_order_acquire);}
+    // 把冻结位置推进到 end
+    void freeze(size_t end);
+
+private:
+    // 不进池直接 free 的块和文件映射的块的 m_class
+    static const int16_t s_unpooled = -1;
+    static const int16_t s_mapped = -2;
+
+    BufferBlock(char* data, size_t capacity, int cls);
+    static void Release(BufferBlock* block);
+
+private:
+    std::atomic<uint32_t> m_ref;
+    int16_t m_class;        // 分档下标，不进池的为 s_unpooled，文件映射为 s_mapped
+    bool m_readonly;
+    std::atomic<size_t> m_frozen;
+    size_t m_capacity;
+    char* m_data;           // 池里分配的块紧跟在块头后面，文件映射的块指向映射地址
+};
+
+/**
+ * @brief 引用计数的数据片段
+ * @details 由若干段 BufferBlock 里的连续内存组成，拷贝 Slice 只增加引用计数，不拷贝数据。
+ *          从 ByteArray 切出来后可以交给别的组件、追加到别的 ByteArray，
+ *          或者直接用 getBuffers 交给 writev/sendmsg
+ */
+class Slice {
+public:
+    // 一段数据
+    struct Piece {
+        BufferBlock* block;     // 所在的内存块，持有一个引用
+        char* ptr;              // 数据起始地址
+        size_t len;             // 数据长度
+    };
+
+    Slice() {}
+    // 拷贝 data 到新的内存块
+    Slice(const void* data, size_t len);
+    explicit Slice(const std::string& data);
+
+    Slice(const Slice& rhs);
+    Slice(Slice&& rhs);
+    Slice& operator=(const Slice& rhs);
+    Slice& operator=(Slice&& rhs);
+    ~Slice();
+
+    /**
+     * @brief 追加内存块里的一段，不拷贝
+     * @details 增加 block 的引用计数，并冻结到这段数据的末尾
+     */
+    void append(BufferBlock* block, char* ptr, size_t len);
+    // 追加另一个 Slice 的全部数据，不拷贝
+    void append(const Slice& rhs);
+
+    // 数据长度
+    size_t size() const { return m_size;}
+    bool empty() const { return m_size == 0;}
+    // 释放所有引用
+    void clear();
+
+    const std::vector<Piece>& getPieces() const { return m_pieces;}
+
+    /**
+     * @brief 取出 [offset, offset + len) 这一段，不拷贝
+     * @exception offset + len 超过 size() 时抛出 std::out_of_range
+     */
+    Slice sub(size_t offset, size_t len) const;
+
+    /**
+     * @brief 获取数据的 iovec 数组
+     * @return 数据长度
+     */
+    uint64_t getBuffers(std::vector<iovec>& buffers) const;
+
+    // 把 [offset, offset + len) 拷贝到 buf
+    void copyTo(void* buf, size_t len, size_t offset = 0) const;
+    // 拷贝成 std::string
+    std::string toString() const;
+
+private:
+    std::vector<Piece> m_pieces;
+    size_t m_size = 0;
+};
+
+}
+
+#endif
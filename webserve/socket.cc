@@ -4,12 +4,44 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "util.h"
 #include <limits.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <algorithm>
+#include <deque>
 
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static sylar::ConfigVar<uint32_t>::ptr g_zerocopy_threshold =
+    sylar::Config::Lookup("socket.zerocopy_threshold", (uint32_t)(16 * 1024),
+            "min bytes per send to use MSG_ZEROCOPY");
+
+static sylar::ConfigVar<uint32_t>::ptr g_zerocopy_close_timeout =
+    sylar::Config::Lookup("socket.zerocopy_close_timeout", (uint32_t)1000,
+            "ms to wait for MSG_ZEROCOPY completions on close");
+
+/**
+ * @brief 零拷贝发送状态
+ * @details 内核给每次成功的 MSG_ZEROCOPY sendmsg 按顺序编号(从0开始)，
+ *          完成通知里给出一段连续的编号 [ee_info, ee_data]，
+ *          pending 按编号保存每次发送的内存持有者，通知到达后释放
+ */
+struct ZeroCopyState {
+    typedef Mutex MutexType;
+
+    MutexType mutex;
+    bool enabled = false;
+    size_t threshold = 0;
+    uint32_t nextSeq = 0;                   // 下一次发送的编号
+    std::deque<std::pair<uint32_t, std::shared_ptr<const void> > > pending;
+    uint64_t sends = 0;                     // 走了零拷贝的发送次数
+    uint64_t copied = 0;                    // 被内核退回成拷贝的次数
+};
+
 Socket::ptr Socket::CreateTCP(sylar::Address::ptr address) {
     Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
     return sock;
@@ -56,6 +88,23 @@ Socket::ptr Socket::CreateUnixUDPSocket() {
     return sock;
 }
 
+bool Socket::CreateUnixPair(Socket::ptr& first, Socket::ptr& second, int type) {
+    int fds[2];
+    if(socketpair(AF_UNIX, type | SOCK_CLOEXEC, 0, fds)) {
+        SYLAR_LOG_ERROR(g_logger) << "socketpair errno=" << errno
+            << " errstr=" << strerror(errno);
+        return false;
+    }
+    first.reset(new Socket(UNIX, type, 0));
+    second.reset(new Socket(UNIX, type, 0));
+    // socketpair 没有 hook，手动登记后才会被设置成非阻塞
+    FdMgr::GetInstance()->get(fds[0], true);
+    FdMgr::GetInstance()->get(fds[1], true);
+    first->init(fds[0]);
+    second->init(fds[1]);
+    return true;
+}
+
 Socket::Socket(int family, int type, int protocol)
     :m_sock(-1)
     ,m_family(family)
@@ -130,6 +179,73 @@ Socket::ptr Socket::accept() {
     return nullptr;
 }
 
+int Socket::acceptBatch(std::vector<Socket::ptr>& socks, size_t budget, uint64_t recv_timeout) {
+    FdCtx* listen_ctx = FdMgr::GetInstance()->lookup(m_sock);
+    IOManager* iom = IOManager::GetThis();
+    bool nonblock = listen_ctx && listen_ctx->getSysNonblock() && iom;
+    if(!nonblock) {
+        budget = std::min(budget, (size_t)1);
+    }
+
+    std::vector<int> fds;
+    std::vector<Address::ptr> addrs;
+    fds.reserve(budget);
+    addrs.reserve(budget);
+    int err = 0;
+    while(fds.size() < budget) {
+        sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int fd = accept4_f(m_sock, (sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd >= 0) {
+            fds.push_back(fd);
+            addrs.push_back(Address::Create((sockaddr*)&addr, addrlen));
+            continue;
+        }
+        // 握手完成后又被对端重置的连接直接跳过
+        if(errno == EINTR || errno == ECONNABORTED) {
+            continue;
+        }
+        if(errno == EAGAIN && fds.empty() && nonblock) {
+            if(iom->addEvent(m_sock, IOManager::READ)) {
+                err = errno;
+                break;
+            }
+            // 登记事件之后再看取消标记：取消的一方先设置标记再取消事件，
+            // 取消发生在 addEvent 之前时这里能看到标记，自己把事件删掉，不会挂上一个没人唤醒的事件；
+            // 删除失败说明事件已经被触发，当前协程已经被调度，要让出一次
+            if(!listen_ctx->isCancelled(SO_RCVTIMEO) || !iom->delEvent(m_sock, IOManager::READ)) {
+                Fiber::YieldToHold();
+            }
+            // 和 do_io 处理被取消的等待一样，被取消时返回，不再重试
+            if(listen_ctx->takeCancelled(SO_RCVTIMEO)) {
+                err = ECANCELED;
+                break;
+            }
+            continue;
+        }
+        err = errno;
+        break;
+    }
+
+    if(fds.empty()) {
+        if(err != EAGAIN) {
+            errno = err;
+            return -1;
+        }
+        return 0;
+    }
+    FdMgr::GetInstance()->addSockets(&fds[0], fds.size(), recv_timeout);
+    for(size_t i = 0; i < fds.size(); ++i) {
+        // TCP_NODELAY 从监听 socket 继承，不需要再 initSock
+        Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+        sock->m_sock = fds[i];
+        sock->m_isConnected = true;
+        sock->m_remoteAddress = addrs[i];
+        socks.push_back(sock);
+    }
+    return fds.size();
+}
+
 bool Socket::init(int sock) {
     FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
     if(ctx && ctx->isSocket() && !ctx->isClose()) {
@@ -143,6 +259,17 @@ bool Socket::init(int sock) {
     return false;
 }
 
+bool Socket::setReusePort() {
+    if(!isValid()) {
+        newSock();
+        if(SYLAR_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = 1;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::bind(const Address::ptr addr) {
     //m_localAddress = addr;
     if(!isValid()) {
@@ -161,11 +288,21 @@ bool Socket::bind(const Address::ptr addr) {
 
     UnixAddress::ptr uaddr = std::dynamic_pointer_cast<UnixAddress>(addr);
     if(uaddr) {
-        Socket::ptr sock = Socket::CreateUnixTCPSocket();
-        if(sock->connect(uaddr)) {
-            return false;
-        } else {
-            // sylar::FSUtil::Unlink(uaddr->getPath(), true);
+        const sockaddr_un* un = (const sockaddr_un*)uaddr->getAddr();
+        // 抽象命名空间(以 \0 开头)没有文件，不用处理
+        if(un->sun_path[0] != '\0') {
+            // 路径上有进程在监听就不能绑定；连接被拒绝说明是上次没删掉的残留文件，删掉再绑定
+            int fd = socket_f(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int rt = connect_f(fd, uaddr->getAddr(), uaddr->getAddrLen());
+            int err = errno;
+            close_f(fd);
+            if(rt == 0 || err == EAGAIN) {
+                SYLAR_LOG_ERROR(g_logger) << "bind unix path in use: " << uaddr->getPath();
+                errno = EADDRINUSE;
+                return false;
+            } else if(err == ECONNREFUSED) {
+                ::unlink(un->sun_path);
+            }
         }
     }
 
@@ -247,6 +384,15 @@ bool Socket::close() {
     }
     m_isConnected = false;
     if(m_sock != -1) {
+        if(getZeroCopyPending()) {
+            // 关闭之后通知就收不到了，而内核可能还在用这些内存，尽量等发送完成
+            if(!flushZeroCopy(g_zerocopy_close_timeout->getValue())) {
+                SYLAR_LOG_WARN(g_logger) << "close with " << getZeroCopyPending()
+                    << " zerocopy sends not completed, sock=" << m_sock;
+            }
+            ZeroCopyState::MutexType::Lock lock(m_zerocopy->mutex);
+            m_zerocopy->pending.clear();
+        }
         ::close(m_sock);
         m_sock = -1;
     }
@@ -330,6 +476,269 @@ int Socket::recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags
     return -1;
 }
 
+int Socket::recvMulti(mmsghdr* msgs, size_t count, int flags) {
+    if(isConnected()) {
+        return ::recvmmsg(m_sock, msgs, count, flags, nullptr);
+    }
+    return -1;
+}
+
+int Socket::sendMulti(mmsghdr* msgs, size_t count, int flags) {
+    if(isConnected()) {
+        return ::sendmmsg(m_sock, msgs, count, flags);
+    }
+    return -1;
+}
+
+bool Socket::setZeroCopy(bool v) {
+    if(v && !setOption(SOL_SOCKET, SO_ZEROCOPY, 1)) {
+        return false;
+    }
+    if(!m_zerocopy) {
+        if(!v) {
+            return true;
+        }
+        m_zerocopy.reset(new ZeroCopyState);
+        m_zerocopy->threshold = g_zerocopy_threshold->getValue();
+    }
+    // 关闭时保留状态，已经发出去的缓冲区还要等通知
+    m_zerocopy->enabled = v;
+    return true;
+}
+
+bool Socket::isZeroCopy() const {
+    return m_zerocopy && m_zerocopy->enabled;
+}
+
+void Socket::setZeroCopyThreshold(size_t v) {
+    if(!m_zerocopy) {
+        m_zerocopy.reset(new ZeroCopyState);
+    }
+    m_zerocopy->threshold = v;
+}
+
+size_t Socket::getZeroCopyThreshold() const {
+    return m_zerocopy ? m_zerocopy->threshold : g_zerocopy_threshold->getValue();
+}
+
+int Socket::sendZeroCopy(const iovec* buffers, size_t length
+                    ,std::shared_ptr<const void> holder, int flags) {
+    if(!isConnected()) {
+        return -1;
+    }
+    size_t total = 0;
+    for(size_t i = 0; i < length; ++i) {
+        total += buffers[i].iov_len;
+    }
+    if(!isZeroCopy() || total < m_zerocopy->threshold) {
+        return send(buffers, length, flags);
+    }
+    reapZeroCopy();
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec*)buffers;
+    msg.msg_iovlen = length;
+    int rt = ::sendmsg(m_sock, &msg, flags | MSG_ZEROCOPY);
+    if(rt < 0 && errno == ENOBUFS) {
+        // 未完成的通知太多，超出了 optmem 限制，这一次退回拷贝发送
+        return ::sendmsg(m_sock, &msg, flags);
+    }
+    if(rt > 0) {
+        // 一个字节都没发出时内核会收回编号，只有成功的发送才占用编号
+        ZeroCopyState::MutexType::Lock lock(m_zerocopy->mutex);
+        m_zerocopy->pending.push_back(std::make_pair(m_zerocopy->nextSeq++, holder));
+        ++m_zerocopy->sends;
+    }
+    return rt;
+}
+
+size_t Socket::reapZeroCopy() {
+    if(!m_zerocopy || m_sock == -1) {
+        return 0;
+    }
+    ZeroCopyState& zc = *m_zerocopy;
+    ZeroCopyState::MutexType::Lock lock(zc.mutex);
+    size_t released = 0;
+    while(!zc.pending.empty()) {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        // 错误队列不会触发可读，走原始函数，没有通知时立即返回 EAGAIN
+        if(recvmsg_f(m_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc.copied += hi - lo + 1;
+            }
+            // 编号是 32 位循环计数，按差值判断是否在区间内
+            auto it = std::remove_if(zc.pending.begin(), zc.pending.end(),
+                    [lo, hi](const std::pair<uint32_t, std::shared_ptr<const void> >& p) {
+                return p.first - lo <= hi - lo;
+            });
+            released += zc.pending.end() - it;
+            zc.pending.erase(it, zc.pending.end());
+        }
+    }
+    return released;
+}
+
+bool Socket::flushZeroCopy(uint64_t timeout_ms) {
+    uint64_t deadline = GetMonotonicMS() + timeout_ms;
+    while(true) {
+        reapZeroCopy();
+        if(getZeroCopyPending() == 0) {
+            return true;
+        }
+        uint64_t now = GetMonotonicMS();
+        if(now >= deadline) {
+            return false;
+        }
+        // 完成通知放在错误队列里，只会让 socket 报告 POLLERR，events 为 0 的 poll 正好只等它。
+        // 协程里走 hook 的 poll，在临时 epoll 上等待，不会和在这个 socket 上读写的协程冲突
+        pollfd pfd = {m_sock, 0, 0};
+        int rt = ::poll(&pfd, 1, (int)std::min(deadline - now, (uint64_t)INT_MAX));
+        if(rt < 0 && errno != EINTR) {
+            return false;
+        }
+        if(rt <= 0 || reapZeroCopy() || !getZeroCopyPending()) {
+            continue;
+        }
+        if(pfd.revents & POLLHUP) {
+            // 连接已经断开，剩下的通知不会再来
+            return false;
+        }
+        // POLLERR 来自 socket 本身的错误而不是通知，取走它，否则下一次 poll 会立即返回
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &err, &len);
+    }
+}
+
+uint64_t Socket::getZeroCopySends() const {
+    return m_zerocopy ? m_zerocopy->sends : 0;
+}
+
+uint64_t Socket::getZeroCopyCopied() const {
+    return m_zerocopy ? m_zerocopy->copied : 0;
+}
+
+size_t Socket::getZeroCopyPending() const {
+    if(!m_zerocopy) {
+        return 0;
+    }
+    ZeroCopyState::MutexType::Lock lock(m_zerocopy->mutex);
+    return m_zerocopy->pending.size();
+}
+
+int Socket::sendFds(const int* fds, size_t count, const void* buffer, size_t length, int flags) {
+    if(!isConnected()) {
+        return -1;
+    }
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len = length;
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(count) {
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+        cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * count);
+    }
+    return ::sendmsg(m_sock, &msg, flags);
+}
+
+int Socket::recvFds(std::vector<int>& fds, size_t max_fds, void* buffer, size_t length, int flags) {
+    if(!isConnected()) {
+        return -1;
+    }
+    iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = length;
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * std::max(max_fds, (size_t)1)));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control[0];
+    msg.msg_controllen = control.size();
+    int rt = ::recvmsg(m_sock, &msg, flags | MSG_CMSG_CLOEXEC);
+    if(rt < 0) {
+        return rt;
+    }
+    for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if(cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* p = (const int*)CMSG_DATA(cm);
+        for(size_t i = 0; i < n; ++i) {
+            fds.push_back(p[i]);
+        }
+    }
+    if(msg.msg_flags & MSG_CTRUNC) {
+        SYLAR_LOG_WARN(g_logger) << "recvFds control truncated, max_fds=" << max_fds
+            << " sock=" << m_sock;
+    }
+    return rt;
+}
+
+bool Socket::sendSocket(Socket::ptr sock) {
+    int fd = sock->getSocket();
+    char c = 0;
+    return sendFds(&fd, 1, &c, 1) == 1;
+}
+
+Socket::ptr Socket::recvSocket() {
+    std::vector<int> fds;
+    char c;
+    int rt = recvFds(fds, 1, &c, 1);
+    if(rt <= 0 || fds.empty()) {
+        for(int fd : fds) {
+            close_f(fd);
+        }
+        return nullptr;
+    }
+    int fd = fds[0];
+    int family = 0;
+    int type = 0;
+    int protocol = 0;
+    socklen_t len = sizeof(int);
+    getsockopt_f(fd, SOL_SOCKET, SO_DOMAIN, &family, &len);
+    len = sizeof(int);
+    getsockopt_f(fd, SOL_SOCKET, SO_TYPE, &type, &len);
+    len = sizeof(int);
+    getsockopt_f(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len);
+    // 和 accept 出来的连接一样登记到 FdManager，设置成非阻塞
+    FdMgr::GetInstance()->get(fd, true);
+    Socket::ptr result(new Socket(family, type, protocol));
+    if(!result->init(fd)) {
+        close_f(fd);
+        return nullptr;
+    }
+    return result;
+}
+
 Address::ptr Socket::getRemoteAddress() {
     // 如果存在，那就直接返回
     if(m_remoteAddress) {
@@ -435,27 +844,39 @@ std::string Socket::toString() const {
     return ss.str();
 }
 
+// 先设置 FdCtx 的取消标记再取消事件，等待的一方登记事件之后检查标记，取消不会丢
+static void MarkCancelled(int fd, int type) {
+    FdCtx* ctx = FdMgr::GetInstance()->lookup(fd);
+    if(ctx) {
+        ctx->setCancelled(type);
+    }
+}
+
 bool Socket::cancelRead() {
+    MarkCancelled(m_sock, SO_RCVTIMEO);
     return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::READ);
 }
 
 bool Socket::cancelWrite() {
+    MarkCancelled(m_sock, SO_SNDTIMEO);
     return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::WRITE);
 }
 
 bool Socket::cancelAccept() {
-    return IOManager::GetThis()->cancelEvent(m_sock, sylar::IOManager::READ);
+    return cancelRead();
 }
 
 bool Socket::cancelAll() {
+    MarkCancelled(m_sock, SO_RCVTIMEO);
+    MarkCancelled(m_sock, SO_SNDTIMEO);
     return IOManager::GetThis()->cancelAll(m_sock);
 }
 
 void Socket::initSock() {
     int val = 1;
     setOption(SOL_SOCKET, SO_REUSEADDR, val);
-    // 如果是 TCP 通信
-    if(m_type == SOCK_STREAM) {
+    // 如果是 TCP 通信，Unix Socket 没有 TCP_NODELAY
+    if(m_type == SOCK_STREAM && m_family != AF_UNIX) {
         setOption(IPPROTO_TCP, TCP_NODELAY, val);
     }
 }
@@ -12,6 +12,8 @@
 
 namespace sylar {
 
+struct ZeroCopyState;
+
 // Socket封装类
 class Socket : public std::enable_shared_from_this<Socket>, Noncopyable {
 public:
@@ -51,6 +53,17 @@ public:
     // 创建Unix的UDP Socket
     static Socket::ptr CreateUnixUDPSocket();
 
+    /**
+     * @brief 创建一对互相连接的 Unix Socket(socketpair)
+     * @details 两端都登记到了 FdManager，在协程里读写会挂起而不是阻塞线程；
+     *          fork 之前创建，父子进程各留一端，就可以用 sendFds/sendSocket 传递句柄
+     * @param[out] first 第一端
+     * @param[out] second 第二端
+     * @param[in] type TCP(SOCK_STREAM) 或 UDP(SOCK_DGRAM)
+     * @return 是否创建成功
+     */
+    static bool CreateUnixPair(Socket::ptr& first, Socket::ptr& second, int type = TCP);
+
     /**
      * @brief Socket构造函数
      * @param[in] family 协议簇
@@ -88,6 +101,12 @@ public:
         return setOption(level, option, &value, sizeof(T));
     }
 
+    /**
+     * @brief 开启 SO_REUSEPORT，多个 socket 可以绑定同一个地址，由内核在它们之间分配连接
+     * @pre 必须在 bind 之前调用
+     */
+    bool setReusePort();
+
     /**
      * @brief 接收connect链接
      * @return 成功返回新连接的socket,失败返回nullptr
@@ -95,6 +114,22 @@ public:
      */
     virtual Socket::ptr accept();
 
+    /**
+     * @brief 批量接收连接
+     * @details 用 accept4(SOCK_NONBLOCK|SOCK_CLOEXEC) 把积压的连接一次取完，最多 budget 个，
+     *          新连接已经是非阻塞的，FdCtx 一次加锁批量登记，对端地址直接取自 accept4，
+     *          本地地址在第一次 getLocalAddress 时再取。
+     *          积压队列为空且还没有收到连接时挂起当前协程等待监听 socket 可读，
+     *          等待被 cancelAccept/cancelAll 取消时返回 -1，errno 为 ECANCELED；
+     *          监听 socket 不是非阻塞的(不在 hook 线程里创建)时退化为一次阻塞的 accept
+     * @param[out] socks 新连接追加到末尾
+     * @param[in] budget 本次最多接收的连接数
+     * @param[in] recv_timeout 新连接的读超时(毫秒)，-1 表示不超时
+     * @return 接收到的连接数；一个都没收到就出错时返回 -1，errno 为 accept4 的错误码
+     * @pre Socket必须 bind , listen  成功
+     */
+    int acceptBatch(std::vector<Socket::ptr>& socks, size_t budget, uint64_t recv_timeout = -1);
+
     /**
      * @brief 绑定地址
      * @param[in] addr 地址
@@ -222,6 +257,125 @@ public:
      */
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
 
+    /**
+     * @brief 批量接收数据报 使用 recvmmsg 函数
+     * @details 在协程里等到 socket 可读后，一次取出已经到达的数据报，最多 count 条
+     * @param[in,out] msgs 每条的缓冲区和地址由调用方准备，返回后 msg_len 为数据报长度，
+     *                     msg_hdr.msg_namelen 为发送端地址长度
+     * @param[in] count msgs 数组长度
+     * @param[in] flags 标志字
+     * @return
+     *      @retval >0 接收到的数据报数量
+     *      @retval <0 socket出错
+     */
+    virtual int recvMulti(mmsghdr* msgs, size_t count, int flags = 0);
+
+    /**
+     * @brief 批量发送数据报 使用 sendmmsg 函数
+     * @param[in,out] msgs 待发送的数据报，每条的 msg_hdr.msg_name 为目标地址，返回后 msg_len 为已发送的字节数
+     * @param[in] count msgs 数组长度
+     * @param[in] flags 标志字
+     * @return
+     *      @retval >0 发送成功的数据报数量，可能小于 count
+     *      @retval <0 socket出错
+     */
+    virtual int sendMulti(mmsghdr* msgs, size_t count, int flags = 0);
+
+    /**
+     * @brief 开启/关闭 MSG_ZEROCOPY 零拷贝发送，需要在 socket 创建之后调用
+     * @details 开启后 sendZeroCopy 不再把数据拷贝进内核，内核直接引用用户内存，
+     *          发送完成后在错误队列里给出通知，通知到达之前这块内存不能释放也不能修改。
+     *          锁页和处理通知本身有开销，只有单次发送达到阈值才走零拷贝，小数据仍然拷贝。
+     *          监听 socket 上开启后 accept 出来的连接也是开启的
+     * @return 内核或协议不支持 SO_ZEROCOPY 时返回 false
+     */
+    bool setZeroCopy(bool v);
+    // 是否开启了零拷贝发送
+    bool isZeroCopy() const;
+    // 设置走零拷贝的最小发送字节数，默认取配置 socket.zerocopy_threshold
+    void setZeroCopyThreshold(size_t v);
+    // 返回走零拷贝的最小发送字节数
+    size_t getZeroCopyThreshold() const;
+
+    /**
+     * @brief 零拷贝发送数据 使用 sendmsg(MSG_ZEROCOPY) 函数
+     * @details 没有开启零拷贝或数据小于阈值时等同于 send(buffers, length, flags)。
+     *          发送出去的部分由 holder 持有，内核通知发送完成后才释放这个引用
+     * @param[in] buffers 待发送数据的内存(iovec数组)
+     * @param[in] length 待发送数据的长度(iovec数组长度)
+     * @param[in] holder 持有 buffers 指向的内存(比如 ByteArray)
+     * @param[in] flags 标志字
+     * @return 同 send
+     */
+    virtual int sendZeroCopy(const iovec* buffers, size_t length
+                        ,std::shared_ptr<const void> holder, int flags = 0);
+
+    /**
+     * @brief 读取错误队列里的零拷贝完成通知，释放内核已经用完的缓冲区
+     * @details 不会挂起，每次 sendZeroCopy 之前和 close 时都会调用
+     * @return 释放的缓冲区个数
+     */
+    size_t reapZeroCopy();
+
+    /**
+     * @brief 等待所有零拷贝发送完成
+     * @details 用 poll 等待错误队列里的完成通知，协程里只挂起当前协程
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 超时或者连接断开时还有没完成的发送，返回 false
+     */
+    bool flushZeroCopy(uint64_t timeout_ms);
+
+    // 走了零拷贝的发送次数
+    uint64_t getZeroCopySends() const;
+    // 其中被内核退回成拷贝的次数(比如发往本机的数据)
+    uint64_t getZeroCopyCopied() const;
+    // 还在等待完成通知的发送次数
+    size_t getZeroCopyPending() const;
+
+    /**
+     * @brief 通过 SCM_RIGHTS 发送文件句柄，只能用于 Unix Socket
+     * @details 句柄随 buffer 里的数据一起发出，流式 socket 至少要带 1 字节数据。
+     *          对端收到的是指向同一个打开文件的新句柄，本端的句柄仍然要自己关闭
+     * @param[in] fds 句柄数组
+     * @param[in] count 句柄个数
+     * @param[in] buffer 随句柄发送的数据
+     * @param[in] length 数据长度
+     * @param[in] flags 标志字
+     * @return
+     *      @retval >0 发送的数据字节数
+     *      @retval <0 socket出错
+     */
+    int sendFds(const int* fds, size_t count, const void* buffer, size_t length, int flags = 0);
+
+    /**
+     * @brief 接收 SCM_RIGHTS 文件句柄
+     * @details 收到的句柄带 close-on-exec，追加到 fds 里，由调用方负责关闭。
+     *          对端发来的句柄超过 max_fds 时多出来的被内核直接关掉
+     * @param[out] fds 收到的句柄
+     * @param[in] max_fds 最多接收的句柄数
+     * @param[out] buffer 接收随句柄发送的数据
+     * @param[in] length buffer 大小
+     * @param[in] flags 标志字
+     * @return
+     *      @retval >0 接收到的数据字节数
+     *      @retval =0 socket被关闭
+     *      @retval <0 socket出错
+     */
+    int recvFds(std::vector<int>& fds, size_t max_fds, void* buffer, size_t length, int flags = 0);
+
+    /**
+     * @brief 把一个连接交给对端进程
+     * @details 发送成功后本端的 sock 仍然是打开的，通常随后关闭它，连接由对端进程继续处理
+     */
+    bool sendSocket(Socket::ptr sock);
+
+    /**
+     * @brief 接收对端进程交过来的连接
+     * @details 返回的 Socket 已经登记到 FdManager，和 accept 出来的连接一样直接读写
+     * @return 对端关闭或出错时返回 nullptr
+     */
+    Socket::ptr recvSocket();
+
     //获取远端地址
     Address::ptr getRemoteAddress();
     // 获取本地地址
@@ -247,13 +401,17 @@ public:
     // 返回socket句柄
     int getSocket() const { return m_sock;}
 
-    // 取消读
+    /**
+     * @brief 取消读
+     * @details 正在等待的读(hook 的 recv/read/accept 等，以及 acceptBatch)返回 -1，errno 为 ECANCELED；
+     *          当前没有在等待时，下一次需要等待的读直接返回 ECANCELED
+     */
     bool cancelRead();
-    // 取消写
+    // 取消写，规则同 cancelRead
     bool cancelWrite();
-    // 取消accept
+    // 取消accept，同 cancelRead
     bool cancelAccept();
-    // 取消所有事件
+    // 取消所有事件，包括 accept
     bool cancelAll();
 
 protected:
@@ -271,6 +429,7 @@ protected:
     bool m_isConnected;                 // 是否连接
     Address::ptr m_localAddress;        // 本地地址
     Address::ptr m_remoteAddress;       // 远端地址
+    std::unique_ptr<ZeroCopyState> m_zerocopy;  // 零拷贝发送状态，没开启过为空
 };
 
 
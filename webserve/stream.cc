@@ -1,4 +1,6 @@
 #include "stream.h"
+#include <errno.h>
+#include <unistd.h>
 
 namespace sylar {
 
@@ -55,4 +57,41 @@ int Stream::writeFixSize(ByteArray::ptr ba, size_t length) {
     return length;
 }
 
+int64_t Stream::transferFrom(int fd, int64_t offset, size_t len) {
+    if(len == 0) {
+        return 0;
+    }
+    BufferBlock* block = BufferBlock::Alloc(std::min(len, (size_t)64 * 1024));
+    char* buf = block->data();
+    size_t cap = block->getCapacity();
+    uint64_t total = 0;
+    // 读写出错时返回的值，0 表示读到了末尾
+    int64_t fail = 0;
+    bool failed = false;
+    while(total < len) {
+        size_t n = std::min(cap, len - total);
+        ssize_t rt = offset >= 0 ? ::pread(fd, buf, n, offset + total) : ::read(fd, buf, n);
+        if(rt < 0 && errno == EINTR) {
+            continue;
+        }
+        if(rt == 0) {
+            break;
+        }
+        if(rt < 0) {
+            fail = -1;
+            failed = true;
+            break;
+        }
+        int w = writeFixSize(buf, rt);
+        if(w <= 0) {
+            fail = w;
+            failed = true;
+            break;
+        }
+        total += rt;
+    }
+    block->unref();
+    return failed ? fail : total;
+}
+
 }
@@ -100,6 +100,20 @@ public:
      */
     virtual int writeFixSize(ByteArray::ptr ba, size_t length);
 
+    /**
+     * @brief 把句柄 fd 里的数据写到流里
+     * @details 默认实现读到用户态的缓冲区再 writeFixSize；
+     *          SocketStream 用 sendfile/splice 在内核里直接搬运，数据不经过用户态
+     * @param[in] fd 数据来源，普通文件、管道或者 socket
+     * @param[in] offset >=0 时从这个位置读，不改变 fd 的读写位置；-1 时从 fd 的当前位置读
+     * @param[in] len 最多传输的字节数
+     * @return
+     *      @retval >0 实际传输的字节数，fd 提前读完时小于 len
+     *      @retval =0 fd 没有数据或者流被关闭
+     *      @retval <0 出现错误
+     */
+    virtual int64_t transferFrom(int fd, int64_t offset, size_t len);
+
     // 关闭流
     virtual void close() = 0;
 };
@@ -0,0 +1,218 @@
+#include "buffered_stream.h"
+#include <string.h>
+
+namespace sylar {
+
+BufferedStream::BufferedStream(Stream::ptr stream, size_t read_buffer, size_t flush_threshold)
+    :m_stream(stream)
+    ,m_readSize(read_buffer ? read_buffer : 1)
+    ,m_flushThreshold(flush_threshold ? flush_threshold : 1)
+    ,m_wbuf(new ByteArray) {
+}
+
+BufferedStream::~BufferedStream() {
+    if(m_rblock) {
+        m_rblock->unref();
+    }
+}
+
+int BufferedStream::read(void* buffer, size_t length) {
+    if(length == 0) {
+        return 0;
+    }
+    if(m_rpos == m_rend) {
+        // 一次就能读满调用者的内存，不用经过缓冲区
+        if(length >= m_readSize) {
+            return m_stream->read(buffer, length);
+        }
+        int rt = fill(0);
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return copyOut(buffer, length);
+}
+
+int BufferedStream::read(ByteArray::ptr ba, size_t length) {
+    if(length == 0) {
+        return 0;
+    }
+    if(m_rpos == m_rend) {
+        if(length >= m_readSize) {
+            return m_stream->read(ba, length);
+        }
+        int rt = fill(0);
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, m_rend - m_rpos);
+    ba->write(m_rblock->data() + m_rpos, n);
+    m_rpos += n;
+    releaseRead();
+    return n;
+}
+
+int BufferedStream::write(const void* buffer, size_t length) {
+    if(length >= m_flushThreshold) {
+        // 大块数据不进缓冲，先把前面攒的发出去保证顺序
+        if(m_wbuf->getSize()) {
+            int rt = flush();
+            if(rt <= 0) {
+                return rt;
+            }
+        }
+        return m_stream->write(buffer, length);
+    }
+    m_wbuf->write(buffer, length);
+    if(m_wbuf->getSize() >= m_flushThreshold) {
+        int rt = flush();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return length;
+}
+
+int BufferedStream::write(ByteArray::ptr ba, size_t length) {
+    length = std::min(length, ba->getReadSize());
+    if(length == 0) {
+        return 0;
+    }
+    if(length >= m_flushThreshold && !m_wbuf->getSize()) {
+        return m_stream->write(ba, length);
+    }
+    m_wbuf->write(ba->readSlice(length));
+    if(m_wbuf->getSize() >= m_flushThreshold) {
+        int rt = flush();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return length;
+}
+
+int BufferedStream::flush() {
+    size_t total = m_wbuf->getSize();
+    if(total == 0) {
+        return 0;
+    }
+    // 底层流可能开启了零拷贝并持有 m_wbuf 直到内核发送完成，换一个新的而不是 clear
+    ByteArray::ptr ba = m_wbuf;
+    m_wbuf.reset(new ByteArray);
+    ba->setPosition(0);
+    while(ba->getReadSize()) {
+        int rt = m_stream->write(ba, ba->getReadSize());
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return total;
+}
+
+int64_t BufferedStream::transferFrom(int fd, int64_t offset, size_t len) {
+    if(m_wbuf->getSize()) {
+        int rt = flush();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    return m_stream->transferFrom(fd, offset, len);
+}
+
+void BufferedStream::close() {
+    flush();
+    m_stream->close();
+}
+
+int BufferedStream::readUntil(std::string& out, const std::string& delim, size_t max_len) {
+    if(delim.empty()) {
+        return -1;
+    }
+    size_t dlen = delim.size();
+    // 从 m_rpos 起已经找过、不可能是分隔符开头的字节数
+    size_t scanned = 0;
+    while(true) {
+        size_t avail = m_rend - m_rpos;
+        if(avail >= dlen) {
+            const char* base = m_rblock->data() + m_rpos;
+            const char* p = dlen == 1
+                ? (const char*)memchr(base + scanned, delim[0], avail - scanned)
+                : (const char*)memmem(base + scanned, avail - scanned, delim.c_str(), dlen);
+            if(p) {
+                size_t len = p - base;
+                if(len > max_len) {
+                    return -2;
+                }
+                out.assign(base, len);
+                m_rpos += len + dlen;
+                releaseRead();
+                return len + dlen;
+            }
+            scanned = avail - dlen + 1;
+            if(scanned > max_len) {
+                return -2;
+            }
+        }
+        int rt = fill(max_len + dlen);
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+}
+
+int BufferedStream::readLine(std::string& line, size_t max_len) {
+    static const std::string s_lf = "\n";
+    int rt = readUntil(line, s_lf, max_len);
+    if(rt > 0 && !line.empty() && line[line.size() - 1] == '\r') {
+        line.resize(line.size() - 1);
+    }
+    return rt;
+}
+
+int BufferedStream::fill(size_t max_size) {
+    size_t avail = m_rend - m_rpos;
+    if(!m_rblock) {
+        m_rblock = BufferBlock::Alloc(m_readSize);
+    } else if(m_rpos > 0) {
+        memmove(m_rblock->data(), m_rblock->data() + m_rpos, avail);
+    }
+    m_rpos = 0;
+    m_rend = avail;
+
+    size_t cap = m_rblock->getCapacity();
+    if(avail == cap) {
+        // 缓冲区满了还没找到分隔符，翻倍但不超过 max_size
+        size_t size = std::max(std::min(cap * 2, max_size), cap + 1);
+        BufferBlock* block = BufferBlock::Alloc(size);
+        memcpy(block->data(), m_rblock->data(), avail);
+        m_rblock->unref();
+        m_rblock = block;
+        cap = block->getCapacity();
+    }
+    int rt = m_stream->read(m_rblock->data() + m_rend, cap - m_rend);
+    if(rt > 0) {
+        m_rend += rt;
+    } else {
+        releaseRead();
+    }
+    return rt;
+}
+
+size_t BufferedStream::copyOut(void* buffer, size_t length) {
+    size_t n = std::min(length, m_rend - m_rpos);
+    memcpy(buffer, m_rblock->data() + m_rpos, n);
+    m_rpos += n;
+    releaseRead();
+    return n;
+}
+
+void BufferedStream::releaseRead() {
+    if(m_rblock && m_rpos == m_rend) {
+        m_rblock->unref();
+        m_rblock = nullptr;
+        m_rpos = m_rend = 0;
+    }
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef __SYLAR_BUFFERED_STREAM_H__
+#define __SYLAR_BUFFERED_STREAM_H__
+
+#include "webserve/stream.h"
+#include "webserve/slice.h"
+
+namespace sylar {
+
+/**
+ * @brief 带缓冲的流，包装任意 Stream
+ * @details 读：一次从底层流读满一个缓冲区(默认 16KB，内存来自 BufferBlock 的 slab 池，读空后立即归还)，
+ *          之后的小读取直接从缓冲区拷贝；要读的长度不小于缓冲区时绕过缓冲区直接读。
+ *          写：小的写入先攒在 ByteArray 里(write(ByteArray::ptr) 只引用数据不拷贝)，
+ *          攒够阈值(默认 64KB)或者调用 flush 时用一次 writev 发出去
+ * @attention 析构时不会自动 flush，缓冲里没有发出去的数据会丢掉；close 会先 flush
+ */
+class BufferedStream : public Stream {
+public:
+    typedef std::shared_ptr<BufferedStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] stream 底层的流
+     * @param[in] read_buffer 读缓冲区大小
+     * @param[in] flush_threshold 写缓冲攒到这么多字节时自动 flush
+     */
+    BufferedStream(Stream::ptr stream, size_t read_buffer = 16 * 1024
+                   ,size_t flush_threshold = 64 * 1024);
+    ~BufferedStream();
+
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 写入数据
+     * @details 先放进写缓冲，攒够阈值时 flush；length 不小于阈值时先 flush 再直接写
+     * @return 写入的长度，flush 出错时返回底层流的返回值
+     */
+    virtual int write(const void* buffer, size_t length) override;
+
+    /**
+     * @brief 写入 ba 里 [position, position + length) 的数据
+     * @details 数据以 Slice 的形式引用进写缓冲，不拷贝，ba 的 position 前进 length
+     */
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    // 先 flush 写缓冲，再由底层的流直接传输
+    virtual int64_t transferFrom(int fd, int64_t offset, size_t len) override;
+
+    // flush 之后关闭底层的流
+    virtual void close() override;
+
+    /**
+     * @brief 把写缓冲里的数据全部写到底层的流
+     * @return >0 写出的字节数，=0 没有数据或者被关闭，<0 出错
+     */
+    int flush();
+
+    /**
+     * @brief 读到分隔符为止
+     * @param[out] out 分隔符之前的数据，不含分隔符
+     * @param[in] delim 分隔符，可以是多个字节
+     * @param[in] max_len 分隔符之前的数据最多这么长
+     * @return
+     *      @retval >0 消耗的字节数，包含分隔符
+     *      @retval =0 没有读到分隔符流就关闭了，已经读到的数据留在缓冲区里
+     *      @retval -1 出错
+     *      @retval -2 超过 max_len 还没有读到分隔符
+     */
+    int readUntil(std::string& out, const std::string& delim, size_t max_len = 64 * 1024);
+
+    /**
+     * @brief 读一行，去掉末尾的 "\n" 或 "\r\n"
+     * @return 同 readUntil
+     */
+    int readLine(std::string& line, size_t max_len = 64 * 1024);
+
+    // 读缓冲里还没有读取的字节数
+    size_t getReadBuffered() const { return m_rend - m_rpos;}
+    // 写缓冲里还没有写出的字节数
+    size_t getWriteBuffered() const { return m_wbuf->getSize();}
+    // 返回底层的流
+    Stream::ptr getStream() const { return m_stream;}
+
+private:
+    /**
+     * @brief 从底层的流读一次，追加到读缓冲
+     * @details 先把未读的数据挪到缓冲区开头，缓冲区满了时容量翻倍，但不超过 max_size
+     *          (至少扩大 1 字节)
+     * @param[in] max_size 缓冲区扩大的上限，0 表示只扩大 1 字节
+     * @return 底层流 read 的返回值
+     */
+    int fill(size_t max_size);
+    // 从读缓冲拷贝最多 length 字节
+    size_t copyOut(void* buffer, size_t length);
+    // 读缓冲读空后把内存还给池
+    void releaseRead();
+
+private:
+    Stream::ptr m_stream;
+    size_t m_readSize;
+    size_t m_flushThreshold;
+    // 读缓冲，[m_rpos, m_rend) 是还没有读取的数据
+    BufferBlock* m_rblock = nullptr;
+    size_t m_rpos = 0;
+    size_t m_rend = 0;
+    // 写缓冲
+    ByteArray::ptr m_wbuf;
+};
+
+}
+
+#endif
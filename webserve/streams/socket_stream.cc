@@ -1,5 +1,9 @@
 #include "socket_stream.h"
 #include "webserve/util.h"
+#include "webserve/hook.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 namespace sylar {
 
@@ -49,15 +53,121 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     if(!isConnected()) {
         return -1;
     }
+    // 切成 Slice 交给内核持有：这段数据被冻结，发送完成之前 ba 再往这里写会先复制节点，
+    // 内核读到的内容不会被改掉
+    length = std::min(length, ba->getReadSize());
+    std::shared_ptr<Slice> data(new Slice(ba->slice(length, ba->getPosition())));
     std::vector<iovec> iovs;
-    ba->getReadBuffers(iovs, length);
-    int rt = m_socket->send(&iovs[0], iovs.size());
+    data->getBuffers(iovs);
+    int rt = m_socket->sendZeroCopy(&iovs[0], iovs.size(), data);
     if(rt > 0) {
         ba->setPosition(ba->getPosition() + rt);
     }
     return rt;
 }
 
+// sendfile 单次最多传输的字节数
+static const size_t s_sendfile_max = 0x7ffff000;
+// splice 经过临时管道时每次搬运的字节数，等于管道的默认容量
+static const size_t s_splice_chunk = 64 * 1024;
+
+// 内核或者文件系统不支持 sendfile/splice 时的错误码
+static bool IsUnsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+int64_t SocketStream::transferFrom(int fd, int64_t offset, size_t len) {
+    if(!isConnected()) {
+        return -1;
+    }
+    if(len == 0) {
+        return 0;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        return -1;
+    }
+    int64_t rt = S_ISREG(st.st_mode) ? sendFile(fd, offset, len)
+                 : spliceFrom(fd, offset, len, S_ISFIFO(st.st_mode));
+    if(rt == -2) {
+        return Stream::transferFrom(fd, offset, len);
+    }
+    return rt;
+}
+
+int64_t SocketStream::sendFile(int fd, int64_t offset, size_t len) {
+    int sock = m_socket->getSocket();
+    off_t off = offset;
+    uint64_t total = 0;
+    while(total < len) {
+        size_t n = std::min(len - total, s_sendfile_max);
+        // hook 过的 sendfile 在 EAGAIN 时挂起协程等 socket 可写
+        ssize_t rt = sendfile(sock, fd, offset >= 0 ? &off : nullptr, n);
+        if(rt > 0) {
+            total += rt;
+        } else if(rt == 0) {
+            break;
+        } else if(errno != EINTR) {
+            return total == 0 && IsUnsupported(errno) ? -2 : -1;
+        }
+    }
+    return total;
+}
+
+int64_t SocketStream::spliceFrom(int fd, int64_t offset, size_t len, bool is_pipe) {
+    int sock = m_socket->getSocket();
+    loff_t off = offset;
+    loff_t* poff = offset >= 0 ? &off : nullptr;
+    int pfd[2] = {-1, -1};
+    if(!is_pipe && pipe2(pfd, O_CLOEXEC) != 0) {
+        return -2;
+    }
+    uint64_t total = 0;
+    int64_t fail = 0;
+    while(total < len) {
+        size_t n = std::min(len - total, s_splice_chunk);
+        // 后面还有数据时带上 SPLICE_F_MORE，让内核把小段合并成满的报文
+        unsigned int more = total + n < len ? SPLICE_F_MORE : 0;
+        ssize_t got = splice(fd, poff, is_pipe ? sock : pfd[1], nullptr, n
+                             ,SPLICE_F_MOVE | (is_pipe ? more : 0));
+        if(got == 0) {
+            break;
+        }
+        if(got < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fail = total == 0 && IsUnsupported(errno) ? -2 : -1;
+            break;
+        }
+        // 临时管道里的数据全部搬到 socket
+        for(size_t left = is_pipe ? 0 : got; left > 0; ) {
+            ssize_t out = splice(pfd[0], nullptr, sock, nullptr, left, SPLICE_F_MOVE | more);
+            if(out < 0 && errno == EINTR) {
+                continue;
+            }
+            if(out <= 0) {
+                fail = -1;
+                break;
+            }
+            left -= out;
+        }
+        if(fail) {
+            break;
+        }
+        total += got;
+    }
+    if(!is_pipe) {
+        ::close(pfd[0]);
+        ::close(pfd[1]);
+    }
+    return fail ? fail : total;
+}
+
+bool SocketStream::setZeroCopy(bool v) {
+    return m_socket && m_socket->setZeroCopy(v);
+}
+
 void SocketStream::close() {
     if(m_socket) {
         m_socket->close();
@@ -58,6 +58,9 @@ public:
 
     /**
      * @brief 写入数据
+     * @details Socket 开启了零拷贝(setZeroCopy)并且数据达到阈值时走 MSG_ZEROCOPY，
+     *          写出的数据切成 Slice 冻结起来，内核发送完成后才释放；之后修改 ba 的这部分会先复制节点，
+     *          不影响正在发送的内容
      * @param[in] ba 待发送数据的ByteArray
      * @param[in] length 待发送数据的内存长度
      * @return
@@ -67,6 +70,22 @@ public:
      */
     virtual int write(ByteArray::ptr ba, size_t length) override;
 
+    /**
+     * @brief 把句柄 fd 里的数据发送到 socket，数据不经过用户态
+     * @details 普通文件用 sendfile，管道直接 splice 到 socket，其他句柄(socket，字符设备)
+     *          先 splice 到一个临时管道再 splice 到 socket。在协程里 EAGAIN 时挂起等待，
+     *          受 socket 的发送超时限制，超时返回 -1。
+     *          内核或者文件系统不支持并且还没有发送任何数据时，退回 Stream 的拷贝实现
+     */
+    virtual int64_t transferFrom(int fd, int64_t offset, size_t len) override;
+
+    /**
+     * @brief 开启/关闭零拷贝发送，只对 write(ByteArray::ptr) 生效
+     * @details write(const void*) 返回后调用方就可以复用内存，始终拷贝
+     * @return 内核不支持时返回 false
+     */
+    bool setZeroCopy(bool v);
+
     // 关闭socket
     virtual void close() override;
     // 返回Socket类
@@ -78,6 +97,12 @@ public:
     Address::ptr getLocalAddress();
     std::string getRemoteAddressString();
     std::string getLocalAddressString();
+private:
+    // sendfile 发送普通文件，不支持时返回 -2
+    int64_t sendFile(int fd, int64_t offset, size_t len);
+    // splice 发送管道或者其他句柄，不支持时返回 -2
+    int64_t spliceFrom(int fd, int64_t offset, size_t len, bool is_pipe);
+
 protected:
     Socket::ptr m_socket;   // Socket类
     bool m_owner;           // 是否主控
@@ -0,0 +1,320 @@
+#include "zlib_stream.h"
+#include "webserve/log.h"
+#include <atomic>
+#include <string.h>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+// zlib 一次能处理的长度是 uInt，大块数据分段送进去
+static const size_t s_max_chunk = 1u << 30;
+
+static std::atomic<size_t> s_max_cached{4};
+
+struct ZlibState {
+    z_stream zs;
+    bool encode;
+    // 按数据格式调整过的 windowBits
+    int windowBits;
+    int level;
+    int memlevel;
+    int strategy;
+};
+
+static void FreeState(ZlibState* s) {
+    if(s->encode) {
+        deflateEnd(&s->zs);
+    } else {
+        inflateEnd(&s->zs);
+    }
+    delete s;
+}
+
+namespace {
+// 线程缓存的 z_stream，线程退出时释放
+struct StateCache {
+    ~StateCache() {
+        for(auto s : states) {
+            FreeState(s);
+        }
+    }
+    std::vector<ZlibState*> states;
+    uint64_t created = 0;
+};
+}
+
+static thread_local StateCache t_cache;
+
+/**
+ * @brief 取一个参数相同的 z_stream，缓存里没有时新建
+ * @details 压缩要求参数全部相同，deflateReset 保留原来的参数；
+ *          解压只需要 inflateReset2 换成新的 windowBits，任何缓存的解压状态都能用
+ */
+static ZlibState* AcquireState(bool encode, int window_bits, int level, int memlevel, int strategy) {
+    auto& states = t_cache.states;
+    for(size_t i = states.size(); i-- > 0;) {
+        ZlibState* s = states[i];
+        if(s->encode != encode) {
+            continue;
+        }
+        int rt;
+        if(encode) {
+            if(s->windowBits != window_bits || s->level != level
+                    || s->memlevel != memlevel || s->strategy != strategy) {
+                continue;
+            }
+            rt = deflateReset(&s->zs);
+        } else {
+            rt = inflateReset2(&s->zs, window_bits);
+        }
+        states.erase(states.begin() + i);
+        if(rt == Z_OK) {
+            s->windowBits = window_bits;
+            return s;
+        }
+        FreeState(s);
+        break;
+    }
+
+    ZlibState* s = new ZlibState;
+    memset(&s->zs, 0, sizeof(s->zs));
+    s->encode = encode;
+    s->windowBits = window_bits;
+    s->level = level;
+    s->memlevel = memlevel;
+    s->strategy = strategy;
+    int rt = encode ? deflateInit2(&s->zs, level, Z_DEFLATED, window_bits, memlevel, strategy)
+                    : inflateInit2(&s->zs, window_bits);
+    if(rt != Z_OK) {
+        SYLAR_LOG_ERROR(g_logger) << (encode ? "deflateInit2" : "inflateInit2")
+            << " fail, rt=" << rt << " window_bits=" << window_bits
+            << " level=" << level << " memlevel=" << memlevel;
+        delete s;
+        return nullptr;
+    }
+    ++t_cache.created;
+    return s;
+}
+
+// 放回缓存末尾，缓存满了时释放最久没用的(开头的)
+static void ReleaseState(ZlibState* s) {
+    auto& states = t_cache.states;
+    size_t max_cached = s_max_cached;
+    if(max_cached == 0) {
+        FreeState(s);
+        return;
+    }
+    while(states.size() >= max_cached) {
+        FreeState(states.front());
+        states.erase(states.begin());
+    }
+    states.push_back(s);
+}
+
+// 数据格式对应的 windowBits：负数是裸 deflate，+16 是 gzip，解压 +32 自动识别 gzip/zlib 头
+static int ToWindowBits(ZlibStream::Type type, int window_bits, bool encode) {
+    switch(type) {
+        case ZlibStream::DEFLATE:
+            return -window_bits;
+        case ZlibStream::GZIP:
+            return window_bits + (encode ? 16 : 32);
+        default:
+            return window_bits;
+    }
+}
+
+ZlibStream::ptr ZlibStream::CreateGzip(bool encode, uint32_t buff_size, int level) {
+    return Create(encode, buff_size, GZIP, level);
+}
+
+ZlibStream::ptr ZlibStream::CreateZlib(bool encode, uint32_t buff_size, int level) {
+    return Create(encode, buff_size, ZLIB, level);
+}
+
+ZlibStream::ptr ZlibStream::CreateDeflate(bool encode, uint32_t buff_size, int level) {
+    return Create(encode, buff_size, DEFLATE, level);
+}
+
+ZlibStream::ptr ZlibStream::Create(bool encode, uint32_t buff_size, Type type
+        ,int level, int window_bits, int memlevel, Strategy strategy) {
+    if(level < DEFAULT_COMPRESSION || level > BEST_COMPRESSION
+            || window_bits < 8 || window_bits > 15
+            || memlevel < 1 || memlevel > 9) {
+        return nullptr;
+    }
+    ZlibState* s = AcquireState(encode, ToWindowBits(type, window_bits, encode)
+                                ,level, memlevel, strategy);
+    if(!s) {
+        return nullptr;
+    }
+    ZlibStream::ptr rt(new ZlibStream(encode, buff_size));
+    rt->m_state = s;
+    return rt;
+}
+
+bool ZlibStream::Compress(const void* data, size_t len, std::string& out, Type type, int level) {
+    if(level < DEFAULT_COMPRESSION || level > BEST_COMPRESSION) {
+        return false;
+    }
+    ZlibState* s = AcquireState(true, ToWindowBits(type, 15, true), level, 8, DEFAULT);
+    if(!s) {
+        return false;
+    }
+    // 输出空间按 deflateBound 一次给够，一次 deflate 压完，不用分段
+    z_stream& zs = s->zs;
+    out.resize(deflateBound(&zs, len));
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+    const char* p = (const char*)data;
+    int rt = Z_OK;
+    while(rt == Z_OK) {
+        size_t n = std::min(len, s_max_chunk);
+        zs.next_in = (Bytef*)p;
+        zs.avail_in = n;
+        rt = deflate(&zs, n == len ? Z_FINISH : Z_NO_FLUSH);
+        p += n - zs.avail_in;
+        len -= n - zs.avail_in;
+    }
+    out.resize(out.size() - zs.avail_out);
+    ReleaseState(s);
+    return rt == Z_STREAM_END;
+}
+
+bool ZlibStream::Decompress(const void* data, size_t len, std::string& out
+                            ,Type type, size_t max_size) {
+    // 输出节点取输入的 4 倍，限制在 4KB ~ 64KB
+    uint32_t buff_size = std::max(std::min(len * 4, (size_t)64 * 1024), (size_t)4096);
+    ZlibStream::ptr zs = Create(false, buff_size, type);
+    if(!zs) {
+        return false;
+    }
+    zs->m_maxOut = max_size;
+    if(zs->write(data, len) < 0 || zs->flush() < 0) {
+        return false;
+    }
+    out = zs->getResult();
+    return true;
+}
+
+size_t ZlibStream::GetCachedStates(uint64_t* created) {
+    if(created) {
+        *created = t_cache.created;
+    }
+    return t_cache.states.size();
+}
+
+void ZlibStream::SetMaxCachedStates(size_t v) {
+    s_max_cached = v;
+}
+
+ZlibStream::ZlibStream(bool encode, uint32_t buff_size)
+    :m_encode(encode)
+    ,m_buffSize(buff_size ? buff_size : 4096)
+    ,m_out(new ByteArray(m_buffSize)) {
+}
+
+ZlibStream::~ZlibStream() {
+    release();
+}
+
+int ZlibStream::read(void* buffer, size_t length) {
+    return -1;
+}
+
+int ZlibStream::read(ByteArray::ptr ba, size_t length) {
+    return -1;
+}
+
+int ZlibStream::write(const void* buffer, size_t length) {
+    const char* p = (const char*)buffer;
+    for(size_t off = 0; off < length; off += s_max_chunk) {
+        if(process(p + off, std::min(length - off, s_max_chunk), Z_NO_FLUSH) < 0) {
+            return -1;
+        }
+    }
+    return length;
+}
+
+int ZlibStream::write(ByteArray::ptr ba, size_t length) {
+    length = std::min(length, ba->getReadSize());
+    std::vector<iovec> iovs;
+    ba->getReadBuffers(iovs, length);
+    for(auto& iov : iovs) {
+        if(write(iov.iov_base, iov.iov_len) < 0) {
+            return -1;
+        }
+    }
+    ba->setPosition(ba->getPosition() + length);
+    return length;
+}
+
+void ZlibStream::close() {
+    flush();
+}
+
+int ZlibStream::flush() {
+    if(m_finished) {
+        return m_error ? -1 : 0;
+    }
+    return process(nullptr, 0, Z_FINISH);
+}
+
+std::string ZlibStream::getResult() const {
+    std::string rt(m_out->getSize(), 0);
+    if(!rt.empty()) {
+        m_out->read(&rt[0], rt.size(), 0);
+    }
+    return rt;
+}
+
+int ZlibStream::process(const void* data, size_t len, int flush) {
+    if(m_finished) {
+        // 解压时数据流已经结束，后面多出来的数据忽略
+        return m_error || m_encode ? -1 : 0;
+    }
+    z_stream& zs = m_state->zs;
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = len;
+    m_inBytes += len;
+    std::vector<iovec> iovs;
+    while(true) {
+        // 直接输出到 ByteArray 的节点里
+        iovs.clear();
+        m_out->getWriteBuffers(iovs, m_buffSize);
+        zs.next_out = (Bytef*)iovs[0].iov_base;
+        zs.avail_out = iovs[0].iov_len;
+        int rt = m_encode ? deflate(&zs, flush) : inflate(&zs, flush);
+        size_t produced = iovs[0].iov_len - zs.avail_out;
+        m_out->setPosition(m_out->getPosition() + produced);
+
+        if(rt == Z_STREAM_END) {
+            release();
+            return 0;
+        }
+        bool no_progress = rt == Z_BUF_ERROR && produced == 0;
+        if((rt != Z_OK && rt != Z_BUF_ERROR) || m_out->getSize() > m_maxOut
+                || (no_progress && flush == Z_FINISH)) {
+            SYLAR_LOG_DEBUG(g_logger) << (m_encode ? "deflate" : "inflate")
+                << " fail, rt=" << rt << " msg=" << (zs.msg ? zs.msg : "")
+                << " out=" << m_out->getSize();
+            m_error = true;
+            release();
+            return -1;
+        }
+        // 输入用完并且输出还有空间，说明 z_stream 里没有积压的输出了
+        if(flush != Z_FINISH && ((zs.avail_in == 0 && zs.avail_out != 0) || no_progress)) {
+            return 0;
+        }
+    }
+}
+
+void ZlibStream::release() {
+    m_finished = true;
+    if(m_state) {
+        ReleaseState(m_state);
+        m_state = nullptr;
+    }
+}
+
+}
@@ -0,0 +1,162 @@
+#ifndef __SYLAR_ZLIB_STREAM_H__
+#define __SYLAR_ZLIB_STREAM_H__
+
+#include "webserve/stream.h"
+#include <zlib.h>
+
+namespace sylar {
+
+// z_stream 和它的创建参数，定义在 zlib_stream.cc
+struct ZlibState;
+
+/**
+ * @brief zlib 压缩/解压流，写入的数据压缩(解压)后追加到内部的 ByteArray
+ * @details deflate 直接输出到 ByteArray 的节点里，不经过中间缓冲。
+ *          z_stream 的状态(压缩时约 256KB)按参数缓存在线程里，同一线程里参数相同的下一个流
+ *          deflateReset/inflateReset 之后复用，不用每次 deflateInit2；流结束(flush/close/析构)时归还。
+ *          流只能由一个协程使用，协程换了线程也没有关系，状态归还到析构时所在线程的缓存
+ */
+class ZlibStream : public Stream {
+public:
+    typedef std::shared_ptr<ZlibStream> ptr;
+
+    // 数据格式
+    enum Type {
+        ZLIB,       // zlib 头 + deflate + adler32
+        DEFLATE,    // 裸的 deflate 数据
+        GZIP        // gzip 头 + deflate + crc32
+    };
+
+    // 压缩策略
+    enum Strategy {
+        DEFAULT = Z_DEFAULT_STRATEGY,
+        FILTERED = Z_FILTERED,
+        HUFFMAN = Z_HUFFMAN_ONLY,
+        FIXED = Z_FIXED,
+        RLE = Z_RLE
+    };
+
+    // 压缩级别，也可以直接用 1~9
+    enum CompressLevel {
+        NO_COMPRESSION = Z_NO_COMPRESSION,
+        BEST_SPEED = Z_BEST_SPEED,
+        BEST_COMPRESSION = Z_BEST_COMPRESSION,
+        DEFAULT_COMPRESSION = Z_DEFAULT_COMPRESSION
+    };
+
+    static ZlibStream::ptr CreateGzip(bool encode, uint32_t buff_size = 4096
+                                      ,int level = DEFAULT_COMPRESSION);
+    static ZlibStream::ptr CreateZlib(bool encode, uint32_t buff_size = 4096
+                                      ,int level = DEFAULT_COMPRESSION);
+    /**
+     * @brief 创建裸 deflate 格式的流
+     * @attention HTTP 的 "Content-Encoding: deflate" 实际是 zlib 格式(RFC 9110)，用 CreateZlib
+     */
+    static ZlibStream::ptr CreateDeflate(bool encode, uint32_t buff_size = 4096
+                                         ,int level = DEFAULT_COMPRESSION);
+
+    /**
+     * @brief 创建流
+     * @param[in] encode true 压缩，false 解压
+     * @param[in] buff_size 每次向 ByteArray 申请的输出空间
+     * @param[in] type 数据格式，解压 GZIP 时也接受 ZLIB 格式
+     * @param[in] level 压缩级别 0~9，-1 是默认级别(6)
+     * @param[in] window_bits 窗口大小 8~15
+     * @param[in] memlevel 压缩的内存级别 1~9
+     * @param[in] strategy 压缩策略
+     * @return 参数不合法或者内存不够时返回 nullptr
+     */
+    static ZlibStream::ptr Create(bool encode, uint32_t buff_size = 4096
+            ,Type type = DEFLATE, int level = DEFAULT_COMPRESSION, int window_bits = 15
+            ,int memlevel = 8, Strategy strategy = DEFAULT);
+
+    /**
+     * @brief 一次压缩一段数据
+     * @details 用线程缓存的 z_stream 压缩到 out 里，适合已经在内存里的 HTTP 消息体
+     * @return 成功返回 true
+     */
+    static bool Compress(const void* data, size_t len, std::string& out
+                         ,Type type = GZIP, int level = DEFAULT_COMPRESSION);
+
+    /**
+     * @brief 一次解压一段数据
+     * @param[in] max_size 解压后超过这个大小时失败，防止压缩炸弹
+     * @return 成功返回 true，数据损坏、不完整或者超过 max_size 返回 false
+     */
+    static bool Decompress(const void* data, size_t len, std::string& out
+                           ,Type type = GZIP, size_t max_size = ~(size_t)0);
+
+    ~ZlibStream();
+
+    // 不支持读，返回 -1
+    virtual int read(void* buffer, size_t length) override;
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 压缩(解压)一段数据，结果追加到 getByteArray()
+     * @return 成功返回 length，出错或者流已经结束返回 -1
+     */
+    virtual int write(const void* buffer, size_t length) override;
+    // 压缩(解压) ba 里 [position, position + length) 的数据，ba 的 position 前进 length
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    // 同 flush
+    virtual void close() override;
+
+    /**
+     * @brief 结束流
+     * @details 压缩时输出剩下的数据和结尾；解压时检查数据是否完整。之后不能再写，
+     *          z_stream 归还到线程缓存
+     * @return 成功返回 0，解压的数据不完整或者出错返回 -1
+     */
+    int flush();
+
+    bool isEncode() const { return m_encode;}
+    // 流是否已经结束
+    bool isFinished() const { return m_finished;}
+
+    // 已经写入的字节数
+    uint64_t getInBytes() const { return m_inBytes;}
+    // 输出的字节数
+    uint64_t getOutBytes() const { return m_out->getSize();}
+
+    // 返回所有输出
+    std::string getResult() const;
+    // 返回保存输出的 ByteArray，position 在末尾
+    ByteArray::ptr getByteArray() const { return m_out;}
+
+    /**
+     * @brief 当前线程缓存的 z_stream 数量
+     * @param[in] created 不为空时返回这个线程创建过的 z_stream 总数
+     */
+    static size_t GetCachedStates(uint64_t* created = nullptr);
+
+    /**
+     * @brief 设置每个线程最多缓存的 z_stream 数，默认 4，0 表示不缓存
+     * @details 只影响之后归还的状态
+     */
+    static void SetMaxCachedStates(size_t v);
+
+private:
+    ZlibStream(bool encode, uint32_t buff_size);
+
+    // 把 data 送进 z_stream，输出写到 m_out
+    int process(const void* data, size_t len, int flush);
+    // 结束流，把状态还给线程缓存
+    void release();
+
+private:
+    bool m_encode;
+    bool m_finished = false;
+    bool m_error = false;
+    uint32_t m_buffSize;
+    uint64_t m_inBytes = 0;
+    // 解压时允许的最大输出
+    uint64_t m_maxOut = ~0ull;
+    ZlibState* m_state = nullptr;
+    ByteArray::ptr m_out;
+};
+
+}
+
+#endif
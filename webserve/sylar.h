@@ -6,20 +6,26 @@
 
 #include "address.h"
 #include "bytearray.h"
+#include "compress.h"
 #include "config.h"
 #include "endian.h"
 #include "fd_manager.h"
 #include "fiber.h"
+#include "file_io.h"
 #include "hook.h"
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
 #include "noncopyable.h"
+#include "offload.h"
 #include "scheduler.h"
+#include "serialize.h"
 #include "socket.h"
 #include "singleton.h"
+#include "slice.h"
 #include "thread.h"
 #include "timer.h"
+#include "udp_server.h"
 #include "util.h"
 
 
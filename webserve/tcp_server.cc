@@ -1,6 +1,9 @@
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
+#include "util.h"
+#include "hook.h"
+#include <fcntl.h>
 
 namespace sylar {
 
@@ -9,8 +12,57 @@ static sylar::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     sylar::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+// 每次唤醒最多接收的连接数
+static sylar::ConfigVar<uint32_t>::ptr g_tcp_server_accept_budget =
+    sylar::Config::Lookup("tcp_server.accept_budget", (uint32_t)64,
+            "tcp server accept budget per wakeup");
+
+// 句柄耗尽时退避时间的上限(毫秒)，从 10ms 开始翻倍
+static sylar::ConfigVar<uint32_t>::ptr g_tcp_server_accept_backoff =
+    sylar::Config::Lookup("tcp_server.accept_backoff", (uint32_t)1000,
+            "tcp server max accept backoff ms on EMFILE/ENFILE");
+
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
+static const uint32_t s_min_backoff = 10;
+
+// 预留的文件句柄，进程内所有 TcpServer 共用
+static sylar::Mutex s_reserve_mutex;
+static int s_reserve_fd = -1;
+
+static void OpenReserveFd() {
+    if(s_reserve_fd == -1) {
+        s_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+}
+
+/**
+ * @brief 句柄耗尽时丢弃积压的连接
+ * @details 不处理的话连接一直留在积压队列里，客户端挂到超时，边沿触发的监听 socket 也不会再被唤醒。
+ *          先关掉预留句柄腾出一个位置，逐个 accept 之后立即关闭，对端马上就能感知到，
+ *          最后再把预留句柄占回来
+ * @return 丢弃的连接数
+ */
+static size_t ShedConnections(Socket::ptr sock, size_t budget) {
+    sylar::Mutex::Lock lock(s_reserve_mutex);
+    if(s_reserve_fd == -1) {
+        return 0;
+    }
+    close_f(s_reserve_fd);
+    s_reserve_fd = -1;
+    size_t count = 0;
+    while(count < budget) {
+        int fd = accept4_f(sock->getSocket(), nullptr, nullptr, SOCK_CLOEXEC);
+        if(fd < 0) {
+            break;
+        }
+        close_f(fd);
+        ++count;
+    }
+    OpenReserveFd();
+    return count;
+}
+
 TcpServer::TcpServer(sylar::IOManager* worker,
                     sylar::IOManager* io_worker,
                     sylar::IOManager* accept_worker)
@@ -29,8 +81,15 @@ TcpServer::~TcpServer() {
     m_socks.clear();
 }
 
+void TcpServer::setConf(TcpServerConf::ptr v) {
+    m_conf = v;
+    if(v) {
+        m_reusePort = v->reuseport;
+    }
+}
+
 void TcpServer::setConf(const TcpServerConf& v) {
-    m_conf.reset(new TcpServerConf(v));
+    setConf(std::make_shared<TcpServerConf>(v));
 }
 
 bool TcpServer::bind(sylar::Address::ptr addr, bool ssl) {
@@ -44,26 +103,50 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
                         ,std::vector<Address::ptr>& fails
                         ,bool ssl) {
     m_ssl = ssl;
+    // 开启 SO_REUSEPORT 时每个地址打开多个监听 socket，各自有一个 accept 协程
+    size_t count = 1;
+    if(m_reusePort > 0) {
+        count = m_reusePort;
+    } else if(m_reusePort < 0) {
+        count = std::max(m_acceptWorker->getThreadIds().size(), (size_t)1);
+    }
     for(auto& addr : addrs) {
-        // Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-        Socket::ptr sock = Socket::CreateTCP(addr);
-        if(!sock->bind(addr)) {
-            // bind 绑定失败
-            SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if(!sock->listen()) {
-            // listen 监听失败
-            SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        Address::ptr bind_addr = addr;
+        // Unix Socket 的路径只能绑定一次，SO_REUSEPORT 对它无效
+        bool is_unix = addr->getFamily() == AF_UNIX;
+        for(size_t i = 0; i < (is_unix ? 1 : count); ++i) {
+            // Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+            Socket::ptr sock = Socket::CreateTCP(bind_addr);
+            if(m_reusePort && !is_unix && !sock->setReusePort()) {
+                SYLAR_LOG_ERROR(g_logger) << "set SO_REUSEPORT fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)) {
+                // bind 绑定失败
+                SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            applyOptions(sock);
+            if(!sock->listen(m_conf ? m_conf->backlog : SOMAXCONN)) {
+                // listen 监听失败
+                SYLAR_LOG_ERROR(g_logger) << "listen fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            // 端口为0时由内核分配，后面的监听 socket 绑定到同一个端口
+            if(i == 0) {
+                bind_addr = sock->getLocalAddress();
+            }
+            m_socks.push_back(sock);
         }
-        m_socks.push_back(sock);
     }
 
     if(!fails.empty()) {
@@ -75,26 +158,101 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
         SYLAR_LOG_INFO(g_logger) << "type=" << m_type
             << " name=" << m_name
             << " ssl=" << m_ssl
+            << " reuseport=" << m_reusePort
             << " server bind success: " << *i;
     }
     return true;
 }
 
+void TcpServer::applyOptions(Socket::ptr sock) {
+    if(!m_conf) {
+        return;
+    }
+    // 调优参数设置失败(内核不支持或没有权限)只告警，不影响监听
+    auto set = [&sock](int level, int option, int value, const char* name) {
+        if(!sock->setOption(level, option, value)) {
+            SYLAR_LOG_WARN(g_logger) << "set " << name << "=" << value
+                << " fail errno=" << errno << " errstr=" << strerror(errno)
+                << " sock=" << *sock;
+        }
+    };
+    const TcpServerConf& conf = *m_conf;
+    // Unix Socket 只有收发缓冲区可以调
+    bool is_ip = sock->getFamily() != AF_UNIX;
+    // initSock 已经开启了 TCP_NODELAY
+    if(is_ip && !conf.nodelay) {
+        set(IPPROTO_TCP, TCP_NODELAY, 0, "TCP_NODELAY");
+    }
+    if(is_ip && conf.defer_accept > 0) {
+        set(IPPROTO_TCP, TCP_DEFER_ACCEPT, conf.defer_accept, "TCP_DEFER_ACCEPT");
+    }
+    if(is_ip && conf.fastopen > 0) {
+        set(IPPROTO_TCP, TCP_FASTOPEN, conf.fastopen, "TCP_FASTOPEN");
+    }
+    // 接收缓冲区要在 listen 之前设置，握手时才会按它协商窗口扩大因子
+    if(conf.rcvbuf > 0) {
+        set(SOL_SOCKET, SO_RCVBUF, conf.rcvbuf, "SO_RCVBUF");
+    }
+    if(conf.sndbuf > 0) {
+        set(SOL_SOCKET, SO_SNDBUF, conf.sndbuf, "SO_SNDBUF");
+    }
+    if(is_ip && conf.user_timeout > 0) {
+        set(IPPROTO_TCP, TCP_USER_TIMEOUT, conf.user_timeout, "TCP_USER_TIMEOUT");
+    }
+    if(is_ip && conf.busy_poll > 0) {
+        set(SOL_SOCKET, SO_BUSY_POLL, conf.busy_poll, "SO_BUSY_POLL");
+    }
+}
+
 void TcpServer::startAccept(Socket::ptr sock) {
-    // 只要没有停止，那么就把 sock 数组中的 sock 全部连接
+    // 分片监听时新连接就在接收它的线程上处理：这个线程此刻是醒着的，不需要跨线程唤醒
+    bool local = m_reusePort && m_ioWorker == m_acceptWorker;
+    size_t budget = std::max(g_tcp_server_accept_budget->getValue(), (uint32_t)1);
+    uint32_t backoff = 0;
+    size_t dropped = 0;
+    std::vector<Socket::ptr> clients;
+    // 只要没有停止，每次唤醒把积压的连接都取出来
     while(!m_isStop) {
-        Socket::ptr client = sock->accept();
-        // 如果连接成功
-        if(client) {
-            client->setRecvTimeout(m_recvTimeout);
-            // 将当前的 sock 放到协程调度器中
+        clients.clear();
+        int rt = sock->acceptBatch(clients, budget, m_recvTimeout);
+        for(auto& client : clients) {
+            // 将新连接放到协程调度器中
             m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
+                        shared_from_this(), client), local ? GetThreadId() : -1);
+        }
+        if(rt >= 0) {
+            if(backoff) {
+                SYLAR_LOG_WARN(g_logger) << "accept recovered, dropped=" << dropped
+                    << " sock=" << *sock;
+                backoff = 0;
+                dropped = 0;
+            }
+            continue;
+        }
+        if(m_isStop) {
+            break;
+        }
+        int err = errno;
+        if(err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+            // 资源耗尽：丢掉积压的连接，然后退避一段时间再试，退避期间每轮只打一条日志
+            if(err == EMFILE || err == ENFILE) {
+                dropped += ShedConnections(sock, budget);
+            }
+            backoff = backoff ? std::min(backoff * 2, g_tcp_server_accept_backoff->getValue())
+                              : s_min_backoff;
+            SYLAR_LOG_WARN(g_logger) << "accept errno=" << err
+                << " errstr=" << strerror(err) << " dropped=" << dropped
+                << " backoff_ms=" << backoff;
+            usleep(backoff * 1000);
         } else {
-            SYLAR_LOG_ERROR(g_logger) << "accept errno=" << errno
-                << " errstr=" << strerror(errno);
+            SYLAR_LOG_ERROR(g_logger) << "accept errno=" << err
+                << " errstr=" << strerror(err);
         }
     }
+    // 监听 socket 只由 accept 协程自己关闭，这时它已经不会再登记事件了；
+    // 加锁是为了不和 stop 里的 cancelAll 交叉，关闭之后 fd 可能马上被别的连接复用
+    sylar::Mutex::Lock lock(m_sockMutex);
+    sock->close();
 }
 
 bool TcpServer::start() {
@@ -102,6 +260,10 @@ bool TcpServer::start() {
         return true;
     }
     m_isStop = false;
+    {
+        sylar::Mutex::Lock lock(s_reserve_mutex);
+        OpenReserveFd();
+    }
     for(auto& sock : m_socks) {
         m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
                     shared_from_this(), sock));
@@ -110,12 +272,22 @@ bool TcpServer::start() {
 }
 
 void TcpServer::stop() {
-    m_isStop = true;
+    bool running = !m_isStop.exchange(true);
     auto self = shared_from_this();
-    m_acceptWorker->schedule([this, self]() {
+    m_acceptWorker->schedule([this, self, running]() {
+        sylar::Mutex::Lock lock(m_sockMutex);
         for(auto& sock : m_socks) {
-            sock->cancelAll();
-            sock->close();
+            if(!sock->isValid()) {
+                // accept 协程已经退出并关闭了监听 socket
+                continue;
+            }
+            if(running) {
+                // 只唤醒 accept 协程，由它退出时关闭监听 socket；在这里关闭的话，
+                // accept 协程可能在关闭之前又登记了读事件，这个事件永远不会结束，IOManager 也就无法退出
+                sock->cancelAll();
+            } else {
+                sock->close();
+            }
         }
         m_socks.clear();
     });
@@ -143,7 +315,19 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
-       << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
+       << " reuseport=" << m_reusePort
+       << " recv_timeout=" << m_recvTimeout;
+    if(m_conf) {
+        ss << " backlog=" << m_conf->backlog
+           << " nodelay=" << m_conf->nodelay
+           << " defer_accept=" << m_conf->defer_accept
+           << " fastopen=" << m_conf->fastopen
+           << " rcvbuf=" << m_conf->rcvbuf
+           << " sndbuf=" << m_conf->sndbuf
+           << " user_timeout=" << m_conf->user_timeout
+           << " busy_poll=" << m_conf->busy_poll;
+    }
+    ss << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_socks) {
         ss << pfx << pfx << *i << std::endl;
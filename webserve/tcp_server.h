@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
 #include "address.h"
 #include "iomanager.h"
 #include "socket.h"
@@ -27,6 +28,25 @@ struct TcpServerConf {
     std::string accept_worker;
     std::string io_worker;
     std::string process_worker;
+    /// 每个地址的 SO_REUSEPORT 监听 socket 数，0 不开启，-1 每个 accept 线程一个
+    int reuseport = 0;
+    /// 监听队列长度
+    int backlog = SOMAXCONN;
+    /// 以下 TCP 参数设置在监听 socket 上，accept 出来的连接继承；除 nodelay 外为 0 时保持系统默认
+    /// TCP_NODELAY，1 开启，0 关闭
+    int nodelay = 1;
+    /// TCP_DEFER_ACCEPT(秒)，连接上有数据到达才完成 accept，不为空连接唤醒协程
+    int defer_accept = 0;
+    /// TCP_FASTOPEN 队列长度，允许客户端在 SYN 里带数据，省掉一次往返
+    int fastopen = 0;
+    /// SO_RCVBUF(字节)
+    int rcvbuf = 0;
+    /// SO_SNDBUF(字节)
+    int sndbuf = 0;
+    /// TCP_USER_TIMEOUT(毫秒)，已发送数据多久没有被确认就断开连接
+    int user_timeout = 0;
+    /// SO_BUSY_POLL(微秒)
+    int busy_poll = 0;
     std::map<std::string, std::string> args;
 
     bool isValid() const {
@@ -44,6 +64,15 @@ struct TcpServerConf {
             && accept_worker == oth.accept_worker
             && io_worker == oth.io_worker
             && process_worker == oth.process_worker
+            && reuseport == oth.reuseport
+            && backlog == oth.backlog
+            && nodelay == oth.nodelay
+            && defer_accept == oth.defer_accept
+            && fastopen == oth.fastopen
+            && rcvbuf == oth.rcvbuf
+            && sndbuf == oth.sndbuf
+            && user_timeout == oth.user_timeout
+            && busy_poll == oth.busy_poll
             && args == oth.args
             && id == oth.id
             && type == oth.type;
@@ -64,9 +93,18 @@ public:
         conf.ssl = node["ssl"].as<int>(conf.ssl);
         conf.cert_file = node["cert_file"].as<std::string>(conf.cert_file);
         conf.key_file = node["key_file"].as<std::string>(conf.key_file);
-        conf.accept_worker = node["accept_worker"].as<std::string>();
-        conf.io_worker = node["io_worker"].as<std::string>();
-        conf.process_worker = node["process_worker"].as<std::string>();
+        conf.accept_worker = node["accept_worker"].as<std::string>(conf.accept_worker);
+        conf.io_worker = node["io_worker"].as<std::string>(conf.io_worker);
+        conf.process_worker = node["process_worker"].as<std::string>(conf.process_worker);
+        conf.reuseport = node["reuseport"].as<int>(conf.reuseport);
+        conf.backlog = node["backlog"].as<int>(conf.backlog);
+        conf.nodelay = node["nodelay"].as<int>(conf.nodelay);
+        conf.defer_accept = node["defer_accept"].as<int>(conf.defer_accept);
+        conf.fastopen = node["fastopen"].as<int>(conf.fastopen);
+        conf.rcvbuf = node["rcvbuf"].as<int>(conf.rcvbuf);
+        conf.sndbuf = node["sndbuf"].as<int>(conf.sndbuf);
+        conf.user_timeout = node["user_timeout"].as<int>(conf.user_timeout);
+        conf.busy_poll = node["busy_poll"].as<int>(conf.busy_poll);
         conf.args = LexicalCast<std::string
             ,std::map<std::string, std::string> >()(node["args"].as<std::string>(""));
         if(node["address"].IsDefined()) {
@@ -94,6 +132,15 @@ public:
         node["accept_worker"] = conf.accept_worker;
         node["io_worker"] = conf.io_worker;
         node["process_worker"] = conf.process_worker;
+        node["reuseport"] = conf.reuseport;
+        node["backlog"] = conf.backlog;
+        node["nodelay"] = conf.nodelay;
+        node["defer_accept"] = conf.defer_accept;
+        node["fastopen"] = conf.fastopen;
+        node["rcvbuf"] = conf.rcvbuf;
+        node["sndbuf"] = conf.sndbuf;
+        node["user_timeout"] = conf.user_timeout;
+        node["busy_poll"] = conf.busy_poll;
         node["args"] = YAML::Load(LexicalCast<std::map<std::string, std::string>
             , std::string>()(conf.args));
         for(auto& i : conf.address) {
@@ -127,6 +174,8 @@ public:
 
     /**
      * @brief 绑定地址数组（多个地址）
+     * @details 地址可以是 UnixAddress，本机的旁路进程走 Unix Socket 不经过 TCP/IP 协议栈；
+     *          Unix 路径只打开一个监听 socket，路径上残留的文件会先删掉
      * @param[in] addrs 需要绑定的地址数组
      * @param[out] fails 绑定失败的地址
      * @return 是否绑定成功
@@ -140,7 +189,10 @@ public:
 
     // 启动服务，需要bind成功后执行
     virtual bool start();
-    // 停止服务
+    /**
+     * @brief 停止服务
+     * @details 唤醒各个 accept 协程，监听 socket 由 accept 协程退出时自己关闭
+     */
     virtual void stop();
 
     // 返回读取超时时间(毫秒)
@@ -156,8 +208,22 @@ public:
     // 是否停止
     bool isStop() const { return m_isStop;}
 
+    /**
+     * @brief 设置每个地址的 SO_REUSEPORT 监听 socket 数，需要在 bind 之前设置
+     * @details 0 表示每个地址一个监听 socket，所有连接都由一个 accept 协程接收；
+     *          n > 0 表示每个地址打开 n 个 SO_REUSEPORT 监听 socket，每个都有自己的 accept 协程，
+     *          由内核在它们之间分配新连接，新连接留在接收它的线程上处理；-1 表示每个 accept 线程一个
+     */
+    void setReusePort(int v) { m_reusePort = v;}
+    // 返回每个地址的 SO_REUSEPORT 监听 socket 数
+    int getReusePort() const { return m_reusePort;}
+
     TcpServerConf::ptr getConf() const { return m_conf;}
-    void setConf(TcpServerConf::ptr v) { m_conf = v;}
+    /**
+     * @brief 设置配置，同时应用其中的监听参数
+     * @details reuseport、backlog 和 TCP 参数在 bind 时生效，需要在 bind 之前设置
+     */
+    void setConf(TcpServerConf::ptr v);
     void setConf(const TcpServerConf& v);
 
     virtual std::string toString(const std::string& prefix = "");
@@ -169,6 +235,8 @@ protected:
     virtual void handleClient(Socket::ptr client);
     // 开始接受连接
     virtual void startAccept(Socket::ptr sock);
+    // 把配置里的 TCP 参数设置到监听 socket 上，在 bind 之后 listen 之前调用
+    virtual void applyOptions(Socket::ptr sock);
 
 protected:
     std::vector<Socket::ptr> m_socks;   // 监听Socket数组，相当于一个线程池
@@ -178,8 +246,10 @@ protected:
     uint64_t m_recvTimeout;             // 接收超时时间(毫秒)
     std::string m_name;                 // 服务器名称
     std::string m_type = "tcp";         // 服务器类型
-    bool m_isStop;                      // 服务是否停止
+    std::atomic<bool> m_isStop;         // 服务是否停止
+    sylar::Mutex m_sockMutex;           // 保护监听 socket 的关闭和取消
     bool m_ssl = false;
+    int m_reusePort = 0;                // 每个地址的 SO_REUSEPORT 监听 socket 数
     TcpServerConf::ptr m_conf;
 };
 
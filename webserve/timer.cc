@@ -1,8 +1,29 @@
 #include "timer.h"
 #include "util.h"
+#include "config.h"
+#include <algorithm>
 
 namespace sylar {
 
+// 粗粒度超时(recv/send 等)的合并窗口，同一窗口内到期的超时一起触发
+static sylar::ConfigVar<uint64_t>::ptr g_timer_slack =
+    sylar::Config::Lookup("timer.slack", (uint64_t)1000, "coarse timeout slack ms");
+
+static uint64_t s_timer_slack = 1000;
+
+namespace {
+struct _TimerSlackIniter {
+    _TimerSlackIniter() {
+        s_timer_slack = g_timer_slack->getValue();
+        g_timer_slack->addListener([](const uint64_t& ov, const uint64_t& nv){
+            s_timer_slack = nv;
+        });
+    }
+};
+
+static _TimerSlackIniter s_timer_slack_initer;
+}
+
 bool Timer::Comparator::operator()(const Timer::ptr& lhs
                         ,const Timer::ptr& rhs) const {
     if(!lhs && !rhs) {
@@ -25,13 +46,14 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs
 }
 
 
-Timer::Timer(uint64_t ms, std::function<void()> cb,
+Timer::Timer(uint64_t us, std::function<void()> cb,
              bool recurring, TimerManager* manager)
     :m_recurring(recurring)
-    ,m_ms(ms)
+    ,m_us(us)
     ,m_cb(cb)
     ,m_manager(manager) {
-    m_next = sylar::GetCurrentMS() + m_ms;
+    // 精确定时器(sleep 等)直接读单调时钟，避免协程跑久了之后用到旧的缓存时间提前触发
+    m_next = sylar::GetMonotonicUS() + m_us;
 }
 
 Timer::Timer(uint64_t next)
@@ -62,13 +84,17 @@ bool Timer::refresh() {
     }
     // 因为 m_timers 是 set 结构，不能直接修改key值，所以先删除，再修改，最后添加
     m_manager->m_timers.erase(it);
-    m_next = sylar::GetCurrentMS() + m_ms;
+    m_next = sylar::GetMonotonicUS() + m_us;
     m_manager->m_timers.insert(shared_from_this());
     return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now) {
-    if(ms == m_ms && !from_now) {
+    return resetUS(ms * 1000, from_now);
+}
+
+bool Timer::resetUS(uint64_t us, bool from_now) {
+    if(us == m_us && !from_now) {
         return true;
     }
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
@@ -82,19 +108,18 @@ bool Timer::reset(uint64_t ms, bool from_now) {
     m_manager->m_timers.erase(it);
     uint64_t start = 0;
     if(from_now) {
-        start = sylar::GetCurrentMS();
+        start = sylar::GetMonotonicUS();
     } else {
-        start = m_next - m_ms;
+        start = m_next - m_us;
     }
-    m_ms = ms;
-    m_next = start + m_ms;
+    m_us = us;
+    m_next = start + m_us;
     m_manager->addTimer(shared_from_this(), lock);
     return true;
 
 }
 
 TimerManager::TimerManager() {
-    m_previouseTime = sylar::GetCurrentMS();
 }
 
 TimerManager::~TimerManager() {
@@ -102,7 +127,12 @@ TimerManager::~TimerManager() {
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
                                   ,bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    return addTimerUS(ms * 1000, cb, recurring);
+}
+
+Timer::ptr TimerManager::addTimerUS(uint64_t us, std::function<void()> cb
+                                    ,bool recurring) {
+    Timer::ptr timer(new Timer(us, cb, recurring, this));
     RWMutexType::WriteLock lock(m_mutex);
     addTimer(timer, lock);
     // 返回值可以用于取消定时器
@@ -122,51 +152,213 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
                                     ,std::weak_ptr<void> weak_cond
                                     ,bool recurring) {
     // bind 扩大函数是使用场合，使得函数更加灵活的被使用
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    return addTimerUS(ms * 1000, std::bind(&OnTimer, weak_cond, cb), recurring);
+}
+
+Timer::ptr TimerManager::addConditionTimerUS(uint64_t us, std::function<void()> cb
+                                    ,std::weak_ptr<void> weak_cond
+                                    ,bool recurring) {
+    return addTimerUS(us, std::bind(&OnTimer, weak_cond, cb), recurring);
+}
+
+void TimerManager::armTimeout(TimeoutNode* node, uint64_t ms) {
+    // slack 不超过超时时间的 1/16，取 2 的幂，保证不同超时时间的节点也能落在同一个桶里
+    uint64_t slack = std::min(s_timer_slack, ms / 16);
+    uint64_t gran = 1;
+    while(gran * 2 <= slack) {
+        gran *= 2;
+    }
+    // 在业务协程里调用，缓存的时间可能是很久之前的，直接读时钟
+    uint64_t next = sylar::GetMonotonicMS() + ms;
+    next = (next + gran - 1) / gran * gran;
+
+    RWMutexType::WriteLock lock(m_mutex);
+    if(node->isArmed()) {
+        timeoutUnlink(node);
+    }
+    // 桶在窗口第一次用到时创建，空了也留到到期，同一个窗口内反复挂载不再分配内存
+    auto it = m_timeouts.lower_bound(next);
+    if(it == m_timeouts.end() || it->first != next) {
+        it = m_timeouts.insert(it, std::make_pair(next, TimeoutBucket()));
+        it->second.expire = next;
+    }
+    TimeoutBucket& bucket = it->second;
+    if(!bucket.head) {
+        m_timeoutHeap.push_back(&bucket);
+        heapUp(m_timeoutHeap.size() - 1);
+    }
+    node->m_bucket = &bucket;
+    node->m_prev = nullptr;
+    node->m_next = bucket.head;
+    if(bucket.head) {
+        bucket.head->m_prev = node;
+    }
+    bucket.head = node;
+
+    // 和 addTimer 一样，成为最早的定时器时需要唤醒 epoll_wait 重新计算等待时间
+    bool at_front = !m_tickled && nextTimeout() == next
+        && (m_timers.empty() || next * 1000 < (*m_timers.begin())->m_next);
+    if(at_front) {
+        m_tickled = true;
+    }
+    lock.unlock();
+
+    if(at_front) {
+        onTimerInsertedAtFront();
+    }
+}
+
+bool TimerManager::disarmTimeout(TimeoutNode* node) {
+    RWMutexType::WriteLock lock(m_mutex);
+    if(!node->isArmed()) {
+        return false;
+    }
+    timeoutUnlink(node);
+    return true;
+}
+
+void TimerManager::timeoutUnlink(TimeoutNode* node) {
+    TimeoutBucket* bucket = (TimeoutBucket*)node->m_bucket;
+    if(node->m_prev) {
+        node->m_prev->m_next = node->m_next;
+    } else {
+        bucket->head = node->m_next;
+    }
+    if(node->m_next) {
+        node->m_next->m_prev = node->m_prev;
+    }
+    node->m_bucket = nullptr;
+    node->m_prev = node->m_next = nullptr;
+    if(!bucket->head) {
+        heapRemove(bucket);
+    }
+}
+
+uint64_t TimerManager::nextTimeout() const {
+    return m_timeoutHeap.empty() ? ~0ull : m_timeoutHeap[0]->expire;
+}
+
+void TimerManager::heapUp(size_t i) {
+    TimeoutBucket* bucket = m_timeoutHeap[i];
+    while(i > 0) {
+        size_t parent = (i - 1) / 2;
+        if(m_timeoutHeap[parent]->expire <= bucket->expire) {
+            break;
+        }
+        m_timeoutHeap[i] = m_timeoutHeap[parent];
+        m_timeoutHeap[i]->heapIndex = i;
+        i = parent;
+    }
+    m_timeoutHeap[i] = bucket;
+    bucket->heapIndex = i;
+}
+
+void TimerManager::heapDown(size_t i) {
+    TimeoutBucket* bucket = m_timeoutHeap[i];
+    size_t size = m_timeoutHeap.size();
+    while(true) {
+        size_t child = i * 2 + 1;
+        if(child >= size) {
+            break;
+        }
+        if(child + 1 < size && m_timeoutHeap[child + 1]->expire < m_timeoutHeap[child]->expire) {
+            ++child;
+        }
+        if(bucket->expire <= m_timeoutHeap[child]->expire) {
+            break;
+        }
+        m_timeoutHeap[i] = m_timeoutHeap[child];
+        m_timeoutHeap[i]->heapIndex = i;
+        i = child;
+    }
+    m_timeoutHeap[i] = bucket;
+    bucket->heapIndex = i;
+}
+
+void TimerManager::heapRemove(TimeoutBucket* bucket) {
+    size_t i = bucket->heapIndex;
+    TimeoutBucket* last = m_timeoutHeap.back();
+    m_timeoutHeap.pop_back();
+    if(last == bucket) {
+        return;
+    }
+    // 用最后一个桶填上空位，再按它的到期时间上浮或下沉
+    m_timeoutHeap[i] = last;
+    last->heapIndex = i;
+    heapUp(i);
+    heapDown(last->heapIndex);
 }
 
 uint64_t TimerManager::getNextTimer() {
+    uint64_t us = getNextTimerUS();
+    if(us == ~0ull) {
+        return ~0ull;
+    }
+    // 向上取整，按毫秒等待的调用方不会在定时器到期前醒来空转
+    return (us + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUS() {
     RWMutexType::ReadLock lock(m_mutex);
     m_tickled = false;
-    if(m_timers.empty()) {
+    uint64_t next = nextTimeout();
+    if(next != ~0ull) {
+        next *= 1000;
+    }
+    if(!m_timers.empty() && (*m_timers.begin())->m_next < next) {
+        next = (*m_timers.begin())->m_next;
+    }
+    if(next == ~0ull) {
         return ~0ull;
     }
 
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = sylar::GetCurrentMS();
+    uint64_t now_us = sylar::GetCachedMonotonicUS();
     // 判断当前时间和下一个定时器的大小
-    if(now_ms >= next->m_next) {
+    if(now_us >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_us;
     }
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
-    uint64_t now_ms = sylar::GetCurrentMS();
+    uint64_t now_us = sylar::GetCachedMonotonicUS();
+    uint64_t now_ms = now_us / 1000;
     // expired 用来存放已经超时的定时器（待执行）
     std::vector<Timer::ptr> expired;
     {
         RWMutexType::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
+        if(m_timers.empty() && m_timeouts.empty()) {
             return;
         }
     }
     RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
+    if(m_timers.empty() && m_timeouts.empty()) {
         return;
     }
-    // 还要判断当前服务器的时间是没有问题的，如果时间变动，那么所有的定时器都要处理
-    bool rollover = detectClockRollover(now_ms);
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
+
+    // 到期的桶整体触发，回调在锁内执行，摘除节点的一方会等到回调结束，节点不会悬空；
+    // 桶里最后一个节点摘除时桶移出堆，到期的空桶随后一起删除
+    while(!m_timeoutHeap.empty()
+            && m_timeoutHeap[0]->expire <= now_ms) {
+        TimeoutNode* node = m_timeoutHeap[0]->head;
+        timeoutUnlink(node);
+        node->onTimeout();
+    }
+    while(!m_timeouts.empty()
+            && m_timeouts.begin()->first <= now_ms) {
+        m_timeouts.erase(m_timeouts.begin());
+    }
+
+    if(m_timers.empty() || (*m_timers.begin())->m_next > now_us) {
         return;
     }
 
     // 找到计时器数组中，比 now_timer 小的计时器
     // lower_bound -- 从数组的begin位置到end-1位置二分查找第一个大于或等于num的数字，找到返回该数字的地址
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
+    Timer::ptr now_timer(new Timer(now_us));
+    auto it = m_timers.lower_bound(now_timer);
+    while(it != m_timers.end() && (*it)->m_next == now_us) {
         ++it;
     }
     // 存入超时的定时器，并将其在原数组中删除
@@ -177,7 +369,11 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     for(auto& timer : expired) {
         cbs.push_back(timer->m_cb);
         if(timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
+            // 按固定节奏推进，避免每次都从处理时刻起算导致周期漂移；落后太多时从现在重新起算
+            timer->m_next += timer->m_us;
+            if(timer->m_next <= now_us) {
+                timer->m_next = now_us + timer->m_us;
+            }
             m_timers.insert(timer);
         } else {
             timer->m_cb = nullptr;
@@ -199,19 +395,9 @@ void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
     }
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if(now_ms < m_previouseTime &&
-            now_ms < (m_previouseTime - 60 * 60 * 1000)) {
-        rollover = true;
-    }
-    m_previouseTime = now_ms;
-    return rollover;
-}
-
 bool TimerManager::hasTimer() {
     RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    return !m_timers.empty() || nextTimeout() != ~0ull;
 }
 
 }
\ No newline at end of file
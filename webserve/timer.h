@@ -4,6 +4,8 @@
 #include <memory>
 #include <vector>
 #include <set>
+#include <map>
+#include <functional>
 #include "thread.h"
 
 namespace sylar {
@@ -29,28 +31,35 @@ public:
      * @param[in] from_now 是否从当前时间开始计算
      */
     bool reset(uint64_t ms, bool from_now);
+
+    /**
+     * @brief 重置定时器时间(微秒)
+     * @param[in] us 定时器执行间隔时间(微秒)
+     * @param[in] from_now 是否从当前时间开始计算
+     */
+    bool resetUS(uint64_t us, bool from_now);
     
 private:
     /**
      * @brief 构造函数
-     * @param[in] ms 定时器执行间隔时间
+     * @param[in] us 定时器执行间隔时间(微秒)
      * @param[in] cb 回调函数
      * @param[in] recurring 是否循环
      * @param[in] manager 定时器管理器
      */
-    Timer(uint64_t ms, std::function<void()> cb,
+    Timer(uint64_t us, std::function<void()> cb,
           bool recurring, TimerManager* manager);
 
     /**
      * @brief 构造函数
-     * @param[in] next 执行的时间戳(毫秒)
+     * @param[in] next 执行的时间戳(单调时钟微秒)
      */
     Timer(uint64_t next);
 
 private:
     bool m_recurring = false;           // 是否循环定时器
-    uint64_t m_ms = 0;                  // 执行周期
-    uint64_t m_next = 0;                // 精确的执行时间
+    uint64_t m_us = 0;                  // 执行周期(微秒)
+    uint64_t m_next = 0;                // 精确的执行时间(单调时钟微秒)
     std::function<void()> m_cb;         // 回调函数
     TimerManager* m_manager = nullptr;  // 定时器管理器
 
@@ -63,6 +72,37 @@ private:
 };
 
 
+/**
+ * @brief 侵入式粗粒度超时节点
+ * @details 节点由调用方持有(一般放在等待协程的栈上)，挂载/摘除都不需要分配内存。
+ *          超时时间会向上对齐到 slack 窗口，同一个窗口内到期的节点挂在同一个桶里一起触发，
+ *          摘除只是桶内的链表操作。适合 recv/send 这类几乎不会触发的超时，
+ *          sleep/usleep 这类需要精确时间的仍然使用 Timer
+ */
+class TimeoutNode {
+friend class TimerManager;
+public:
+    TimeoutNode() = default;
+    virtual ~TimeoutNode() {}
+
+    // 是否已经挂载到定时器管理器上
+    bool isArmed() const { return m_bucket != nullptr;}
+
+protected:
+    /**
+     * @brief 超时回调
+     * @attention 在 TimerManager 的写锁内执行，不能再操作定时器，
+     *            所以节点被摘除(disarm)返回后，回调一定已经执行完毕
+     */
+    virtual void onTimeout() = 0;
+
+private:
+    void* m_bucket = nullptr;           // 所在的桶，nullptr 表示未挂载
+    TimeoutNode* m_prev = nullptr;      // 桶内双向链表
+    TimeoutNode* m_next = nullptr;
+};
+
+
 // 定时器管理器
 class TimerManager {
 friend class Timer;
@@ -81,6 +121,15 @@ public:
     Timer::ptr addTimer(uint64_t ms, std::function<void()> cb
                         ,bool recurring = false);
 
+    /**
+     * @brief 添加微秒精度的定时器，用于限速、发送节奏控制等亚毫秒场景
+     * @param[in] us 定时器执行间隔时间(微秒)
+     * @param[in] cb 定时器回调函数
+     * @param[in] recurring 是否循环定时器
+     */
+    Timer::ptr addTimerUS(uint64_t us, std::function<void()> cb
+                        ,bool recurring = false);
+
     /**
      * @brief 添加条件定时器
      * @param[in] ms 定时器执行间隔时间
@@ -92,9 +141,30 @@ public:
                         ,std::weak_ptr<void> weak_cond
                         ,bool recurring = false);
 
-    // 获取到最近一个定时器执行的时间间隔(毫秒)
+    // 添加微秒精度的条件定时器
+    Timer::ptr addConditionTimerUS(uint64_t us, std::function<void()> cb
+                        ,std::weak_ptr<void> weak_cond
+                        ,bool recurring = false);
+
+    /**
+     * @brief 挂载侵入式超时节点
+     * @param[in] node 超时节点，在摘除或超时之前必须保持有效
+     * @param[in] ms 超时时间(毫秒)，实际触发时间最多推迟 slack 毫秒
+     */
+    void armTimeout(TimeoutNode* node, uint64_t ms);
+
+    /**
+     * @brief 摘除侵入式超时节点
+     * @return 节点还在等待中返回 true，已经超时(或未挂载)返回 false
+     */
+    bool disarmTimeout(TimeoutNode* node);
+
+    // 获取到最近一个定时器执行的时间间隔(毫秒，向上取整)
     uint64_t getNextTimer();
 
+    // 获取到最近一个定时器执行的时间间隔(微秒)
+    uint64_t getNextTimerUS();
+
     // 获取需要执行的定时器的回调函数列表，是一个回调函数数组
     void listExpiredCb(std::vector<std::function<void()> >& cbs);
 
@@ -109,14 +179,32 @@ protected:
     void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
 
 private:
-    // 检测服务器时间是否被调后了
-    bool detectClockRollover(uint64_t now_ms);
+    // 同一个 slack 窗口内到期的超时节点
+    struct TimeoutBucket {
+        TimeoutNode* head = nullptr;
+        uint64_t expire = 0;        // 到期时间(毫秒)，即在 m_timeouts 里的键
+        size_t heapIndex = 0;       // 非空时在 m_timeoutHeap 里的下标
+    };
+
+    // 超时节点从桶里摘除，桶空了时移出堆，调用方持有写锁
+    void timeoutUnlink(TimeoutNode* node);
+    // 最早一个非空超时桶的到期时间，没有返回 ~0ull，调用方持有锁
+    uint64_t nextTimeout() const;
+    // m_timeoutHeap 的上浮、下沉和删除
+    void heapUp(size_t i);
+    void heapDown(size_t i);
+    void heapRemove(TimeoutBucket* bucket);
 
 private:
     RWMutexType m_mutex;                                // Mutex
     std::set<Timer::ptr, Timer::Comparator> m_timers;   // 定时器集合
+    /**
+     * 到期时间 -> 超时桶。空桶不马上删除，同一个窗口里再次挂载时直接复用，不用分配 map 节点；
+     * 到期后在 listExpiredCb 里统一删除
+     */
+    std::map<uint64_t, TimeoutBucket> m_timeouts;
+    std::vector<TimeoutBucket*> m_timeoutHeap;          // 非空超时桶按到期时间组成的小根堆
     bool m_tickled = false;                             // 是否触发onTimerInsertedAtFront
-    uint64_t m_previouseTime = 0;                       // 上次执行时间
 };
 
 }
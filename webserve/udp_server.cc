@@ -0,0 +1,275 @@
+#include "udp_server.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "log.h"
+#include <string.h>
+
+namespace sylar {
+
+static sylar::ConfigVar<uint32_t>::ptr g_udp_server_batch_size =
+    sylar::Config::Lookup("udp_server.batch_size", (uint32_t)64,
+            "udp server max datagrams per recvmmsg");
+
+static sylar::ConfigVar<uint32_t>::ptr g_udp_server_buffer_size =
+    sylar::Config::Lookup("udp_server.buffer_size", (uint32_t)2048,
+            "udp server buffer size per datagram");
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+DatagramBatch::DatagramBatch(size_t capacity, size_t buffer_size)
+    :m_bufferSize(buffer_size)
+    ,m_buffer(capacity * buffer_size)
+    ,m_addrs(capacity)
+    ,m_iovs(capacity)
+    ,m_msgs(capacity) {
+    memset(&m_msgs[0], 0, sizeof(mmsghdr) * capacity);
+    for(size_t i = 0; i < capacity; ++i) {
+        m_iovs[i].iov_base = data(i);
+        m_iovs[i].iov_len = m_bufferSize;
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+        m_msgs[i].msg_hdr.msg_name = &m_addrs[i];
+    }
+}
+
+Address::ptr DatagramBatch::getAddress(size_t i) const {
+    return Address::Create(addr(i), addrLen(i));
+}
+
+bool DatagramBatch::append(const void* data, size_t len, const sockaddr* to, socklen_t tolen) {
+    if(m_size >= m_msgs.size() || len > m_bufferSize
+            || tolen > sizeof(sockaddr_storage)) {
+        return false;
+    }
+    memcpy(this->data(m_size), data, len);
+    memcpy(&m_addrs[m_size], to, tolen);
+    m_iovs[m_size].iov_len = len;
+    m_msgs[m_size].msg_hdr.msg_namelen = tolen;
+    m_msgs[m_size].msg_len = len;
+    ++m_size;
+    return true;
+}
+
+bool DatagramBatch::append(const void* data, size_t len, Address::ptr to) {
+    return append(data, len, to->getAddr(), to->getAddrLen());
+}
+
+int DatagramBatch::recvFrom(Socket::ptr sock, int flags) {
+    m_size = 0;
+    // 上一次发送时可能改过长度，接收前全部恢复成整个缓冲区
+    for(size_t i = 0; i < m_msgs.size(); ++i) {
+        m_iovs[i].iov_len = m_bufferSize;
+        m_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        m_msgs[i].msg_hdr.msg_flags = 0;
+    }
+    int rt = sock->recvMulti(&m_msgs[0], m_msgs.size(), flags);
+    if(rt > 0) {
+        m_size = rt;
+    }
+    return rt;
+}
+
+int DatagramBatch::sendTo(Socket::ptr sock, int flags) {
+    size_t sent = 0;
+    while(sent < m_size) {
+        int rt = sock->sendMulti(&m_msgs[sent], m_size - sent, flags);
+        if(rt <= 0) {
+            return sent ? (int)sent : -1;
+        }
+        sent += rt;
+    }
+    return sent;
+}
+
+DatagramBatchPool::DatagramBatchPool(size_t capacity, size_t buffer_size, size_t max_free)
+    :m_capacity(capacity)
+    ,m_bufferSize(buffer_size)
+    ,m_maxFree(max_free) {
+}
+
+DatagramBatchPool::~DatagramBatchPool() {
+    for(auto i : m_free) {
+        delete i;
+    }
+}
+
+DatagramBatch::ptr DatagramBatchPool::acquire() {
+    DatagramBatch* batch = nullptr;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(!m_free.empty()) {
+            batch = m_free.back();
+            m_free.pop_back();
+        }
+    }
+    if(!batch) {
+        batch = new DatagramBatch(m_capacity, m_bufferSize);
+        ++m_created;
+    }
+    batch->clear();
+    // 删除器持有对象池，批次比服务器活得久也能安全地回收
+    DatagramBatchPool::ptr self = shared_from_this();
+    return DatagramBatch::ptr(batch, [self](DatagramBatch* b){
+        self->release(b);
+    });
+}
+
+size_t DatagramBatchPool::getFree() {
+    MutexType::Lock lock(m_mutex);
+    return m_free.size();
+}
+
+void DatagramBatchPool::release(DatagramBatch* batch) {
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_free.size() < m_maxFree) {
+            m_free.push_back(batch);
+            return;
+        }
+    }
+    delete batch;
+}
+
+UdpServer::UdpServer(sylar::IOManager* worker)
+    :m_worker(worker)
+    ,m_name("sylar/1.0.0")
+    ,m_isStop(true)
+    ,m_batchSize(g_udp_server_batch_size->getValue())
+    ,m_bufferSize(g_udp_server_buffer_size->getValue()) {
+}
+
+UdpServer::~UdpServer() {
+    for(auto& i : m_socks) {
+        i->close();
+    }
+    m_socks.clear();
+}
+
+bool UdpServer::bind(sylar::Address::ptr addr) {
+    std::vector<Address::ptr> addrs;
+    std::vector<Address::ptr> fails;
+    addrs.push_back(addr);
+    return bind(addrs, fails);
+}
+
+bool UdpServer::bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails) {
+    size_t count = 1;
+    if(m_reusePort > 0) {
+        count = m_reusePort;
+    } else if(m_reusePort < 0) {
+        count = std::max(m_worker->getThreadIds().size(), (size_t)1);
+    }
+    for(auto& addr : addrs) {
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0; i < count; ++i) {
+            Socket::ptr sock = Socket::CreateUDP(bind_addr);
+            // 不在 hook 线程里创建的 socket 没有登记，登记之后才是非阻塞的，接收时只挂起协程
+            FdMgr::GetInstance()->get(sock->getSocket(), true);
+            if(m_reusePort && !sock->setReusePort()) {
+                SYLAR_LOG_ERROR(g_logger) << "set SO_REUSEPORT fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)) {
+                SYLAR_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            // 端口为0时由内核分配，后面的 socket 绑定到同一个端口
+            if(i == 0) {
+                bind_addr = sock->getLocalAddress();
+            }
+            m_socks.push_back(sock);
+        }
+    }
+
+    if(!fails.empty()) {
+        m_socks.clear();
+        return false;
+    }
+
+    for(auto& i : m_socks) {
+        SYLAR_LOG_INFO(g_logger) << "name=" << m_name
+            << " reuseport=" << m_reusePort
+            << " udp server bind success: " << *i;
+    }
+    return true;
+}
+
+void UdpServer::startRecv(Socket::ptr sock) {
+    while(!m_isStop) {
+        DatagramBatch::ptr batch = m_pool->acquire();
+        int rt = batch->recvFrom(sock);
+        if(rt > 0) {
+            m_recvCount += rt;
+            ++m_recvCalls;
+            handleBatch(sock, batch);
+        } else if(!m_isStop) {
+            SYLAR_LOG_ERROR(g_logger) << "recvmmsg errno=" << errno
+                << " errstr=" << strerror(errno) << " sock=" << *sock;
+        }
+    }
+    // 和 TcpServer 一样，socket 只由接收协程自己关闭，加锁避免和 stop 里的 cancelAll 交叉
+    sylar::Mutex::Lock lock(m_sockMutex);
+    sock->close();
+}
+
+bool UdpServer::start() {
+    if(!m_isStop) {
+        return true;
+    }
+    m_isStop = false;
+    m_pool.reset(new DatagramBatchPool(std::max(m_batchSize, (size_t)1), m_bufferSize));
+    // 不绑定线程：tickle 不能指定唤醒哪个线程，绑定到正在 epoll_wait 里睡眠的线程上要等到超时才会执行；
+    // 每个 socket 一个接收协程，自然分散到各个线程上
+    for(auto& sock : m_socks) {
+        m_worker->schedule(std::bind(&UdpServer::startRecv,
+                    shared_from_this(), sock));
+    }
+    return true;
+}
+
+void UdpServer::stop() {
+    bool running = !m_isStop.exchange(true);
+    auto self = shared_from_this();
+    m_worker->schedule([this, self, running]() {
+        sylar::Mutex::Lock lock(m_sockMutex);
+        for(auto& sock : m_socks) {
+            if(!sock->isValid()) {
+                continue;
+            }
+            if(running) {
+                // 只唤醒接收协程(recvmmsg 返回 ECANCELED)，由它退出时关闭 socket
+                sock->cancelAll();
+            } else {
+                sock->close();
+            }
+        }
+        m_socks.clear();
+    });
+}
+
+void UdpServer::handleBatch(Socket::ptr sock, DatagramBatch::ptr batch) {
+    SYLAR_LOG_INFO(g_logger) << "handleBatch: " << *sock << " count=" << batch->size();
+}
+
+std::string UdpServer::toString(const std::string& prefix) {
+    std::stringstream ss;
+    ss << prefix << "[name=" << m_name
+       << " worker=" << (m_worker ? m_worker->getName() : "")
+       << " reuseport=" << m_reusePort
+       << " batch_size=" << m_batchSize
+       << " buffer_size=" << m_bufferSize << "]" << std::endl;
+    std::string pfx = prefix.empty() ? "    " : prefix;
+    for(auto& i : m_socks) {
+        ss << pfx << pfx << *i << std::endl;
+    }
+    return ss.str();
+}
+
+}
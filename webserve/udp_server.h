@@ -0,0 +1,214 @@
+#ifndef __SYLAR_UDP_SERVER_H__
+#define __SYLAR_UDP_SERVER_H__
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include "address.h"
+#include "iomanager.h"
+#include "socket.h"
+#include "noncopyable.h"
+#include "thread.h"
+
+namespace sylar {
+
+/**
+ * @brief 一批数据报
+ * @details 固定 capacity 个槽位，每个槽位有 buffer_size 字节的缓冲区和一个地址，
+ *          缓冲区是一整块连续内存，mmsghdr/iovec 在构造时就指向各自的槽位，
+ *          收发时直接交给 recvmmsg/sendmmsg，不再逐条分配
+ */
+class DatagramBatch : Noncopyable {
+public:
+    typedef std::shared_ptr<DatagramBatch> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 最多容纳的数据报数量
+     * @param[in] buffer_size 每条数据报的缓冲区大小，超过的部分被截断
+     */
+    DatagramBatch(size_t capacity, size_t buffer_size);
+
+    // 返回最多容纳的数据报数量
+    size_t getCapacity() const { return m_msgs.size();}
+    // 返回每条数据报的缓冲区大小
+    size_t getBufferSize() const { return m_bufferSize;}
+    // 返回当前的数据报数量
+    size_t size() const { return m_size;}
+    // 是否没有数据报
+    bool empty() const { return m_size == 0;}
+    // 清空
+    void clear() { m_size = 0;}
+
+    // 第 i 条数据报的数据
+    char* data(size_t i) { return &m_buffer[i * m_bufferSize];}
+    const char* data(size_t i) const { return &m_buffer[i * m_bufferSize];}
+    // 第 i 条数据报的长度
+    size_t length(size_t i) const { return m_msgs[i].msg_len;}
+    // 第 i 条数据报是否因为缓冲区不够被截断
+    bool isTruncated(size_t i) const { return m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC;}
+    // 第 i 条数据报的对端地址(接收时为发送端，发送时为目标)
+    const sockaddr* addr(size_t i) const { return (const sockaddr*)&m_addrs[i];}
+    socklen_t addrLen(size_t i) const { return m_msgs[i].msg_hdr.msg_namelen;}
+    // 第 i 条数据报的对端地址，会创建一个 Address 对象
+    Address::ptr getAddress(size_t i) const;
+
+    /**
+     * @brief 追加一条待发送的数据报，数据拷贝到槽位的缓冲区里
+     * @return 批次已满或数据超过缓冲区大小时返回 false
+     */
+    bool append(const void* data, size_t len, const sockaddr* to, socklen_t tolen);
+    bool append(const void* data, size_t len, Address::ptr to);
+
+    /**
+     * @brief 从 socket 批量接收，接收前清空
+     * @return 收到的数据报数量，<0 出错
+     */
+    int recvFrom(Socket::ptr sock, int flags = 0);
+
+    /**
+     * @brief 把批次里的数据报全部发送出去，sendmmsg 只发出一部分时继续发送剩下的
+     * @return 发送成功的数据报数量，一条都没发出就出错时返回 -1
+     */
+    int sendTo(Socket::ptr sock, int flags = 0);
+
+private:
+    size_t m_bufferSize;
+    size_t m_size = 0;
+    std::vector<char> m_buffer;
+    std::vector<sockaddr_storage> m_addrs;
+    std::vector<iovec> m_iovs;
+    std::vector<mmsghdr> m_msgs;
+};
+
+/**
+ * @brief DatagramBatch 对象池
+ * @details acquire 返回的批次在最后一个引用释放时自动回到池里，
+ *          处理函数可以把批次交给别的协程继续处理，不需要拷贝数据。
+ *          池里最多缓存 max_free 个空闲批次，多出来的直接释放
+ */
+class DatagramBatchPool : public std::enable_shared_from_this<DatagramBatchPool>
+                        , Noncopyable {
+public:
+    typedef std::shared_ptr<DatagramBatchPool> ptr;
+    typedef Mutex MutexType;
+
+    DatagramBatchPool(size_t capacity, size_t buffer_size, size_t max_free = 64);
+    ~DatagramBatchPool();
+
+    // 取出一个空的批次
+    DatagramBatch::ptr acquire();
+
+    // 返回创建过的批次总数
+    uint64_t getCreated() const { return m_created;}
+    // 返回池里空闲的批次数
+    size_t getFree();
+
+private:
+    void release(DatagramBatch* batch);
+
+private:
+    MutexType m_mutex;
+    size_t m_capacity;
+    size_t m_bufferSize;
+    size_t m_maxFree;
+    std::vector<DatagramBatch*> m_free;
+    std::atomic<uint64_t> m_created = {0};
+};
+
+/**
+ * @brief UDP服务器封装
+ * @details 每个地址打开多个 SO_REUSEPORT 的 socket(默认每个工作线程一个)，
+ *          每个 socket 有一个接收协程，用 recvmmsg 一次取出一批数据报交给 handleBatch
+ */
+class UdpServer : public std::enable_shared_from_this<UdpServer>
+                    , Noncopyable {
+public:
+    typedef std::shared_ptr<UdpServer> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] worker 接收和处理数据报的协程调度器
+     */
+    UdpServer(sylar::IOManager* worker = sylar::IOManager::GetThis());
+
+    virtual ~UdpServer();
+
+    // 绑定地址，返回是否绑定成功
+    virtual bool bind(sylar::Address::ptr addr);
+
+    /**
+     * @brief 绑定地址数组（多个地址）
+     * @param[in] addrs 需要绑定的地址数组
+     * @param[out] fails 绑定失败的地址
+     * @return 是否绑定成功
+     */
+    virtual bool bind(const std::vector<Address::ptr>& addrs
+                        ,std::vector<Address::ptr>& fails);
+
+    // 启动服务，需要bind成功后执行
+    virtual bool start();
+    // 停止服务，唤醒各个接收协程，socket 由接收协程退出时自己关闭
+    virtual void stop();
+
+    // 是否停止
+    bool isStop() const { return m_isStop;}
+
+    // 返回服务器名称
+    std::string getName() const { return m_name;}
+    // 设置服务器名称
+    void setName(const std::string& v) { m_name = v;}
+
+    /**
+     * @brief 设置每个地址的 SO_REUSEPORT socket 数，需要在 bind 之前设置
+     * @details 0 表示每个地址一个 socket，n > 0 表示 n 个，-1(默认)表示每个工作线程一个
+     */
+    void setReusePort(int v) { m_reusePort = v;}
+    // 返回每个地址的 SO_REUSEPORT socket 数
+    int getReusePort() const { return m_reusePort;}
+
+    // 设置每批最多接收的数据报数量，需要在 start 之前设置
+    void setBatchSize(size_t v) { m_batchSize = v;}
+    size_t getBatchSize() const { return m_batchSize;}
+    // 设置每条数据报的缓冲区大小，需要在 start 之前设置
+    void setBufferSize(size_t v) { m_bufferSize = v;}
+    size_t getBufferSize() const { return m_bufferSize;}
+
+    // 返回收到的数据报总数
+    uint64_t getRecvCount() const { return m_recvCount;}
+    // 返回 recvmmsg 成功的次数
+    uint64_t getRecvCalls() const { return m_recvCalls;}
+
+    std::vector<Socket::ptr> getSocks() const { return m_socks;}
+    DatagramBatchPool::ptr getPool() const { return m_pool;}
+
+    virtual std::string toString(const std::string& prefix = "");
+
+protected:
+    /**
+     * @brief 处理一批数据报
+     * @param[in] sock 收到这批数据报的 socket，可以用来回包
+     * @param[in] batch 数据报，处理完释放即回到对象池
+     */
+    virtual void handleBatch(Socket::ptr sock, DatagramBatch::ptr batch);
+    // 接收协程
+    virtual void startRecv(Socket::ptr sock);
+
+protected:
+    std::vector<Socket::ptr> m_socks;   // 绑定的 socket
+    IOManager* m_worker;                // 接收和处理数据报的调度器
+    std::string m_name;                 // 服务器名称
+    std::atomic<bool> m_isStop;         // 服务是否停止
+    sylar::Mutex m_sockMutex;           // 保护 socket 的关闭和取消
+    int m_reusePort = -1;               // 每个地址的 SO_REUSEPORT socket 数
+    size_t m_batchSize;                 // 每批最多接收的数据报数量
+    size_t m_bufferSize;                // 每条数据报的缓冲区大小
+    DatagramBatchPool::ptr m_pool;      // 批次对象池
+    std::atomic<uint64_t> m_recvCount = {0};
+    std::atomic<uint64_t> m_recvCalls = {0};
+};
+
+}
+
+#endif
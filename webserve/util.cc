@@ -63,5 +63,46 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul  + tv.tv_usec;
 }
 
+uint64_t GetMonotonicMS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000 / 1000;
+}
+
+uint64_t GetMonotonicUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+// 事件循环缓存的单调时钟(微秒)，0 表示没有缓存
+static thread_local uint64_t t_cached_monotonic_us = 0;
+
+uint64_t GetCachedMonotonicMS() {
+    return GetCachedMonotonicUS() / 1000;
+}
+
+uint64_t GetCachedMonotonicUS() {
+    if(t_cached_monotonic_us) {
+        return t_cached_monotonic_us;
+    }
+    return GetMonotonicUS();
+}
+
+uint64_t UpdateCachedMonotonicUS() {
+    t_cached_monotonic_us = GetMonotonicUS();
+    return t_cached_monotonic_us;
+}
+
+void ClearCachedMonotonic() {
+    t_cached_monotonic_us = 0;
+}
+
+time_t GetCoarseTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
 
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 #include <vector>
 #include <string>
 
@@ -37,6 +38,33 @@ uint64_t GetCurrentMS();
 // 获取当前时间的微秒
 uint64_t GetCurrentUS();
 
+// 获取单调时钟(CLOCK_MONOTONIC)的毫秒，不受系统时间调整的影响，只能用来计算时间间隔
+uint64_t GetMonotonicMS();
+
+// 获取单调时钟(CLOCK_MONOTONIC)的微秒
+uint64_t GetMonotonicUS();
+
+/**
+ * @brief 获取当前线程缓存的单调时钟(毫秒)
+ * @details IOManager 的事件循环每一轮刷新一次，同一轮里的定时器计算不再重复读时钟；
+ *          不在事件循环里的线程没有缓存，直接读单调时钟
+ * @attention 缓存只在 idle 协程里刷新，业务协程运行期间不会更新，可能落后任意长时间。
+ *            协程里计算超时、过期时间要用 GetMonotonicMS/GetMonotonicUS
+ */
+uint64_t GetCachedMonotonicMS();
+
+// 获取当前线程缓存的单调时钟(微秒)
+uint64_t GetCachedMonotonicUS();
+
+// 刷新当前线程缓存的单调时钟，返回刷新后的微秒
+uint64_t UpdateCachedMonotonicUS();
+
+// 清除当前线程缓存的单调时钟，之后的读取回退到直接读时钟
+void ClearCachedMonotonic();
+
+// 获取粗粒度的墙上时间(秒)，CLOCK_REALTIME_COARSE，用于日志时间戳
+time_t GetCoarseTime();
+
 }
 
 #endif
\ No newline at end of file